@@ -1,6 +1,8 @@
 import math
 import sys
 import random
+import struct
+import numpy
 import matplotlib.pyplot as plot
 from mpl_toolkits.mplot3d import Axes3D
 
@@ -39,11 +41,152 @@ def read_bodies(files = []):
         bodies.append({"name":str(name), "x":x, "y":y, "z":z})
 
     return bodies
-        
+
+# Columnar trajectory files (see src/include/trajectory.h): a 64 byte file
+# header, chunks of 64 byte header + ids + name table + time column + six
+# columns (x, y, z, vx, vy, vz) per body, then a time index of the chunks and
+# a 32 byte trailer. Files of a run that died have no index, their chunks are
+# walked instead. Coded chunks store every column as the k-th differences of
+# 64 bit integers (double bits or quantization levels), zigzag mapped, with a
+# 4 bit count of significant bytes per value; missing values are left out and
+# marked in a presence bitmap.
+TRAJECTORY_COLUMNS = 6
+
+def decode_column(data, offset, n):
+    mode, order, sparse = data[offset], data[offset + 1], data[offset + 2]
+    start = offset + (16 if mode == 1 else 8)
+    present = numpy.ones(n, dtype = bool)
+    if sparse:
+        bitmap = numpy.frombuffer(data, dtype = numpy.uint8, count = (n + 7) // 8, offset = start)
+        present = numpy.unpackbits(bitmap, bitorder = "little")[:n].astype(bool)
+        start += (n + 7) // 8
+    m = int(present.sum())
+    codes = numpy.frombuffer(data, dtype = numpy.uint8, count = (m + 1) // 2, offset = start)
+    lengths = numpy.empty(2 * len(codes), dtype = numpy.int64)
+    lengths[0::2] = codes & 15
+    lengths[1::2] = codes >> 4
+    lengths = lengths[:m]
+    starts = start + (m + 1) // 2 + numpy.cumsum(lengths) - lengths
+    raw = numpy.frombuffer(data, dtype = numpy.uint8)
+    u = numpy.zeros(m, dtype = numpy.uint64)
+    for b in range(8):
+        has = lengths > b
+        u[has] |= raw[starts[has] + b].astype(numpy.uint64) << numpy.uint64(8 * b)
+    w = (u >> numpy.uint64(1)) ^ (numpy.uint64(0) - (u & numpy.uint64(1)))
+    # difference k was taken from sample k on
+    for k in range(order, 0, -1):
+        w[k - 1:] = numpy.cumsum(w[k - 1:], dtype = numpy.uint64)
+    column = numpy.full(n, numpy.nan)
+    if mode == 1:
+        step = struct.unpack_from("<d", data, offset + 8)[0]
+        column[present] = w.view(numpy.int64).astype(numpy.float64) * step
+    else:
+        column[present] = w.view(numpy.float64)
+    return column
+
+def trajectory_chunks(data):
+    magic, version, byte_order, header_bytes, columns = struct.unpack_from("<8sIIQQ", data, 0)
+    if magic != b"CELTRAJ\0" or byte_order != 0x01020304 or columns != TRAJECTORY_COLUMNS:
+        raise ValueError("not a little endian trajectory file")
+    trailer_magic, chunks, index_offset = struct.unpack_from("<8sQQ", data, len(data) - 32)
+    if trailer_magic == b"CELTIDX\0" and index_offset + 32 * chunks + 32 == len(data):
+        index = numpy.frombuffer(data, dtype = numpy.uint64, count = 4 * chunks, offset = index_offset)
+        return [int(offset) for offset in index[0::4]]
+    offsets = []
+    offset = header_bytes
+    while offset + 64 <= len(data):
+        chunk_magic, chunk_bytes = struct.unpack_from("<8sQ", data, offset)
+        if chunk_magic != b"CELCHNK\0" or offset + chunk_bytes > len(data):
+            break
+        offsets.append(offset)
+        offset += chunk_bytes
+    return offsets
+
+def read_trajectory(path, velocities = False):
+    with open(path, "rb") as f:
+        data = f.read()
+    names = {}
+    times = []
+    samples = {}
+    frames_before = 0
+    for offset in trajectory_chunks(data):
+        chunk_bytes, frames, n, names_bytes, encoding = struct.unpack_from("<QQQQQ", data, offset + 8)
+        ids = numpy.frombuffer(data, dtype = numpy.uint64, count = n, offset = offset + 64)
+        table = offset + 64 + 8 * n
+        read = 0
+        while read < names_bytes:
+            body_id, length = struct.unpack_from("<QQ", data, table + read)
+            names[body_id] = data[table + read + 16:table + read + 16 + length].decode()
+            read += 16 + (length + 7) // 8 * 8
+        start = table + names_bytes
+        if encoding == 1:
+            sizes = numpy.frombuffer(data, dtype = numpy.uint64, count = 1 + n * TRAJECTORY_COLUMNS, offset = start)
+            column_offsets = start + 8 * len(sizes) + numpy.cumsum(sizes) - sizes
+            decoded = [decode_column(data, int(o), frames) for o in column_offsets]
+            times.append(decoded[0])
+            columns = numpy.array(decoded[1:]).reshape(n, TRAJECTORY_COLUMNS, frames)
+        else:
+            times.append(numpy.frombuffer(data, dtype = numpy.float64, count = frames, offset = start))
+            columns = numpy.frombuffer(data, dtype = numpy.float64, count = n * TRAJECTORY_COLUMNS * frames,
+                                       offset = start + 8 * frames).reshape(n, TRAJECTORY_COLUMNS, frames)
+        for body, body_id in enumerate(ids):
+            samples.setdefault(int(body_id), []).append((frames_before, columns[body]))
+        frames_before += frames
+
+    time = numpy.concatenate(times)
+    bodies = []
+    for body_id, blocks in sorted(samples.items()):
+        # NaN where the body is missing, matplotlib leaves those out
+        body_columns = numpy.full((TRAJECTORY_COLUMNS, len(time)), numpy.nan)
+        for first, block in blocks:
+            body_columns[:, first:first + block.shape[1]] = block
+        body = {"name":names.get(body_id, str(body_id)), "time":time,
+                "x":body_columns[0], "y":body_columns[1], "z":body_columns[2]}
+        if velocities:
+            body.update({"vx":body_columns[3], "vy":body_columns[4], "vz":body_columns[5]})
+        bodies.append(body)
+    return bodies
+
+# Positions of a body at times, by the cubic Hermite interpolant of its
+# stored samples (positions and velocities), as in a decimated trajectory;
+# NaN outside the samples
+def hermite_positions(body, times):
+    stored = ~numpy.isnan(body["x"])
+    t = body["time"][stored]
+    times = numpy.asarray(times, dtype = numpy.float64)
+    result = {}
+    if len(t) < 2:
+        for axis in ("x", "y", "z"):
+            result[axis] = numpy.full(len(times), numpy.nan)
+        return result
+    k = numpy.clip(numpy.searchsorted(t, times, side = "right") - 1, 0, len(t) - 2)
+    h = t[k + 1] - t[k]
+    u = (times - t[k]) / h
+    pa, va = 2 * u**3 - 3 * u**2 + 1, (u**3 - 2 * u**2 + u) * h
+    pb, vb = -2 * u**3 + 3 * u**2, (u**3 - u**2) * h
+    outside = (times < t[0]) | (times > t[-1])
+    for axis in ("x", "y", "z"):
+        p, v = body[axis][stored], body["v" + axis][stored]
+        result[axis] = pa * p[k] + va * v[k] + pb * p[k + 1] + vb * v[k + 1]
+        result[axis][outside] = numpy.nan
+    return result
+
+def resample_trajectory(bodies, points = 5000):
+    time = bodies[0]["time"]
+    times = numpy.linspace(time[0], time[-1], points)
+    resampled = []
+    for body in bodies:
+        positions = hermite_positions(body, times)
+        resampled.append({"name":body["name"], "time":times, "x":positions["x"], "y":positions["y"], "z":positions["z"]})
+    return resampled
+
 if __name__ == "__main__":
     if len(sys.argv) < 2:
-        print ("Please include list of body files as arguments")
+        print ("Please include a trajectory file or a list of body files as arguments")
     names = sys.argv[1:]
-    bodies = read_bodies(names)
+    if len(names) == 1 and names[0].endswith(".traj"):
+        bodies = resample_trajectory(read_trajectory(names[0], velocities = True))
+    else:
+        bodies = read_bodies(names)
     plot_output(bodies)
     
\ No newline at end of file
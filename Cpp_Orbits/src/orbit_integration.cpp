@@ -8,7 +8,7 @@ point Orbit_integration::Euler::calculate_single_body_acceleration(int body_inde
 {
 	double G_const = 6.67408e-11; //m3 kg - 1 s - 2
 	point acceleration{ 0, 0, 0 };
-	body target_body = m_bodies[body_index];
+	body &target_body = m_bodies[body_index];
 
 	int index = 0;
 
@@ -55,7 +55,7 @@ point Orbit_integration::RK4::calculate_single_body_acceleration(int body_index)
 	point acceleration{ 0, 0, 0 };
 	point velocity_update{ 0, 0, 0 };
 	point location_update{ 0, 0, 0 };
-	body target_body = m_bodies[body_index];
+	body &target_body = m_bodies[body_index];
 
 	int index = 0;
 	for (auto external_body = m_bodies.begin(); external_body != m_bodies.end(); *external_body++, index++)
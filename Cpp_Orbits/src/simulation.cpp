@@ -1,5 +1,4 @@
 #include "orbit_integration.h"
-#include <omp.h>
 #include <iostream>
 
 template <typename Integrator>
@@ -31,12 +30,11 @@ int main(int argc, char *argv[])
 	*/
     bodies.push_back(benchmarking::m1);
 	bodies.push_back(benchmarking::m2);
-	#pragma omp parallel
-	{
-
-	  Orbit_integration::RK4 orbit(bodies, 0.01);
-	  run_simulation(orbit, (int)1e4, 1);
-	}
+	// A single simulation: a parallel region here ran one identical copy per
+	// thread, all writing the same .dat files. Independent systems are run in
+	// parallel by the ensemble mode of Celestial (--ensemble n).
+	Orbit_integration::RK4 orbit(bodies, 0.01);
+	run_simulation(orbit, (int)1e4, 1);
 
 	std::cout << "Done" << std::endl;
 }
@@ -0,0 +1,75 @@
+/*
+ * arena.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "include/arena.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+Arena::Arena(std::size_t bytes, bool huge_pages) :
+        m_base(nullptr),
+        m_capacity((bytes + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1)),
+        m_used(0),
+        m_mapped(0),
+        m_huge_pages(false)
+{
+#ifdef __linux__
+    if (huge_pages)
+    {
+        std::size_t length = (bytes + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+        void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            m_huge_pages = true;
+        else
+        {
+            // no reserved huge pages: ordinary mapping, let the kernel promote it
+            p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED)
+                m_huge_pages = madvise(p, length, MADV_HUGEPAGE) == 0;
+        }
+        if (p != MAP_FAILED)
+        {
+            m_base = p;
+            m_capacity = length;
+            m_mapped = length;
+            return;
+        }
+    }
+#endif
+    (void)huge_pages;
+    m_base = ::operator new(m_capacity > 0 ? m_capacity : ARENA_ALIGNMENT, std::align_val_t(ARENA_ALIGNMENT));
+}
+
+Arena::~Arena()
+{
+#ifdef __linux__
+    if (m_mapped > 0)
+    {
+        munmap(m_base, m_mapped);
+        return;
+    }
+#endif
+    ::operator delete(m_base, std::align_val_t(ARENA_ALIGNMENT));
+}
@@ -0,0 +1,429 @@
+/*
+ * barnes_hut.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include "include/barnes_hut.h"
+#include "include/gravity_kernels.h"
+
+//Cells holding coincident particles stop splitting at this depth
+#define TREE_MAX_DEPTH 48
+
+//Enough for TREE_MAX_DEPTH levels with 8 children pushed per level
+#define TREE_STACK_SIZE 512
+
+void BarnesHut::build(const ParticleSet& particles)
+{
+    const int n = (int)particles.size();
+    m_x = particles.x;
+    m_y = particles.y;
+    m_z = particles.z;
+    m_m = particles.mass;
+    m_order.resize(n);
+    std::iota(m_order.begin(), m_order.end(), 0);
+    m_scratch.resize(n);
+    m_cells.clear();
+    m_groups.clear();
+    if (n == 0)
+        return;
+
+    auto x_range = std::minmax_element(m_x.begin(), m_x.end());
+    auto y_range = std::minmax_element(m_y.begin(), m_y.end());
+    auto z_range = std::minmax_element(m_z.begin(), m_z.end());
+    double half = 0.5 * std::max({ *x_range.second - *x_range.first,
+                                   *y_range.second - *y_range.first,
+                                   *z_range.second - *z_range.first });
+    half = half * (1 + 1e-12) + 1e-300;
+
+    cell root{};
+    root.cx = 0.5 * (*x_range.first + *x_range.second);
+    root.cy = 0.5 * (*y_range.first + *y_range.second);
+    root.cz = 0.5 * (*z_range.first + *z_range.second);
+    root.half = half;
+    root.begin = 0;
+    root.end = n;
+    m_cells.reserve(4 * n / std::max(m_leaf_size, 1) + 16);
+    m_cells.push_back(root);
+    build_cell(0, 0);
+
+    // store the particle data in tree order so leaves are contiguous
+    std::vector<double> sorted(n);
+    for (std::vector<double>* column : { &m_x, &m_y, &m_z, &m_m })
+    {
+        for (int k = 0; k < n; k++)
+            sorted[k] = (*column)[m_order[k]];
+        column->swap(sorted);
+    }
+    compute_moments(0);
+}
+
+/*
+ *PROCEDURE: build_cell
+ *
+ *DESCRIPTION: Splits the particles of a cell into its non empty octants,
+ *recursively, until cells hold at most leaf_size particles
+ *
+ *RETURNS: -
+ */
+void BarnesHut::build_cell(int index, int depth)
+{
+    const cell c = m_cells[index];
+    m_cells[index].first_child = -1;
+    m_cells[index].children = 0;
+    if (c.end - c.begin <= m_leaf_size || depth >= TREE_MAX_DEPTH)
+    {
+        m_groups.push_back(index);
+        return;
+    }
+
+    auto octant = [&](int i)
+    {
+        return (m_x[i] > c.cx) | ((m_y[i] > c.cy) << 1) | ((m_z[i] > c.cz) << 2);
+    };
+
+    int counts[8] = { 0 };
+    for (int k = c.begin; k < c.end; k++)
+        counts[octant(m_order[k])]++;
+    int offsets[8];
+    offsets[0] = c.begin;
+    for (int o = 1; o < 8; o++)
+        offsets[o] = offsets[o - 1] + counts[o - 1];
+    int next[8];
+    std::copy(offsets, offsets + 8, next);
+    for (int k = c.begin; k < c.end; k++)
+        m_scratch[next[octant(m_order[k])]++] = m_order[k];
+    std::copy(m_scratch.begin() + c.begin, m_scratch.begin() + c.end, m_order.begin() + c.begin);
+
+    const int first = (int)m_cells.size();
+    const double quarter = 0.5 * c.half;
+    for (int o = 0; o < 8; o++)
+    {
+        if (counts[o] == 0)
+            continue;
+        cell child{};
+        child.cx = c.cx + ((o & 1) ? quarter : -quarter);
+        child.cy = c.cy + ((o & 2) ? quarter : -quarter);
+        child.cz = c.cz + ((o & 4) ? quarter : -quarter);
+        child.half = quarter;
+        child.begin = offsets[o];
+        child.end = offsets[o] + counts[o];
+        m_cells.push_back(child);
+    }
+    const int children = (int)m_cells.size() - first;
+    m_cells[index].first_child = first;
+    m_cells[index].children = children;
+    for (int k = 0; k < children; k++)
+        build_cell(first + k, depth + 1);
+}
+
+/*
+ *PROCEDURE: compute_moments
+ *
+ *DESCRIPTION: Upward pass: mass, centre of mass and traceless quadrupole
+ *Q_ab = sum m (3 d_a d_b - d^2 delta_ab) of every cell, from its particles
+ *for leaves and from its children (parallel axis theorem) otherwise
+ *
+ *RETURNS: -
+ */
+void BarnesHut::compute_moments(int index)
+{
+    cell& c = m_cells[index];
+    c.mass = c.mx = c.my = c.mz = 0;
+    c.qxx = c.qxy = c.qxz = c.qyy = c.qyz = c.qzz = 0;
+    c.w2 = c.w3 = c.w4 = 0;
+
+    auto add_quadrupole = [&c](double m, double dx, double dy, double dz)
+    {
+        double d2 = dx*dx + dy*dy + dz*dz;
+        c.qxx += m * (3 * dx * dx - d2);
+        c.qyy += m * (3 * dy * dy - d2);
+        c.qzz += m * (3 * dz * dz - d2);
+        c.qxy += m * 3 * dx * dy;
+        c.qxz += m * 3 * dx * dz;
+        c.qyz += m * 3 * dy * dz;
+    };
+
+    if (c.children == 0)
+    {
+        for (int k = c.begin; k < c.end; k++)
+        {
+            double m = m_m[k];
+            c.mass += m;
+            c.mx += m * m_x[k];
+            c.my += m * m_y[k];
+            c.mz += m * m_z[k];
+            c.w2 += m * m;
+            c.w3 += m * m * m;
+            c.w4 += m * m * m * m;
+        }
+    }
+    else
+    {
+        for (int k = 0; k < c.children; k++)
+        {
+            compute_moments(c.first_child + k);
+            const cell& child = m_cells[c.first_child + k];
+            c.mass += child.mass;
+            c.mx += child.mass * child.mx;
+            c.my += child.mass * child.my;
+            c.mz += child.mass * child.mz;
+            c.w2 += child.w2;
+            c.w3 += child.w3;
+            c.w4 += child.w4;
+        }
+    }
+
+    if (c.mass > 0)
+    {
+        c.mx /= c.mass;
+        c.my /= c.mass;
+        c.mz /= c.mass;
+    }
+    else
+    {
+        c.mx = c.cx;
+        c.my = c.cy;
+        c.mz = c.cz;
+    }
+
+    if (c.children == 0)
+    {
+        for (int k = c.begin; k < c.end; k++)
+            add_quadrupole(m_m[k], m_x[k] - c.mx, m_y[k] - c.my, m_z[k] - c.mz);
+    }
+    else
+    {
+        for (int k = 0; k < c.children; k++)
+        {
+            const cell& child = m_cells[c.first_child + k];
+            c.qxx += child.qxx; c.qxy += child.qxy; c.qxz += child.qxz;
+            c.qyy += child.qyy; c.qyz += child.qyz; c.qzz += child.qzz;
+            add_quadrupole(child.mass, child.mx - c.mx, child.my - c.my, child.mz - c.mz);
+        }
+    }
+    c.delta = norm(point{ c.mx - c.cx, c.my - c.cy, c.mz - c.cz });
+}
+
+/*
+ *PROCEDURE: interaction_lists
+ *
+ *DESCRIPTION: Walks the tree once for all the particles of the leaf group.
+ *A cell is accepted against the nearest point of the group's box, so the
+ *same lists are valid for every particle of the group: accepted cells go to
+ *cells, leaves that had to be opened (the group itself included) to leaves.
+ *
+ *RETURNS: -
+ */
+void BarnesHut::interaction_lists(int group, std::vector<int>& cells, std::vector<int>& leaves) const
+{
+    const cell& g = m_cells[group];
+    const double inv_theta = 1.0 / m_theta;
+    int stack[TREE_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    cells.clear();
+    leaves.clear();
+
+    while (top > 0)
+    {
+        const int index = stack[--top];
+        const cell& c = m_cells[index];
+        double dx = std::max(std::fabs(c.mx - g.cx) - g.half, 0.0);
+        double dy = std::max(std::fabs(c.my - g.cy) - g.half, 0.0);
+        double dz = std::max(std::fabs(c.mz - g.cz) - g.half, 0.0);
+        double r_crit = 2 * c.half * inv_theta + c.delta;
+
+        if (dx*dx + dy*dy + dz*dz > r_crit * r_crit)
+            cells.push_back(index);
+        else if (c.children == 0)
+            leaves.push_back(index);
+        else
+            for (int k = 0; k < c.children; k++)
+                stack[top++] = c.first_child + k;
+    }
+}
+
+void BarnesHut::accelerations(const ParticleSet& particles, double G,
+                              std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az)
+{
+    build(particles);
+    const int n = (int)particles.size();
+    ax.resize(n);
+    ay.resize(n);
+    az.resize(n);
+    const gravity_kernels::direct_kernel kernel = gravity_kernels::best_direct_kernel().function;
+    const int groups = (int)m_groups.size();
+
+    #pragma omp parallel
+    {
+        std::vector<int> cells, leaves;
+        std::vector<double> sx, sy, sz, sm, gx, gy, gz;
+        std::vector<double> quadrupoles[6];
+
+        #pragma omp for schedule(dynamic, 4)
+        for (int group = 0; group < groups; group++)
+        {
+            const cell& g = m_cells[m_groups[group]];
+            const int nt = g.end - g.begin;
+            interaction_lists(m_groups[group], cells, leaves);
+
+            // opened leaves and the monopoles of accepted cells all go through the direct kernel
+            sx.clear(); sy.clear(); sz.clear(); sm.clear();
+            for (int leaf : leaves)
+            {
+                const cell& c = m_cells[leaf];
+                sx.insert(sx.end(), m_x.begin() + c.begin, m_x.begin() + c.end);
+                sy.insert(sy.end(), m_y.begin() + c.begin, m_y.begin() + c.end);
+                sz.insert(sz.end(), m_z.begin() + c.begin, m_z.begin() + c.end);
+                sm.insert(sm.end(), m_m.begin() + c.begin, m_m.begin() + c.end);
+            }
+            for (int index : cells)
+            {
+                const cell& c = m_cells[index];
+                sx.push_back(c.mx);
+                sy.push_back(c.my);
+                sz.push_back(c.mz);
+                sm.push_back(c.mass);
+            }
+            gx.assign(nt, 0.0);
+            gy.assign(nt, 0.0);
+            gz.assign(nt, 0.0);
+            kernel(sx.data(), sy.data(), sz.data(), sm.data(), (int)sx.size(),
+                   &m_x[g.begin], &m_y[g.begin], &m_z[g.begin], nt, 1.0, gx.data(), gy.data(), gz.data());
+
+            if (m_quadrupole)
+            {
+                const int first = (int)sx.size() - (int)cells.size();
+                const int count = (int)cells.size();
+                for (int q = 0; q < 6; q++)
+                    quadrupoles[q].resize(count);
+                for (int k = 0; k < count; k++)
+                {
+                    const cell& c = m_cells[cells[k]];
+                    quadrupoles[0][k] = c.qxx; quadrupoles[1][k] = c.qxy; quadrupoles[2][k] = c.qxz;
+                    quadrupoles[3][k] = c.qyy; quadrupoles[4][k] = c.qyz; quadrupoles[5][k] = c.qzz;
+                }
+                const double *cx = sx.data() + first, *cy = sy.data() + first, *cz = sz.data() + first;
+                const double *qxx = quadrupoles[0].data(), *qxy = quadrupoles[1].data(), *qxz = quadrupoles[2].data();
+                const double *qyy = quadrupoles[3].data(), *qyz = quadrupoles[4].data(), *qzz = quadrupoles[5].data();
+
+                for (int t = 0; t < nt; t++)
+                {
+                    const double x = m_x[g.begin + t], y = m_y[g.begin + t], z = m_z[g.begin + t];
+                    double rx = 0, ry = 0, rz = 0;
+                    #pragma omp simd reduction(+:rx, ry, rz)
+                    for (int k = 0; k < count; k++)
+                    {
+                        // a = -Q d / r^5 + 5/2 (d.Q.d) d / r^7, d pointing from target to cell
+                        double dx = cx[k] - x;
+                        double dy = cy[k] - y;
+                        double dz = cz[k] - z;
+                        double inv_r2 = 1.0 / (dx*dx + dy*dy + dz*dz);
+                        double inv_r5 = inv_r2 * inv_r2 * sqrt(inv_r2);
+                        double qdx = qxx[k] * dx + qxy[k] * dy + qxz[k] * dz;
+                        double qdy = qxy[k] * dx + qyy[k] * dy + qyz[k] * dz;
+                        double qdz = qxz[k] * dx + qyz[k] * dy + qzz[k] * dz;
+                        double dqd = 2.5 * (dx * qdx + dy * qdy + dz * qdz) * inv_r5 * inv_r2;
+                        rx += dqd * dx - qdx * inv_r5;
+                        ry += dqd * dy - qdy * inv_r5;
+                        rz += dqd * dz - qdz * inv_r5;
+                    }
+                    gx[t] += rx;
+                    gy[t] += ry;
+                    gz[t] += rz;
+                }
+            }
+
+            for (int t = 0; t < nt; t++)
+            {
+                const int i = m_order[g.begin + t];
+                ax[i] = G * gx[t];
+                ay[i] = G * gy[t];
+                az[i] = G * gz[t];
+            }
+        }
+    }
+}
+
+void BarnesHut::rk4_moments(const ParticleSet& particles, double G, std::vector<double>& moments)
+{
+    build(particles);
+    const int n = (int)particles.size();
+    moments.assign((std::size_t)RK4_MOMENT_CHANNELS * n, 0.0);
+    const int groups = (int)m_groups.size();
+
+    #pragma omp parallel
+    {
+        std::vector<int> cells, leaves;
+
+        #pragma omp for schedule(dynamic, 4)
+        for (int group = 0; group < groups; group++)
+        {
+            const cell& g = m_cells[m_groups[group]];
+            interaction_lists(m_groups[group], cells, leaves);
+
+            for (int k = g.begin; k < g.end; k++)
+            {
+                double sums[RK4_MOMENT_CHANNELS] = { 0 };
+                auto add = [&sums](double t1, double t2, double t3, double t4, double dx, double dy, double dz)
+                {
+                    sums[RK4_P1] += t1; sums[RK4_P2] += t2; sums[RK4_P3] += t3;
+                    sums[RK4_D1X] += t1 * dx; sums[RK4_D1Y] += t1 * dy; sums[RK4_D1Z] += t1 * dz;
+                    sums[RK4_D2X] += t2 * dx; sums[RK4_D2Y] += t2 * dy; sums[RK4_D2Z] += t2 * dz;
+                    sums[RK4_D3X] += t3 * dx; sums[RK4_D3Y] += t3 * dy; sums[RK4_D3Z] += t3 * dz;
+                    sums[RK4_D4X] += t4 * dx; sums[RK4_D4Y] += t4 * dy; sums[RK4_D4Z] += t4 * dz;
+                };
+
+                // a cell stands for its particles with t_j = G m_j s, s taken at the centre of mass
+                for (int index : cells)
+                {
+                    const cell& c = m_cells[index];
+                    double dx = c.mx - m_x[k], dy = c.my - m_y[k], dz = c.mz - m_z[k];
+                    double r2 = dx*dx + dy*dy + dz*dz;
+                    double s = G / (r2 * sqrt(r2));
+                    add(s * c.mass, s * s * c.w2, s * s * s * c.w3, s * s * s * s * c.w4, dx, dy, dz);
+                }
+                for (int leaf : leaves)
+                {
+                    const cell& c = m_cells[leaf];
+                    for (int j = c.begin; j < c.end; j++)
+                    {
+                        double dx = m_x[j] - m_x[k], dy = m_y[j] - m_y[k], dz = m_z[j] - m_z[k];
+                        double r2 = dx*dx + dy*dy + dz*dz;
+                        if (r2 == 0)
+                            continue;
+                        double t1 = G * m_m[j] / (r2 * sqrt(r2));
+                        double t2 = t1 * t1, t3 = t2 * t1;
+                        add(t1, t2, t3, t3 * t1, dx, dy, dz);
+                    }
+                }
+
+                const int i = m_order[k];
+                for (int channel = 0; channel < RK4_MOMENT_CHANNELS; channel++)
+                    moments[(std::size_t)channel * n + i] = sums[channel];
+            }
+        }
+    }
+}
@@ -0,0 +1,442 @@
+/*
+ * batch.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <cmath>
+#include <limits>
+#include <map>
+#include "include/batch.h"
+#include "include/ensemble.h"
+#include "include/gravity_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CELESTIAL_X86 1
+#endif
+
+#define BATCH_INLINE inline __attribute__((always_inline))
+
+/*
+ * Struct: lane_arrays
+ *
+ * OBJECTS: The columns of a SystemBatch handed to the lane kernels.
+*/
+struct lane_arrays{
+    int n;
+    double* __restrict x;
+    double* __restrict y;
+    double* __restrict z;
+    double* __restrict vx;
+    double* __restrict vy;
+    double* __restrict vz;
+    double* __restrict ax;
+    double* __restrict ay;
+    double* __restrict az;
+    const double* __restrict mass;
+    const double* __restrict radius;
+    double* __restrict contact;
+    double* __restrict escape;
+    double* __restrict invalid;
+};
+
+/*
+ *PROCEDURE: forces_lanes
+ *
+ *DESCRIPTION: Accelerations of every lane, each pair once (Newton's third
+ *law), with the contact, escape and finiteness tracking folded into the
+ *pair loop
+ *
+ *RETURNS: -
+ */
+static BATCH_INLINE void forces_lanes(const lane_arrays& s, double G)
+{
+    const int n = s.n;
+    double* __restrict ax = s.ax;
+    double* __restrict ay = s.ay;
+    double* __restrict az = s.az;
+    #pragma omp simd
+    for (int k = 0; k < n * BATCH_LANES; k++)
+    {
+        ax[k] = 0;
+        ay[k] = 0;
+        az[k] = 0;
+    }
+
+    for (int i = 0; i < n; i++)
+        for (int j = i + 1; j < n; j++)
+        {
+            const int a = i * BATCH_LANES, b = j * BATCH_LANES;
+            #pragma omp simd
+            for (int l = 0; l < BATCH_LANES; l++)
+            {
+                const double dx = s.x[b + l] - s.x[a + l];
+                const double dy = s.y[b + l] - s.y[a + l];
+                const double dz = s.z[b + l] - s.z[a + l];
+                const double r2 = dx*dx + dy*dy + dz*dz;
+                const double inv_r3 = 1.0 / (r2 * sqrt(r2));
+                const double fi = s.mass[b + l] * inv_r3, fj = s.mass[a + l] * inv_r3;
+                ax[a + l] += fi * dx; ay[a + l] += fi * dy; az[a + l] += fi * dz;
+                ax[b + l] -= fj * dx; ay[b + l] -= fj * dy; az[b + l] -= fj * dz;
+
+                const double reach = s.radius[a + l] + s.radius[b + l];
+                const double gap = r2 - reach * reach;
+                s.contact[l] = gap < s.contact[l] ? gap : s.contact[l];
+                // 0 for a finite distance, NaN otherwise
+                s.invalid[l] += r2 * 0.0;
+            }
+            if (i == 0)
+            {
+                #pragma omp simd
+                for (int l = 0; l < BATCH_LANES; l++)
+                {
+                    const double dx = s.x[b + l] - s.x[l];
+                    const double dy = s.y[b + l] - s.y[l];
+                    const double dz = s.z[b + l] - s.z[l];
+                    const double r2 = dx*dx + dy*dy + dz*dz;
+                    s.escape[l] = r2 > s.escape[l] ? r2 : s.escape[l];
+                }
+            }
+        }
+
+    #pragma omp simd
+    for (int k = 0; k < n * BATCH_LANES; k++)
+    {
+        ax[k] *= G;
+        ay[k] *= G;
+        az[k] *= G;
+    }
+}
+
+/*
+ *PROCEDURE: stage_lanes
+ *
+ *DESCRIPTION: One kick-drift-kick leapfrog stage of length h[l] in every
+ *running lane; stopped lanes keep their state bit for bit
+ *
+ *RETURNS: -
+ */
+static BATCH_INLINE void stage_lanes(const lane_arrays& s, double G, const double* h, const bool* running)
+{
+    const int n = s.n;
+    for (int i = 0; i < n; i++)
+    {
+        const int a = i * BATCH_LANES;
+        #pragma omp simd
+        for (int l = 0; l < BATCH_LANES; l++)
+        {
+            const double half = 0.5 * h[l];
+            const double vx = s.vx[a + l] + half * s.ax[a + l];
+            const double vy = s.vy[a + l] + half * s.ay[a + l];
+            const double vz = s.vz[a + l] + half * s.az[a + l];
+            const double x = s.x[a + l] + h[l] * vx;
+            const double y = s.y[a + l] + h[l] * vy;
+            const double z = s.z[a + l] + h[l] * vz;
+            s.vx[a + l] = running[l] ? vx : s.vx[a + l];
+            s.vy[a + l] = running[l] ? vy : s.vy[a + l];
+            s.vz[a + l] = running[l] ? vz : s.vz[a + l];
+            s.x[a + l] = running[l] ? x : s.x[a + l];
+            s.y[a + l] = running[l] ? y : s.y[a + l];
+            s.z[a + l] = running[l] ? z : s.z[a + l];
+        }
+    }
+
+    forces_lanes(s, G);
+
+    for (int i = 0; i < n; i++)
+    {
+        const int a = i * BATCH_LANES;
+        #pragma omp simd
+        for (int l = 0; l < BATCH_LANES; l++)
+        {
+            const double half = 0.5 * h[l];
+            const double vx = s.vx[a + l] + half * s.ax[a + l];
+            const double vy = s.vy[a + l] + half * s.ay[a + l];
+            const double vz = s.vz[a + l] + half * s.az[a + l];
+            s.vx[a + l] = running[l] ? vx : s.vx[a + l];
+            s.vy[a + l] = running[l] ? vy : s.vy[a + l];
+            s.vz[a + l] = running[l] ? vz : s.vz[a + l];
+        }
+    }
+}
+
+static void forces_generic(const lane_arrays& s, double G) { forces_lanes(s, G); }
+
+static void stage_generic(const lane_arrays& s, double G, const double* h, const bool* running)
+{
+    stage_lanes(s, G, h, running);
+}
+
+#ifdef CELESTIAL_X86
+
+__attribute__((target("avx2,fma")))
+static void forces_avx2(const lane_arrays& s, double G) { forces_lanes(s, G); }
+
+__attribute__((target("avx2,fma")))
+static void stage_avx2(const lane_arrays& s, double G, const double* h, const bool* running)
+{
+    stage_lanes(s, G, h, running);
+}
+
+__attribute__((target("avx512f")))
+static void forces_avx512(const lane_arrays& s, double G) { forces_lanes(s, G); }
+
+__attribute__((target("avx512f")))
+static void stage_avx512(const lane_arrays& s, double G, const double* h, const bool* running)
+{
+    stage_lanes(s, G, h, running);
+}
+
+#endif
+
+struct lane_kernels{
+    void (*forces)(const lane_arrays&, double);
+    void (*stage)(const lane_arrays&, double, const double*, const bool*);
+};
+
+/*
+ *PROCEDURE: best_lane_kernels
+ *
+ *DESCRIPTION: Lane kernels for the instruction set of the selected direct
+ *gravity kernel, so CELESTIAL_KERNEL applies to them as well
+ *
+ *RETURNS: lane_kernels
+ */
+static const lane_kernels& best_lane_kernels()
+{
+    static const lane_kernels selected = []()
+    {
+        const std::string isa = gravity_kernels::best_direct_kernel().name;
+#ifdef CELESTIAL_X86
+        if (isa == "avx512")
+            return lane_kernels{ forces_avx512, stage_avx512 };
+        if (isa == "avx2")
+            return lane_kernels{ forces_avx2, stage_avx2 };
+#endif
+        return lane_kernels{ forces_generic, stage_generic };
+    }();
+    return selected;
+}
+
+SystemBatch::SystemBatch(const std::vector<const batch_system*>& systems, const batch_options& options) :
+    m_options(options),
+    m_sources(systems),
+    m_systems((int)systems.size()),
+    m_n(systems.empty() ? 0 : (int)systems[0]->bodies.size())
+{
+    const std::size_t size = (std::size_t)m_n * BATCH_LANES;
+    for (auto* column : { &m_x, &m_y, &m_z, &m_vx, &m_vy, &m_vz, &m_ax, &m_ay, &m_az, &m_mass, &m_radius })
+        column->assign(size, 0.0);
+
+    // lanes beyond the last system repeat it, masked off from the start
+    for (int l = 0; l < BATCH_LANES; l++)
+    {
+        const std::vector<body>& bodies = systems[std::min(l, m_systems - 1)]->bodies;
+        for (int i = 0; i < m_n; i++)
+        {
+            const std::size_t k = (std::size_t)i * BATCH_LANES + l;
+            m_x[k] = bodies[i].location.x; m_y[k] = bodies[i].location.y; m_z[k] = bodies[i].location.z;
+            m_vx[k] = bodies[i].velocity.x; m_vy[k] = bodies[i].velocity.y; m_vz[k] = bodies[i].velocity.z;
+            m_mass[k] = bodies[i].mass;
+            m_radius[k] = bodies[i].radius;
+        }
+        m_running[l] = l < m_systems;
+        m_status[l] = BATCH_COMPLETED;
+        m_stop_time[l] = 0;
+        m_contact[l] = std::numeric_limits<double>::infinity();
+        m_escape[l] = 0;
+        m_invalid[l] = 0;
+    }
+
+    energies(m_energy0);
+    best_lane_kernels().forces(lane_arrays{ m_n, m_x.data(), m_y.data(), m_z.data(), m_vx.data(), m_vy.data(), m_vz.data(),
+                                            m_ax.data(), m_ay.data(), m_az.data(), m_mass.data(), m_radius.data(),
+                                            m_contact, m_escape, m_invalid }, m_options.G);
+    check_lanes(0);
+}
+
+/*
+ *PROCEDURE: energies
+ *
+ *DESCRIPTION: Total energy of the system in every lane
+ *
+ *RETURNS: -
+ */
+void SystemBatch::energies(double* energy) const
+{
+    double kinetic[BATCH_LANES] = {}, potential[BATCH_LANES] = {};
+    for (int i = 0; i < m_n; i++)
+    {
+        const int a = i * BATCH_LANES;
+        for (int l = 0; l < BATCH_LANES; l++)
+            kinetic[l] += 0.5 * m_mass[a + l] * (m_vx[a + l] * m_vx[a + l] + m_vy[a + l] * m_vy[a + l] + m_vz[a + l] * m_vz[a + l]);
+        for (int j = i + 1; j < m_n; j++)
+        {
+            const int b = j * BATCH_LANES;
+            for (int l = 0; l < BATCH_LANES; l++)
+            {
+                const double dx = m_x[b + l] - m_x[a + l];
+                const double dy = m_y[b + l] - m_y[a + l];
+                const double dz = m_z[b + l] - m_z[a + l];
+                potential[l] -= m_mass[a + l] * m_mass[b + l] / sqrt(dx*dx + dy*dy + dz*dz);
+            }
+        }
+    }
+    for (int l = 0; l < BATCH_LANES; l++)
+        energy[l] = kinetic[l] + m_options.G * potential[l];
+}
+
+/*
+ *PROCEDURE: check_lanes
+ *
+ *DESCRIPTION: Stops the running lanes whose system diverged, had a contact or
+ *lost a body since the last check, and resets the tracking
+ *
+ *RETURNS: -
+ */
+void SystemBatch::check_lanes(long long step)
+{
+    double energy[BATCH_LANES];
+    const bool energy_check = m_options.energy_tolerance > 0 && step % BATCH_ENERGY_INTERVAL == 0;
+    if (energy_check)
+        energies(energy);
+
+    const double escape2 = m_options.escape_radius * m_options.escape_radius;
+    for (int l = 0; l < BATCH_LANES; l++)
+    {
+        if (m_running[l])
+        {
+            bool stop = true;
+            if (m_invalid[l] != 0)
+                m_status[l] = BATCH_DIVERGED;
+            else if (energy_check && !(fabs(energy[l] - m_energy0[l]) <= m_options.energy_tolerance * fabs(m_energy0[l])))
+                m_status[l] = BATCH_DIVERGED;
+            else if (m_contact[l] < 0)
+                m_status[l] = BATCH_COLLIDED;
+            else if (escape2 > 0 && m_escape[l] > escape2)
+                m_status[l] = BATCH_ESCAPED;
+            else
+                stop = false;
+            if (stop)
+            {
+                m_running[l] = false;
+                m_stop_time[l] = step * m_options.time_step;
+            }
+        }
+        m_contact[l] = std::numeric_limits<double>::infinity();
+        m_escape[l] = 0;
+        m_invalid[l] = 0;
+    }
+}
+
+void SystemBatch::run()
+{
+    const long long total = (long long)ceil(m_options.duration / m_options.time_step - 1e-9);
+    const lane_kernels& kernels = best_lane_kernels();
+    const lane_arrays lanes{ m_n, m_x.data(), m_y.data(), m_z.data(), m_vx.data(), m_vy.data(), m_vz.data(),
+                             m_ax.data(), m_ay.data(), m_az.data(), m_mass.data(), m_radius.data(),
+                             m_contact, m_escape, m_invalid };
+    double h[BATCH_LANES];
+
+    while (m_steps < total && std::find(m_running, m_running + BATCH_LANES, true) != m_running + BATCH_LANES)
+    {
+        for (double w : m_options.weights)
+        {
+            std::fill(h, h + BATCH_LANES, w * m_options.time_step);
+            kernels.stage(lanes, m_options.G, h, m_running);
+        }
+        m_steps++;
+        check_lanes(m_steps);
+    }
+    for (int l = 0; l < BATCH_LANES; l++)
+        if (m_running[l])
+            m_stop_time[l] = m_steps * m_options.time_step;
+}
+
+batch_result SystemBatch::result(int lane) const
+{
+    double energy[BATCH_LANES];
+    energies(energy);
+    const double error = fabs(energy[lane] - m_energy0[lane]);
+    batch_result r{ m_status[lane], m_stop_time[lane], m_energy0[lane] != 0 ? error / fabs(m_energy0[lane]) : error,
+                    m_sources[lane]->bodies };
+    for (int i = 0; i < m_n; i++)
+    {
+        const std::size_t k = (std::size_t)i * BATCH_LANES + lane;
+        r.bodies[i].location = point{ m_x[k], m_y[k], m_z[k] };
+        r.bodies[i].velocity = point{ m_vx[k], m_vy[k], m_vz[k] };
+    }
+    return r;
+}
+
+std::vector<batch_result> integrate_batch(const std::vector<batch_system>& systems,
+                                          const batch_options& options, int threads)
+{
+    // systems of the same size share a batch
+    std::map<std::size_t, std::vector<std::size_t>> by_size;
+    for (std::size_t s = 0; s < systems.size(); s++)
+        by_size[systems[s].bodies.size()].push_back(s);
+    std::vector<std::vector<std::size_t>> groups;
+    for (const auto& size : by_size)
+        for (std::size_t k = 0; k < size.second.size(); k += BATCH_LANES)
+            groups.emplace_back(size.second.begin() + k,
+                                size.second.begin() + std::min(k + BATCH_LANES, size.second.size()));
+
+    std::vector<batch_result> results(systems.size());
+    EnsembleRunner runner(threads);
+    runner.run(groups.size(), [&](std::size_t g, std::ostream&)
+    {
+        std::vector<const batch_system*> members;
+        for (std::size_t s : groups[g])
+            members.push_back(&systems[s]);
+        SystemBatch batch(members, options);
+        batch.run();
+        for (std::size_t l = 0; l < groups[g].size(); l++)
+            results[groups[g][l]] = batch.result((int)l);
+    });
+    return results;
+}
+
+void write_batch_results(const std::string& filename, const std::vector<batch_system>& systems,
+                         const std::vector<batch_result>& results)
+{
+    std::ofstream f(filename);
+    f << std::setprecision(17);
+    for (std::size_t s = 0; s < systems.size(); s++)
+    {
+        const batch_result& r = results[s];
+        f << systems[s].label << " " << batch_status_name(r.status) << " " << r.time << " " << r.energy_error << std::endl;
+        for (const auto& b : r.bodies)
+            f << b.name << "," << b.location.x << "," << b.location.y << "," << b.location.z << ","
+              << b.velocity.x << "," << b.velocity.y << "," << b.velocity.z << std::endl;
+    }
+}
+
+const char* batch_status_name(batch_status status)
+{
+    switch (status)
+    {
+        case BATCH_COLLIDED: return "collided";
+        case BATCH_ESCAPED: return "escaped";
+        case BATCH_DIVERGED: return "diverged";
+        default: return "completed";
+    }
+}
@@ -0,0 +1,2126 @@
+/*
+ * benchmark.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "include/benchmark.h"
+#include "include/integration.h"
+#include "include/hermite.h"
+#include "include/kepler.h"
+#include "include/planet_data.h"
+#include "include/gravity_kernels.h"
+#include "include/pair_forces.h"
+#include "include/barnes_hut.h"
+#include "include/fmm.h"
+#include "include/particle_mesh.h"
+#include "include/mergers.h"
+#include "include/ensemble.h"
+#include "include/batch.h"
+#include "include/snapshot.h"
+#include "include/trajectory.h"
+#include "include/heap_counter.h"
+#include <random>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+typedef std::chrono::steady_clock bench_clock;
+
+/*
+ *PROCEDURE: seconds_since
+ *
+ *DESCRIPTION: Wall clock time elapsed since start
+ *
+ *RETURNS: seconds(double)
+ */
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static std::vector<body> solar_system_bodies()
+{
+    return { sun, mercury, venus, earth, mars, jupiter, saturn, uranus, neptune, pluto };
+}
+
+/*
+ *PROCEDURE: plummer_sphere
+ *
+ *DESCRIPTION: Random equal mass Plummer sphere in N-body units (G = M = 1),
+ *positions only, velocities are zero
+ *
+ *RETURNS: ParticleSet
+ */
+static ParticleSet plummer_sphere(int n, unsigned seed)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    ParticleSet particles;
+    particles.reserve(n);
+    for (int i = 0; i < n; i++)
+    {
+        double r = 1.0 / sqrt(pow(uniform(rng) * 0.99 + 1e-6, -2.0 / 3.0) - 1.0);
+        double cos_theta = 2.0 * uniform(rng) - 1.0;
+        double phi = 2.0 * M_PI * uniform(rng);
+        double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+        body b{ { r * sin_theta * cos(phi), r * sin_theta * sin(phi), r * cos_theta },
+                1.0 / n, 0.0, ORIGIN, "p" + std::to_string(i) };
+        particles.add(b);
+    }
+    return particles;
+}
+
+/*
+*CLASS: discarding_trajectory
+*
+*DESCRIPTION: Trajectory format that only counts what it is given, so the
+*history benchmark measures the streaming and not the disk.
+*
+*/
+class discarding_trajectory : public TrajectoryFormat{
+public:
+    bool write(const std::vector<const trajectory_frame*>& chunk)
+    {
+        for (const trajectory_frame* frame : chunk)
+            samples += frame->id.size();
+        chunks++;
+        return true;
+    };
+
+    std::size_t samples = 0;
+    std::size_t chunks = 0;
+};
+
+/*
+ *PROCEDURE: allocation_count
+ *
+ *DESCRIPTION: Heap allocations for a report, or "uncounted" outside the
+ *Celestial_benchmark build, where every difference of heap_allocations()
+ *is zero
+ *
+ *RETURNS: std::string
+ */
+static std::string allocation_count(long long allocations)
+{
+    return heap_allocations() < 0 ? "uncounted" : std::to_string(allocations);
+}
+
+bool benchmarking::history_growth(int steps, int report_frequency)
+{
+    const int windows = 10;
+    const int window_steps = std::max(steps / windows, 1);
+
+    Orbit_integration::Euler orbit(solar_system_bodies(), 0.01);
+    auto format = std::make_unique<discarding_trajectory>();
+    const discarding_trajectory& sink = *format;
+    TrajectoryWriter trajectory(std::move(format));
+    std::vector<double> window_cost;
+    std::vector<std::size_t> window_bytes;
+
+    std::cout << "history_growth: " << windows * window_steps << " Euler steps, "
+              << "streaming every " << report_frequency << " steps" << std::endl;
+
+    for (int w = 0; w < windows; w++)
+    {
+        long long allocations = heap_allocations();
+        auto start = bench_clock::now();
+        for (int i = 0; i < window_steps; i++)
+        {
+            if ((w * window_steps + i) % report_frequency == 0)
+                trajectory.push(orbit.get_particles(), orbit.time());
+            orbit.compute_gravity_step();
+        }
+        window_cost.push_back(seconds_since(start) / window_steps * 1e9);
+        window_bytes.push_back(trajectory.buffer_bytes());
+        std::cout << "  window " << w << ": " << std::setprecision(4) << window_cost.back()
+                  << " ns/step, " << trajectory.frames() << " frames, " << window_bytes.back()
+                  << " buffer bytes, " << allocation_count(heap_allocations() - allocations) << " allocations" << std::endl;
+    }
+    bool closed = trajectory.close();
+    std::cout << "  " << sink.samples << " samples written in " << sink.chunks << " chunks, "
+              << trajectory.stalls() << " pushes waited for the writer" << std::endl;
+
+    // the first window also pays for warming up caches, compare against the best early one
+    double reference = std::min(window_cost[0], window_cost[1]);
+    double ratio = window_cost.back() / reference;
+    bool bounded = window_bytes.back() == window_bytes[0];
+    bool passed = ratio < 1.25 && bounded && closed
+               && sink.samples == trajectory.frames() * orbit.get_particles().size();
+    std::cout << "  last/first window cost ratio: " << ratio
+              << (ratio < 1.25 ? " (flat)" : " (GROWING)") << ", buffer memory "
+              << (bounded ? "bounded" : "GROWING") << std::endl;
+    return passed;
+}
+
+/*
+ *PROCEDURE: race
+ *
+ *DESCRIPTION: Runs the two evaluations in turn for seconds, so a slow spell
+ *of the machine hits both, and keeps the fastest run of each
+ *
+ *RETURNS: Nothing
+ */
+template <class First, class Second>
+static void race(First first, Second second, double seconds, double& first_seconds, double& second_seconds)
+{
+    first_seconds = second_seconds = 0;
+    auto start = bench_clock::now();
+    do
+    {
+        auto evaluation = bench_clock::now();
+        first();
+        double elapsed = seconds_since(evaluation);
+        first_seconds = first_seconds == 0 ? elapsed : std::min(first_seconds, elapsed);
+        evaluation = bench_clock::now();
+        second();
+        elapsed = seconds_since(evaluation);
+        second_seconds = second_seconds == 0 ? elapsed : std::min(second_seconds, elapsed);
+    } while (seconds_since(start) < seconds);
+}
+
+/*
+ *PROCEDURE: minimum_speedup
+ *
+ *DESCRIPTION: Speedup over the scalar path a direct kernel has to reach from
+ *N = 1024, a margin below what each one measures on its own instruction
+ *set: about 5.5x for AVX-512 and 2x for AVX2
+ *
+ *RETURNS: double
+ */
+static double minimum_speedup(const std::string& kernel)
+{
+    if (kernel == "avx512")
+        return 4.0;
+    if (kernel == "avx2")
+        return 1.6;
+    return 0.0;
+}
+
+bool benchmarking::direct_kernels(int n)
+{
+    ParticleSet particles = plummer_sphere(n, 42);
+    const double* x = particles.x.data();
+    const double* y = particles.y.data();
+    const double* z = particles.z.data();
+    const double* m = particles.mass.data();
+    const double interactions = (double)n * (double)n;
+
+    auto evaluate = [&](gravity_kernels::direct_kernel kernel, std::vector<double>& ax,
+                        std::vector<double>& ay, std::vector<double>& az)
+    {
+        ax.assign(n, 0.0);
+        ay.assign(n, 0.0);
+        az.assign(n, 0.0);
+        kernel(x, y, z, m, n, x, y, z, n, 1.0, ax.data(), ay.data(), az.data());
+    };
+
+    std::cout << "direct_kernels: N = " << n << ", selected kernel: "
+              << gravity_kernels::best_direct_kernel().name << std::endl;
+    bool passed = true;
+    std::vector<double> rx, ry, rz;
+    for (const auto& kernel : gravity_kernels::available_kernels())
+    {
+        if (!kernel.supported)
+        {
+            std::cout << "  " << std::setw(8) << kernel.name << ": not supported by this CPU" << std::endl;
+            continue;
+        }
+        std::vector<double> ax, ay, az;
+        double reference_seconds, seconds;
+        race([&]() { evaluate(gravity_kernels::direct_scalar, rx, ry, rz); },
+             [&]() { evaluate(kernel.function, ax, ay, az); }, 0.5, reference_seconds, seconds);
+        double max_error = 0;
+        for (int i = 0; i < n; i++)
+        {
+            double diff = norm(point{ ax[i] - rx[i], ay[i] - ry[i], az[i] - rz[i] });
+            max_error = std::max(max_error, diff / norm(point{ rx[i], ry[i], rz[i] }));
+        }
+        passed = passed && max_error < 1e-12;
+        const double speedup = reference_seconds / seconds, minimum = minimum_speedup(kernel.name);
+        if (n >= 1024)
+            passed = passed && speedup >= minimum;
+        std::cout << "  " << std::setw(8) << kernel.name << ": " << std::setprecision(4)
+                  << interactions / seconds / 1e6 << " M interactions/s, speedup " << speedup;
+        if (minimum > 0)
+            std::cout << " (at least " << minimum << ")";
+        std::cout << ", max relative error " << max_error << std::endl;
+    }
+    return passed;
+}
+
+bool benchmarking::pair_forces(int n)
+{
+    ParticleSet particles = plummer_sphere(n, 7);
+
+    std::vector<double> fx, fy, fz;
+    PairForceEngine serial(1);
+    std::vector<double> ax, ay, az;
+    double full, half;
+    race([&]() { gravity_kernels::accelerations(particles, 1.0, fx, fy, fz); },
+         [&]() { serial.accelerations(particles, 1.0, ax, ay, az); }, 1.0, full, half);
+
+    // at least two threads, so the per thread buffers and their reduction are
+    // always timed; the full kernel gets the same threads over blocks of targets
+    int threads = 2;
+#ifdef _OPENMP
+    threads = std::max(threads, omp_get_max_threads());
+#endif
+    const gravity_kernels::direct_kernel direct = gravity_kernels::best_direct_kernel().function;
+    const double *x = particles.x.data(), *y = particles.y.data(), *z = particles.z.data();
+    const double *m = particles.mass.data();
+    std::vector<double> tx(n), ty(n), tz(n);
+    PairForceEngine parallel(threads);
+    std::vector<double> px, py, pz;
+    double full_threaded, threaded;
+    race([&]()
+    {
+        #pragma omp parallel for num_threads(threads) schedule(static)
+        for (int block = 0; block < n; block += 64)
+        {
+            const int count = std::min(64, n - block);
+            std::fill(tx.begin() + block, tx.begin() + block + count, 0.0);
+            std::fill(ty.begin() + block, ty.begin() + block + count, 0.0);
+            std::fill(tz.begin() + block, tz.begin() + block + count, 0.0);
+            direct(x, y, z, m, n, x + block, y + block, z + block, count, 1.0,
+                   tx.data() + block, ty.data() + block, tz.data() + block);
+        }
+    }, [&]() { parallel.accelerations(particles, 1.0, px, py, pz); }, 1.0, full_threaded, threaded);
+
+    double max_error = 0;
+    for (int i = 0; i < n; i++)
+    {
+        double reference = norm(point{ fx[i], fy[i], fz[i] });
+        max_error = std::max(max_error, norm(point{ ax[i] - fx[i], ay[i] - fy[i], az[i] - fz[i] }) / reference);
+        max_error = std::max(max_error, norm(point{ px[i] - fx[i], py[i] - fy[i], pz[i] - fz[i] }) / reference);
+        max_error = std::max(max_error, norm(point{ tx[i] - fx[i], ty[i] - fy[i], tz[i] - fz[i] }) / reference);
+    }
+
+    int cores = 1;
+#ifdef _OPENMP
+    cores = omp_get_num_procs();
+#endif
+    std::cout << "pair_forces: N = " << n << ", kernel " << gravity_kernels::best_direct_kernel().name
+              << ", " << cores << " cores" << std::setprecision(4) << std::endl;
+    std::cout << "  full N^2 kernel, 1 thread  : " << full * 1e3 << " ms" << std::endl;
+    std::cout << "  half pairs, 1 thread       : " << half * 1e3 << " ms (" << full / half << "x)" << std::endl;
+    std::cout << "  full N^2 kernel, " << threads << " threads : " << full_threaded * 1e3 << " ms" << std::endl;
+    std::cout << "  half pairs, " << threads << " threads      : " << threaded * 1e3 << " ms ("
+              << full_threaded / threaded << "x)" << std::endl;
+    std::cout << "  max relative difference: " << max_error << std::endl;
+    return max_error < 1e-12 && half * 1.25 < full && threaded * 1.25 < full_threaded;
+}
+
+/*
+ *PROCEDURE: time_per_call
+ *
+ *DESCRIPTION: Repeats evaluate for at least min_seconds
+ *
+ *RETURNS: average seconds per call(double)
+ */
+template <class Function>
+static double time_per_call(Function evaluate, double min_seconds = 0.5)
+{
+    int repeats = 0;
+    auto start = bench_clock::now();
+    do
+    {
+        evaluate();
+        repeats++;
+    } while (seconds_since(start) < min_seconds);
+    return seconds_since(start) / repeats;
+}
+
+bool benchmarking::tree_gravity(int max_n, int error_n)
+{
+    std::cout << "tree_gravity: direct half pairs vs Barnes-Hut (theta 0.5, quadrupole)"
+              << std::setprecision(4) << std::endl;
+    DirectSummation direct;
+    BarnesHut tree(0.5, true);
+    int crossover = 0;
+    double last_speedup = 0;
+    for (int n = 256; n <= max_n; n *= 2)
+    {
+        ParticleSet particles = plummer_sphere(n, 11);
+        std::vector<double> ax, ay, az;
+        double direct_time = time_per_call([&]() { direct.accelerations(particles, 1.0, ax, ay, az); }, 0.2);
+        double tree_time = time_per_call([&]() { tree.accelerations(particles, 1.0, ax, ay, az); }, 0.2);
+        last_speedup = direct_time / tree_time;
+        if (last_speedup > 1 && crossover == 0)
+            crossover = n;
+        std::cout << "  N = " << std::setw(6) << n << ": direct " << std::setw(9) << direct_time * 1e3
+                  << " ms, tree " << std::setw(9) << tree_time * 1e3 << " ms, speedup " << last_speedup << std::endl;
+    }
+    if (crossover > 0)
+        std::cout << "  tree is faster from N = " << crossover << std::endl;
+    else
+        std::cout << "  tree never faster up to N = " << max_n << std::endl;
+
+    ParticleSet particles = plummer_sphere(error_n, 12);
+    std::vector<double> rx, ry, rz;
+    direct.accelerations(particles, 1.0, rx, ry, rz);
+    std::cout << "  relative force error, N = " << error_n << " (median / 99% / max):" << std::endl;
+    bool passed = true;
+    for (bool quadrupole : { false, true })
+    {
+        for (double theta : { 0.3, 0.5, 0.7 })
+        {
+            BarnesHut approximate(theta, quadrupole);
+            std::vector<double> ax, ay, az;
+            double elapsed = time_per_call([&]() { approximate.accelerations(particles, 1.0, ax, ay, az); }, 0.2);
+            std::vector<double> errors(error_n);
+            for (int i = 0; i < error_n; i++)
+                errors[i] = norm(point{ ax[i] - rx[i], ay[i] - ry[i], az[i] - rz[i] })
+                            / norm(point{ rx[i], ry[i], rz[i] });
+            std::sort(errors.begin(), errors.end());
+            double p99 = errors[(std::size_t)(0.99 * (error_n - 1))];
+            std::cout << "    theta " << theta << (quadrupole ? ", quadrupole: " : ", monopole:   ")
+                      << errors[error_n / 2] << " / " << p99 << " / " << errors.back()
+                      << ", " << elapsed * 1e3 << " ms" << std::endl;
+            if (quadrupole && theta == 0.5)
+                passed = passed && p99 < 1e-2;
+        }
+    }
+    return passed && last_speedup > 1;
+}
+
+/*
+ *PROCEDURE: sampled_force_errors
+ *
+ *DESCRIPTION: Relative acceleration error of the first samples particles
+ *against the direct kernel (with G = 1), which is timed to estimate the cost
+ *of a full direct evaluation
+ *
+ *RETURNS: sorted relative errors(vector)
+ */
+static std::vector<double> sampled_force_errors(const ParticleSet& particles, const std::vector<double>& ax,
+                                                const std::vector<double>& ay, const std::vector<double>& az,
+                                                int samples, double& direct_seconds)
+{
+    const int n = (int)particles.size();
+    samples = std::min(samples, n);
+    std::vector<double> rx(samples, 0.0), ry(samples, 0.0), rz(samples, 0.0);
+    auto start = bench_clock::now();
+    gravity_kernels::best_direct_kernel().function(particles.x.data(), particles.y.data(), particles.z.data(),
+                                                   particles.mass.data(), n, particles.x.data(), particles.y.data(),
+                                                   particles.z.data(), samples, 1.0, rx.data(), ry.data(), rz.data());
+    direct_seconds = seconds_since(start) * n / samples;
+
+    std::vector<double> errors(samples);
+    for (int i = 0; i < samples; i++)
+        errors[i] = norm(point{ ax[i] - rx[i], ay[i] - ry[i], az[i] - rz[i] }) / norm(point{ rx[i], ry[i], rz[i] });
+    std::sort(errors.begin(), errors.end());
+    return errors;
+}
+
+bool benchmarking::fmm_scaling(int max_n, int order_n)
+{
+    const int samples = 1000;
+    std::cout << "fmm_scaling: time per force evaluation and relative force error (median / 99% / max)"
+              << " on " << samples << " sampled particles" << std::setprecision(4) << std::endl;
+
+    bool passed = true;
+    double previous_cost = 0;
+    for (int n = 10000; n <= max_n; n *= 10)
+    {
+        ParticleSet particles = plummer_sphere(n, 21);
+        FastMultipole fmm;
+        std::vector<double> ax, ay, az;
+        double elapsed = time_per_call([&]() { fmm.accelerations(particles, 1.0, ax, ay, az); }, 0.0);
+        double direct = 0;
+        std::vector<double> errors = sampled_force_errors(particles, ax, ay, az, samples, direct);
+        double cost = elapsed / n;
+        std::cout << "  N = " << std::setw(7) << n << ", order " << fmm.order() << ", theta " << fmm.theta()
+                  << ": " << elapsed * 1e3 << " ms (" << cost * 1e9 << " ns/particle), direct ~"
+                  << direct * 1e3 << " ms, error " << errors[samples / 2] << " / "
+                  << errors[(samples * 99) / 100] << " / " << errors.back() << std::endl;
+        // O(N): the cost per particle must not grow like N
+        if (previous_cost > 0)
+            passed = passed && cost < 3 * previous_cost;
+        previous_cost = cost;
+    }
+
+    ParticleSet particles = plummer_sphere(order_n, 22);
+    std::cout << "  N = " << order_n << " versus expansion order:" << std::endl;
+    double previous_error = 1;
+    for (int order : { 2, 3, 4, 5, 6, 8 })
+    {
+        FastMultipole fmm(order);
+        std::vector<double> ax, ay, az;
+        double elapsed = time_per_call([&]() { fmm.accelerations(particles, 1.0, ax, ay, az); }, 0.0);
+        double direct = 0;
+        std::vector<double> errors = sampled_force_errors(particles, ax, ay, az, samples, direct);
+        std::cout << "    order " << order << ": " << std::setw(9) << elapsed * 1e3 << " ms, error "
+                  << errors[samples / 2] << " / " << errors[(samples * 99) / 100] << " / " << errors.back()
+                  << std::endl;
+        passed = passed && errors[samples / 2] < previous_error;
+        previous_error = errors[samples / 2];
+    }
+    return passed;
+}
+
+bool benchmarking::particle_mesh(int n, int grid)
+{
+    const int samples = 1000;
+    ParticleSet particles = plummer_sphere(n, 31);
+    std::cout << "particle_mesh: N = " << n << ", " << grid << "^3 mesh (" << 2 * grid
+              << "^3 padded), error on " << samples << " sampled particles (median / 99% / max)"
+              << std::setprecision(4) << std::endl;
+
+    bool passed = true;
+    for (mass_assignment scheme : { CIC, TSC })
+    {
+        ParticleMesh mesh(grid, scheme);
+        std::vector<double> ax, ay, az;
+        double first = time_per_call([&]() { mesh.accelerations(particles, 1.0, ax, ay, az); }, 0.0);
+        double elapsed = time_per_call([&]() { mesh.accelerations(particles, 1.0, ax, ay, az); }, 0.0);
+        double direct = 0;
+        std::vector<double> errors = sampled_force_errors(particles, ax, ay, az, samples, direct);
+        std::cout << "  " << (scheme == CIC ? "CIC" : "TSC") << ": " << elapsed * 1e3 << " ms per step ("
+                  << first * 1e3 << " ms with the Green's function), cell " << mesh.cell_size()
+                  << ", direct ~" << direct * 1e3 << " ms, error " << errors[samples / 2] << " / "
+                  << errors[(samples * 99) / 100] << " / " << errors.back() << std::endl;
+        passed = passed && errors[samples / 2] < 0.1 && elapsed < direct;
+    }
+    return passed;
+}
+
+/*
+ *PROCEDURE: plummer_cluster
+ *
+ *DESCRIPTION: Equal mass Plummer sphere in N-body units with isotropic
+ *velocities in virial equilibrium (Aarseth, Henon & Wielen 1974), written
+ *into the Hermite arrays
+ *
+ *RETURNS: -
+ */
+static void plummer_cluster(int n, unsigned seed, std::vector<real>& mass,
+                            std::vector<real>& pos, std::vector<real>& vel)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    auto isotropic = [&](double length, real* v)
+    {
+        double cos_theta = 2.0 * uniform(rng) - 1.0;
+        double phi = 2.0 * M_PI * uniform(rng);
+        double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+        v[0] = length * sin_theta * cos(phi);
+        v[1] = length * sin_theta * sin(phi);
+        v[2] = length * cos_theta;
+    };
+    mass.assign(n, 1.0 / n);
+    pos.resize(NDIM * n);
+    vel.resize(NDIM * n);
+    // Plummer scale length 3 pi / 16 puts the virial radius at 1
+    const double scale = 3 * M_PI / 16;
+    for (int i = 0; i < n; i++)
+    {
+        double r = 1.0 / sqrt(pow(uniform(rng) * 0.99 + 1e-6, -2.0 / 3.0) - 1.0);
+        isotropic(r * scale, &pos[NDIM * i]);
+        // von Neumann rejection for q = v / v_escape, g(q) = q^2 (1 - q^2)^3.5
+        double q = 0, g = 1;
+        while (0.1 * g > q * q * pow(1.0 - q * q, 3.5))
+        {
+            q = uniform(rng);
+            g = uniform(rng);
+        }
+        isotropic(q * sqrt(2.0) * pow(1.0 + r * r, -0.25) / sqrt(scale), &vel[NDIM * i]);
+    }
+}
+
+bool benchmarking::hermite_block(int n, double duration)
+{
+    std::vector<real> mass, pos, vel;
+    plummer_cluster(n, 41, mass, pos, vel);
+    // turn particles 0 and 1 into a circular binary with semi-major axis 1e-3
+    const double separation = 1e-3;
+    const double orbital = sqrt((mass[0] + mass[1]) / separation);
+    for (int k = 0; k < NDIM; k++)
+    {
+        pos[NDIM + k] = pos[k];
+        vel[NDIM + k] = vel[k];
+    }
+    pos[NDIM] += separation / 2;
+    pos[0] -= separation / 2;
+    vel[NDIM + 1] += orbital / 2;
+    vel[1] -= orbital / 2;
+
+    typedef const real (*rows)[NDIM];
+    auto energy = [&](rows p, rows v)
+    {
+        double ekin = 0;
+        for (int i = 0; i < n; i++)
+            for (int k = 0; k < NDIM; k++)
+                ekin += 0.5 * mass[i] * v[i][k] * v[i][k];
+        return ekin + potential_energy(mass.data(), p, n);
+    };
+    const double e0 = energy((rows)pos.data(), (rows)vel.data());
+    std::cout << "hermite_block: N = " << n << " Plummer sphere with a binary of period "
+              << 2 * M_PI * separation / orbital << ", integrated for " << duration << " time units"
+              << std::setprecision(4) << std::endl;
+
+    // shared step, dt = 0.03 coll_time as in nbody_sh1
+    HermiteEngine shared(n, true);
+    std::cout << "  workspace " << shared.workspace().capacity() / 1024 << " KiB"
+              << (shared.workspace().huge_pages() ? " on huge pages" : "") << std::endl;
+    shared.load(mass.data(), (rows)pos.data(), (rows)vel.data(), 0);
+    auto start = bench_clock::now();
+    shared.start_shared();
+    long long allocations = heap_allocations();
+    real epot, coll_time = shared.collision_time();
+    while (shared.time() < duration)
+        evolve_step(shared, 0.03 * coll_time, epot, coll_time);
+    long long shared_allocations = heap_allocations() - allocations;
+    double shared_time = seconds_since(start);
+    double shared_error = fabs((energy(shared.positions(), shared.velocities()) - e0) / e0);
+    std::cout << "  shared step: " << std::setw(9) << shared_time << " s, " << shared.steps() << " steps, "
+              << (double)shared.interactions() << " pair interactions, relative energy error "
+              << shared_error << ", " << allocation_count(shared_allocations) << " heap allocations" << std::endl;
+
+    // block steps, eta = 0.02
+    HermiteEngine block(n, true);
+    block.load(mass.data(), (rows)pos.data(), (rows)vel.data(), 0);
+    start = bench_clock::now();
+    block.start_block(0.02, 1.0 / 16);
+    allocations = heap_allocations();
+    while (!(block.synchronized() && block.time() >= duration))
+        block.step_block(0.02);
+    long long block_allocations = heap_allocations() - allocations;
+    double block_time = seconds_since(start);
+    double block_error = fabs((energy(block.positions(), block.velocities()) - e0) / e0);
+    std::cout << "  block steps: " << std::setw(9) << block_time << " s, " << block.steps() << " blocks, "
+              << (double)block.particle_steps() / block.steps() << " active particles per block, "
+              << (double)block.interactions() << " pair interactions, relative energy error "
+              << block_error << ", " << allocation_count(block_allocations) << " heap allocations" << std::endl;
+    std::cout << "  speedup " << shared_time / block_time << std::endl;
+
+    return block_time < shared_time && block_error < 1e-4
+           && shared_allocations == 0 && block_allocations == 0;
+}
+
+bool benchmarking::hermite_forces(int n)
+{
+    std::vector<real> mass, pos, vel;
+    plummer_cluster(n, 51, mass, pos, vel);
+    typedef real (*rows)[NDIM];
+    std::vector<real> acc(NDIM * n), jerk(NDIM * n), ref_acc(NDIM * n), ref_jerk(NDIM * n);
+    real epot, coll_time, ref_epot, ref_coll_time;
+
+    double scalar = time_per_call([&]() {
+        get_acc_jerk_pot_coll_scalar(mass.data(), (rows)pos.data(), (rows)vel.data(), (rows)ref_acc.data(),
+                                     (rows)ref_jerk.data(), n, ref_epot, ref_coll_time); }, 0.2);
+    double fused = time_per_call([&]() {
+        get_acc_jerk_pot_coll(mass.data(), (rows)pos.data(), (rows)vel.data(), (rows)acc.data(),
+                              (rows)jerk.data(), n, epot, coll_time); }, 0.2);
+
+    double acc_error = 0, jerk_error = 0;
+    for (int i = 0; i < n; i++)
+    {
+        double da = 0, dj = 0, a = 0, j = 0;
+        for (int k = 0; k < NDIM; k++)
+        {
+            da += pow(acc[NDIM * i + k] - ref_acc[NDIM * i + k], 2);
+            dj += pow(jerk[NDIM * i + k] - ref_jerk[NDIM * i + k], 2);
+            a += pow(ref_acc[NDIM * i + k], 2);
+            j += pow(ref_jerk[NDIM * i + k], 2);
+        }
+        acc_error = std::max(acc_error, sqrt(da / a));
+        jerk_error = std::max(jerk_error, sqrt(dj / j));
+    }
+    double epot_error = fabs(epot - ref_epot) / fabs(ref_epot);
+    double coll_error = fabs(coll_time - ref_coll_time) / ref_coll_time;
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    std::cout << "hermite_forces: N = " << n << ", " << gravity_kernels::best_direct_kernel().name << ", "
+              << threads << " threads" << std::setprecision(4) << std::endl;
+    std::cout << "  nbody_sh1 half pairs: " << std::setw(9) << scalar * 1e3 << " ms" << std::endl;
+    std::cout << "  fused SIMD rows:      " << std::setw(9) << fused * 1e3 << " ms, speedup "
+              << scalar / fused << std::endl;
+    std::cout << "  largest relative difference: acc " << acc_error << ", jerk " << jerk_error
+              << ", epot " << epot_error << ", coll_time " << coll_error << std::endl;
+
+    return fused < scalar && acc_error < 1e-10 && jerk_error < 1e-10 && epot_error < 1e-10
+           && coll_error < 1e-10;
+}
+
+/*
+ *PROCEDURE: total_energy
+ *
+ *DESCRIPTION: Kinetic plus potential energy of a particle set
+ *
+ *RETURNS: double
+ */
+static double total_energy(const ParticleSet& p, double G)
+{
+    double energy = 0;
+    for (std::size_t i = 0; i < p.size(); i++)
+    {
+        energy += 0.5 * p.mass[i] * (p.vx[i] * p.vx[i] + p.vy[i] * p.vy[i] + p.vz[i] * p.vz[i]);
+        for (std::size_t j = i + 1; j < p.size(); j++)
+        {
+            double dx = p.x[j] - p.x[i], dy = p.y[j] - p.y[i], dz = p.z[j] - p.z[i];
+            energy -= G * p.mass[i] * p.mass[j] / sqrt(dx * dx + dy * dy + dz * dz);
+        }
+    }
+    return energy;
+}
+
+/*
+ *PROCEDURE: energy_run
+ *
+ *DESCRIPTION: Integrates for steps steps, checking the relative energy
+ *error every steps / samples steps
+ *
+ *RETURNS: largest relative energy error seen, elapsed seconds in seconds
+ */
+template <class Integrator>
+static double energy_run(Integrator& integrator, long long steps, int samples, double& seconds)
+{
+    const double e0 = total_energy(integrator.get_particles(), G_const);
+    const long long every = std::max(1LL, steps / samples);
+    double worst = 0;
+    auto start = bench_clock::now();
+    for (long long i = 1; i <= steps; i++)
+    {
+        integrator.compute_gravity_step();
+        if (i % every == 0 || i == steps)
+            worst = std::max(worst, fabs((total_energy(integrator.get_particles(), G_const) - e0) / e0));
+    }
+    seconds = seconds_since(start);
+    return worst;
+}
+
+bool benchmarking::whfast_energy(double years, double long_years)
+{
+    const double year = 365.25 * 86400;
+    const double day = 86400;
+    std::cout << "whfast_energy: solar system over " << years << " years, largest relative energy error"
+              << std::setprecision(4) << std::endl;
+
+    double best_rk4_error = HUGE_VAL, best_rk4_time = 0;
+    for (double step : { 1.0 * day, 0.25 * day })
+    {
+        Orbit_integration::RK4 rk4(solar_system_bodies(), step);
+        double seconds = 0;
+        double error = energy_run(rk4, (long long)(years * year / step), 1000, seconds);
+        std::cout << "  RK4,    dt = " << std::setw(6) << step / day << " d: " << std::setw(9) << seconds
+                  << " s, error " << error << std::endl;
+        if (error < best_rk4_error)
+        {
+            best_rk4_error = error;
+            best_rk4_time = seconds;
+        }
+    }
+
+    bool passed = true;
+    for (bool correctors : { false, true })
+    {
+        for (double step : { 8.0 * day, 2.0 * day })
+        {
+            Orbit_integration::WHFast whfast(solar_system_bodies(), step, correctors);
+            double seconds = 0;
+            double error = energy_run(whfast, (long long)(years * year / step), 1000, seconds);
+            std::cout << "  WHFast, dt = " << std::setw(6) << step / day << " d"
+                      << (correctors ? ", correctors: " : ":             ") << std::setw(9) << seconds
+                      << " s, error " << error << std::endl;
+            if (correctors && step == 8.0 * day)
+                passed = seconds < best_rk4_time && error < best_rk4_error;
+        }
+    }
+
+    Orbit_integration::WHFast whfast(solar_system_bodies(), 8.0 * day, true);
+    double seconds = 0;
+    double error = energy_run(whfast, (long long)(long_years * year / (8.0 * day)), 1000, seconds);
+    std::cout << "  WHFast, dt = 8 d, correctors, " << long_years << " years: " << seconds
+              << " s, error " << error << std::endl;
+    return passed;
+}
+
+/*
+ *PROCEDURE: max_position_error
+ *
+ *DESCRIPTION: Largest distance between the same particle in two sets
+ *
+ *RETURNS: double
+ */
+static double max_position_error(const ParticleSet& a, const ParticleSet& b)
+{
+    double worst = 0;
+    for (std::size_t i = 0; i < a.size(); i++)
+    {
+        double dx = a.x[i] - b.x[i], dy = a.y[i] - b.y[i], dz = a.z[i] - b.z[i];
+        worst = std::max(worst, sqrt(dx * dx + dy * dy + dz * dz));
+    }
+    return worst;
+}
+
+/*
+ *PROCEDURE: ias15_scenario
+ *
+ *DESCRIPTION: Integrates bodies for duration with RK4 at each of rk4_steps and
+ *with IAS15 at a range of tolerances, printing wall time, relative energy
+ *error and largest position error against an IAS15 run at epsilon 1e-11
+ *
+ *RETURNS: true if IAS15 at epsilon 1e-9 ends closer to the reference than
+ *every RK4 run
+ */
+static bool ias15_scenario(const char* label, const std::vector<body>& bodies, double duration,
+                           std::initializer_list<double> rk4_steps)
+{
+    const double AU = 1.495978707e11;
+    const double day = 86400;
+
+    Orbit_integration::IAS15 reference(bodies, day, 1e-11);
+    const double e0 = total_energy(reference.get_particles(), G_const);
+    reference.integrate(duration);
+    const ParticleSet& exact = reference.get_particles();
+    std::cout << "  " << label << ": reference IAS15, epsilon = 1e-11, " << reference.steps() << " steps" << std::endl;
+
+    double best_rk4_error = HUGE_VAL;
+    for (double step : rk4_steps)
+    {
+        Orbit_integration::RK4 rk4(bodies, step);
+        const long long steps = llround(duration / step);
+        auto start = bench_clock::now();
+        for (long long i = 0; i < steps; i++)
+            rk4.compute_gravity_step();
+        const double seconds = seconds_since(start);
+        const double error = max_position_error(rk4.get_particles(), exact);
+        std::cout << "    RK4,   dt = " << std::setw(9) << step / day << " d:  " << std::setw(9) << seconds
+                  << " s, energy error " << std::setw(10) << fabs((total_energy(rk4.get_particles(), G_const) - e0) / e0)
+                  << ", position error " << std::setw(10) << error / AU << " AU" << std::endl;
+        best_rk4_error = std::min(best_rk4_error, error);
+    }
+
+    bool passed = false;
+    for (double epsilon : { 1e-5, 1e-7, 1e-9 })
+    {
+        Orbit_integration::IAS15 ias15(bodies, day, epsilon);
+        auto start = bench_clock::now();
+        ias15.integrate(duration);
+        const double seconds = seconds_since(start);
+        const double error = max_position_error(ias15.get_particles(), exact);
+        std::cout << "    IAS15, epsilon = " << std::setw(6) << epsilon << ": " << std::setw(9) << seconds
+                  << " s, energy error " << std::setw(10) << fabs((total_energy(ias15.get_particles(), G_const) - e0) / e0)
+                  << ", position error " << std::setw(10) << error / AU << " AU, " << ias15.steps() << " steps ("
+                  << ias15.rejected_steps() << " rejected), " << ias15.evaluations() << " force evaluations" << std::endl;
+        if (epsilon == 1e-9)
+            passed = error < best_rk4_error;
+    }
+    return passed;
+}
+
+bool benchmarking::ias15_accuracy(double solar_years, double encounter_years)
+{
+    const double year = 365.25 * 86400;
+    const double day = 86400;
+    std::cout << "ias15_accuracy: accuracy per CPU time of fixed step RK4 and adaptive IAS15" << std::setprecision(3) << std::endl;
+
+    bool passed = ias15_scenario("solar system", solar_system_bodies(), solar_years * year,
+                                 { 1.0 * day, 0.25 * day });
+
+    // an Earth mass body overtaking Jupiter about 0.01 AU off its path: the
+    // flyby needs steps of minutes, the rest of the orbit steps of days
+    body flyby{ { jupiter.location.x + 1.5e9, jupiter.location.y + 7.5e10, 0.0 }, 5.97e24, 6371000,
+                { jupiter.velocity.x, jupiter.velocity.y - 6000, 0.0 }, "Flyby" };
+    passed = ias15_scenario("close encounter", { sun, jupiter, flyby }, encounter_years * year,
+                            { 0.25 * day, day / 16, day / 64 }) && passed;
+    return passed;
+}
+
+bool benchmarking::dopri5_dense(double years)
+{
+    const double AU = 1.495978707e11;
+    const double day = 86400;
+    const double duration = years * 365.25 * day;
+    const long long outputs = llround(duration / day);
+    std::cout << "dopri5_dense: solar system over " << years << " years, position errors against IAS15 (epsilon 1e-11)"
+              << std::setprecision(3) << std::endl;
+
+    // reference positions at every day
+    const std::size_t n = solar_system_bodies().size();
+    std::vector<double> reference(outputs * 3 * n);
+    Orbit_integration::IAS15 ias15(solar_system_bodies(), day, 1e-11);
+    for (long long j = 0; j < outputs; j++)
+    {
+        ias15.integrate(day);
+        const ParticleSet& p = ias15.get_particles();
+        for (std::size_t i = 0; i < n; i++)
+        {
+            reference[(j * n + i) * 3] = p.x[i];
+            reference[(j * n + i) * 3 + 1] = p.y[i];
+            reference[(j * n + i) * 3 + 2] = p.z[i];
+        }
+    }
+    auto error_at = [&](long long j, const ParticleSet& p) {
+        double worst = 0;
+        for (std::size_t i = 0; i < n; i++)
+        {
+            const double* r = &reference[(j * n + i) * 3];
+            double dx = p.x[i] - r[0], dy = p.y[i] - r[1], dz = p.z[i] - r[2];
+            worst = std::max(worst, sqrt(dx * dx + dy * dy + dz * dz));
+        }
+        return worst;
+    };
+
+    bool passed = true;
+    for (double tolerance : { 1e-8, 1e-10, 1e-12 })
+    {
+        // one output at the end
+        Orbit_integration::DOPRI5 single(solar_system_bodies(), day, tolerance);
+        double end_error = 0;
+        auto start = bench_clock::now();
+        single.integrate(duration, duration, [&](double, const ParticleSet& p) { end_error = error_at(outputs - 1, p); });
+        const double seconds = seconds_since(start);
+
+        // the same run with an output every day
+        Orbit_integration::DOPRI5 daily(solar_system_bodies(), day, tolerance);
+        double dense_error = 0;
+        long long j = 0;
+        start = bench_clock::now();
+        daily.integrate(duration, day, [&](double, const ParticleSet& p) { dense_error = std::max(dense_error, error_at(j++, p)); });
+        const double daily_seconds = seconds_since(start);
+
+        std::cout << "  tolerance " << std::setw(6) << tolerance << ": " << std::setw(8) << seconds << " s, "
+                  << single.steps() << " steps (" << single.rejected_steps() << " rejected), " << single.evaluations()
+                  << " force evaluations, final position error " << end_error / AU << " AU" << std::endl;
+        std::cout << "    " << outputs << " daily outputs: " << std::setw(8) << daily_seconds << " s, "
+                  << daily.steps() << " steps, largest position error " << dense_error / AU << " AU" << std::endl;
+        passed = passed && daily.steps() == single.steps();
+    }
+
+    Orbit_integration::DOPRI5 dopri5(solar_system_bodies(), day, 1e-10);
+    dopri5.compute_gravity_step();
+    long long allocations = heap_allocations();
+    for (int i = 0; i < 1000; i++)
+        dopri5.compute_gravity_step();
+    allocations = heap_allocations() - allocations;
+    std::cout << "  " << allocation_count(allocations) << " heap allocations in 1000 steps" << std::endl;
+    return passed && allocations == 0;
+}
+
+/*
+ *PROCEDURE: bs_scenario
+ *
+ *DESCRIPTION: Integrates bodies for duration with Bulirsch-Stoer and
+ *Dormand-Prince at several tolerances and with IAS15, printing steps, force
+ *evaluations, digits of accuracy (-log10 of the largest position error
+ *relative to the size of the system, against exact) and evaluations per digit
+ *
+ *RETURNS: true if Bulirsch-Stoer at tolerance 1e-14 gets at least 11 digits
+ *with fewer evaluations per digit than Dormand-Prince at 1e-14
+ */
+static bool bs_scenario(const char* label, const std::vector<body>& bodies, double duration, const ParticleSet& exact)
+{
+    double size = 0;
+    for (std::size_t i = 0; i < exact.size(); i++)
+        size = std::max(size, sqrt(exact.x[i] * exact.x[i] + exact.y[i] * exact.y[i] + exact.z[i] * exact.z[i]));
+    std::cout << "  " << label << ", " << duration / (365.25 * 86400) << " years:" << std::endl;
+
+    auto report = [&](const char* name, double tolerance, long long steps, long long evaluations,
+                      const ParticleSet& p, double seconds) {
+        const double digits = -log10(std::max(max_position_error(p, exact) / size, 1e-17));
+        std::cout << "    " << std::left << std::setw(13) << name << std::right << std::setw(6) << tolerance << ": "
+                  << std::setw(7) << steps << " steps, " << std::setw(8) << evaluations << " evaluations, "
+                  << std::setw(9) << seconds << " s, " << std::setw(5) << digits << " digits, "
+                  << std::setw(8) << evaluations / std::max(digits, 0.1) << " evaluations per digit" << std::endl;
+        return digits;
+    };
+
+    double bs_digits = 0, bs_cost = 0, dopri5_cost = 0;
+    for (double tolerance : { 1e-8, 1e-11, 1e-14 })
+    {
+        Orbit_integration::BulirschStoer bs(bodies, 86400, tolerance);
+        auto start = bench_clock::now();
+        bs.integrate(duration);
+        bs_digits = report("Bulirsch-Stoer", tolerance, bs.steps(), bs.evaluations(), bs.get_particles(), seconds_since(start));
+        bs_cost = bs.evaluations() / bs_digits;
+    }
+    for (double tolerance : { 1e-8, 1e-11, 1e-14 })
+    {
+        Orbit_integration::DOPRI5 dopri5(bodies, 86400, tolerance);
+        ParticleSet end = exact;
+        auto start = bench_clock::now();
+        dopri5.integrate(duration, duration, [&](double, const ParticleSet& p) { end = p; });
+        const double digits = report("DOPRI5", tolerance, dopri5.steps(), dopri5.evaluations(), end, seconds_since(start));
+        dopri5_cost = dopri5.evaluations() / digits;
+    }
+    Orbit_integration::IAS15 ias15(bodies, 86400, 1e-9);
+    auto start = bench_clock::now();
+    ias15.integrate(duration);
+    report("IAS15", 1e-9, ias15.steps(), ias15.evaluations(), ias15.get_particles(), seconds_since(start));
+    return bs_digits >= 11 && bs_cost < dopri5_cost;
+}
+
+bool benchmarking::bs_efficiency()
+{
+    const double year = 365.25 * 86400;
+    std::cout << "bs_efficiency: force evaluations per digit of accuracy" << std::setprecision(3) << std::endl;
+
+    // Sun and Earth alone: the exact solution is a Kepler orbit about the centre of mass
+    std::vector<body> pair = { sun, earth };
+    ParticleSet kepler_orbit(pair);
+    {
+        ParticleSet& p = kepler_orbit;
+        const double m0 = p.mass[0], m1 = p.mass[1], total = m0 + m1;
+        const double duration = year;
+        double x = p.x[1] - p.x[0], y = p.y[1] - p.y[0], z = p.z[1] - p.z[0];
+        double vx = p.vx[1] - p.vx[0], vy = p.vy[1] - p.vy[0], vz = p.vz[1] - p.vz[0];
+        const double cx = (m0 * p.x[0] + m1 * p.x[1]) / total + duration * (m0 * p.vx[0] + m1 * p.vx[1]) / total;
+        const double cy = (m0 * p.y[0] + m1 * p.y[1]) / total + duration * (m0 * p.vy[0] + m1 * p.vy[1]) / total;
+        const double cz = (m0 * p.z[0] + m1 * p.z[1]) / total + duration * (m0 * p.vz[0] + m1 * p.vz[1]) / total;
+        kepler::drift(G_const * total, duration, x, y, z, vx, vy, vz);
+        p.x[0] = cx - m1 / total * x; p.y[0] = cy - m1 / total * y; p.z[0] = cz - m1 / total * z;
+        p.x[1] = cx + m0 / total * x; p.y[1] = cy + m0 / total * y; p.z[1] = cz + m0 / total * z;
+    }
+    bool passed = bs_scenario("Sun and Earth (exact Kepler orbit)", pair, year, kepler_orbit);
+
+    // larger systems against a tight IAS15 run, over about one orbit of the
+    // innermost planet that matters
+    std::vector<body> outer = { sun, jupiter, saturn, uranus, neptune };
+    Orbit_integration::IAS15 outer_reference(outer, 86400, 1e-11);
+    outer_reference.integrate(12 * year);
+    passed = bs_scenario("Sun and outer planets (IAS15 reference)", outer, 12 * year,
+                         outer_reference.get_particles()) && passed;
+
+    Orbit_integration::IAS15 solar_reference(solar_system_bodies(), 86400, 1e-11);
+    solar_reference.integrate(year);
+    passed = bs_scenario("solar system (IAS15 reference)", solar_system_bodies(), year,
+                         solar_reference.get_particles()) && passed;
+    return passed;
+}
+
+/*
+ *PROCEDURE: kepler_order
+ *
+ *DESCRIPTION: Observed order of an integrator on the Sun-Earth pair: relative
+ *position errors after three years at steps of a year / steps and half that,
+ *against the exact Kepler orbit
+ *
+ *RETURNS: log2 of the ratio of the two errors
+ */
+template <class Integrator>
+static double kepler_order(int steps)
+{
+    const double year = 365.25 * 86400;
+    std::vector<body> pair = { sun, earth };
+    ParticleSet p(pair);
+    const double gm = G_const * (p.mass[0] + p.mass[1]);
+    double x = p.x[1] - p.x[0], y = p.y[1] - p.y[0], z = p.z[1] - p.z[0];
+    double vx = p.vx[1] - p.vx[0], vy = p.vy[1] - p.vy[0], vz = p.vz[1] - p.vz[0];
+    kepler::drift(gm, 3 * year, x, y, z, vx, vy, vz);
+
+    double errors[2];
+    for (int k = 0; k < 2; k++)
+    {
+        const int n = steps << k;
+        Integrator integrator(pair, year / n);
+        for (int i = 0; i < 3 * n; i++)
+            integrator.compute_gravity_step();
+        const ParticleSet& q = integrator.get_particles();
+        double dx = q.x[1] - q.x[0] - x, dy = q.y[1] - q.y[0] - y, dz = q.z[1] - q.z[0] - z;
+        errors[k] = sqrt(dx * dx + dy * dy + dz * dz) / sqrt(x * x + y * y + z * z);
+    }
+    return log2(errors[0] / errors[1]);
+}
+
+/*
+ *PROCEDURE: composition_run
+ *
+ *DESCRIPTION: Integrates the solar system for years with a composition
+ *scheme at step days, sampling the relative energy error 1000 times
+ *
+ *RETURNS: - (prints the largest error over the first tenth and over the
+ *whole run, the wall time and the force evaluations; true if the observed
+ *order on the Kepler problem is the nominal one and the energy error has no
+ *secular growth)
+ */
+template <class Scheme>
+static bool composition_run(const char* name, double years, double days)
+{
+    const double day = 86400;
+    const double order = kepler_order<Orbit_integration::Composition<Scheme>>(50);
+
+    Orbit_integration::Composition<Scheme> integrator(solar_system_bodies(), days * day);
+    const long long steps = llround(years * 365.25 / days);
+    const long long every = std::max(1LL, steps / 1000);
+    const double e0 = total_energy(integrator.get_particles(), G_const);
+    double early = 0, worst = 0;
+    auto start = bench_clock::now();
+    for (long long i = 1; i <= steps; i++)
+    {
+        integrator.compute_gravity_step();
+        if (i % every == 0)
+        {
+            const double error = fabs((total_energy(integrator.get_particles(), G_const) - e0) / e0);
+            worst = std::max(worst, error);
+            if (i <= steps / 10)
+                early = worst;
+        }
+    }
+    const double seconds = seconds_since(start);
+    std::cout << "  " << std::left << std::setw(9) << name << std::right << " order " << std::setw(4) << order
+              << " (nominal " << Scheme::order << "), dt = " << std::setw(3) << days << " d: " << std::setw(8)
+              << seconds << " s, " << integrator.evaluations() << " evaluations, energy error " << std::setw(9)
+              << early << " over the first tenth, " << std::setw(9) << worst << " overall" << std::endl;
+    return fabs(order - Scheme::order) < 0.3 && worst < 3 * early;
+}
+
+bool benchmarking::symplectic_compositions(double years)
+{
+    std::cout << "symplectic_compositions: solar system over " << years
+              << " years at one force evaluation per day of integration" << std::setprecision(3) << std::endl;
+
+    Orbit_integration::RK4 rk4(solar_system_bodies(), 86400);
+    double seconds = 0;
+    double error = energy_run(rk4, llround(years * 365.25), 1000, seconds);
+    std::cout << "  RK4       dt =   1 d: " << seconds << " s, largest energy error " << error << std::endl;
+
+    // steps of one day per stage, so every scheme costs the same
+    bool passed = composition_run<Orbit_integration::leapfrog2>("leapfrog", years, 1);
+    passed = composition_run<Orbit_integration::yoshida4>("Yoshida 4", years, 3) && passed;
+    passed = composition_run<Orbit_integration::suzuki4>("Suzuki 4", years, 5) && passed;
+    passed = composition_run<Orbit_integration::yoshida6>("Yoshida 6", years, 7) && passed;
+    passed = composition_run<Orbit_integration::yoshida8>("Yoshida 8", years, 15) && passed;
+    return passed;
+}
+
+/*
+ *PROCEDURE: asteroid_belt
+ *
+ *DESCRIPTION: n massless bodies on circular, slightly inclined heliocentric
+ *orbits between 2.1 and 3.3 AU with random phases
+ *
+ *RETURNS: std::vector<body>
+ */
+static std::vector<body> asteroid_belt(int n, unsigned seed)
+{
+    const double au = 1.495978707e11;
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<body> belt;
+    belt.reserve(n);
+    for (int i = 0; i < n; i++)
+    {
+        double r = (2.1 + 1.2 * uniform(rng)) * au;
+        double phi = 2.0 * M_PI * uniform(rng);
+        double tilt = 0.1 * (uniform(rng) - 0.5);
+        double v = sqrt(G_const * sun.mass / r);
+        belt.push_back(body{ { r * cos(phi), r * sin(phi) * cos(tilt), r * sin(phi) * sin(tilt) }, 0.0, 0.0,
+                             { -v * sin(phi), v * cos(phi) * cos(tilt), v * cos(phi) * sin(tilt) },
+                             "a" + std::to_string(i) });
+    }
+    return belt;
+}
+
+/*
+ *PROCEDURE: planets_unperturbed
+ *
+ *DESCRIPTION: Integrates the planets alone and the planets with the test
+ *particles for steps steps
+ *
+ *RETURNS: largest position difference of the planets between the two runs
+ */
+template <class Integrator>
+static double planets_unperturbed(const std::vector<body>& planets, const std::vector<body>& all,
+                                  double step, int steps, double& seconds)
+{
+    Integrator alone(planets, step);
+    Integrator with_tests(all, step);
+    auto start = bench_clock::now();
+    for (int i = 0; i < steps; i++)
+        with_tests.compute_gravity_step();
+    seconds = seconds_since(start);
+    for (int i = 0; i < steps; i++)
+        alone.compute_gravity_step();
+
+    // the planets come first in both sets, the comparison stops at the first set's size
+    return max_position_error(alone.get_particles(), with_tests.get_particles());
+}
+
+bool benchmarking::test_particles(int n)
+{
+    std::vector<body> planets = solar_system_bodies();
+    std::vector<body> belt = asteroid_belt(n, 11);
+    std::vector<body> all = planets;
+    all.insert(all.end(), belt.begin(), belt.end());
+
+    ParticleSet tests(all);
+    ParticleSet massive = tests;
+    for (std::size_t i = tests.massive(); i < tests.size(); i++)
+        massive.mass[i] = 1e15;
+    massive.n_test = 0;
+
+    DirectSummation forces;
+    std::vector<double> ax, ay, az, mx, my, mz;
+    double test_time = time_per_call([&]() { forces.accelerations(tests, G_const, ax, ay, az); });
+    double massive_time = time_per_call([&]() { forces.accelerations(massive, G_const, mx, my, mz); });
+
+    // reference: the planets alone acting on every particle, through the direct kernel
+    const int nm = (int)tests.massive(), total = (int)tests.size();
+    std::vector<double> rx(total, 0.0), ry(total, 0.0), rz(total, 0.0);
+    gravity_kernels::direct_scalar(tests.x.data(), tests.y.data(), tests.z.data(), tests.mass.data(), nm,
+                                   tests.x.data(), tests.y.data(), tests.z.data(), total,
+                                   G_const, rx.data(), ry.data(), rz.data());
+    double max_error = 0;
+    for (int i = 0; i < total; i++)
+    {
+        double reference = norm(point{ rx[i], ry[i], rz[i] });
+        max_error = std::max(max_error, norm(point{ ax[i] - rx[i], ay[i] - ry[i], az[i] - rz[i] }) / reference);
+    }
+
+    std::cout << "test_particles: " << nm << " massive bodies, " << total - nm << " test particles, "
+              << forces.name() << " forces" << std::setprecision(4) << std::endl;
+    std::cout << "  all bodies massive : " << massive_time * 1e3 << " ms per evaluation" << std::endl;
+    std::cout << "  test particles     : " << test_time * 1e3 << " ms per evaluation ("
+              << massive_time / test_time << "x)" << std::endl;
+    std::cout << "  max relative difference to the direct kernel: " << max_error << std::endl;
+
+    const double day = 86400;
+    double leapfrog_seconds = 0, rk4_seconds = 0;
+    double leapfrog_drift = planets_unperturbed<Orbit_integration::Leapfrog>(planets, all, day, 365, leapfrog_seconds);
+    double rk4_drift = planets_unperturbed<Orbit_integration::RK4>(planets, all, day, 365, rk4_seconds);
+    std::cout << "  1 year, dt = 1 d, leapfrog: " << leapfrog_seconds << " s, planets moved by the test particles "
+              << leapfrog_drift << " m" << std::endl;
+    std::cout << "  1 year, dt = 1 d, RK4     : " << rk4_seconds << " s, planets moved by the test particles "
+              << rk4_drift << " m" << std::endl;
+
+    return max_error < 1e-12 && leapfrog_drift == 0 && rk4_drift == 0 && test_time < massive_time;
+}
+
+/*
+ *PROCEDURE: saturn_ring
+ *
+ *DESCRIPTION: Saturn and n ring particles of 1e14 kg and 14 km radius on
+ *nearly circular orbits starting 1e8 m from it, with 1 m/s of random
+ *velocity. The ring is n * 10 m wide, which keeps its surface density (an
+ *optical depth of 0.1) the same whatever n. With spread > 1 the radii are
+ *uniform between r and spread * r, r chosen to keep the optical depth.
+ *
+ *RETURNS: std::vector<body>
+ */
+static std::vector<body> saturn_ring(int n, unsigned seed, double spread = 1)
+{
+    const double inner = 1e8, width = 10.0 * n, thickness = 1e3, dispersion = 1.0;
+    const double mean_square = 1 + (spread - 1) + (spread - 1) * (spread - 1) / 3;
+    const double particle_radius = sqrt(2 * 0.1 * inner * width / n / mean_square);
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<body> ring{ body{ ORIGIN, saturn.mass, saturn.radius, ORIGIN, "Saturn" } };
+    ring.reserve(n + 1);
+    for (int i = 0; i < n; i++)
+    {
+        double r = inner + width * uniform(rng);
+        double phi = 2.0 * M_PI * uniform(rng);
+        double v = sqrt(G_const * saturn.mass / r);
+        point jitter{ uniform(rng) - 0.5, uniform(rng) - 0.5, uniform(rng) - 0.5 };
+        double radius = spread > 1 ? particle_radius * (1 + (spread - 1) * uniform(rng)) : particle_radius;
+        ring.push_back(body{ { r * cos(phi), r * sin(phi), thickness * (uniform(rng) - 0.5) }, 1e14, radius,
+                             point{ -v * sin(phi), v * cos(phi), 0.0 } + jitter * (2 * dispersion),
+                             "r" + std::to_string(i) });
+    }
+    return ring;
+}
+
+/*
+ *PROCEDURE: all_pairs_collisions
+ *
+ *DESCRIPTION: Reference search: swept sphere test of every pair between the
+ *positions of before and after
+ *
+ *RETURNS: the colliding pairs, sorted by (i, j)
+ */
+static std::vector<collision> all_pairs_collisions(const ParticleSet& before, const ParticleSet& after)
+{
+    std::vector<collision> pairs;
+    const int n = (int)before.size();
+    for (int i = 0; i < n; i++)
+        for (int j = i + 1; j < n; j++)
+        {
+            point d0 = before.location(j) - before.location(i);
+            point u = after.location(j) - after.location(i) - d0;
+            double reach = before.radius[i] + before.radius[j];
+            // smallest t in [0, 1] with |d0 + u t| <= reach
+            double a = u.x * u.x + u.y * u.y + u.z * u.z;
+            double b = d0.x * u.x + d0.y * u.y + d0.z * u.z;
+            double c = d0.x * d0.x + d0.y * d0.y + d0.z * d0.z - reach * reach;
+            if (c <= 0)
+                pairs.push_back(collision{ i, j, 0.0 });
+            else if (a > 0 && b * b - a * c >= 0)
+            {
+                double t = (-b - sqrt(b * b - a * c)) / a;
+                if (t >= 0 && t <= 1)
+                    pairs.push_back(collision{ i, j, t });
+            }
+        }
+    return pairs;
+}
+
+/*
+ *PROCEDURE: ring_step
+ *
+ *DESCRIPTION: One Barnes-Hut leapfrog step of a Saturn ring with radii
+ *spread over spread times followed by the collision search over it
+ *
+ *RETURNS: the pairs found, step and search seconds in step_seconds and search_seconds
+ */
+static std::vector<collision> ring_step(int n, double spread, double dt, CollisionDetector& detector,
+                                        ParticleSet& before, ParticleSet& after,
+                                        double& step_seconds, double& search_seconds)
+{
+    Orbit_integration::Leapfrog leapfrog(saturn_ring(n, 5, spread), dt, std::make_shared<BarnesHut>());
+    before = leapfrog.get_particles();
+    detector.start(leapfrog.get_particles());
+    auto start = bench_clock::now();
+    leapfrog.compute_gravity_step();
+    step_seconds = seconds_since(start);
+    after = leapfrog.get_particles();
+
+    // the first search sizes the buffers, the second one is timed
+    detector.detect(after);
+    start = bench_clock::now();
+    std::vector<collision> pairs = detector.detect(after);
+    search_seconds = seconds_since(start);
+    return pairs;
+}
+
+bool benchmarking::collision_detection(int n)
+{
+    const double dt = 32;   // about a thousandth of the orbital period
+    std::cout << "collision_detection: Saturn ring, optical depth 0.1, dt = " << dt << " s, Barnes-Hut leapfrog"
+              << std::setprecision(4) << std::endl;
+
+    bool passed = true;
+    for (double spread : { 1.0, 3.0 })
+    {
+        std::cout << "  radii spread over " << spread << "x" << std::endl;
+        for (int size : { n / 10, n })
+        {
+            CollisionDetector detector;
+            ParticleSet before, after;
+            double step_seconds = 0, search_seconds = 0;
+            std::vector<collision> pairs = ring_step(size, spread, dt, detector, before, after, step_seconds, search_seconds);
+            std::cout << "  N = " << std::setw(6) << size << ": step " << step_seconds * 1e3 << " ms, collision search "
+                      << search_seconds * 1e3 << " ms (" << search_seconds / size * 1e9 << " ns per particle, "
+                      << detector.candidate_pairs() << " candidates, " << detector.substeps() << " sub-steps, frame turning "
+                      << detector.frame_rotation() << " rad, cell "
+                      << detector.cell_size() << " m, " << detector.grid_levels() << " levels), "
+                      << pairs.size() << " pairs" << std::endl;
+            passed = passed && search_seconds < step_seconds;
+
+            if (size != n)
+            {
+                std::vector<collision> brute = all_pairs_collisions(before, after);
+                bool same = brute.size() == pairs.size();
+                for (std::size_t k = 0; same && k < brute.size(); k++)
+                    same = brute[k].i == pairs[k].i && brute[k].j == pairs[k].j && fabs(brute[k].time - pairs[k].time) < 1e-9;
+                std::cout << "  O(N^2) search at N = " << size << ": " << brute.size() << " pairs, "
+                          << (same ? "identical" : "DIFFERENT") << std::endl;
+                passed = passed && same;
+            }
+        }
+    }
+    return passed;
+}
+
+/*
+ *PROCEDURE: conserved_quantities
+ *
+ *DESCRIPTION: Total mass, momentum and mass weighted position of the particles
+ *
+ *RETURNS: the seven sums in q, each with its magnitude scale in scale
+ */
+static void conserved_quantities(const ParticleSet& p, double q[7], double scale[7])
+{
+    for (int k = 0; k < 7; k++)
+        q[k] = scale[k] = 0;
+    for (std::size_t i = 0; i < p.size(); i++)
+    {
+        const double m = p.mass[i];
+        const double terms[7] = { m, m * p.vx[i], m * p.vy[i], m * p.vz[i], m * p.x[i], m * p.y[i], m * p.z[i] };
+        for (int k = 0; k < 7; k++)
+        {
+            q[k] += terms[k];
+            scale[k] += fabs(terms[k]);
+        }
+    }
+}
+
+bool benchmarking::particle_mergers(int n, int steps)
+{
+    const double dt = 32;
+    std::cout << "particle_mergers: Saturn ring of " << n << " merging particles, optical depth 0.1, dt = " << dt
+              << " s, " << steps << " Barnes-Hut leapfrog steps" << std::setprecision(4) << std::endl;
+
+    Orbit_integration::Leapfrog leapfrog(saturn_ring(n, 7), dt, std::make_shared<BarnesHut>());
+    CollisionDetector detector;
+    MergeStage mergers;
+    const ParticleSet& particles = leapfrog.get_particles();
+    const double* columns = particles.x.data();
+    const std::size_t capacity = particles.x.capacity();
+
+    double step_seconds = 0, merge_seconds = 0, rebuild_seconds = 0, worst_drift = 0;
+    bool passed = true;
+    for (int s = 0; s < steps; s++)
+    {
+        detector.start(leapfrog.get_particles());
+        auto start = bench_clock::now();
+        leapfrog.compute_gravity_step();
+        step_seconds += seconds_since(start);
+        ParticleSet& p = leapfrog.get_particles();
+        const std::vector<collision>& hits = detector.detect(p);
+
+        double q0[7], q1[7], scale[7], unused[7];
+        conserved_quantities(p, q0, scale);
+        start = bench_clock::now();
+        std::size_t removed = mergers.merge(p, hits);
+        merge_seconds += seconds_since(start);
+        conserved_quantities(p, q1, unused);
+        for (int k = 0; k < 7; k++)
+            worst_drift = std::max(worst_drift, fabs(q1[k] - q0[k]) / scale[k]);
+
+        // what the same step costs when the particles live in a vector of bodies
+        start = bench_clock::now();
+        ParticleSet rebuilt(p.to_bodies());
+        rebuild_seconds += seconds_since(start);
+
+        for (std::size_t i = 1; i < p.size(); i++)
+            passed = passed && p.id[i - 1] < p.id[i];
+        std::cout << "  step " << std::setw(2) << s << ": " << std::setw(4) << hits.size() << " contacts, "
+                  << std::setw(4) << removed << " particles merged away, " << p.size() << " left" << std::endl;
+    }
+
+    const bool in_place = particles.x.data() == columns && particles.x.capacity() == capacity;
+    std::cout << "  " << mergers.removed() << " particles lost, per step: leapfrog " << step_seconds / steps * 1e3
+              << " ms, merge and compaction " << merge_seconds / steps * 1e6 << " us, rebuild from bodies "
+              << rebuild_seconds / steps * 1e6 << " us" << std::endl;
+    std::cout << "  largest relative change of mass, momentum or centre of mass in a merge: " << worst_drift
+              << ", columns " << (in_place ? "compacted in place" : "REALLOCATED") << std::endl;
+    return passed && in_place && worst_drift < 1e-12 && mergers.removed() > 0 && merge_seconds < rebuild_seconds;
+}
+
+/*
+ *PROCEDURE: ensemble_member
+ *
+ *DESCRIPTION: System k of the ensemble benchmark: the solar system with
+ *relative 1e-8 perturbations, integrated with WHFast for a length that
+ *varies between members by a factor of ten
+ *
+ *RETURNS: final positions of all bodies
+ */
+static std::vector<double> ensemble_member(std::size_t k)
+{
+    Orbit_integration::WHFast orbit(perturbed_bodies(solar_system_bodies(), k, 1e-8), 86400);
+    const int steps = 365 * (1 + (int)(k * 7919 % 10));
+    for (int i = 0; i < steps; i++)
+        orbit.compute_gravity_step();
+    const ParticleSet& p = orbit.get_particles();
+    std::vector<double> state;
+    for (std::size_t i = 0; i < p.size(); i++)
+        state.insert(state.end(), { p.x[i], p.y[i], p.z[i] });
+    return state;
+}
+
+bool benchmarking::ensemble_throughput(int systems)
+{
+    std::cout << "ensemble_throughput: " << systems << " perturbed solar systems, WHFast, 1 to 10 years each"
+              << std::setprecision(4) << std::endl;
+
+    std::vector<std::vector<double>> reference(systems);
+    auto start = bench_clock::now();
+    for (int k = 0; k < systems; k++)
+        reference[k] = ensemble_member(k);
+    const double serial_rate = systems / seconds_since(start);
+    std::cout << "  serial loop: " << serial_rate << " systems/s" << std::endl;
+
+    // system 0 is the unperturbed original, every other one moves every body
+    const std::vector<body> original = solar_system_bodies();
+    bool unperturbed = true, perturbed = true;
+    for (std::size_t k = 0; k < 4; k++)
+    {
+        const std::vector<body> member = perturbed_bodies(original, k, 1e-8);
+        for (std::size_t i = 0; i < original.size(); i++)
+        {
+            const bool same = member[i].location.x == original[i].location.x &&
+                              member[i].location.y == original[i].location.y &&
+                              member[i].location.z == original[i].location.z &&
+                              member[i].velocity.x == original[i].velocity.x &&
+                              member[i].velocity.y == original[i].velocity.y &&
+                              member[i].velocity.z == original[i].velocity.z;
+            if (k == 0)
+                unperturbed = unperturbed && same;
+            else if (i > 0)                 // the sun sits at the origin at rest
+                perturbed = perturbed && !same;
+        }
+    }
+    std::cout << "  system 0 " << (unperturbed ? "unperturbed" : "PERTURBED") << ", systems 1-3 "
+              << (perturbed ? "perturbed" : "NOT PERTURBED") << std::endl;
+
+    bool passed = unperturbed && perturbed;
+    const int cores = EnsembleRunner().threads();
+    for (int threads : { cores, 4 * cores })
+    {
+        EnsembleRunner runner(threads);
+        std::vector<std::vector<double>> states(systems);
+        ensemble_stats stats = runner.run(systems, [&](std::size_t k, std::ostream&) { states[k] = ensemble_member(k); });
+        const bool identical = states == reference;
+        std::cout << "  " << std::setw(3) << threads << " threads: " << stats.systems_per_second << " systems/s, speedup "
+                  << stats.systems_per_second / serial_rate << ", " << stats.steals << " steals, final states "
+                  << (identical ? "identical" : "DIFFERENT") << std::endl;
+        passed = passed && identical;
+        if (threads == cores)
+            passed = passed && stats.systems_per_second > 0.9 * serial_rate;
+    }
+    return passed;
+}
+
+/*
+ *PROCEDURE: few_body_systems
+ *
+ *DESCRIPTION: Random binaries and hierarchical triples in units where G m = 1
+ *for a unit mass, like benchmarking::m1/m2. Every 16th system is a head-on
+ *pair of large bodies, every 16th (offset by 8) a hyperbolic flyby, both of
+ *which stop early.
+ *
+ *RETURNS: std::vector<batch_system>
+ */
+static std::vector<batch_system> few_body_systems(int systems, unsigned seed)
+{
+    const double unit = 1.0 / G_const;
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<batch_system> batch;
+    for (int s = 0; s < systems; s++)
+    {
+        batch_system system{ "s" + std::to_string(s), {} };
+        const double q = 0.5 + 0.5 * uniform(rng), e = 0.5 * uniform(rng);
+        double v = sqrt((1 + q) * (1 - e));             // apocentre speed, unit separation
+        if (s % 16 == 8)
+            v = 5;
+        // centre of mass at rest
+        system.bodies.push_back(body{ { 0, 0, 0 }, unit, 0.01, { 0, -q * v / (1 + q), 0 }, "a" });
+        system.bodies.push_back(body{ { 1, 0, 0 }, q * unit, 0.01, { 0, v / (1 + q), 0 }, "b" });
+        if (s % 16 == 0)
+        {
+            system.bodies[1].radius = 0.3;
+            system.bodies[1].velocity = point{ -2, 0, 0 };
+        }
+        else if (s % 2)
+        {
+            const double r = 6 + 4 * uniform(rng), phase = 2 * M_PI * uniform(rng);
+            const double vt = sqrt((1 + q) / r);
+            system.bodies.push_back(body{ { r * cos(phase), r * sin(phase), 0.1 * uniform(rng) }, 0.1 * unit, 0.01,
+                                          { -vt * sin(phase), vt * cos(phase), 0 }, "c" });
+        }
+        batch.push_back(system);
+    }
+    return batch;
+}
+
+bool benchmarking::batch_systems(int systems)
+{
+    batch_options options;
+    options.G = G_const;
+    options.time_step = 1e-3;
+    options.duration = 20;
+    options.escape_radius = 50;
+    options.energy_tolerance = 1e-3;
+    std::vector<batch_system> batch = few_body_systems(systems, 3);
+    std::cout << "batch_systems: " << systems << " binaries and triples, leapfrog, "
+              << options.duration / options.time_step << " steps, " << BATCH_LANES << " systems per "
+              << gravity_kernels::best_direct_kernel().name << " batch" << std::setprecision(4) << std::endl;
+
+    auto start = bench_clock::now();
+    std::vector<batch_result> results = integrate_batch(batch, options, 1);
+    const double batch_rate = systems / seconds_since(start);
+
+    // the same systems one by one; the early stoppers have no counterpart
+    const int reference_systems = std::min(systems, 256);
+    double worst = 0;
+    start = bench_clock::now();
+    for (int s = 0; s < reference_systems; s++)
+    {
+        if (s % 8 == 0)
+            continue;
+        Orbit_integration::Leapfrog leapfrog(batch[s].bodies, options.time_step);
+        for (int i = 0; i < (int)(options.duration / options.time_step + 0.5); i++)
+            leapfrog.compute_gravity_step();
+        const ParticleSet& p = leapfrog.get_particles();
+        for (std::size_t i = 0; i < p.size(); i++)
+        {
+            const point d = p.location(i) - results[s].bodies[i].location;
+            worst = std::max(worst, sqrt(d.x * d.x + d.y * d.y + d.z * d.z));
+        }
+    }
+    const double scalar_rate = reference_systems * 7.0 / 8.0 / seconds_since(start);
+
+    bool stops = true;
+    std::size_t outcomes[4] = { 0, 0, 0, 0 };
+    for (int s = 0; s < systems; s++)
+    {
+        outcomes[results[s].status]++;
+        const batch_status expected = s % 16 == 0 ? BATCH_COLLIDED : s % 16 == 8 ? BATCH_ESCAPED : BATCH_COMPLETED;
+        stops = stops && results[s].status == expected;
+    }
+
+    // a system alone in its batch against the same system among others
+    options.duration = 2;
+    std::vector<batch_system> single(batch.begin() + 1, batch.begin() + 2);
+    std::vector<batch_system> mixed(batch.begin(), batch.begin() + 16);
+    batch_result alone = integrate_batch(single, options, 1)[0];
+    batch_result among = integrate_batch(mixed, options, 1)[1];
+    bool masked = alone.status == among.status && alone.time == among.time;
+    for (std::size_t i = 0; i < alone.bodies.size(); i++)
+        masked = masked && alone.bodies[i].location.x == among.bodies[i].location.x &&
+                 alone.bodies[i].velocity.y == among.bodies[i].velocity.y;
+
+    std::cout << "  one by one (Leapfrog integrator): " << scalar_rate * 3600 << " systems/hour" << std::endl;
+    std::cout << "  SIMD batches, 1 thread:           " << batch_rate * 3600 << " systems/hour, "
+              << batch_rate / scalar_rate << "x" << std::endl;
+    std::cout << "  " << outcomes[BATCH_COMPLETED] << " completed, " << outcomes[BATCH_COLLIDED] << " collided, "
+              << outcomes[BATCH_ESCAPED] << " escaped, " << outcomes[BATCH_DIVERGED] << " diverged"
+              << (stops ? "" : " (UNEXPECTED)") << std::endl;
+    std::cout << "  largest distance to the one by one final positions: " << worst
+              << ", masked lanes " << (masked ? "leave the others untouched" : "CHANGE the others") << std::endl;
+    return stops && masked && worst < 1e-9 && batch_rate > scalar_rate;
+}
+
+bool benchmarking::snapshot_io(int n)
+{
+    ParticleSet particles = plummer_sphere(n, 17);
+    std::mt19937_64 rng(17);
+    std::normal_distribution<double> normal(0.0, 0.5);
+    for (int i = 0; i < n; i++)
+    {
+        particles.vx[i] = normal(rng);
+        particles.vy[i] = normal(rng);
+        particles.vz[i] = normal(rng);
+    }
+    const double time = 12.5;
+    const snapshot_units units{ 1.0, 0.0, 0.0, 0.0 };
+    const std::string text_path = "celestial_benchmark_snapshot.txt", binary_path = "celestial_benchmark_snapshot.snap",
+                      converted_path = "celestial_benchmark_converted.snap";
+    std::cout << "snapshot_io: " << n << " particles" << std::setprecision(4) << std::endl;
+
+    // the former put_snapshot / get_snapshot, on a file instead of cout / cin
+    auto start = bench_clock::now();
+    {
+        std::ofstream out(text_path);
+        out.precision(16);
+        out << n << std::endl << time << std::endl;
+        for (int i = 0; i < n; i++)
+            out << particles.mass[i] << ' ' << particles.x[i] << ' ' << particles.y[i] << ' ' << particles.z[i]
+                << ' ' << particles.vx[i] << ' ' << particles.vy[i] << ' ' << particles.vz[i] << std::endl;
+    }
+    const double text_write = seconds_since(start);
+    start = bench_clock::now();
+    std::vector<double> text_columns[SNAPSHOT_COLUMNS];
+    {
+        std::ifstream in(text_path);
+        std::size_t count;
+        double t;
+        in >> count >> t;
+        for (auto& column : text_columns)
+            column.resize(count);
+        for (std::size_t i = 0; i < count; i++)
+            for (auto& column : text_columns)
+                in >> column[i];
+    }
+    const double text_read = seconds_since(start);
+
+    start = bench_clock::now();
+    bool passed = write_snapshot(binary_path, particles, time, units);
+    const double binary_write = seconds_since(start);
+
+    SnapshotReader reader;
+    double checksum_read = 0, mapped_read = 0, sum = 0;
+    for (bool verify : { true, false })
+    {
+        start = bench_clock::now();
+        passed = reader.open(binary_path, verify) && passed;
+        // touch every column, as a loader would
+        for (int c = 0; c < SNAPSHOT_COLUMNS; c++)
+            for (std::size_t i = 0; i < reader.size(); i++)
+                sum += reader.column(c)[i];
+        (verify ? checksum_read : mapped_read) = seconds_since(start);
+    }
+    const double* const original[SNAPSHOT_COLUMNS] = { particles.mass.data(), particles.x.data(), particles.y.data(),
+                                                       particles.z.data(), particles.vx.data(), particles.vy.data(),
+                                                       particles.vz.data() };
+    bool exact = reader.size() == (std::size_t)n && reader.time() == time;
+    for (int c = 0; exact && c < SNAPSHOT_COLUMNS; c++)
+        exact = std::memcmp(reader.column(c), original[c], n * sizeof(double)) == 0;
+
+    // text -> binary -> text agrees with the text dump, which holds 16 digits
+    std::ifstream text_in(text_path);
+    bool converted = text_to_snapshot(text_in, converted_path, units) == 1;
+    SnapshotReader conversion;
+    converted = converted && conversion.open(converted_path);
+    double worst = 0;
+    for (int c = 0; converted && c < SNAPSHOT_COLUMNS; c++)
+        for (int i = 0; i < n; i++)
+        {
+            worst = std::max(worst, fabs(conversion.column(c)[i] - original[c][i]) / std::max(fabs(original[c][i]), 1e-300));
+            converted = converted && conversion.column(c)[i] == text_columns[c][i];
+        }
+    std::ostringstream text_out;
+    converted = converted && snapshot_to_text(converted_path, text_out) == 1;
+
+    // a flipped byte in the last column must be caught
+    reader.close();
+    {
+        std::fstream corrupt(binary_path, std::ios::in | std::ios::out | std::ios::binary);
+        corrupt.seekp(-16, std::ios::end);
+        corrupt.put('x');
+    }
+    const bool caught = !reader.open(binary_path);
+
+    const double megabytes = (sizeof(snapshot_header) + SNAPSHOT_COLUMNS * n * sizeof(double)) / 1e6;
+    std::cout << "  text:   write " << text_write << " s, read " << text_read << " s" << std::endl;
+    std::cout << "  binary: write " << binary_write << " s (" << megabytes / binary_write << " MB/s), mapped read "
+              << checksum_read << " s with checksum (" << megabytes / checksum_read << " MB/s), "
+              << mapped_read << " s without (" << megabytes / mapped_read << " MB/s)" << std::endl;
+    std::cout << "  round trip " << (exact ? "exact" : "DIFFERENT") << ", text converters within " << worst
+              << (converted ? "" : " (FAILED)") << ", corrupted byte " << (caught ? "detected" : "MISSED")
+              << " (" << reader.error() << ")" << std::endl;
+
+    std::remove(text_path.c_str());
+    std::remove(binary_path.c_str());
+    std::remove(converted_path.c_str());
+    return passed && exact && converted && worst < 1e-15 && caught && sum == sum &&
+           binary_write * 10 < text_write && checksum_read * 10 < text_read;
+}
+
+/*
+ *PROCEDURE: settle_disk
+ *
+ *DESCRIPTION: Writes the dirty pages of earlier output back to disk, so a
+ *timed write does not pay for them
+ *
+ *RETURNS: -
+ */
+static void settle_disk()
+{
+#ifndef _WIN32
+    sync();
+#endif
+}
+
+bool benchmarking::trajectory_output(int n, int frames)
+{
+    ParticleSet particles = plummer_sphere(n, 23);
+    std::mt19937_64 rng(23);
+    std::normal_distribution<double> normal(0.0, 0.5);
+    for (int i = 0; i < n; i++)
+    {
+        particles.vx[i] = normal(rng);
+        particles.vy[i] = normal(rng);
+        particles.vz[i] = normal(rng);
+    }
+    const double dt = 0.01;
+    const std::string prefix = "celestial_benchmark_", columnar_path = "celestial_benchmark_trajectory.traj";
+    std::cout << "trajectory_output: " << n << " bodies, " << frames << " frames" << std::setprecision(4) << std::endl;
+
+    // drifting bodies, the frames of both formats are the same; the x of
+    // every frame is kept to check the columnar file against
+    std::vector<double> expected_x((std::size_t)n * frames);
+    auto stream = [&](std::unique_ptr<TrajectoryFormat> format, bool& ok)
+    {
+        ParticleSet p = particles;
+        auto start = bench_clock::now();
+        TrajectoryWriter writer(std::move(format));
+        for (int f = 0; f < frames; f++)
+        {
+            ok = writer.push(p, f * dt) && ok;
+            std::copy(p.x.begin(), p.x.end(), expected_x.begin() + (std::size_t)f * n);
+            for (int i = 0; i < n; i++)
+            {
+                p.x[i] += p.vx[i] * dt;
+                p.y[i] += p.vy[i] * dt;
+                p.z[i] += p.vz[i] * dt;
+            }
+        }
+        ok = writer.close() && ok;
+        return seconds_since(start);
+    };
+    // every timed write starts from a flushed disk and the best of a few is
+    // kept, so neither format pays for the dirty pages of the other; each
+    // read follows its own write and finds it in the page cache
+    auto best_write = [&](auto make_format, bool& ok)
+    {
+        double best = 0;
+        for (int repeat = 0; repeat < 3; repeat++)
+        {
+            settle_disk();
+            const double seconds = stream(make_format(), ok);
+            best = repeat == 0 ? seconds : std::min(best, seconds);
+        }
+        return best;
+    };
+    auto file_bytes = [](const std::string& path)
+    {
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        return f ? (double)f.tellg() : 0.0;
+    };
+
+    // the text baseline holds the same six columns to the same precision
+    bool passed = true;
+    const double text_write = best_write([&] { return std::make_unique<TextTrajectory>(prefix, true); }, passed);
+    double text_bytes = 0, sum = 0;
+    auto start = bench_clock::now();
+    for (int i = 0; i < n; i++)
+    {
+        const std::string path = prefix + particles.name[i] + ".dat";
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        while (std::getline(in, line))
+        {
+            const char* c = line.c_str();
+            char* end;
+            for (int column = 0; column < TRAJECTORY_COLUMNS; column++, c = end + 1)
+                sum += strtod(c, &end);
+        }
+    }
+    const double text_read = seconds_since(start);
+    for (int i = 0; i < n; i++)
+    {
+        const std::string path = prefix + particles.name[i] + ".dat";
+        text_bytes += file_bytes(path);
+        std::remove(path.c_str());
+    }
+
+    // the lossless columnar coding of the same frames, for the size
+    trajectory_compression lossless;
+    lossless.enabled = true;
+    const double coded_write = best_write([&] { return std::make_unique<ColumnarTrajectory>(columnar_path, lossless); },
+                                          passed);
+    const double coded_bytes = file_bytes(columnar_path);
+
+    const double columnar_write = best_write([&] { return std::make_unique<ColumnarTrajectory>(columnar_path); }, passed);
+    const double columnar_bytes = file_bytes(columnar_path);
+    TrajectoryReader reader;
+    start = bench_clock::now();
+    passed = reader.open(columnar_path) && passed;
+    for (std::size_t k = 0; passed && k < reader.chunks(); k++)
+    {
+        reader.select(k);
+        for (std::size_t b = 0; b < reader.bodies(); b++)
+            for (int c = 0; c < TRAJECTORY_COLUMNS; c++)
+                for (std::size_t f = 0; f < reader.frames(); f++)
+                    sum += reader.column(b, c)[f];
+    }
+    const double columnar_read = seconds_since(start);
+
+    // random access by time, full precision
+    bool exact = passed && reader.name(n - 1) == particles.name[n - 1];
+    std::uniform_int_distribution<int> pick_frame(0, frames - 1), pick_body(0, n - 1);
+    for (int probe = 0; exact && probe < 1000; probe++)
+    {
+        const int f = pick_frame(rng), i = pick_body(rng);
+        std::size_t frame;
+        exact = reader.locate(f * dt + 0.25 * dt, frame) && reader.time()[frame] == f * dt
+             && reader.id(i) == (std::size_t)i && reader.x(i)[frame] == expected_x[(std::size_t)f * n + i];
+    }
+    reader.close();
+    std::remove(columnar_path.c_str());
+
+    std::cout << "  x, y, z, vx, vy, vz to 17 digits, best of 3 writes from a flushed disk, reads from the page cache"
+              << std::endl;
+    std::cout << "  text:     write " << text_write << " s, read " << text_read << " s, "
+              << text_bytes / 1e6 << " MB" << std::endl;
+    std::cout << "  columnar: write " << columnar_write << " s, read " << columnar_read << " s, "
+              << columnar_bytes / 1e6 << " MB" << std::endl;
+    std::cout << "  lossless: write " << coded_write << " s, " << coded_bytes / 1e6 << " MB" << std::endl;
+    std::cout << "  write " << text_write / columnar_write << "x, read " << text_read / columnar_read
+              << "x faster, " << text_bytes / columnar_bytes << "x (lossless " << text_bytes / coded_bytes
+              << "x) smaller, random access by time " << (exact ? "exact" : "WRONG") << std::endl;
+    return passed && exact && sum == sum && columnar_write * 10 < text_write && columnar_read * 10 < text_read
+        && coded_bytes * 10 < text_bytes;
+}
+
+/*
+ *PROCEDURE: compression_run
+ *
+ *DESCRIPTION: Integrates the bodies with a leapfrog of step dt for frames
+ *frames and writes every chunk of chunk_frames frames to a plain, a lossless
+ *and a quantized columnar trajectory, timing the writes; then decodes the
+ *coded files chunk by chunk against the plain one
+ *
+ *RETURNS: true if the lossless file gives back the plain bits and the
+ *quantized one stays within its errors
+ */
+static bool compression_run(const std::string& label, const std::vector<body>& bodies, double dt,
+                            int frames, int chunk_frames, const trajectory_compression& quantized)
+{
+    const std::string paths[3] = { "celestial_benchmark_plain.traj", "celestial_benchmark_lossless.traj",
+                                   "celestial_benchmark_quantized.traj" };
+    trajectory_compression lossless;
+    lossless.enabled = true;
+    ColumnarTrajectory plain_file(paths[0]), lossless_file(paths[1], lossless), quantized_file(paths[2], quantized);
+    ColumnarTrajectory* files[3] = { &plain_file, &lossless_file, &quantized_file };
+    double write_seconds[3] = { 0, 0, 0 };
+    bool passed = true;
+
+    Orbit_integration::Leapfrog orbit(bodies, dt);
+    std::vector<trajectory_frame> ring(chunk_frames);
+    std::vector<const trajectory_frame*> chunk;
+    for (int f = 0; f < frames; f++)
+    {
+        // the frame copy TrajectoryWriter::push makes
+        const ParticleSet& p = orbit.get_particles();
+        trajectory_frame& frame = ring[f % chunk_frames];
+        frame.time = f * dt;
+        frame.id = p.id;
+        frame.x = p.x; frame.y = p.y; frame.z = p.z;
+        frame.vx = p.vx; frame.vy = p.vy; frame.vz = p.vz;
+        frame.new_names.clear();
+        if (f == 0)
+            for (std::size_t i = 0; i < p.size(); i++)
+                frame.new_names.emplace_back(p.id[i], p.name[i]);
+        chunk.push_back(&frame);
+        if ((int)chunk.size() == chunk_frames || f == frames - 1)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                auto start = bench_clock::now();
+                passed = files[k]->write(chunk) && passed;
+                write_seconds[k] += seconds_since(start);
+            }
+            chunk.clear();
+        }
+        orbit.compute_gravity_step();
+    }
+    for (auto* file : files)
+        passed = file->finish() && passed;
+
+    TrajectoryReader readers[3];
+    for (int k = 0; k < 3; k++)
+        passed = readers[k].open(paths[k]) && passed;
+    double read_seconds[3] = { 0, 0, 0 }, worst_position = 0, worst_velocity = 0;
+    bool exact = passed;
+    for (std::size_t c = 0; passed && c < readers[0].chunks(); c++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            auto start = bench_clock::now();
+            passed = readers[k].select(c) && passed;
+            read_seconds[k] += seconds_since(start);
+        }
+        const std::size_t n = readers[0].frames() * (1 + readers[0].bodies() * TRAJECTORY_COLUMNS);
+        exact = exact && std::memcmp(readers[0].time(), readers[1].time(), n * sizeof(double)) == 0;
+        for (std::size_t b = 0; passed && b < readers[0].bodies(); b++)
+            for (int col = 0; col < TRAJECTORY_COLUMNS; col++)
+                for (std::size_t f = 0; f < readers[0].frames(); f++)
+                {
+                    double error = fabs(readers[2].column(b, col)[f] - readers[0].column(b, col)[f]);
+                    (col < 3 ? worst_position : worst_velocity) = std::max(col < 3 ? worst_position : worst_velocity, error);
+                }
+    }
+
+    const double megabytes = plain_file.plain_bytes() / 1e6;
+    std::cout << "  " << label << ": " << readers[0].bodies() << " bodies, " << frames << " frames, "
+              << megabytes << " MB as plain doubles" << std::endl;
+    const char* names[3] = { "plain", "lossless", "quantized" };
+    for (int k = 0; k < 3; k++)
+    {
+        std::cout << "    " << std::setw(9) << names[k] << ": ratio " << std::setw(5)
+                  << (double)plain_file.plain_bytes() / files[k]->written_bytes() << ", write "
+                  << std::setw(6) << megabytes / write_seconds[k] << " MB/s, ";
+        if (k == 0)
+            std::cout << "read in place" << std::endl;
+        else
+            std::cout << "decode " << std::setw(6) << megabytes / read_seconds[k] << " MB/s" << std::endl;
+    }
+    std::cout << "    lossless " << (exact ? "exact" : "DIFFERENT") << ", quantized errors " << worst_position
+              << " m (bound " << quantized.position_error << "), " << worst_velocity << " m/s (bound "
+              << quantized.velocity_error << ")" << std::endl;
+
+    for (auto& reader : readers)
+        reader.close();
+    for (const auto& path : paths)
+        std::remove(path.c_str());
+    return passed && exact && worst_position <= quantized.position_error && worst_velocity <= quantized.velocity_error;
+}
+
+bool benchmarking::column_compression(int belt, int frames)
+{
+    std::cout << "column_compression: coded columnar trajectories, one day leapfrog" << std::setprecision(4) << std::endl;
+    trajectory_compression quantized;
+    quantized.enabled = true;
+    quantized.position_error = 1e3;
+    quantized.velocity_error = 1e-3;
+
+    std::vector<body> asteroids = solar_system_bodies();
+    std::vector<body> extra = asteroid_belt(belt, 29);
+    asteroids.insert(asteroids.end(), extra.begin(), extra.end());
+    bool passed = compression_run("solar system", solar_system_bodies(), 86400, frames, TRAJECTORY_CHUNK_FRAMES, quantized);
+    passed = compression_run("asteroid belt", asteroids, 86400, 128, 32, quantized) && passed;
+    return passed;
+}
+
+bool benchmarking::trajectory_decimation(int frames)
+{
+    const double tolerances[2] = { 1e6, 1e8 };
+    const std::string full_path = "celestial_benchmark_full.traj";
+    const std::string decimated_paths[2] = { "celestial_benchmark_decimated_0.traj", "celestial_benchmark_decimated_1.traj" };
+    std::cout << "trajectory_decimation: solar system, WHFast, " << frames << " daily frames, lossless coding"
+              << std::setprecision(4) << std::endl;
+
+    trajectory_compression lossless;
+    lossless.enabled = true;
+    bool passed = true;
+    double full_seconds, sampled_seconds[2] = { 0, 0 };
+    std::size_t stored[2], offered = 0;
+    {
+        TrajectoryWriter full(std::make_unique<ColumnarTrajectory>(full_path, lossless));
+        TrajectoryWriter decimated_0(std::make_unique<ColumnarTrajectory>(decimated_paths[0], lossless));
+        TrajectoryWriter decimated_1(std::make_unique<ColumnarTrajectory>(decimated_paths[1], lossless));
+        HermiteSampler samplers[2] = { HermiteSampler(decimated_0, tolerances[0]), HermiteSampler(decimated_1, tolerances[1]) };
+        Orbit_integration::WHFast orbit(solar_system_bodies(), 86400, true);
+        full_seconds = 0;
+        for (int f = 0; f < frames; f++)
+        {
+            auto start = bench_clock::now();
+            passed = full.push(orbit.get_particles(), orbit.time()) && passed;
+            full_seconds += seconds_since(start);
+            for (int k = 0; k < 2; k++)
+            {
+                start = bench_clock::now();
+                passed = samplers[k].push(orbit.get_particles(), orbit.time()) && passed;
+                sampled_seconds[k] += seconds_since(start);
+            }
+            orbit.compute_gravity_step();
+        }
+        for (int k = 0; k < 2; k++)
+        {
+            passed = samplers[k].close() && passed;
+            stored[k] = samplers[k].stored();
+            offered = samplers[k].offered();
+        }
+        passed = full.close() && decimated_0.close() && decimated_1.close() && passed;
+    }
+    auto file_bytes = [](const std::string& path)
+    {
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        return f ? (double)f.tellg() : 0.0;
+    };
+
+    // the full trajectory holds every frame, the decimated ones are
+    // reconstructed at each of them
+    TrajectoryInterpolator reference;
+    passed = reference.open(full_path) && passed;
+    const double full_bytes = file_bytes(full_path);
+    std::cout << "  every frame: " << offered << " samples, " << full_bytes / 1e3 << " kB, "
+              << full_seconds / frames * 1e6 << " us/frame" << std::endl;
+    for (int k = 0; passed && k < 2; k++)
+    {
+        TrajectoryInterpolator decimated;
+        passed = decimated.open(decimated_paths[k]);
+        double worst = 0;
+        std::ostringstream per_body;
+        for (std::size_t id : reference.ids())
+        {
+            for (const auto& s : reference.samples(id))
+            {
+                point p;
+                if (!decimated.position(id, s.t, p))
+                {
+                    passed = false;
+                    break;
+                }
+                worst = std::max(worst, norm(point{ p.x - s.x, p.y - s.y, p.z - s.z }));
+            }
+            per_body << " " << reference.name(id) << " " << (passed ? decimated.samples(id).size() : 0);
+        }
+        const double bytes = file_bytes(decimated_paths[k]);
+        std::cout << "  tolerance " << tolerances[k] << " m: " << stored[k] << " samples ("
+                  << (double)offered / stored[k] << "x fewer), " << bytes / 1e3 << " kB (" << full_bytes / bytes
+                  << "x smaller), " << sampled_seconds[k] / frames * 1e6 << " us/frame, largest error "
+                  << worst / tolerances[k] << " tolerance" << std::endl;
+        std::cout << "   " << per_body.str() << std::endl;
+        passed = passed && worst <= tolerances[k] && full_bytes > 5 * bytes;
+    }
+
+    std::remove(full_path.c_str());
+    for (const auto& path : decimated_paths)
+        std::remove(path.c_str());
+    return passed;
+}
+
+bool benchmarking::run(const std::string& name)
+{
+    if (name == "history")
+        return history_growth(1000000, 10);
+    if (name == "kernels")
+        return direct_kernels(1024) && direct_kernels(4096);
+    if (name == "pairs")
+        return pair_forces(1024) && pair_forces(16384);
+    if (name == "tree")
+        return tree_gravity(65536, 8192);
+    if (name == "fmm")
+        return fmm_scaling(1000000, 100000);
+    if (name == "pm")
+        return particle_mesh(1000000, 256);
+    if (name == "hermite")
+        return hermite_block(1024, 0.0625);
+    if (name == "whfast")
+        return whfast_energy(1000, 1000000);
+    if (name == "ias15")
+        return ias15_accuracy(100, 1);
+    if (name == "dopri5")
+        return dopri5_dense(100);
+    if (name == "bs")
+        return bs_efficiency();
+    if (name == "symplectic")
+        return symplectic_compositions(10000);
+    if (name == "jerk")
+        return hermite_forces(1024) && hermite_forces(16384);
+    if (name == "testparticles")
+        return test_particles(20000);
+    if (name == "collisions")
+        return collision_detection(100000);
+    if (name == "mergers")
+        return particle_mergers(20000, 20);
+    if (name == "ensemble")
+        return ensemble_throughput(200);
+    if (name == "batch")
+        return batch_systems(4096);
+    if (name == "snapshot")
+        return snapshot_io(1000000);
+    if (name == "trajectory")
+        return trajectory_output(10000, 256);
+    if (name == "compression")
+        return column_compression(100000, 36524);
+    if (name == "decimation")
+        return trajectory_decimation(36524);
+
+    std::cerr << "Unknown benchmark: " << name << std::endl;
+    std::cerr << "Available benchmarks: history, kernels, pairs, tree, fmm, pm, hermite, jerk, whfast, ias15, dopri5, bs, symplectic, testparticles, collisions, mergers, ensemble, batch, snapshot, trajectory, compression, decimation" << std::endl;
+    return false;
+}
@@ -0,0 +1,303 @@
+/*
+ * bulirsch_stoer.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "include/integration.h"
+
+using namespace solar_system;
+
+#define BS_MAX_COLUMNS 9        // substep sequence 2, 4, ..., 18
+#define BS_MIN_COLUMNS 2        // lowest target column
+#define BS_ERROR_TARGET 0.65    // fraction of the tolerance new steps aim at
+#define BS_SAFETY 0.94
+#define BS_MIN_FACTOR 0.02      // limits of the change of step from one step to the next
+#define BS_MAX_FACTOR 4.0
+
+/*
+ * Struct: bs_sequence
+ *
+ * OBJECTS: Substeps n_k = 2 (k + 1) of column k, the work A_k = 1 + n_0 + ... + n_k
+ * (force evaluations) of reaching it and the Neville weights
+ * 1 / ((n_k / n_(k-j))^2 - 1) of the extrapolation.
+*/
+struct bs_sequence{
+    int substeps[BS_MAX_COLUMNS];
+    double work[BS_MAX_COLUMNS];
+    double weight[BS_MAX_COLUMNS][BS_MAX_COLUMNS];
+
+    bs_sequence()
+    {
+        double total = 1;
+        for (int k = 0; k < BS_MAX_COLUMNS; k++)
+        {
+            substeps[k] = 2 * (k + 1);
+            total += substeps[k];
+            work[k] = total;
+            for (int j = 1; j <= k; j++)
+            {
+                const double ratio = (double)substeps[k] / substeps[k - j];
+                weight[k][j] = 1.0 / (ratio * ratio - 1.0);
+            }
+        }
+    }
+};
+
+static const bs_sequence& sequence()
+{
+    static const bs_sequence table;
+    return table;
+}
+
+/*
+ *PROCEDURE: start
+ *
+ *DESCRIPTION: Sizes the state and tableau buffers and loads the particle set
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::BulirschStoer::start()
+{
+    const ParticleSet& p = m_particles;
+    const std::size_t n = p.size();
+    m_stage = p;
+    for (auto* v : { &m_y, &m_f0, &m_z0, &m_z1, &m_f, &m_result })
+        v->assign(6 * n, 0.0);
+    m_table.assign(BS_MAX_COLUMNS, std::vector<double>(6 * n, 0.0));
+    const std::vector<double>* columns[6] = { &p.x, &p.y, &p.z, &p.vx, &p.vy, &p.vz };
+    for (int c = 0; c < 6; c++)
+        std::copy(columns[c]->begin(), columns[c]->end(), m_y.begin() + c * n);
+    m_f0_valid = false;
+}
+
+/*
+ *PROCEDURE: derivative
+ *
+ *DESCRIPTION: Time derivative of a whole system state: its velocities and
+ *the force provider accelerations at its positions
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::BulirschStoer::derivative(const std::vector<double>& state, std::vector<double>& rate)
+{
+    const std::size_t n = m_stage.size();
+    std::copy(state.begin(), state.begin() + n, m_stage.x.begin());
+    std::copy(state.begin() + n, state.begin() + 2 * n, m_stage.y.begin());
+    std::copy(state.begin() + 2 * n, state.begin() + 3 * n, m_stage.z.begin());
+    m_forces->accelerations(m_stage, G_const, m_ax, m_ay, m_az);
+    std::copy(state.begin() + 3 * n, state.end(), rate.begin());
+    std::copy(m_ax.begin(), m_ax.end(), rate.begin() + 3 * n);
+    std::copy(m_ay.begin(), m_ay.end(), rate.begin() + 4 * n);
+    std::copy(m_az.begin(), m_az.end(), rate.begin() + 5 * n);
+    m_evaluations++;
+}
+
+/*
+ *PROCEDURE: modified_midpoint
+ *
+ *DESCRIPTION: Gragg's modified midpoint rule across H in substeps steps of
+ *h = H / substeps, with the final smoothing step, into m_result:
+ *z_1 = y + h f(y), z_(m+1) = z_(m-1) + 2 h f(z_m), y(H) = (z_n + z_(n-1) + h f(z_n)) / 2
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::BulirschStoer::modified_midpoint(double H, int substeps)
+{
+    const std::size_t n6 = m_y.size();
+    const double h = H / substeps;
+    for (std::size_t c = 0; c < n6; c++)
+    {
+        m_z0[c] = m_y[c];
+        m_z1[c] = m_y[c] + h * m_f0[c];
+    }
+    for (int m = 1; m < substeps; m++)
+    {
+        derivative(m_z1, m_f);
+        for (std::size_t c = 0; c < n6; c++)
+        {
+            const double next = m_z0[c] + 2 * h * m_f[c];
+            m_z0[c] = m_z1[c];
+            m_z1[c] = next;
+        }
+    }
+    derivative(m_z1, m_f);
+    for (std::size_t c = 0; c < n6; c++)
+        m_result[c] = 0.5 * (m_z0[c] + m_z1[c] + h * m_f[c]);
+}
+
+/*
+ *PROCEDURE: attempt_step
+ *
+ *DESCRIPTION: Builds extrapolation columns for a step of m_time_step up to
+ *one beyond the target column, accepting at the first column from
+ *target - 1 on whose error is within tolerance (relative to each coordinate
+ *plus the largest position or velocity of the system). The next target column
+ *and step minimise the estimated work per unit time
+ *
+ *RETURNS: true if the step was accepted
+ */
+bool Orbit_integration::BulirschStoer::attempt_step()
+{
+    const bs_sequence& seq = sequence();
+    const std::size_t n = m_particles.size(), n6 = 6 * n;
+    const double H = m_time_step;
+
+    if (!m_f0_valid)
+    {
+        derivative(m_y, m_f0);
+        m_f0_valid = true;
+    }
+    double position_scale = 0, velocity_scale = 0;
+    for (std::size_t c = 0; c < 3 * n; c++)
+        position_scale = std::max(position_scale, fabs(m_y[c]));
+    for (std::size_t c = 3 * n; c < n6; c++)
+        velocity_scale = std::max(velocity_scale, fabs(m_y[c]));
+
+    double step[BS_MAX_COLUMNS], work[BS_MAX_COLUMNS];
+    const int last = std::min(m_columns + 1, BS_MAX_COLUMNS - 1);
+    int accepted = -1, k = 0;
+    for (; k <= last; k++)
+    {
+        modified_midpoint(H, seq.substeps[k]);
+        if (k == 0)
+        {
+            std::swap(m_table[0], m_result);
+            continue;
+        }
+
+        // Neville: row k of the tableau replaces row k - 1 in place
+        double sum = 0;
+        for (std::size_t c = 0; c < n6; c++)
+        {
+            double current = m_result[c];
+            for (int j = 1; j <= k; j++)
+            {
+                const double next = current + (current - m_table[j - 1][c]) * seq.weight[k][j];
+                m_table[j - 1][c] = current;
+                current = next;
+            }
+            m_table[k][c] = current;
+            const double scale = m_tolerance * (std::max(fabs(m_y[c]), fabs(current))
+                                                + (c < 3 * n ? position_scale : velocity_scale));
+            const double ratio = (current - m_table[k - 1][c]) / scale;
+            sum += ratio * ratio;
+        }
+        const double error = sqrt(sum / n6);
+
+        const double factor = error > 0 ? BS_SAFETY * pow(BS_ERROR_TARGET / error, 1.0 / (2 * k + 1)) : BS_MAX_FACTOR;
+        step[k] = H * std::max(BS_MIN_FACTOR, std::min(BS_MAX_FACTOR, std::isfinite(factor) ? factor : BS_MIN_FACTOR));
+        work[k] = seq.work[k] / step[k];
+        if (k >= m_columns - 1 && error <= 1.0)
+        {
+            accepted = k;
+            break;
+        }
+        if (!std::isfinite(error))
+            break;
+    }
+
+    if (accepted < 0)
+    {
+        const int tried = std::min(k, last);
+        m_time_step = tried >= 1 ? std::min(step[tried], H * 0.5) : H * BS_MIN_FACTOR;
+        m_rejected++;
+        return false;
+    }
+
+    // order and step for the next step from the work per unit time
+    int next = accepted;
+    double H_new = step[accepted];
+    if (accepted >= 2 && work[accepted - 1] < 0.8 * work[accepted])
+    {
+        next = accepted - 1;
+        H_new = step[next];
+    }
+    else if (accepted + 1 < BS_MAX_COLUMNS && (accepted < 2 || work[accepted] < 0.9 * work[accepted - 1]))
+    {
+        next = accepted + 1;
+        H_new = step[accepted] * seq.work[next] / seq.work[accepted];
+    }
+    m_columns = std::max(BS_MIN_COLUMNS, next);
+
+    std::swap(m_y, m_table[accepted]);
+    ParticleSet& p = m_particles;
+    std::vector<double>* columns[6] = { &p.x, &p.y, &p.z, &p.vx, &p.vy, &p.vz };
+    for (int c = 0; c < 6; c++)
+        std::copy(m_y.begin() + c * n, m_y.begin() + (c + 1) * n, columns[c]->begin());
+
+    m_f0_valid = false;
+    m_time += H;
+    m_time_step = H_new;
+    m_steps++;
+    return true;
+}
+
+/*
+ *PROCEDURE: compute_gravity_step
+ *
+ *DESCRIPTION: Takes one accepted Bulirsch-Stoer step, retrying with shorter
+ *steps while they fail to converge
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::BulirschStoer::compute_gravity_step()
+{
+    if (m_y.size() != 6 * m_particles.size())
+        start();
+    while (!attempt_step())
+        ;
+}
+
+/*
+ *PROCEDURE: integrate
+ *
+ *DESCRIPTION: Advances the system by exactly duration, shortening the last
+ *step so that it ends on the requested time
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::BulirschStoer::integrate(double duration)
+{
+    if (m_y.size() != 6 * m_particles.size())
+        start();
+    const double t_end = m_time + duration;
+    while (m_time < t_end)
+    {
+        const double remaining = t_end - m_time;
+        if (m_time_step < remaining)
+        {
+            while (!attempt_step())
+                ;
+            continue;
+        }
+        const double proposed = m_time_step;
+        m_time_step = remaining;
+        if (attempt_step())
+        {
+            m_time = t_end;
+            m_time_step = std::max(m_time_step, proposed);
+            break;
+        }
+    }
+}
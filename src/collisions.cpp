@@ -0,0 +1,418 @@
+/*
+ * collisions.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include "include/collisions.h"
+
+//Side of a hash cell of the finest level in units of the median swept box.
+//Every further level doubles it, larger boxes go to the first level that
+//holds them.
+#define COLLISION_CELL_FACTOR 1.25
+#define COLLISION_MAX_LEVELS 48
+
+//Paths are cut into sub-steps over which the median particle moves at most
+//this many diameters in the search frame
+#define COLLISION_SWEEP_DIAMETERS 2.0
+#define COLLISION_MAX_SUBSTEPS 64
+
+//Up to this many particles every pair is tested directly over the whole step
+#define COLLISION_DIRECT_N 64
+
+/*
+ *PROCEDURE: hash_cell
+ *
+ *DESCRIPTION: Bucket of cell (ix, iy, iz) of a grid level in a table of
+ *mask + 1 buckets. Cells next to each other along x (and, a little further,
+ *along y) land in nearby buckets, so the neighbour search walks the table
+ *almost in order.
+ *
+ *RETURNS: bucket index
+ */
+static inline int hash_cell(long long ix, long long iy, long long iz, int level, unsigned long long mask)
+{
+    return (int)(((unsigned long long)ix + 1031ULL * (unsigned long long)iy
+                  + 1062961ULL * (unsigned long long)iz + 2654435761ULL * (unsigned long long)level) & mask);
+}
+
+void CollisionDetector::start(const ParticleSet& particles)
+{
+    m_x0.assign(particles.x.begin(), particles.x.end());
+    m_y0.assign(particles.y.begin(), particles.y.end());
+    m_z0.assign(particles.z.begin(), particles.z.end());
+}
+
+void CollisionDetector::search_frame(const ParticleSet& p)
+{
+    const int n = (int)p.size();
+
+    // centre of mass at the start of the step (centroid when nothing has mass)
+    double total = 0, c[3] = { 0, 0, 0 };
+    for (int k = 0; k < n; k++)
+    {
+        const double w = p.mass[k];
+        total += w;
+        c[0] += w * m_x0[k];
+        c[1] += w * m_y0[k];
+        c[2] += w * m_z0[k];
+    }
+    if (!(total > 0))
+    {
+        total = n;
+        for (int k = 0; k < n; k++)
+        {
+            c[0] += m_x0[k];
+            c[1] += m_y0[k];
+            c[2] += m_z0[k];
+        }
+    }
+    for (int d = 0; d < 3; d++)
+        m_centre[d] = c[d] / total;
+
+    // axis along the summed angular momentum of the moves, angle the median one about it
+    double axis[3] = { 0, 0, 0 };
+    for (const sweep& s : m_sweeps)
+    {
+        const double r[3] = { s.start[0] - m_centre[0], s.start[1] - m_centre[1], s.start[2] - m_centre[2] };
+        axis[0] += r[1] * s.move[2] - r[2] * s.move[1];
+        axis[1] += r[2] * s.move[0] - r[0] * s.move[2];
+        axis[2] += r[0] * s.move[1] - r[1] * s.move[0];
+    }
+    const double length = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    m_angle = 0;
+    if (!(length > 0))
+        return;
+    for (int d = 0; d < 3; d++)
+        m_axis[d] = axis[d] / length;
+
+    m_median.resize(n);
+    for (int k = 0; k < n; k++)
+    {
+        const sweep& s = m_sweeps[k];
+        double a[3], b[3];
+        for (int d = 0; d < 3; d++)
+        {
+            a[d] = s.start[d] - m_centre[d];
+            b[d] = a[d] + s.move[d];
+        }
+        const double cross = m_axis[0] * (a[1] * b[2] - a[2] * b[1]) + m_axis[1] * (a[2] * b[0] - a[0] * b[2])
+                             + m_axis[2] * (a[0] * b[1] - a[1] * b[0]);
+        const double along_a = a[0] * m_axis[0] + a[1] * m_axis[1] + a[2] * m_axis[2];
+        const double along_b = b[0] * m_axis[0] + b[1] * m_axis[1] + b[2] * m_axis[2];
+        const double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] - along_a * along_b;
+        m_median[k] = atan2(cross, dot);
+    }
+    std::nth_element(m_median.begin(), m_median.begin() + n / 2, m_median.end());
+    m_angle = m_median[n / 2];
+}
+
+void CollisionDetector::path_box(const path& s, double t0, double t1, double lo[3], double hi[3])
+{
+    // a sub-step of length h bends away from its chord by at most bend h^2
+    const double h = t1 - t0;
+    const double reach = s.radius + s.bend * h * h;
+    for (int d = 0; d < 3; d++)
+    {
+        const double a = s.start[d] + s.move[d] * t0;
+        const double b = s.start[d] + s.move[d] * t1;
+        lo[d] = std::min(a, b) - reach;
+        hi[d] = std::max(a, b) + reach;
+    }
+}
+
+double CollisionDetector::contact_time(const sweep& i, const sweep& j)
+{
+    // separation at the start of the step and its change over the step
+    const double dx = j.start[0] - i.start[0], dy = j.start[1] - i.start[1], dz = j.start[2] - i.start[2];
+    const double ux = j.move[0] - i.move[0], uy = j.move[1] - i.move[1], uz = j.move[2] - i.move[2];
+    const double reach = i.radius + j.radius;
+
+    // |d + u t| = reach: a t^2 + 2 b t + c = 0
+    const double c = dx*dx + dy*dy + dz*dz - reach * reach;
+    if (c <= 0)
+        return 0;
+    const double a = ux*ux + uy*uy + uz*uz;
+    const double b = dx*ux + dy*uy + dz*uz;
+    const double discriminant = b * b - a * c;
+    if (b >= 0 || discriminant < 0)
+        return -1;
+    const double t = c / (-b + sqrt(discriminant));
+    return t <= 1 ? t : -1;
+}
+
+void CollisionDetector::test_pair(int i, int j, int substep, int substeps)
+{
+    // pairs of test particles do not interact
+    if (i >= m_massive && j >= m_massive)
+        return;
+    m_candidates++;
+    const double t = contact_time(m_sweeps[i], m_sweeps[j]);
+    // a pair is a candidate in every sub-step its boxes share, it is reported from the one holding t
+    if (t < 0 || std::min((int)(t * substeps), substeps - 1) != substep)
+        return;
+    m_hits.push_back(collision{ std::min(i, j), std::max(i, j), t });
+}
+
+const std::vector<collision>& CollisionDetector::detect(const ParticleSet& p)
+{
+    const int n = (int)p.size();
+    if (m_x0.size() != (std::size_t)n)
+        start(p);
+    m_hits.clear();
+    m_oversized.clear();
+    m_candidates = 0;
+    m_massive = (int)p.massive();
+    if (n < 2)
+        return m_hits;
+
+    m_sweeps.resize(n);
+    for (int k = 0; k < n; k++)
+        m_sweeps[k] = sweep{ { m_x0[k], m_y0[k], m_z0[k] },
+                             { p.x[k] - m_x0[k], p.y[k] - m_y0[k], p.z[k] - m_z0[k] }, p.radius[k] };
+    if (n <= COLLISION_DIRECT_N)
+    {
+        m_cell = 0;
+        m_substeps = 1;
+        m_levels = 0;
+        m_angle = 0;
+        for (int i = 0; i < n; i++)
+            for (int j = i + 1; j < n; j++)
+                test_pair(i, j, 0, 1);
+        std::sort(m_hits.begin(), m_hits.end(), [](const collision& a, const collision& b)
+        {
+            return a.i < b.i || (a.i == b.i && a.j < b.j);
+        });
+        return m_hits;
+    }
+
+    // paths in the search frame: the end point turned back by the frame's
+    // rotation. Along the way f(t) = R(-angle t) (x(t) - centre) with x linear,
+    // so |f''| <= angle^2 |x - centre| + 2 |angle| |move|, and a path leaves
+    // its chord by at most |f''| / 8.
+    search_frame(p);
+    const double cos_a = cos(m_angle), sin_a = sin(m_angle);
+    const double* u = m_axis;
+    m_paths.resize(n);
+    for (int k = 0; k < n; k++)
+    {
+        const sweep& s = m_sweeps[k];
+        double a[3], b[3], turned[3];
+        for (int d = 0; d < 3; d++)
+        {
+            a[d] = s.start[d] - m_centre[d];
+            b[d] = a[d] + s.move[d];
+        }
+        // Rodrigues' rotation of b by -angle about the axis
+        const double along = u[0] * b[0] + u[1] * b[1] + u[2] * b[2];
+        const double cross[3] = { u[1] * b[2] - u[2] * b[1], u[2] * b[0] - u[0] * b[2], u[0] * b[1] - u[1] * b[0] };
+        for (int d = 0; d < 3; d++)
+            turned[d] = b[d] * cos_a - cross[d] * sin_a + u[d] * along * (1 - cos_a);
+
+        const double far = std::max(sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]),
+                                    sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]));
+        const double moved = sqrt(s.move[0] * s.move[0] + s.move[1] * s.move[1] + s.move[2] * s.move[2]);
+        path& q = m_paths[k];
+        q.particle = k;
+        for (int d = 0; d < 3; d++)
+        {
+            q.start[d] = a[d];
+            q.move[d] = turned[d] - a[d];
+        }
+        q.radius = s.radius;
+        // the rotated end point carries rounding errors of the order of far * 1e-15
+        q.bend = (m_angle * m_angle * far + 2 * fabs(m_angle) * moved) / 8 + far * 1e-14;
+    }
+
+    // sub-steps from the median path in diameters, cells from the median sub-step box
+    m_median.resize(n);
+    for (int k = 0; k < n; k++)
+    {
+        const double* move = m_paths[k].move;
+        m_median[k] = sqrt(move[0] * move[0] + move[1] * move[1] + move[2] * move[2])
+                      / std::max(2 * p.radius[k], 1e-300);
+    }
+    std::nth_element(m_median.begin(), m_median.begin() + n / 2, m_median.end());
+    m_substeps = (int)std::ceil(m_median[n / 2] / COLLISION_SWEEP_DIAMETERS);
+    m_substeps = std::max(1, std::min(m_substeps, COLLISION_MAX_SUBSTEPS));
+    const double sub = 1.0 / m_substeps;
+
+    double lo[3], hi[3];
+    m_extent.resize(n);
+    for (int k = 0; k < n; k++)
+    {
+        path_box(m_paths[k], 0, sub, lo, hi);
+        m_extent[k] = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    }
+    m_median.assign(m_extent.begin(), m_extent.end());
+    std::nth_element(m_median.begin(), m_median.begin() + n / 2, m_median.end());
+    m_cell = COLLISION_CELL_FACTOR * m_median[n / 2];
+    if (!(m_cell > 0))
+        m_cell = *std::max_element(m_extent.begin(), m_extent.end());
+    if (!(m_cell > 0))
+        m_cell = 1;
+
+    // the extent of a sub-step box is the same for every sub-step: each box
+    // goes to the first level whose cell holds it, boxes no larger than a
+    // cell that overlap have their centres in neighbouring cells of the
+    // coarser of their two levels
+    double level_cell[COLLISION_MAX_LEVELS], inv_cell[COLLISION_MAX_LEVELS];
+    bool occupied[COLLISION_MAX_LEVELS] = {};
+    for (int l = 0; l < COLLISION_MAX_LEVELS; l++)
+    {
+        level_cell[l] = l == 0 ? m_cell : 2 * level_cell[l - 1];
+        inv_cell[l] = 1.0 / level_cell[l];
+    }
+    m_level.resize(n);
+    m_levels = 0;
+    for (int k = 0; k < n; k++)
+    {
+        int l = 0;
+        while (l < COLLISION_MAX_LEVELS && !(m_extent[k] <= level_cell[l]))
+            l++;
+        if (l == COLLISION_MAX_LEVELS)
+        {
+            m_oversized.push_back(k);
+            m_level[k] = -1;
+            continue;
+        }
+        m_level[k] = l;
+        occupied[l] = true;
+        m_levels = std::max(m_levels, l + 1);
+    }
+
+    int buckets = 1;
+    while (buckets < 2 * n)
+        buckets *= 2;
+    const unsigned long long mask = buckets - 1;
+
+    // own cell and the 13 neighbours ahead of it, every pair of cells of a level is visited once
+    static const int stencil[14][3] = {
+        { 0, 0, 0 }, { 1, 0, 0 }, { -1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
+        { -1, -1, 1 }, { 0, -1, 1 }, { 1, -1, 1 }, { -1, 0, 1 }, { 0, 0, 1 },
+        { 1, 0, 1 }, { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 } };
+
+    double lo_v[3], hi_v[3];
+    for (int s = 0; s < m_substeps; s++)
+    {
+        const double t0 = s * sub, t1 = (s + 1) * sub;
+
+        // counting sort of the boxes by the bucket of the cell holding their centre
+        m_bucket_start.assign(buckets + 1, 0);
+        m_cells.resize(n);
+        for (int k = 0; k < n; k++)
+        {
+            const int l = m_level[k];
+            if (l < 0)
+                continue;
+            path_box(m_paths[k], t0, t1, lo, hi);
+            for (int d = 0; d < 3; d++)
+                m_cells[k].cell[d] = (long long)std::floor(0.5 * (lo[d] + hi[d]) * inv_cell[l]);
+            m_cells[k].bucket = hash_cell(m_cells[k].cell[0], m_cells[k].cell[1], m_cells[k].cell[2], l, mask);
+            m_bucket_start[m_cells[k].bucket + 1]++;
+        }
+        for (int b = 0; b < buckets; b++)
+            m_bucket_start[b + 1] += m_bucket_start[b];
+        m_entries.resize(n - m_oversized.size());
+        for (int k = 0; k < n; k++)
+            if (m_level[k] >= 0)
+                m_entries[m_bucket_start[m_cells[k].bucket]++] =
+                    entry{ { m_cells[k].cell[0], m_cells[k].cell[1], m_cells[k].cell[2] }, m_level[k], m_paths[k] };
+        // the fill advanced every start to the next bucket's: shift back
+        for (int b = buckets; b > 0; b--)
+            m_bucket_start[b] = m_bucket_start[b - 1];
+        m_bucket_start[0] = 0;
+
+        for (std::size_t u = 0; u < m_entries.size(); u++)
+        {
+            const entry& eu = m_entries[u];
+            path_box(eu.motion, t0, t1, lo, hi);
+            // boxes of the same level through the half stencil
+            for (const auto& offset : stencil)
+            {
+                const long long cx = eu.cell[0] + offset[0], cy = eu.cell[1] + offset[1], cz = eu.cell[2] + offset[2];
+                const int b = hash_cell(cx, cy, cz, eu.level, mask);
+                // in its own cell a box only meets the ones after it
+                int v = offset[0] == 0 && offset[1] == 0 && offset[2] == 0 ? (int)u + 1 : m_bucket_start[b];
+                for (; v < m_bucket_start[b + 1]; v++)
+                {
+                    const entry& ev = m_entries[v];
+                    // a shared bucket is not a shared cell
+                    if (ev.level != eu.level || ev.cell[0] != cx || ev.cell[1] != cy || ev.cell[2] != cz)
+                        continue;
+                    path_box(ev.motion, t0, t1, lo_v, hi_v);
+                    if (lo[0] <= hi_v[0] && lo_v[0] <= hi[0] && lo[1] <= hi_v[1] && lo_v[1] <= hi[1]
+                        && lo[2] <= hi_v[2] && lo_v[2] <= hi[2])
+                        test_pair(eu.motion.particle, ev.motion.particle, s, m_substeps);
+                }
+            }
+            // boxes of coarser levels in the 27 cells around its centre there
+            for (int l = eu.level + 1; l < m_levels; l++)
+            {
+                if (!occupied[l])
+                    continue;
+                long long centre[3];
+                for (int d = 0; d < 3; d++)
+                    centre[d] = (long long)std::floor(0.5 * (lo[d] + hi[d]) * inv_cell[l]);
+                for (int ox = -1; ox <= 1; ox++)
+                    for (int oy = -1; oy <= 1; oy++)
+                        for (int oz = -1; oz <= 1; oz++)
+                        {
+                            const long long cx = centre[0] + ox, cy = centre[1] + oy, cz = centre[2] + oz;
+                            const int b = hash_cell(cx, cy, cz, l, mask);
+                            for (int v = m_bucket_start[b]; v < m_bucket_start[b + 1]; v++)
+                            {
+                                const entry& ev = m_entries[v];
+                                if (ev.level != l || ev.cell[0] != cx || ev.cell[1] != cy || ev.cell[2] != cz)
+                                    continue;
+                                path_box(ev.motion, t0, t1, lo_v, hi_v);
+                                if (lo[0] <= hi_v[0] && lo_v[0] <= hi[0] && lo[1] <= hi_v[1] && lo_v[1] <= hi[1]
+                                    && lo[2] <= hi_v[2] && lo_v[2] <= hi[2])
+                                    test_pair(eu.motion.particle, ev.motion.particle, s, m_substeps);
+                            }
+                        }
+            }
+        }
+    }
+
+    // boxes beyond the coarsest level (not finite) against everyone over the
+    // whole step, pairs of them once (from the later one)
+    for (int k : m_oversized)
+    {
+        path_box(m_paths[k], 0, 1, lo, hi);
+        for (int other = 0; other < n; other++)
+        {
+            if (other == k || (m_level[other] < 0 && other > k))
+                continue;
+            path_box(m_paths[other], 0, 1, lo_v, hi_v);
+            if (lo[0] <= hi_v[0] && lo_v[0] <= hi[0] && lo[1] <= hi_v[1] && lo_v[1] <= hi[1]
+                && lo[2] <= hi_v[2] && lo_v[2] <= hi[2])
+                test_pair(k, other, 0, 1);
+        }
+    }
+
+    std::sort(m_hits.begin(), m_hits.end(), [](const collision& a, const collision& b)
+    {
+        return a.i < b.i || (a.i == b.i && a.j < b.j);
+    });
+    return m_hits;
+}
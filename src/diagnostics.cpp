@@ -24,6 +24,9 @@
 
 #include "include/integration.h"
 
+using std::cerr;
+using std::endl;
+
 /*-----------------------------------------------------------------------------
  *PROCEDURE: write_diagnostics   
  
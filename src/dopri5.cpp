@@ -0,0 +1,265 @@
+/*
+ * dopri5.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "include/integration.h"
+
+using namespace solar_system;
+
+#define DOPRI5_SAFETY 0.9       // fraction of the step the error estimate allows that is taken
+#define DOPRI5_MIN_FACTOR 0.2   // limits of the change of step from one step to the next
+#define DOPRI5_MAX_FACTOR 10.0
+#define DOPRI5_BETA 0.04        // weight of the previous error in the PI controller
+
+//Dormand-Prince 5(4) tableau, row 7 is the fifth order solution
+static const double DOPRI5_A[7][6] = {
+    { 0 },
+    { 1.0 / 5 },
+    { 3.0 / 40, 9.0 / 40 },
+    { 44.0 / 45, -56.0 / 15, 32.0 / 9 },
+    { 19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729 },
+    { 9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176, -5103.0 / 18656 },
+    { 35.0 / 384, 0.0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84 } };
+
+//fifth minus fourth order weights
+static const double DOPRI5_E[7] = { 71.0 / 57600, 0.0, -71.0 / 16695, 71.0 / 1920, -17253.0 / 339200, 22.0 / 525, -1.0 / 40 };
+
+//dense output weights of Hairer's contd5
+static const double DOPRI5_D[7] = { -12715105075.0 / 11282082432, 0.0, 87487479700.0 / 32700410799,
+                                    -10690763975.0 / 1880347072, 701980252875.0 / 199316789632,
+                                    -1453857185.0 / 822651844, 69997945.0 / 29380423 };
+
+/*
+ *PROCEDURE: start
+ *
+ *DESCRIPTION: Sizes the state and stage buffers, loads the particle set and
+ *evaluates the derivative at the initial state
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::DOPRI5::start()
+{
+    const ParticleSet& p = m_particles;
+    const std::size_t n = p.size();
+    m_stage = p;
+    m_output = p;
+    for (auto* v : { &m_y, &m_y_new, &m_y_stage })
+        v->assign(6 * n, 0.0);
+    for (auto& k : m_k)
+        k.assign(6 * n, 0.0);
+    for (auto& d : m_dense)
+        d.assign(6 * n, 0.0);
+    const std::vector<double>* columns[6] = { &p.x, &p.y, &p.z, &p.vx, &p.vy, &p.vz };
+    for (int c = 0; c < 6; c++)
+        std::copy(columns[c]->begin(), columns[c]->end(), m_y.begin() + c * n);
+    derivative(m_y, m_k[0]);
+    m_last_rejected = false;
+}
+
+/*
+ *PROCEDURE: derivative
+ *
+ *DESCRIPTION: Time derivative of a whole system state: its velocities and
+ *the force provider accelerations at its positions
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::DOPRI5::derivative(const std::vector<double>& state, std::vector<double>& rate)
+{
+    const std::size_t n = m_stage.size();
+    std::copy(state.begin(), state.begin() + n, m_stage.x.begin());
+    std::copy(state.begin() + n, state.begin() + 2 * n, m_stage.y.begin());
+    std::copy(state.begin() + 2 * n, state.begin() + 3 * n, m_stage.z.begin());
+    m_forces->accelerations(m_stage, G_const, m_ax, m_ay, m_az);
+    std::copy(state.begin() + 3 * n, state.end(), rate.begin());
+    std::copy(m_ax.begin(), m_ax.end(), rate.begin() + 3 * n);
+    std::copy(m_ay.begin(), m_ay.end(), rate.begin() + 4 * n);
+    std::copy(m_az.begin(), m_az.end(), rate.begin() + 5 * n);
+    m_evaluations++;
+}
+
+/*
+ *PROCEDURE: attempt_step
+ *
+ *DESCRIPTION: Runs the six new stages of a step of m_time_step and measures
+ *the embedded error against tolerance times the larger of each coordinate
+ *and the largest position or velocity of the system. An accepted step
+ *stores the dense output coefficients and advances the state; either way
+ *the PI controller sets the next step length
+ *
+ *RETURNS: true if the step was accepted
+ */
+bool Orbit_integration::DOPRI5::attempt_step()
+{
+    const std::size_t n = m_particles.size(), n6 = 6 * n;
+    const double h = m_time_step;
+
+    for (int s = 1; s < 7; s++)
+    {
+        std::vector<double>& target = s < 6 ? m_y_stage : m_y_new;
+        for (std::size_t c = 0; c < n6; c++)
+        {
+            double sum = 0;
+            for (int j = 0; j < s; j++)
+                sum += DOPRI5_A[s][j] * m_k[j][c];
+            target[c] = m_y[c] + h * sum;
+        }
+        derivative(target, m_k[s]);
+    }
+
+    double position_scale = 0, velocity_scale = 0;
+    for (std::size_t c = 0; c < 3 * n; c++)
+        position_scale = std::max(position_scale, fabs(m_y[c]));
+    for (std::size_t c = 3 * n; c < n6; c++)
+        velocity_scale = std::max(velocity_scale, fabs(m_y[c]));
+
+    double sum = 0;
+    for (std::size_t c = 0; c < n6; c++)
+    {
+        double e = 0;
+        for (int j = 0; j < 7; j++)
+            e += DOPRI5_E[j] * m_k[j][c];
+        const double scale = m_tolerance * (std::max(fabs(m_y[c]), fabs(m_y_new[c]))
+                                            + (c < 3 * n ? position_scale : velocity_scale));
+        const double ratio = h * e / scale;
+        sum += ratio * ratio;
+    }
+    const double error = sqrt(sum / n6);
+
+    // PI step control (Hairer, Norsett & Wanner II.4)
+    const double alpha = 0.2 - 0.75 * DOPRI5_BETA;
+    const double error_factor = pow(error, alpha);
+    if (!(error <= 1.0))
+    {
+        const double shrink = std::min(1.0 / DOPRI5_MIN_FACTOR, error_factor / DOPRI5_SAFETY);
+        m_time_step = std::isfinite(shrink) ? h / shrink : h * DOPRI5_MIN_FACTOR;
+        m_last_rejected = true;
+        m_rejected++;
+        return false;
+    }
+    double factor = error_factor / pow(m_previous_error, DOPRI5_BETA) / DOPRI5_SAFETY;
+    factor = std::max(1.0 / DOPRI5_MAX_FACTOR, std::min(1.0 / DOPRI5_MIN_FACTOR, factor));
+    double h_new = h / factor;
+    if (m_last_rejected)
+        h_new = std::min(h_new, h);
+    m_previous_error = std::max(error, 1e-4);
+    m_last_rejected = false;
+
+    for (std::size_t c = 0; c < n6; c++)
+    {
+        const double difference = m_y_new[c] - m_y[c];
+        const double spline = h * m_k[0][c] - difference;
+        double dense = 0;
+        for (int j = 0; j < 7; j++)
+            dense += DOPRI5_D[j] * m_k[j][c];
+        m_dense[0][c] = m_y[c];
+        m_dense[1][c] = difference;
+        m_dense[2][c] = spline;
+        m_dense[3][c] = difference - h * m_k[6][c] - spline;
+        m_dense[4][c] = h * dense;
+    }
+    std::swap(m_y, m_y_new);
+    std::swap(m_k[0], m_k[6]);
+
+    ParticleSet& p = m_particles;
+    std::vector<double>* columns[6] = { &p.x, &p.y, &p.z, &p.vx, &p.vy, &p.vz };
+    for (int c = 0; c < 6; c++)
+        std::copy(m_y.begin() + c * n, m_y.begin() + (c + 1) * n, columns[c]->begin());
+
+    m_time += h;
+    m_last_step = h;
+    m_time_step = h_new;
+    m_steps++;
+    return true;
+}
+
+/*
+ *PROCEDURE: compute_gravity_step
+ *
+ *DESCRIPTION: Takes one accepted Dormand-Prince step, retrying with shorter
+ *steps while the error control rejects them
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::DOPRI5::compute_gravity_step()
+{
+    if (m_y.size() != 6 * m_particles.size())
+        start();
+    while (!attempt_step())
+        ;
+}
+
+/*
+ *PROCEDURE: interpolate
+ *
+ *DESCRIPTION: Dense output: fourth order interpolant of the last step at
+ *theta = (t - t_0) / h, y = r1 + theta (r2 + (1 - theta) (r3 + theta (r4 + (1 - theta) r5)))
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::DOPRI5::interpolate(double t, ParticleSet& out) const
+{
+    const std::size_t n = m_particles.size();
+    const double theta = m_last_step > 0 ? (t - (m_time - m_last_step)) / m_last_step : 1.0;
+    const double theta1 = 1.0 - theta;
+    std::vector<double>* columns[6] = { &out.x, &out.y, &out.z, &out.vx, &out.vy, &out.vz };
+    for (int c = 0; c < 6; c++)
+    {
+        double* column = columns[c]->data();
+        for (std::size_t i = 0; i < n; i++)
+        {
+            const std::size_t k = c * n + i;
+            column[i] = m_dense[0][k] + theta * (m_dense[1][k] + theta1 * (m_dense[2][k]
+                      + theta * (m_dense[3][k] + theta1 * m_dense[4][k])));
+        }
+    }
+}
+
+/*
+ *PROCEDURE: integrate
+ *
+ *DESCRIPTION: Steps freely past time() + duration and calls output with the
+ *interpolated state at every multiple of interval on the way
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::DOPRI5::integrate(double duration, double interval,
+                                          const std::function<void(double, const ParticleSet&)>& output)
+{
+    if (m_y.size() != 6 * m_particles.size())
+        start();
+    const double t0 = m_time;
+    const long long outputs = (long long)floor(duration / interval * (1 + 1e-12));
+    for (long long j = 1; j <= outputs; j++)
+    {
+        const double t = t0 + j * interval;
+        while (m_time < t)
+            compute_gravity_step();
+        interpolate(t, m_output);
+        output(t, m_output);
+    }
+    while (m_time < t0 + duration)
+        compute_gravity_step();
+}
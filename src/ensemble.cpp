@@ -0,0 +1,179 @@
+/*
+ * ensemble.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <thread>
+#include "include/ensemble.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+std::vector<body> perturbed_bodies(const std::vector<body>& bodies, std::size_t system, double relative)
+{
+    std::vector<body> perturbed = bodies;
+    if (system == 0 || relative <= 0)
+        return perturbed;
+    std::mt19937_64 rng(system);
+    std::normal_distribution<double> normal(0.0, relative);
+    for (auto& b : perturbed)
+    {
+        b.location = b.location + b.location * normal(rng);
+        b.velocity = b.velocity + b.velocity * normal(rng);
+    }
+    return perturbed;
+}
+
+EnsembleRunner::EnsembleRunner(int threads, std::string output_prefix) :
+    m_threads(threads > 0 ? threads : std::max(1, (int)std::thread::hardware_concurrency())),
+    m_output_prefix(std::move(output_prefix))
+{
+    for (int w = 0; w < m_threads; w++)
+        m_queues.push_back(std::make_unique<work_queue>());
+}
+
+/*
+ *PROCEDURE: next_system
+ *
+ *DESCRIPTION: Takes the next system of the worker from the front of its own
+ *queue. When that is empty the other queues are visited in turn and the back
+ *half of the first non empty one is moved over: the victim keeps the systems
+ *it is about to reach, and the thief gets enough work to not come back soon.
+ *
+ *RETURNS: false once every queue is empty
+ */
+bool EnsembleRunner::next_system(int worker, std::size_t& system)
+{
+    work_queue& own = *m_queues[worker];
+    {
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.systems.empty())
+        {
+            system = own.systems.front();
+            own.systems.pop_front();
+            return true;
+        }
+    }
+
+    for (int k = 1; k < m_threads; k++)
+    {
+        work_queue& victim = *m_queues[(worker + k) % m_threads];
+        std::deque<std::size_t> stolen;
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            const std::size_t count = (victim.systems.size() + 1) / 2;
+            if (count == 0)
+                continue;
+            stolen.assign(victim.systems.end() - count, victim.systems.end());
+            victim.systems.erase(victim.systems.end() - count, victim.systems.end());
+        }
+        m_steals++;
+        system = stolen.front();
+        stolen.pop_front();
+        if (!stolen.empty())
+        {
+            std::lock_guard<std::mutex> guard(own.lock);
+            own.systems.insert(own.systems.end(), stolen.begin(), stolen.end());
+        }
+        return true;
+    }
+    return false;
+}
+
+void EnsembleRunner::work(int worker, const simulation& simulate)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(1);
+#endif
+    std::size_t system;
+    while (!m_failed && next_system(worker, system))
+    {
+        try
+        {
+            if (m_output_prefix.empty())
+            {
+                std::ostream discard(nullptr);
+                simulate(system, discard);
+            }
+            else
+            {
+                std::ofstream out(m_output_prefix + std::to_string(system) + ".dat");
+                simulate(system, out);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> guard(m_finished_lock);
+            if (!m_first_error)
+                m_first_error = std::current_exception();
+            m_failed = true;
+        }
+        m_done++;
+        std::lock_guard<std::mutex> guard(m_finished_lock);
+        m_finished.notify_all();
+    }
+}
+
+ensemble_stats EnsembleRunner::run(std::size_t systems, const simulation& simulate,
+                                   std::ostream* progress, double report_seconds)
+{
+    m_done = 0;
+    m_steals = 0;
+    m_failed = false;
+    m_first_error = nullptr;
+    for (int w = 0; w < m_threads; w++)
+    {
+        m_queues[w]->systems.clear();
+        for (std::size_t s = systems * w / m_threads; s < systems * (w + 1) / m_threads; s++)
+            m_queues[w]->systems.push_back(s);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+    std::vector<std::thread> pool;
+    for (int w = 0; w < m_threads; w++)
+        pool.emplace_back(&EnsembleRunner::work, this, w, std::cref(simulate));
+
+    {
+        std::unique_lock<std::mutex> guard(m_finished_lock);
+        const auto interval = std::chrono::duration<double>(report_seconds);
+        while (!m_finished.wait_for(guard, interval, [&]() { return m_done == systems || m_failed; }))
+            if (progress)
+                *progress << "  " << m_done << " / " << systems << " systems, " << std::setprecision(4)
+                          << m_done / elapsed() << " systems/s" << std::endl;
+    }
+    for (auto& thread : pool)
+        thread.join();
+    if (m_first_error)
+        std::rethrow_exception(m_first_error);
+
+    const double seconds = elapsed();
+    if (progress)
+        *progress << "  " << systems << " systems in " << std::setprecision(4) << seconds << " s, "
+                  << systems / seconds << " systems/s on " << m_threads << " threads, "
+                  << m_steals << " steals" << std::endl;
+    return ensemble_stats{ systems, seconds, systems / seconds, m_steals };
+}
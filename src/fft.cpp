@@ -0,0 +1,140 @@
+/*
+ * fft.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <cmath>
+#include <utility>
+#include "include/fft.h"
+
+ComplexFFT::ComplexFFT(int n) : m_n(n), m_reverse(n), m_cos(n / 2), m_sin(n / 2)
+{
+    int bits = 0;
+    while ((1 << bits) < n)
+        bits++;
+    for (int i = 0; i < n; i++)
+    {
+        int r = 0;
+        for (int b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        m_reverse[i] = r;
+    }
+    for (int k = 0; k < n / 2; k++)
+    {
+        m_cos[k] = cos(2 * M_PI * k / n);
+        m_sin[k] = -sin(2 * M_PI * k / n);
+    }
+}
+
+void ComplexFFT::transform(complex_t* data, bool inverse) const
+{
+    const int n = m_n;
+    for (int i = 0; i < n; i++)
+        if (i < m_reverse[i])
+            std::swap(data[i], data[m_reverse[i]]);
+
+    // butterflies written out on the real and imaginary parts, std::complex
+    // products would go through the NaN checking library routine
+    double* d = reinterpret_cast<double*>(data);
+    const double sign = inverse ? -1.0 : 1.0;
+    for (int length = 2; length <= n; length *= 2)
+    {
+        const int half = length / 2;
+        const int step = n / length;
+        for (int start = 0; start < n; start += length)
+        {
+            for (int j = 0; j < half; j++)
+            {
+                const double wr = m_cos[j * step];
+                const double wi = sign * m_sin[j * step];
+                double* a = d + 2 * (start + j);
+                double* b = d + 2 * (start + j + half);
+                const double tr = b[0] * wr - b[1] * wi;
+                const double ti = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+RealFFT::RealFFT(int n) : m_n(n), m_half(n / 2)
+{
+    for (int k = 0; k <= n / 4; k++)
+        m_twiddles.push_back(std::polar(1.0, -2 * M_PI * k / n));
+}
+
+void RealFFT::forward(complex_t* line) const
+{
+    // the n reals read as n/2 complex values z_k = x_2k + i x_2k+1
+    const int half = m_n / 2;
+    m_half.forward(line);
+
+    const complex_t z0 = line[0];
+    line[0] = complex_t(z0.real() + z0.imag(), 0.0);
+    line[half] = complex_t(z0.real() - z0.imag(), 0.0);
+
+    // X_k = (Z_k + conj Z_(h-k)) / 2 - i w^k (Z_k - conj Z_(h-k)) / 2, paired with X_(h-k)
+    const complex_t minus_i_half(0.0, -0.5);
+    for (int k = 1; k <= half / 2; k++)
+    {
+        const complex_t a = line[k];
+        const complex_t b = line[half - k];
+        const complex_t w = m_twiddles[k];
+        // w^(h-k) = -conj(w^k)
+        const complex_t w_mirror(-w.real(), w.imag());
+        const complex_t even_a = 0.5 * (a + std::conj(b)), odd_a = a - std::conj(b);
+        const complex_t even_b = 0.5 * (b + std::conj(a)), odd_b = b - std::conj(a);
+        line[k] = even_a + minus_i_half * complex_t(w.real() * odd_a.real() - w.imag() * odd_a.imag(),
+                                                    w.real() * odd_a.imag() + w.imag() * odd_a.real());
+        line[half - k] = even_b + minus_i_half * complex_t(w_mirror.real() * odd_b.real() - w_mirror.imag() * odd_b.imag(),
+                                                           w_mirror.real() * odd_b.imag() + w_mirror.imag() * odd_b.real());
+    }
+}
+
+void RealFFT::inverse(complex_t* line) const
+{
+    const int half = m_n / 2;
+    const double x0 = line[0].real(), xh = line[half].real();
+    line[0] = complex_t(x0 + xh, x0 - xh);
+
+    // Z_k = E_k + i O_k with E_k = X_k + conj X_(h-k), O_k = conj(w^k) (X_k - conj X_(h-k)),
+    // twice the textbook values so the result carries the factor n
+    for (int k = 1; k <= half / 2; k++)
+    {
+        const complex_t a = line[k];
+        const complex_t b = line[half - k];
+        const complex_t w = std::conj(m_twiddles[k]);
+        const complex_t w_mirror(-w.real(), w.imag());
+        const complex_t even_a = a + std::conj(b), odd_a = a - std::conj(b);
+        const complex_t even_b = b + std::conj(a), odd_b = b - std::conj(a);
+        const complex_t rotated_a(w.real() * odd_a.real() - w.imag() * odd_a.imag(),
+                                  w.real() * odd_a.imag() + w.imag() * odd_a.real());
+        const complex_t rotated_b(w_mirror.real() * odd_b.real() - w_mirror.imag() * odd_b.imag(),
+                                  w_mirror.real() * odd_b.imag() + w_mirror.imag() * odd_b.real());
+        line[k] = complex_t(even_a.real() - rotated_a.imag(), even_a.imag() + rotated_a.real());
+        line[half - k] = complex_t(even_b.real() - rotated_b.imag(), even_b.imag() + rotated_b.real());
+    }
+    m_half.inverse(line);
+}
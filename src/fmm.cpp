@@ -0,0 +1,556 @@
+/*
+ * fmm.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/*
+ * Expansions used (phi = sum m_j / |x - x_j|, acceleration = G grad phi):
+ *
+ *   multipole about z:  M_k = sum m_j (x_j - z)^k
+ *   a_k(R) = D^k (1/|R|) / k!, from |k| r^2 a_k + (2|k| - 1) sum_i R_i a_{k-e_i}
+ *                                     + (|k| - 1) sum_i a_{k-2e_i} = 0
+ *   local about z_L:    phi(z_L + u) = sum_n L_n u^n
+ *
+ *   M2M (shift d = z_child - z_parent):  M'_k = sum_{n<=k} C(k,n) d^(k-n) M_n
+ *   M2L (R = z_L - z_M):  L_n = sum_k (-1)^|k| C(n+k,n) a_{n+k}(R) M_k,  |n|+|k| <= order
+ *   L2L (shift e = z_child - z_parent):  L'_n = sum_{m>=n} C(m,n) e^(m-n) L_m
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include "include/fmm.h"
+#include "include/gravity_kernels.h"
+
+//Cells holding coincident particles stop splitting at this depth
+#define FMM_MAX_DEPTH 48
+
+//Subtrees with fewer particles are processed inside the task that reaches them
+#define FMM_TASK_MIN_PARTICLES 2048
+
+//Number of terms of a Taylor expansion of order FMM_MAX_ORDER
+#define FMM_MAX_TERMS ((FMM_MAX_ORDER + 1) * (FMM_MAX_ORDER + 2) * (FMM_MAX_ORDER + 3) / 6)
+
+FastMultipole::FastMultipole(int order, double theta, int leaf_size) :
+        m_order(std::min(std::max(order, 1), FMM_MAX_ORDER)),
+        m_theta(theta),
+        m_leaf_size(std::max(leaf_size, 1)),
+        m_G(1),
+        m_moments(false)
+{
+    const int p = m_order;
+    std::vector<int> index((p + 1) * (p + 1) * (p + 1), -1);
+    auto term = [&](int i, int j, int k)
+    {
+        return (i < 0 || j < 0 || k < 0 || i + j + k > p) ? -1 : index[(i * (p + 1) + j) * (p + 1) + k];
+    };
+    // missing lower terms point past the last term, at a slot kept at zero
+    auto lower = [&](int i, int j, int k)
+    {
+        int t = term(i, j, k);
+        return t < 0 ? m_terms : t;
+    };
+
+    for (int degree = 0; degree <= p; degree++)
+        for (int i = degree; i >= 0; i--)
+            for (int j = degree - i; j >= 0; j--)
+            {
+                index[(i * (p + 1) + j) * (p + 1) + degree - i - j] = (int)m_exponents.size() / 3;
+                m_exponents.insert(m_exponents.end(), { i, j, degree - i - j });
+            }
+    m_terms = (int)m_exponents.size() / 3;
+
+    double binomial[FMM_MAX_ORDER + 1][FMM_MAX_ORDER + 1] = { { 0 } };
+    for (int a = 0; a <= p; a++)
+    {
+        binomial[a][0] = 1;
+        for (int b = 1; b <= a; b++)
+            binomial[a][b] = binomial[a - 1][b - 1] + (b <= a - 1 ? binomial[a - 1][b] : 0);
+    }
+
+    for (int t = 0; t < m_terms; t++)
+    {
+        const int* k = &m_exponents[3 * t];
+        const int degree = k[0] + k[1] + k[2];
+        m_lower.insert(m_lower.end(), { lower(k[0] - 1, k[1], k[2]), lower(k[0], k[1] - 1, k[2]),
+                                        lower(k[0], k[1], k[2] - 1) });
+        m_lower2.insert(m_lower2.end(), { lower(k[0] - 2, k[1], k[2]), lower(k[0], k[1] - 2, k[2]),
+                                          lower(k[0], k[1], k[2] - 2) });
+        m_axis.push_back(k[0] > 0 ? 0 : (k[1] > 0 ? 1 : 2));
+        m_recurrence.push_back(degree > 0 ? -(2.0 * degree - 1) / degree : 0);
+        m_recurrence.push_back(degree > 0 ? -(degree - 1.0) / degree : 0);
+        for (int axis = 0; axis < 3; axis++)
+            if (k[axis] > 0)
+                m_gradient.push_back({ axis, m_lower[3 * t + axis], t, (double)k[axis] });
+
+        for (int s = 0; s < m_terms; s++)
+        {
+            const int* n = &m_exponents[3 * s];
+            const int n_degree = n[0] + n[1] + n[2];
+            const int k_degree = k[0] + k[1] + k[2];
+
+            // M2M and L2L: n <= k componentwise
+            if (n[0] <= k[0] && n[1] <= k[1] && n[2] <= k[2])
+            {
+                double c = binomial[k[0]][n[0]] * binomial[k[1]][n[1]] * binomial[k[2]][n[2]];
+                int difference = term(k[0] - n[0], k[1] - n[1], k[2] - n[2]);
+                m_m2m.push_back({ t, difference, s, c });
+                m_l2l.push_back({ s, difference, t, c });
+            }
+
+            // M2L: L_t += (-1)^|n| C(t+n, t) a_{t+n} M_n
+            if (n_degree + k_degree <= p)
+            {
+                double c = binomial[k[0] + n[0]][k[0]] * binomial[k[1] + n[1]][k[1]]
+                           * binomial[k[2] + n[2]][k[2]];
+                m_m2l.push_back({ t, term(k[0] + n[0], k[1] + n[1], k[2] + n[2]), s,
+                                  (n_degree % 2 ? -c : c) });
+            }
+        }
+    }
+}
+
+void FastMultipole::build(const ParticleSet& particles)
+{
+    const int n = (int)particles.size();
+    m_x = particles.x;
+    m_y = particles.y;
+    m_z = particles.z;
+    m_m = particles.mass;
+    m_order_of.resize(n);
+    std::iota(m_order_of.begin(), m_order_of.end(), 0);
+    m_scratch.resize(n);
+    m_cells.clear();
+    if (n == 0)
+        return;
+
+    auto x_range = std::minmax_element(m_x.begin(), m_x.end());
+    auto y_range = std::minmax_element(m_y.begin(), m_y.end());
+    auto z_range = std::minmax_element(m_z.begin(), m_z.end());
+    double half = 0.5 * std::max({ *x_range.second - *x_range.first,
+                                   *y_range.second - *y_range.first,
+                                   *z_range.second - *z_range.first });
+    half = half * (1 + 1e-12) + 1e-300;
+
+    cell root{};
+    root.cx = 0.5 * (*x_range.first + *x_range.second);
+    root.cy = 0.5 * (*y_range.first + *y_range.second);
+    root.cz = 0.5 * (*z_range.first + *z_range.second);
+    root.half = half;
+    root.begin = 0;
+    root.end = n;
+    m_cells.reserve(4 * n / m_leaf_size + 16);
+    m_cells.push_back(root);
+    build_cell(0, 0);
+
+    // store the particle data in tree order so leaves are contiguous
+    std::vector<double> sorted(n);
+    for (std::vector<double>* column : { &m_x, &m_y, &m_z, &m_m })
+    {
+        for (int k = 0; k < n; k++)
+            sorted[k] = (*column)[m_order_of[k]];
+        column->swap(sorted);
+    }
+}
+
+/*
+ *PROCEDURE: build_cell
+ *
+ *DESCRIPTION: Splits the particles of a cell into its non empty octants,
+ *recursively, until cells hold at most leaf_size particles
+ *
+ *RETURNS: -
+ */
+void FastMultipole::build_cell(int index, int depth)
+{
+    const cell c = m_cells[index];
+    m_cells[index].first_child = -1;
+    m_cells[index].children = 0;
+    if (c.end - c.begin <= m_leaf_size || depth >= FMM_MAX_DEPTH)
+        return;
+
+    auto octant = [&](int i)
+    {
+        return (m_x[i] > c.cx) | ((m_y[i] > c.cy) << 1) | ((m_z[i] > c.cz) << 2);
+    };
+
+    int counts[8] = { 0 };
+    for (int k = c.begin; k < c.end; k++)
+        counts[octant(m_order_of[k])]++;
+    int offsets[8];
+    offsets[0] = c.begin;
+    for (int o = 1; o < 8; o++)
+        offsets[o] = offsets[o - 1] + counts[o - 1];
+    int next[8];
+    std::copy(offsets, offsets + 8, next);
+    for (int k = c.begin; k < c.end; k++)
+        m_scratch[next[octant(m_order_of[k])]++] = m_order_of[k];
+    std::copy(m_scratch.begin() + c.begin, m_scratch.begin() + c.end, m_order_of.begin() + c.begin);
+
+    const int first = (int)m_cells.size();
+    const double quarter = 0.5 * c.half;
+    for (int o = 0; o < 8; o++)
+    {
+        if (counts[o] == 0)
+            continue;
+        cell child{};
+        child.cx = c.cx + ((o & 1) ? quarter : -quarter);
+        child.cy = c.cy + ((o & 2) ? quarter : -quarter);
+        child.cz = c.cz + ((o & 4) ? quarter : -quarter);
+        child.half = quarter;
+        child.begin = offsets[o];
+        child.end = offsets[o] + counts[o];
+        m_cells.push_back(child);
+    }
+    const int children = (int)m_cells.size() - first;
+    m_cells[index].first_child = first;
+    m_cells[index].children = children;
+    for (int k = 0; k < children; k++)
+        build_cell(first + k, depth + 1);
+}
+
+void FastMultipole::monomials(double x, double y, double z, double* out) const
+{
+    const double u[3] = { x, y, z };
+    out[0] = 1;
+    for (int t = 1; t < m_terms; t++)
+    {
+        const int axis = m_axis[t];
+        out[t] = out[m_lower[3 * t + axis]] * u[axis];
+    }
+}
+
+void FastMultipole::derivatives(double x, double y, double z, double* out) const
+{
+    const double inv_r2 = 1.0 / (x*x + y*y + z*z);
+    out[0] = sqrt(inv_r2);
+    out[m_terms] = 0;
+    for (int t = 1; t < m_terms; t++)
+    {
+        const int* lower = &m_lower[3 * t];
+        const int* lower2 = &m_lower2[3 * t];
+        double first = x * out[lower[0]] + y * out[lower[1]] + z * out[lower[2]];
+        double second = out[lower2[0]] + out[lower2[1]] + out[lower2[2]];
+        out[t] = (m_recurrence[2 * t] * first + m_recurrence[2 * t + 1] * second) * inv_r2;
+    }
+}
+
+/*
+ *PROCEDURE: upward
+ *
+ *DESCRIPTION: Centre of mass, radius and multipole expansion of a cell, from
+ *its particles (P2M) or from its children (M2M); children are processed as
+ *tasks when large enough
+ *
+ *RETURNS: -
+ */
+void FastMultipole::upward(int index)
+{
+    cell& c = m_cells[index];
+    double* M = &m_multipoles[(std::size_t)index * m_terms];
+    c.mass = c.mx = c.my = c.mz = 0;
+
+    if (c.children == 0)
+    {
+        for (int k = c.begin; k < c.end; k++)
+        {
+            c.mass += m_m[k];
+            c.mx += m_m[k] * m_x[k];
+            c.my += m_m[k] * m_y[k];
+            c.mz += m_m[k] * m_z[k];
+        }
+    }
+    else
+    {
+        for (int k = 0; k < c.children; k++)
+        {
+            const int child = c.first_child + k;
+            if (m_cells[child].end - m_cells[child].begin >= FMM_TASK_MIN_PARTICLES)
+            {
+                #pragma omp task
+                upward(child);
+            }
+            else
+            {
+                upward(child);
+            }
+        }
+        #pragma omp taskwait
+        for (int k = 0; k < c.children; k++)
+        {
+            const cell& child = m_cells[c.first_child + k];
+            c.mass += child.mass;
+            c.mx += child.mass * child.mx;
+            c.my += child.mass * child.my;
+            c.mz += child.mass * child.mz;
+        }
+    }
+
+    if (c.mass > 0)
+    {
+        c.mx /= c.mass;
+        c.my /= c.mass;
+        c.mz /= c.mass;
+    }
+    else
+    {
+        c.mx = c.cx;
+        c.my = c.cy;
+        c.mz = c.cz;
+    }
+
+    std::fill(M, M + m_terms, 0.0);
+    double mono[FMM_MAX_TERMS + 1];
+    if (c.children == 0)
+    {
+        c.radius = 0;
+        for (int k = c.begin; k < c.end; k++)
+        {
+            double dx = m_x[k] - c.mx, dy = m_y[k] - c.my, dz = m_z[k] - c.mz;
+            c.radius = std::max(c.radius, dx*dx + dy*dy + dz*dz);
+            monomials(dx, dy, dz, mono);
+            for (int t = 0; t < m_terms; t++)
+                M[t] += m_m[k] * mono[t];
+        }
+        c.radius = sqrt(c.radius);
+    }
+    else
+    {
+        double corner_x = fabs(c.mx - c.cx) + c.half;
+        double corner_y = fabs(c.my - c.cy) + c.half;
+        double corner_z = fabs(c.mz - c.cz) + c.half;
+        c.radius = sqrt(corner_x * corner_x + corner_y * corner_y + corner_z * corner_z);
+        double bound = 0;
+        for (int k = 0; k < c.children; k++)
+        {
+            const int child = c.first_child + k;
+            const cell& ch = m_cells[child];
+            double dx = ch.mx - c.mx, dy = ch.my - c.my, dz = ch.mz - c.mz;
+            bound = std::max(bound, sqrt(dx*dx + dy*dy + dz*dz) + ch.radius);
+            monomials(dx, dy, dz, mono);
+            const double* child_M = &m_multipoles[(std::size_t)child * m_terms];
+            for (const term_product& product : m_m2m)
+                M[product.out] += product.coefficient * mono[product.a] * child_M[product.b];
+        }
+        c.radius = std::min(c.radius, bound);
+    }
+}
+
+void FastMultipole::multipole_to_local(int source, int target)
+{
+    const cell& s = m_cells[source];
+    const cell& t = m_cells[target];
+    double a[FMM_MAX_TERMS + 1];
+    derivatives(t.mx - s.mx, t.my - s.my, t.mz - s.mz, a);
+    const double* M = &m_multipoles[(std::size_t)source * m_terms];
+    double* L = &m_locals[(std::size_t)target * m_terms];
+    for (const term_product& product : m_m2l)
+        L[product.out] += product.coefficient * a[product.a] * M[product.b];
+}
+
+void FastMultipole::particle_to_particle(int source, int target)
+{
+    const cell& s = m_cells[source];
+    const cell& t = m_cells[target];
+    if (!m_moments)
+    {
+        gravity_kernels::best_direct_kernel().function(
+                &m_x[s.begin], &m_y[s.begin], &m_z[s.begin], &m_m[s.begin], s.end - s.begin,
+                &m_x[t.begin], &m_y[t.begin], &m_z[t.begin], t.end - t.begin,
+                1.0, &m_ax[t.begin], &m_ay[t.begin], &m_az[t.begin]);
+        return;
+    }
+
+    const std::size_t n = m_x.size();
+    for (int i = t.begin; i < t.end; i++)
+    {
+        double sums[RK4_MOMENT_CHANNELS] = { 0 };
+        for (int j = s.begin; j < s.end; j++)
+        {
+            double dx = m_x[j] - m_x[i], dy = m_y[j] - m_y[i], dz = m_z[j] - m_z[i];
+            double r2 = dx*dx + dy*dy + dz*dz;
+            if (r2 == 0)
+                continue;
+            double t1 = m_G * m_m[j] / (r2 * sqrt(r2));
+            double t2 = t1 * t1, t3 = t2 * t1, t4 = t3 * t1;
+            sums[RK4_P1] += t1; sums[RK4_P2] += t2; sums[RK4_P3] += t3;
+            sums[RK4_D1X] += t1 * dx; sums[RK4_D1Y] += t1 * dy; sums[RK4_D1Z] += t1 * dz;
+            sums[RK4_D2X] += t2 * dx; sums[RK4_D2Y] += t2 * dy; sums[RK4_D2Z] += t2 * dz;
+            sums[RK4_D3X] += t3 * dx; sums[RK4_D3Y] += t3 * dy; sums[RK4_D3Z] += t3 * dz;
+            sums[RK4_D4X] += t4 * dx; sums[RK4_D4Y] += t4 * dy; sums[RK4_D4Z] += t4 * dz;
+        }
+        for (int channel = 0; channel < RK4_MOMENT_CHANNELS; channel++)
+            m_moment_sums[channel * n + i] += sums[channel];
+    }
+}
+
+void FastMultipole::local_to_particle(int index)
+{
+    const cell& c = m_cells[index];
+    const double* L = &m_locals[(std::size_t)index * m_terms];
+    const std::size_t n = m_x.size();
+    double mono[FMM_MAX_TERMS + 1];
+    for (int k = c.begin; k < c.end; k++)
+    {
+        monomials(m_x[k] - c.mx, m_y[k] - c.my, m_z[k] - c.mz, mono);
+        double g[3] = { 0, 0, 0 };
+        for (const term_product& product : m_gradient)
+            g[product.out] += product.coefficient * mono[product.a] * L[product.b];
+        if (m_moments)
+        {
+            m_moment_sums[RK4_D1X * n + k] += m_G * g[0];
+            m_moment_sums[RK4_D1Y * n + k] += m_G * g[1];
+            m_moment_sums[RK4_D1Z * n + k] += m_G * g[2];
+        }
+        else
+        {
+            m_ax[k] += g[0];
+            m_ay[k] += g[1];
+            m_az[k] += g[2];
+        }
+    }
+}
+
+/*
+ *PROCEDURE: downward
+ *
+ *DESCRIPTION: Dual tree traversal for one target cell. Every source of the
+ *list either is well separated (M2L), or forms a leaf pair (P2P), or gets
+ *split: the source when it is the bigger cell or the target is a leaf,
+ *otherwise the target, whose children inherit the source. Once the target's
+ *local is complete it is passed on to its children (L2L), which continue as
+ *separate tasks, or evaluated at its particles (L2P) for a leaf.
+ *
+ *RETURNS: -
+ */
+void FastMultipole::downward(int target, std::vector<int> sources)
+{
+    const cell& t = m_cells[target];
+    std::vector<int> inherited;
+
+    for (std::size_t k = 0; k < sources.size(); k++)
+    {
+        const int source = sources[k];
+        const cell& s = m_cells[source];
+        double dx = t.mx - s.mx, dy = t.my - s.my, dz = t.mz - s.mz;
+        double separation = m_theta * sqrt(dx*dx + dy*dy + dz*dz);
+
+        if (t.radius + s.radius < separation)
+            multipole_to_local(source, target);
+        else if (t.children == 0 && s.children == 0)
+            particle_to_particle(source, target);
+        else if (t.children == 0 || (s.children > 0 && s.radius > t.radius))
+            for (int c = 0; c < s.children; c++)
+                sources.push_back(s.first_child + c);
+        else
+            inherited.push_back(source);
+    }
+
+    if (t.children == 0)
+    {
+        local_to_particle(target);
+        return;
+    }
+
+    const double* L = &m_locals[(std::size_t)target * m_terms];
+    double mono[FMM_MAX_TERMS + 1];
+    for (int c = 0; c < t.children; c++)
+    {
+        const int child = t.first_child + c;
+        const cell& ch = m_cells[child];
+        double* child_L = &m_locals[(std::size_t)child * m_terms];
+        monomials(ch.mx - t.mx, ch.my - t.my, ch.mz - t.mz, mono);
+        for (const term_product& product : m_l2l)
+            child_L[product.out] += product.coefficient * mono[product.a] * L[product.b];
+    }
+
+    for (int c = 0; c < t.children; c++)
+    {
+        const int child = t.first_child + c;
+        if (m_cells[child].end - m_cells[child].begin >= FMM_TASK_MIN_PARTICLES)
+        {
+            #pragma omp task firstprivate(inherited)
+            downward(child, inherited);
+        }
+        else
+        {
+            downward(child, inherited);
+        }
+    }
+}
+
+void FastMultipole::evaluate(const ParticleSet& particles)
+{
+    build(particles);
+    const std::size_t n = particles.size();
+    m_multipoles.assign(m_cells.size() * m_terms, 0.0);
+    m_locals.assign(m_cells.size() * m_terms, 0.0);
+    if (m_moments)
+    {
+        m_moment_sums.assign(RK4_MOMENT_CHANNELS * n, 0.0);
+    }
+    else
+    {
+        m_ax.assign(n, 0.0);
+        m_ay.assign(n, 0.0);
+        m_az.assign(n, 0.0);
+    }
+    if (n == 0)
+        return;
+
+    #pragma omp parallel
+    #pragma omp single
+    {
+        upward(0);
+        downward(0, std::vector<int>(1, 0));
+    }
+}
+
+void FastMultipole::accelerations(const ParticleSet& particles, double G,
+                                  std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az)
+{
+    m_moments = false;
+    evaluate(particles);
+    const int n = (int)particles.size();
+    ax.resize(n);
+    ay.resize(n);
+    az.resize(n);
+    for (int k = 0; k < n; k++)
+    {
+        const int i = m_order_of[k];
+        ax[i] = G * m_ax[k];
+        ay[i] = G * m_ay[k];
+        az[i] = G * m_az[k];
+    }
+}
+
+void FastMultipole::rk4_moments(const ParticleSet& particles, double G, std::vector<double>& moments)
+{
+    m_moments = true;
+    m_G = G;
+    evaluate(particles);
+    const std::size_t n = particles.size();
+    moments.resize(RK4_MOMENT_CHANNELS * n);
+    for (int channel = 0; channel < RK4_MOMENT_CHANNELS; channel++)
+        for (std::size_t k = 0; k < n; k++)
+            moments[channel * n + m_order_of[k]] = m_moment_sums[channel * n + k];
+}
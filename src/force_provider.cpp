@@ -0,0 +1,41 @@
+/*
+ * force_provider.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "include/force_provider.h"
+#include "include/barnes_hut.h"
+#include "include/fmm.h"
+#include "include/particle_mesh.h"
+
+std::shared_ptr<ForceProvider> make_force_provider(const std::string& name, int grid)
+{
+    if (name == "direct")
+        return std::make_shared<DirectSummation>();
+    if (name == "tree")
+        return std::make_shared<BarnesHut>();
+    if (name == "fmm")
+        return std::make_shared<FastMultipole>();
+    if (name == "pm")
+        return std::make_shared<ParticleMesh>(grid);
+    return nullptr;
+}
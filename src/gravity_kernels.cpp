@@ -0,0 +1,635 @@
+/*
+ * gravity_kernels.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include "include/gravity_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CELESTIAL_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ *PROCEDURE: scalar_pairs
+ *
+ *DESCRIPTION: Reference pair loop for target (xi, yi, zi) over sources [begin, end).
+ *Also used for the tails of the vector kernels.
+ *
+ *RETURNS: -
+ */
+static inline void scalar_pairs(const double* sx, const double* sy, const double* sz,
+                                const double* sm, int begin, int end,
+                                double xi, double yi, double zi, double G,
+                                double& rx, double& ry, double& rz)
+{
+    for (int j = begin; j < end; j++)
+    {
+        double dx = sx[j] - xi;
+        double dy = sy[j] - yi;
+        double dz = sz[j] - zi;
+        double r2 = dx*dx + dy*dy + dz*dz;
+        if (r2 > 0)
+        {
+            double r = sqrt(r2);
+            double tmp = G * sm[j] / (r*r*r);
+            rx += dx * tmp;
+            ry += dy * tmp;
+            rz += dz * tmp;
+        }
+    }
+}
+
+void gravity_kernels::direct_scalar(const double* sx, const double* sy, const double* sz,
+                                    const double* sm, int ns,
+                                    const double* tx, const double* ty, const double* tz, int nt,
+                                    double G, double* ax, double* ay, double* az)
+{
+    for (int i = 0; i < nt; i++)
+    {
+        double rx = 0, ry = 0, rz = 0;
+        scalar_pairs(sx, sy, sz, sm, 0, ns, tx[i], ty[i], tz[i], G, rx, ry, rz);
+        ax[i] += rx;
+        ay[i] += ry;
+        az[i] += rz;
+    }
+}
+
+void gravity_kernels::test_particles(const double* sx, const double* sy, const double* sz,
+                                     const double* sm, int ns,
+                                     const double* tx, const double* ty, const double* tz, int nt,
+                                     double G, double* __restrict ax, double* __restrict ay,
+                                     double* __restrict az)
+{
+    for (int j = 0; j < ns; j++)
+    {
+        const double xj = sx[j], yj = sy[j], zj = sz[j], gm = G * sm[j];
+        #pragma omp simd
+        for (int i = 0; i < nt; i++)
+        {
+            const double dx = xj - tx[i];
+            const double dy = yj - ty[i];
+            const double dz = zj - tz[i];
+            const double r2 = dx*dx + dy*dy + dz*dz;
+            // a target sitting on the source gets no contribution, without a branch
+            const double other = r2 > 0 ? 1.0 : 0.0;
+            const double inv_r = other / sqrt(r2 + (1 - other));
+            const double tmp = gm * inv_r * inv_r * inv_r;
+            ax[i] += dx * tmp;
+            ay[i] += dy * tmp;
+            az[i] += dz * tmp;
+        }
+    }
+}
+
+/*
+ *PROCEDURE: symmetric_scalar_row
+ *
+ *DESCRIPTION: Half pair loop of row i over sources [begin, n), also used for
+ *the tails of the vector kernels
+ *
+ *RETURNS: -
+ */
+static inline void symmetric_scalar_row(const double* x, const double* y, const double* z,
+                                        const double* m, int i, int begin, int n,
+                                        double& rx, double& ry, double& rz,
+                                        double* ax, double* ay, double* az)
+{
+    const double xi = x[i], yi = y[i], zi = z[i], mi = m[i];
+    for (int j = begin; j < n; j++)
+    {
+        double dx = x[j] - xi;
+        double dy = y[j] - yi;
+        double dz = z[j] - zi;
+        double r2 = dx*dx + dy*dy + dz*dz;
+        if (r2 > 0)
+        {
+            double r = sqrt(r2);
+            double s = 1.0 / (r*r*r);
+            double mj_s = m[j] * s;
+            double mi_s = mi * s;
+            rx += dx * mj_s;
+            ry += dy * mj_s;
+            rz += dz * mj_s;
+            ax[j] -= dx * mi_s;
+            ay[j] -= dy * mi_s;
+            az[j] -= dz * mi_s;
+        }
+    }
+}
+
+void gravity_kernels::symmetric_scalar(const double* x, const double* y, const double* z,
+                                       const double* m, int n, int row_begin, int row_end,
+                                       double* ax, double* ay, double* az)
+{
+    for (int i = row_begin; i < row_end; i++)
+    {
+        double rx = 0, ry = 0, rz = 0;
+        symmetric_scalar_row(x, y, z, m, i, i + 1, n, rx, ry, rz, ax, ay, az);
+        ax[i] += rx;
+        ay[i] += ry;
+        az[i] += rz;
+    }
+}
+
+#ifdef CELESTIAL_X86
+
+/*
+ *PROCEDURE: rsqrt_avx2
+ *
+ *DESCRIPTION: 1/sqrt(r2) for 4 doubles. The single precision rsqrt estimate is
+ *taken on the mantissa only (split off with an even power of two) so it works
+ *over the whole double range, then refined to full precision with one third
+ *order and one Newton-Raphson step.
+ *Lanes with r2 == 0 return 0.
+ *
+ *RETURNS: __m256d
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256d rsqrt_avx2(__m256d r2)
+{
+    const __m256i mantissa_mask = _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL);
+    const __m256i one_i = _mm256_set1_epi64x(1);
+    const __m256i bias = _mm256_set1_epi64x(1023);
+    const __m256i scale_base = _mm256_set1_epi64x(3069);
+
+    __m256i bits = _mm256_castpd_si256(r2);
+    __m256i e = _mm256_srli_epi64(bits, 52);
+    __m256i odd = _mm256_xor_si256(_mm256_and_si256(e, one_i), one_i);  // unbiased exponent is odd
+    __m256i m_bits = _mm256_or_si256(_mm256_and_si256(bits, mantissa_mask),
+                                     _mm256_slli_epi64(_mm256_add_epi64(bias, odd), 52));
+    __m256i s_bits = _mm256_slli_epi64(
+            _mm256_srli_epi64(_mm256_add_epi64(_mm256_sub_epi64(scale_base, e), odd), 1), 52);
+
+    __m128 estimate = _mm_rsqrt_ps(_mm256_cvtpd_ps(_mm256_castsi256_pd(m_bits)));
+    __m256d y = _mm256_mul_pd(_mm256_cvtps_pd(estimate), _mm256_castsi256_pd(s_bits));
+
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d three_eighths = _mm256_set1_pd(0.375);
+
+    // third order step (12 -> 36 bits) followed by a plain Newton step
+    __m256d h = _mm256_fnmadd_pd(_mm256_mul_pd(r2, y), y, one);                    // 1 - r2*y*y
+    y = _mm256_fmadd_pd(_mm256_mul_pd(y, h), _mm256_fmadd_pd(three_eighths, h, half), y);
+    h = _mm256_fnmadd_pd(_mm256_mul_pd(r2, y), y, one);
+    y = _mm256_fmadd_pd(_mm256_mul_pd(y, half), h, y);                               // y + y*h/2
+    __m256d nonzero = _mm256_cmp_pd(r2, _mm256_setzero_pd(), _CMP_GT_OQ);
+    return _mm256_and_pd(y, nonzero);
+}
+
+__attribute__((target("avx2,fma")))
+static inline void pairs_avx2(__m256d xi, __m256d yi, __m256d zi,
+                              const double* sx, const double* sy, const double* sz, const double* sm,
+                              __m256d& ax, __m256d& ay, __m256d& az)
+{
+    __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(sx), xi);
+    __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(sy), yi);
+    __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(sz), zi);
+    __m256d r2 = _mm256_fmadd_pd(dz, dz, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx)));
+    __m256d inv_r = rsqrt_avx2(r2);
+    __m256d tmp = _mm256_mul_pd(_mm256_loadu_pd(sm), _mm256_mul_pd(inv_r, _mm256_mul_pd(inv_r, inv_r)));
+    ax = _mm256_fmadd_pd(dx, tmp, ax);
+    ay = _mm256_fmadd_pd(dy, tmp, ay);
+    az = _mm256_fmadd_pd(dz, tmp, az);
+}
+
+__attribute__((target("avx2,fma")))
+static inline double hsum_avx2(__m256d v)
+{
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2,fma")))
+void gravity_kernels::direct_avx2(const double* sx, const double* sy, const double* sz,
+                                  const double* sm, int ns,
+                                  const double* tx, const double* ty, const double* tz, int nt,
+                                  double G, double* ax, double* ay, double* az)
+{
+    for (int i = 0; i < nt; i++)
+    {
+        __m256d xi = _mm256_set1_pd(tx[i]);
+        __m256d yi = _mm256_set1_pd(ty[i]);
+        __m256d zi = _mm256_set1_pd(tz[i]);
+        __m256d ax0 = _mm256_setzero_pd(), ay0 = _mm256_setzero_pd(), az0 = _mm256_setzero_pd();
+        __m256d ax1 = _mm256_setzero_pd(), ay1 = _mm256_setzero_pd(), az1 = _mm256_setzero_pd();
+
+        int j = 0;
+        for (; j + 8 <= ns; j += 8)
+        {
+            pairs_avx2(xi, yi, zi, sx + j, sy + j, sz + j, sm + j, ax0, ay0, az0);
+            pairs_avx2(xi, yi, zi, sx + j + 4, sy + j + 4, sz + j + 4, sm + j + 4, ax1, ay1, az1);
+        }
+        double rx = G * hsum_avx2(_mm256_add_pd(ax0, ax1));
+        double ry = G * hsum_avx2(_mm256_add_pd(ay0, ay1));
+        double rz = G * hsum_avx2(_mm256_add_pd(az0, az1));
+        scalar_pairs(sx, sy, sz, sm, j, ns, tx[i], ty[i], tz[i], G, rx, ry, rz);
+
+        ax[i] += rx;
+        ay[i] += ry;
+        az[i] += rz;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static inline void symmetric_pairs_avx2(__m256d xi, __m256d yi, __m256d zi, __m256d mi,
+                                        const double* x, const double* y, const double* z, const double* m,
+                                        double* ax, double* ay, double* az,
+                                        __m256d& rx, __m256d& ry, __m256d& rz)
+{
+    __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x), xi);
+    __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y), yi);
+    __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z), zi);
+    __m256d r2 = _mm256_fmadd_pd(dz, dz, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx)));
+    __m256d inv_r = rsqrt_avx2(r2);
+    __m256d s = _mm256_mul_pd(inv_r, _mm256_mul_pd(inv_r, inv_r));
+    __m256d mj_s = _mm256_mul_pd(_mm256_loadu_pd(m), s);
+    __m256d mi_s = _mm256_mul_pd(mi, s);
+    rx = _mm256_fmadd_pd(dx, mj_s, rx);
+    ry = _mm256_fmadd_pd(dy, mj_s, ry);
+    rz = _mm256_fmadd_pd(dz, mj_s, rz);
+    _mm256_storeu_pd(ax, _mm256_fnmadd_pd(dx, mi_s, _mm256_loadu_pd(ax)));
+    _mm256_storeu_pd(ay, _mm256_fnmadd_pd(dy, mi_s, _mm256_loadu_pd(ay)));
+    _mm256_storeu_pd(az, _mm256_fnmadd_pd(dz, mi_s, _mm256_loadu_pd(az)));
+}
+
+__attribute__((target("avx2,fma")))
+void gravity_kernels::symmetric_avx2(const double* x, const double* y, const double* z,
+                                     const double* m, int n, int row_begin, int row_end,
+                                     double* ax, double* ay, double* az)
+{
+    for (int i = row_begin; i < row_end; i++)
+    {
+        __m256d xi = _mm256_set1_pd(x[i]);
+        __m256d yi = _mm256_set1_pd(y[i]);
+        __m256d zi = _mm256_set1_pd(z[i]);
+        __m256d mi = _mm256_set1_pd(m[i]);
+        __m256d rx0 = _mm256_setzero_pd(), ry0 = _mm256_setzero_pd(), rz0 = _mm256_setzero_pd();
+        __m256d rx1 = _mm256_setzero_pd(), ry1 = _mm256_setzero_pd(), rz1 = _mm256_setzero_pd();
+
+        int j = i + 1;
+        for (; j + 8 <= n; j += 8)
+        {
+            symmetric_pairs_avx2(xi, yi, zi, mi, x + j, y + j, z + j, m + j,
+                                 ax + j, ay + j, az + j, rx0, ry0, rz0);
+            symmetric_pairs_avx2(xi, yi, zi, mi, x + j + 4, y + j + 4, z + j + 4, m + j + 4,
+                                 ax + j + 4, ay + j + 4, az + j + 4, rx1, ry1, rz1);
+        }
+        double rx = hsum_avx2(_mm256_add_pd(rx0, rx1));
+        double ry = hsum_avx2(_mm256_add_pd(ry0, ry1));
+        double rz = hsum_avx2(_mm256_add_pd(rz0, rz1));
+        symmetric_scalar_row(x, y, z, m, i, j, n, rx, ry, rz, ax, ay, az);
+
+        ax[i] += rx;
+        ay[i] += ry;
+        az[i] += rz;
+    }
+}
+
+/*
+ *PROCEDURE: rsqrt_avx512
+ *
+ *DESCRIPTION: 1/sqrt(r2) for 8 doubles from the 14 bit rsqrt14 estimate and two
+ *Newton-Raphson steps. Lanes with r2 == 0 return 0.
+ *
+ *RETURNS: __m512d
+ */
+__attribute__((target("avx512f")))
+static inline __m512d rsqrt_avx512(__m512d r2)
+{
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d half = _mm512_set1_pd(0.5);
+    __mmask8 nonzero = _mm512_cmp_pd_mask(r2, _mm512_setzero_pd(), _CMP_GT_OQ);
+    __m512d y = _mm512_maskz_rsqrt14_pd(nonzero, r2);
+    for (int k = 0; k < 2; k++)
+    {
+        __m512d h = _mm512_fnmadd_pd(_mm512_mul_pd(r2, y), y, one);
+        y = _mm512_fmadd_pd(_mm512_mul_pd(y, half), h, y);
+    }
+    return _mm512_maskz_mov_pd(nonzero, y);
+}
+
+// 512 to 256 to 128 bit halves by hand: _mm512_reduce_add_pd, the unmasked
+// _mm512_extractf64x4_pd and _mm512_castpd512_pd256 pass undefined vectors
+// GCC warns about, the masked extract with every lane selected is the same
+// instruction
+__attribute__((target("avx512f")))
+static inline double hsum_avx512(__m512d v)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d quad = _mm256_add_pd(_mm512_mask_extractf64x4_pd(zero, 0xFF, v, 0),
+                                 _mm512_mask_extractf64x4_pd(zero, 0xFF, v, 1));
+    __m128d lo = _mm_add_pd(_mm256_castpd256_pd128(quad), _mm256_extractf128_pd(quad, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx512f")))
+static inline void pairs_avx512(__m512d xi, __m512d yi, __m512d zi,
+                                const double* sx, const double* sy, const double* sz, const double* sm,
+                                __m512d& ax, __m512d& ay, __m512d& az)
+{
+    __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(sx), xi);
+    __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(sy), yi);
+    __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(sz), zi);
+    __m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+    __m512d inv_r = rsqrt_avx512(r2);
+    __m512d tmp = _mm512_mul_pd(_mm512_loadu_pd(sm), _mm512_mul_pd(inv_r, _mm512_mul_pd(inv_r, inv_r)));
+    ax = _mm512_fmadd_pd(dx, tmp, ax);
+    ay = _mm512_fmadd_pd(dy, tmp, ay);
+    az = _mm512_fmadd_pd(dz, tmp, az);
+}
+
+// the same 8 sources against two targets: the loads and the independent
+// chains of both targets are shared by the out of order core
+__attribute__((target("avx512f")))
+static inline void pairs2_avx512(__m512d xi, __m512d yi, __m512d zi, __m512d xk, __m512d yk, __m512d zk,
+                                 const double* sx, const double* sy, const double* sz, const double* sm,
+                                 __m512d& ax, __m512d& ay, __m512d& az, __m512d& bx, __m512d& by, __m512d& bz)
+{
+    const __m512d x = _mm512_loadu_pd(sx), y = _mm512_loadu_pd(sy), z = _mm512_loadu_pd(sz);
+    const __m512d m = _mm512_loadu_pd(sm);
+    __m512d dx = _mm512_sub_pd(x, xi), dy = _mm512_sub_pd(y, yi), dz = _mm512_sub_pd(z, zi);
+    __m512d ex = _mm512_sub_pd(x, xk), ey = _mm512_sub_pd(y, yk), ez = _mm512_sub_pd(z, zk);
+    __m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+    __m512d s2 = _mm512_fmadd_pd(ez, ez, _mm512_fmadd_pd(ey, ey, _mm512_mul_pd(ex, ex)));
+    __m512d inv_r = rsqrt_avx512(r2), inv_s = rsqrt_avx512(s2);
+    __m512d tmp = _mm512_mul_pd(m, _mm512_mul_pd(inv_r, _mm512_mul_pd(inv_r, inv_r)));
+    __m512d tmq = _mm512_mul_pd(m, _mm512_mul_pd(inv_s, _mm512_mul_pd(inv_s, inv_s)));
+    ax = _mm512_fmadd_pd(dx, tmp, ax);
+    ay = _mm512_fmadd_pd(dy, tmp, ay);
+    az = _mm512_fmadd_pd(dz, tmp, az);
+    bx = _mm512_fmadd_pd(ex, tmq, bx);
+    by = _mm512_fmadd_pd(ey, tmq, by);
+    bz = _mm512_fmadd_pd(ez, tmq, bz);
+}
+
+__attribute__((target("avx512f")))
+void gravity_kernels::direct_avx512(const double* sx, const double* sy, const double* sz,
+                                    const double* sm, int ns,
+                                    const double* tx, const double* ty, const double* tz, int nt,
+                                    double G, double* ax, double* ay, double* az)
+{
+    int i = 0;
+    for (; i + 2 <= nt; i += 2)
+    {
+        __m512d xi = _mm512_set1_pd(tx[i]), yi = _mm512_set1_pd(ty[i]), zi = _mm512_set1_pd(tz[i]);
+        __m512d xk = _mm512_set1_pd(tx[i + 1]), yk = _mm512_set1_pd(ty[i + 1]), zk = _mm512_set1_pd(tz[i + 1]);
+        __m512d ax0 = _mm512_setzero_pd(), ay0 = _mm512_setzero_pd(), az0 = _mm512_setzero_pd();
+        __m512d bx0 = _mm512_setzero_pd(), by0 = _mm512_setzero_pd(), bz0 = _mm512_setzero_pd();
+
+        int j = 0;
+        for (; j + 8 <= ns; j += 8)
+            pairs2_avx512(xi, yi, zi, xk, yk, zk, sx + j, sy + j, sz + j, sm + j, ax0, ay0, az0, bx0, by0, bz0);
+        double rx = G * hsum_avx512(ax0), ry = G * hsum_avx512(ay0), rz = G * hsum_avx512(az0);
+        double qx = G * hsum_avx512(bx0), qy = G * hsum_avx512(by0), qz = G * hsum_avx512(bz0);
+        scalar_pairs(sx, sy, sz, sm, j, ns, tx[i], ty[i], tz[i], G, rx, ry, rz);
+        scalar_pairs(sx, sy, sz, sm, j, ns, tx[i + 1], ty[i + 1], tz[i + 1], G, qx, qy, qz);
+
+        ax[i] += rx;
+        ay[i] += ry;
+        az[i] += rz;
+        ax[i + 1] += qx;
+        ay[i + 1] += qy;
+        az[i + 1] += qz;
+    }
+    for (; i < nt; i++)
+    {
+        __m512d xi = _mm512_set1_pd(tx[i]);
+        __m512d yi = _mm512_set1_pd(ty[i]);
+        __m512d zi = _mm512_set1_pd(tz[i]);
+        __m512d ax0 = _mm512_setzero_pd(), ay0 = _mm512_setzero_pd(), az0 = _mm512_setzero_pd();
+
+        int j = 0;
+        for (; j + 8 <= ns; j += 8)
+            pairs_avx512(xi, yi, zi, sx + j, sy + j, sz + j, sm + j, ax0, ay0, az0);
+        double rx = G * hsum_avx512(ax0);
+        double ry = G * hsum_avx512(ay0);
+        double rz = G * hsum_avx512(az0);
+        scalar_pairs(sx, sy, sz, sm, j, ns, tx[i], ty[i], tz[i], G, rx, ry, rz);
+
+        ax[i] += rx;
+        ay[i] += ry;
+        az[i] += rz;
+    }
+}
+
+
+__attribute__((target("avx512f")))
+static inline void symmetric_pairs_avx512(__m512d xi, __m512d yi, __m512d zi, __m512d mi,
+                                          const double* x, const double* y, const double* z, const double* m,
+                                          double* ax, double* ay, double* az,
+                                          __m512d& rx, __m512d& ry, __m512d& rz)
+{
+    __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x), xi);
+    __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y), yi);
+    __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(z), zi);
+    __m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+    __m512d inv_r = rsqrt_avx512(r2);
+    __m512d s = _mm512_mul_pd(inv_r, _mm512_mul_pd(inv_r, inv_r));
+    __m512d mj_s = _mm512_mul_pd(_mm512_loadu_pd(m), s);
+    __m512d mi_s = _mm512_mul_pd(mi, s);
+    rx = _mm512_fmadd_pd(dx, mj_s, rx);
+    ry = _mm512_fmadd_pd(dy, mj_s, ry);
+    rz = _mm512_fmadd_pd(dz, mj_s, rz);
+    _mm512_storeu_pd(ax, _mm512_fnmadd_pd(dx, mi_s, _mm512_loadu_pd(ax)));
+    _mm512_storeu_pd(ay, _mm512_fnmadd_pd(dy, mi_s, _mm512_loadu_pd(ay)));
+    _mm512_storeu_pd(az, _mm512_fnmadd_pd(dz, mi_s, _mm512_loadu_pd(az)));
+}
+
+// rows i and k = i + 1 against the same 8 partners: the partners' positions,
+// masses and accelerations are loaded and stored once for both rows. Lanes
+// not set in lanes read as massless particles at the origin and are not
+// stored, which covers the end of the rows.
+__attribute__((target("avx512f")))
+static inline void symmetric_pairs2_avx512(__m512d xi, __m512d yi, __m512d zi, __m512d mi,
+                                           __m512d xk, __m512d yk, __m512d zk, __m512d mk,
+                                           const double* x, const double* y, const double* z, const double* m,
+                                           double* ax, double* ay, double* az, __mmask8 lanes,
+                                           __m512d& rx, __m512d& ry, __m512d& rz,
+                                           __m512d& qx, __m512d& qy, __m512d& qz)
+{
+    const __m512d xj = _mm512_maskz_loadu_pd(lanes, x), yj = _mm512_maskz_loadu_pd(lanes, y);
+    const __m512d zj = _mm512_maskz_loadu_pd(lanes, z), mj = _mm512_maskz_loadu_pd(lanes, m);
+    __m512d dx = _mm512_sub_pd(xj, xi), dy = _mm512_sub_pd(yj, yi), dz = _mm512_sub_pd(zj, zi);
+    __m512d ex = _mm512_sub_pd(xj, xk), ey = _mm512_sub_pd(yj, yk), ez = _mm512_sub_pd(zj, zk);
+    __m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+    __m512d q2 = _mm512_fmadd_pd(ez, ez, _mm512_fmadd_pd(ey, ey, _mm512_mul_pd(ex, ex)));
+    __m512d inv_r = rsqrt_avx512(r2), inv_q = rsqrt_avx512(q2);
+    __m512d s = _mm512_mul_pd(inv_r, _mm512_mul_pd(inv_r, inv_r));
+    __m512d t = _mm512_mul_pd(inv_q, _mm512_mul_pd(inv_q, inv_q));
+    __m512d mj_s = _mm512_mul_pd(mj, s), mi_s = _mm512_mul_pd(mi, s);
+    __m512d mj_t = _mm512_mul_pd(mj, t), mk_t = _mm512_mul_pd(mk, t);
+    rx = _mm512_fmadd_pd(dx, mj_s, rx);
+    ry = _mm512_fmadd_pd(dy, mj_s, ry);
+    rz = _mm512_fmadd_pd(dz, mj_s, rz);
+    qx = _mm512_fmadd_pd(ex, mj_t, qx);
+    qy = _mm512_fmadd_pd(ey, mj_t, qy);
+    qz = _mm512_fmadd_pd(ez, mj_t, qz);
+    _mm512_mask_storeu_pd(ax, lanes, _mm512_fnmadd_pd(ex, mk_t, _mm512_fnmadd_pd(dx, mi_s, _mm512_maskz_loadu_pd(lanes, ax))));
+    _mm512_mask_storeu_pd(ay, lanes, _mm512_fnmadd_pd(ey, mk_t, _mm512_fnmadd_pd(dy, mi_s, _mm512_maskz_loadu_pd(lanes, ay))));
+    _mm512_mask_storeu_pd(az, lanes, _mm512_fnmadd_pd(ez, mk_t, _mm512_fnmadd_pd(dz, mi_s, _mm512_maskz_loadu_pd(lanes, az))));
+}
+
+__attribute__((target("avx512f")))
+void gravity_kernels::symmetric_avx512(const double* x, const double* y, const double* z,
+                                       const double* m, int n, int row_begin, int row_end,
+                                       double* ax, double* ay, double* az)
+{
+    int i = row_begin;
+    for (; i + 2 <= row_end; i += 2)
+    {
+        const int k = i + 1;
+        __m512d xi = _mm512_set1_pd(x[i]), yi = _mm512_set1_pd(y[i]), zi = _mm512_set1_pd(z[i]);
+        __m512d xk = _mm512_set1_pd(x[k]), yk = _mm512_set1_pd(y[k]), zk = _mm512_set1_pd(z[k]);
+        __m512d mi = _mm512_set1_pd(m[i]), mk = _mm512_set1_pd(m[k]);
+        __m512d rx0 = _mm512_setzero_pd(), ry0 = _mm512_setzero_pd(), rz0 = _mm512_setzero_pd();
+        __m512d qx0 = _mm512_setzero_pd(), qy0 = _mm512_setzero_pd(), qz0 = _mm512_setzero_pd();
+
+        // the pair (i, k) itself, then both rows over the partners after k
+        double rx = 0, ry = 0, rz = 0;
+        symmetric_scalar_row(x, y, z, m, i, k, k + 1, rx, ry, rz, ax, ay, az);
+        for (int j = k + 1; j < n; j += 8)
+            symmetric_pairs2_avx512(xi, yi, zi, mi, xk, yk, zk, mk, x + j, y + j, z + j, m + j,
+                                    ax + j, ay + j, az + j, (__mmask8)(0xFF >> std::max(0, j + 8 - n)),
+                                    rx0, ry0, rz0, qx0, qy0, qz0);
+        double qx = hsum_avx512(qx0), qy = hsum_avx512(qy0), qz = hsum_avx512(qz0);
+        rx += hsum_avx512(rx0);
+        ry += hsum_avx512(ry0);
+        rz += hsum_avx512(rz0);
+
+        ax[i] += rx;
+        ay[i] += ry;
+        az[i] += rz;
+        ax[k] += qx;
+        ay[k] += qy;
+        az[k] += qz;
+    }
+    for (; i < row_end; i++)
+    {
+        __m512d xi = _mm512_set1_pd(x[i]);
+        __m512d yi = _mm512_set1_pd(y[i]);
+        __m512d zi = _mm512_set1_pd(z[i]);
+        __m512d mi = _mm512_set1_pd(m[i]);
+        __m512d rx0 = _mm512_setzero_pd(), ry0 = _mm512_setzero_pd(), rz0 = _mm512_setzero_pd();
+
+        int j = i + 1;
+        for (; j + 8 <= n; j += 8)
+            symmetric_pairs_avx512(xi, yi, zi, mi, x + j, y + j, z + j, m + j,
+                                   ax + j, ay + j, az + j, rx0, ry0, rz0);
+        double rx = hsum_avx512(rx0);
+        double ry = hsum_avx512(ry0);
+        double rz = hsum_avx512(rz0);
+        symmetric_scalar_row(x, y, z, m, i, j, n, rx, ry, rz, ax, ay, az);
+
+        ax[i] += rx;
+        ay[i] += ry;
+        az[i] += rz;
+    }
+}
+
+#else
+
+void gravity_kernels::direct_avx2(const double* sx, const double* sy, const double* sz,
+                                  const double* sm, int ns,
+                                  const double* tx, const double* ty, const double* tz, int nt,
+                                  double G, double* ax, double* ay, double* az)
+{
+    direct_scalar(sx, sy, sz, sm, ns, tx, ty, tz, nt, G, ax, ay, az);
+}
+
+void gravity_kernels::direct_avx512(const double* sx, const double* sy, const double* sz,
+                                    const double* sm, int ns,
+                                    const double* tx, const double* ty, const double* tz, int nt,
+                                    double G, double* ax, double* ay, double* az)
+{
+    direct_scalar(sx, sy, sz, sm, ns, tx, ty, tz, nt, G, ax, ay, az);
+}
+
+void gravity_kernels::symmetric_avx2(const double* x, const double* y, const double* z,
+                                     const double* m, int n, int row_begin, int row_end,
+                                     double* ax, double* ay, double* az)
+{
+    symmetric_scalar(x, y, z, m, n, row_begin, row_end, ax, ay, az);
+}
+
+void gravity_kernels::symmetric_avx512(const double* x, const double* y, const double* z,
+                                       const double* m, int n, int row_begin, int row_end,
+                                       double* ax, double* ay, double* az)
+{
+    symmetric_scalar(x, y, z, m, n, row_begin, row_end, ax, ay, az);
+}
+
+#endif
+
+std::vector<gravity_kernels::kernel_info> gravity_kernels::available_kernels()
+{
+    bool avx2 = false, avx512 = false;
+#ifdef CELESTIAL_X86
+    __builtin_cpu_init();
+    avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    avx512 = __builtin_cpu_supports("avx512f");
+#endif
+    return {
+        { "avx512", direct_avx512, symmetric_avx512, avx512 },
+        { "avx2", direct_avx2, symmetric_avx2, avx2 },
+        { "scalar", direct_scalar, symmetric_scalar, true }
+    };
+}
+
+const gravity_kernels::kernel_info& gravity_kernels::best_direct_kernel()
+{
+    static const kernel_info selected = []()
+    {
+        auto kernels = available_kernels();
+        const char* requested = getenv("CELESTIAL_KERNEL");
+        if (requested)
+        {
+            for (const auto& k : kernels)
+                if (k.supported && strcmp(k.name, requested) == 0)
+                    return k;
+            std::cerr << "CELESTIAL_KERNEL=" << requested
+                      << " is not available on this CPU, using autodetection" << std::endl;
+        }
+        for (const auto& k : kernels)
+            if (k.supported)
+                return k;
+        return kernels.back();
+    }();
+    return selected;
+}
+
+void gravity_kernels::accelerations(const ParticleSet& particles, double G,
+                                    std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az)
+{
+    const int n = (int)particles.size();
+    ax.assign(n, 0.0);
+    ay.assign(n, 0.0);
+    az.assign(n, 0.0);
+    best_direct_kernel().function(particles.x.data(), particles.y.data(), particles.z.data(),
+                                  particles.mass.data(), n,
+                                  particles.x.data(), particles.y.data(), particles.z.data(), n,
+                                  G, ax.data(), ay.data(), az.data());
+}
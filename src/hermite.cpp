@@ -0,0 +1,912 @@
+/*
+ * hermite.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/*
+ * Hermite integrators for N-body systems in units G = 1.
+ *
+ * The shared time step driver (evolve, evolve_step and helpers) is Piet Hut
+ * and Jun Makino's nbody_sh1 (ref.: Hut, P., Makino, J. & McMillan, S.,
+ * 1995, ApJL 443, L93), its state kept in a HermiteEngine; the snapshot i/o
+ * is in integration.cpp, the diagnostics in diagnostics.cpp. The block time step driver (evolve_block) follows Makino & Aarseth
+ * 1992, PASJ 44, 141.
+ */
+
+#include <cmath>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "include/hermite.h"
+#include "include/gravity_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CELESTIAL_X86 1
+#endif
+
+//Rows handed to an OpenMP thread at a time
+#define HERMITE_ROW_BLOCK 16
+//Below this many pair interactions per thread the parallel region costs more than it saves
+#define HERMITE_MIN_PAIRS_PER_THREAD 65536
+
+using std::cerr;
+using std::endl;
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: evolve
+ *
+ *DESCRIPTION: integrates an N-body system, for a total duration dt_tot.
+ *             Snapshots are sent to the standard output stream once every
+ *             time interval dt_out. Diagnostics are sent to the standard
+ *             error stream once every time interval dt_dia.
+ *
+ *  note: the integration time step, shared by all particles at any given time,
+ *        is variable. Before each integration step we use coll_time (short
+ *        for collision time, an estimate of the time scale for any significant
+ *        change in configuration to happen), multiplying it by dt_param (the
+ *        accuracy parameter governing the size of dt in units of coll_time),
+ *        to obtain the new time step size.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void evolve(const real mass[], real pos[][NDIM], real vel[][NDIM],
+            int n, real & t, real dt_param, real dt_dia, real dt_out,
+            real dt_tot, bool init_out, bool x_flag)
+{
+    cerr << "Starting a Hermite integration for a " << n
+         << "-body system,\n  from time t = " << t
+         << " with time step control parameter dt_param = " << dt_param
+         << "  until time " << t + dt_tot
+         << " ,\n  with diagnostics output interval dt_dia = "
+         << dt_dia << ",\n  and snapshot output interval dt_out = "
+         << dt_out << "." << endl;
+
+    HermiteEngine engine(n);
+    engine.load(mass, pos, vel, t);
+    engine.start_shared();
+
+    int nsteps = 0;               // number of integration time steps completed
+    real einit;                   // initial total energy of the system
+
+    write_diagnostics(mass, engine.positions(), engine.velocities(),
+                      engine.accelerations(), engine.jerks(), n, t,
+                      engine.potential(), nsteps, einit, true, x_flag);
+    if (init_out)                                    // flag for initial output
+        put_snapshot(mass, pos, vel, n, t);
+
+    real t_dia = t + dt_dia;           // next time for diagnostics output
+    real t_out = t + dt_out;           // next time for snapshot output
+    real t_end = t + dt_tot;           // final time, to finish the integration
+
+    while (true){
+        while (engine.time() < t_dia && engine.time() < t_out
+               && engine.time() < t_end){
+            real epot, coll_time;
+            evolve_step(engine, dt_param * engine.collision_time(), epot, coll_time);
+            nsteps++;
+        }
+        t = engine.time();
+        if (t >= t_dia){
+            write_diagnostics(mass, engine.positions(), engine.velocities(),
+                              engine.accelerations(), engine.jerks(), n, t,
+                              engine.potential(), nsteps, einit, false, x_flag);
+            t_dia += dt_dia;
+        }
+        if (t >= t_out){
+            put_snapshot(mass, engine.positions(), engine.velocities(), n, t);
+            t_out += dt_out;
+        }
+        if (t >= t_end)
+            break;
+    }
+    engine.store(pos, vel);
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: evolve_step
+ *
+ *DESCRIPTION: takes one integration step for the N-body system loaded in
+ *             engine, using the Hermite algorithm. The previous state is
+ *             kept in the engine workspace, so a step never allocates.
+ *             The engine must have been started with start_shared().
+ *
+ *RETURNS: potential energy and collision time of the new state in epot and
+ *         coll_time
+ *-----------------------------------------------------------------------------
+ */
+void evolve_step(HermiteEngine& engine, real dt, real & epot, real & coll_time)
+{
+    engine.step(dt);
+    epot = engine.potential();
+    coll_time = engine.collision_time();
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: predict_step
+ *
+ *DESCRIPTION: takes the first approximation of one Hermite integration
+ *             step, advancing the positions and velocities through a
+ *             Taylor series development up to the order of the jerks.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void predict_step(real pos[][NDIM], real vel[][NDIM],
+                  const real acc[][NDIM], const real jerk[][NDIM],
+                  int n, real dt)
+{
+    for (int i = 0; i < n ; i++)
+        for (int k = 0; k < NDIM ; k++){
+            pos[i][k] += vel[i][k]*dt + acc[i][k]*dt*dt/2
+                         + jerk[i][k]*dt*dt*dt/6;
+            vel[i][k] += acc[i][k]*dt + jerk[i][k]*dt*dt/2;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: correct_step
+ *
+ *DESCRIPTION: takes one iteration to improve the new values of position
+ *             and velocities, effectively by using a higher-order
+ *             Taylor series constructed from the terms up to jerk at
+ *             the beginning and the end of the time step.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void correct_step(real pos[][NDIM], real vel[][NDIM],
+                  const real acc[][NDIM], const real jerk[][NDIM],
+                  const real old_pos[][NDIM], const real old_vel[][NDIM],
+                  const real old_acc[][NDIM], const real old_jerk[][NDIM],
+                  int n, real dt)
+{
+    for (int i = 0; i < n ; i++)
+        for (int k = 0; k < NDIM ; k++){
+            vel[i][k] = old_vel[i][k] + (old_acc[i][k] + acc[i][k])*dt/2
+                        + (old_jerk[i][k] - jerk[i][k])*dt*dt/12;
+            pos[i][k] = old_pos[i][k] + (old_vel[i][k] + vel[i][k])*dt/2
+                        + (old_acc[i][k] - acc[i][k])*dt*dt/12;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: get_acc_jerk_pot_coll_scalar
+ *
+ *DESCRIPTION: nbody_sh1 reference version of get_acc_jerk_pot_coll().
+ *             Calculates accelerations and jerks, and as side effects also
+ *             calculates potential energy and the time scale coll_time for
+ *             significant changes in local configurations to occur.
+ *
+ *  a_ji = M_j r_ji / |r_ji|^3
+ *  j_ji = M_j [ v_ji - 3 (r_ji . v_ji) r_ji / |r_ji|^2 ] / |r_ji|^3
+ *
+ *  note: it would be cleaner to calculate potential energy and collision time
+ *        in a separate function. However, the current function is by far the
+ *        most time consuming part of the whole program, with a double loop
+ *        over all particles that is executed every time step. Splitting off
+ *        some of the work to another function would significantly increase
+ *        the total computer time (by an amount close to a factor two).
+ *
+ *  The collision time is the minimum over all pairs of two estimates:
+ *  |r|/|v| for unaccelerated linear motion and sqrt(|r|/|a|) for free fall,
+ *  kept to the fourth power inside the loop. Only pairs j > i are visited,
+ *  the contribution of i to j follows by symmetry.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void get_acc_jerk_pot_coll_scalar(const real mass[], const real pos[][NDIM],
+                                  const real vel[][NDIM], real acc[][NDIM],
+                                  real jerk[][NDIM], int n, real & epot,
+                                  real & coll_time)
+{
+    for (int i = 0; i < n ; i++)
+        for (int k = 0; k < NDIM ; k++)
+            acc[i][k] = jerk[i][k] = 0;
+    epot = 0;
+    const real VERY_LARGE_NUMBER = 1e300;
+    real coll_time_q = VERY_LARGE_NUMBER;      // collision time to 4th power
+    real coll_est_q;                           // collision time scale estimate
+                                               // to 4th power (quartic)
+    for (int i = 0; i < n ; i++){
+        for (int j = i+1; j < n ; j++){            // rji[] is the vector from
+            real rji[NDIM];                        // particle i to particle j
+            real vji[NDIM];                        // vji[] = d rji[] / d t
+            for (int k = 0; k < NDIM ; k++){
+                rji[k] = pos[j][k] - pos[i][k];
+                vji[k] = vel[j][k] - vel[i][k];
+            }
+            real r2 = 0;                           // | rji |^2
+            real v2 = 0;                           // | vji |^2
+            real rv_r2 = 0;                        // ( rij . vij ) / | rji |^2
+            for (int k = 0; k < NDIM ; k++){
+                r2 += rji[k] * rji[k];
+                v2 += vji[k] * vji[k];
+                rv_r2 += rji[k] * vji[k];
+            }
+            rv_r2 /= r2;
+            real r = sqrt(r2);                     // | rji |
+            real r3 = r * r2;                      // | rji |^3
+
+            // add the {i,j} contribution to the total potential energy for the system:
+
+            epot -= mass[i] * mass[j] / r;
+
+            // add the {j (i)} contribution to the {i (j)} values of acceleration and jerk:
+
+            real da[NDIM];                            // main terms in pairwise
+            real dj[NDIM];                            // acceleration and jerk
+            for (int k = 0; k < NDIM ; k++){
+                da[k] = rji[k] / r3;                           // see equations
+                dj[k] = (vji[k] - 3 * rv_r2 * rji[k]) / r3;    // in the header
+            }
+            for (int k = 0; k < NDIM ; k++){
+                acc[i][k] += mass[j] * da[k];                 // using symmetry
+                acc[j][k] -= mass[i] * da[k];                 // find pairwise
+                jerk[i][k] += mass[j] * dj[k];                // acceleration
+                jerk[j][k] -= mass[i] * dj[k];                // and jerk
+            }
+
+            // first collision time estimate, based on unaccelerated linear motion:
+
+            coll_est_q = (r2*r2) / (v2*v2);
+            if (coll_time_q > coll_est_q)
+                coll_time_q = coll_est_q;
+
+            // second collision time estimate, based on free fall:
+
+            real da2 = 0;                                  // da2 becomes the
+            for (int k = 0; k < NDIM ; k++)                // square of the
+                da2 += da[k] * da[k];                      // pair-wise accel-
+            double mij = mass[i] + mass[j];                // eration between
+            da2 *= mij * mij;                              // particles i and j
+
+            coll_est_q = r2/da2;
+            if (coll_time_q > coll_est_q)
+                coll_time_q = coll_est_q;
+        }
+    }                                               // from q for quartic back
+    coll_time = sqrt(sqrt(coll_time_q));            // to linear collision time
+}
+
+void hermite_sources::fill(const real mass[], const real pos[][NDIM],
+                           const real vel[][NDIM], int n)
+{
+    for (int i = 0; i < n; i++){
+        m[i] = mass[i];
+        x[i] = pos[i][0];
+        y[i] = pos[i][1];
+        z[i] = pos[i][2];
+        vx[i] = vel[i][0];
+        vy[i] = vel[i][1];
+        vz[i] = vel[i][2];
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: acc_jerk_rows
+ *
+ *DESCRIPTION: fused acceleration, jerk, potential and collision time loop
+ *             for rows [begin, end), row r being particle active[r] (or r
+ *             when active is null), against all n sources. The inner loop is
+ *             vectorised over sources with one accumulator per quantity and
+ *             the collision time reduced as the maximum of its inverse
+ *             fourth power, which needs no division per pair. The particle
+ *             itself is masked out. Adds half the potential energy of the
+ *             rows to epot and raises inv_coll_q to their largest inverse.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+static inline __attribute__((always_inline))
+void acc_jerk_rows(const hermite_sources& s, int n, const int active[],
+                   int begin, int end, real acc[][NDIM], real jerk[][NDIM],
+                   real & epot, real & inv_coll_q)
+{
+    const real* __restrict m = s.m;
+    const real* __restrict x = s.x;
+    const real* __restrict y = s.y;
+    const real* __restrict z = s.z;
+    const real* __restrict vx = s.vx;
+    const real* __restrict vy = s.vy;
+    const real* __restrict vz = s.vz;
+    for (int r = begin; r < end; r++){
+        const int i = active ? active[r] : r;
+        const real xi = x[i], yi = y[i], zi = z[i];
+        const real vxi = vx[i], vyi = vy[i], vzi = vz[i], mi = m[i];
+        real ax = 0, ay = 0, az = 0, jx = 0, jy = 0, jz = 0;
+        real pot = 0, inv_q = 0;
+        #pragma omp simd reduction(+:ax,ay,az,jx,jy,jz,pot) reduction(max:inv_q)
+        for (int j = 0; j < n; j++){
+            const real dx = x[j] - xi, dy = y[j] - yi, dz = z[j] - zi;
+            const real dvx = vx[j] - vxi, dvy = vy[j] - vyi, dvz = vz[j] - vzi;
+            const real r2 = dx*dx + dy*dy + dz*dz;
+            const real v2 = dvx*dvx + dvy*dvy + dvz*dvz;
+            const real rv = dx*dvx + dy*dvy + dz*dvz;
+            const real other = r2 > 0 ? 1.0 : 0.0;
+            const real inv_r = other / sqrt(r2 + (1 - other));
+            const real inv_r2 = inv_r * inv_r;
+            const real mr3 = m[j] * inv_r * inv_r2;
+            const real alpha = 3 * rv * inv_r2;
+            ax += mr3 * dx;
+            ay += mr3 * dy;
+            az += mr3 * dz;
+            jx += mr3 * (dvx - alpha * dx);
+            jy += mr3 * (dvy - alpha * dy);
+            jz += mr3 * (dvz - alpha * dz);
+            pot -= m[j] * inv_r;
+            // inverse fourth powers of the linear motion and free fall estimates
+            const real mij = mi + m[j];
+            const real linear = v2 * v2 * inv_r2 * inv_r2;
+            const real free_fall = mij * mij * inv_r2 * inv_r2 * inv_r2;
+            inv_q = std::max(inv_q, std::max(linear, free_fall));
+        }
+        acc[r][0] = ax;
+        acc[r][1] = ay;
+        acc[r][2] = az;
+        jerk[r][0] = jx;
+        jerk[r][1] = jy;
+        jerk[r][2] = jz;
+        epot += 0.5 * mi * pot;
+        inv_coll_q = std::max(inv_coll_q, inv_q);
+    }
+}
+
+typedef void (*acc_jerk_kernel)(const hermite_sources& s, int n, const int active[],
+                                int begin, int end, real acc[][NDIM], real jerk[][NDIM],
+                                real & epot, real & inv_coll_q);
+
+static void acc_jerk_rows_scalar(const hermite_sources& s, int n, const int active[],
+                                 int begin, int end, real acc[][NDIM], real jerk[][NDIM],
+                                 real & epot, real & inv_coll_q)
+{
+    acc_jerk_rows(s, n, active, begin, end, acc, jerk, epot, inv_coll_q);
+}
+
+#ifdef CELESTIAL_X86
+__attribute__((target("avx2,fma")))
+static void acc_jerk_rows_avx2(const hermite_sources& s, int n, const int active[],
+                               int begin, int end, real acc[][NDIM], real jerk[][NDIM],
+                               real & epot, real & inv_coll_q)
+{
+    acc_jerk_rows(s, n, active, begin, end, acc, jerk, epot, inv_coll_q);
+}
+
+__attribute__((target("avx512f")))
+static void acc_jerk_rows_avx512(const hermite_sources& s, int n, const int active[],
+                                 int begin, int end, real acc[][NDIM], real jerk[][NDIM],
+                                 real & epot, real & inv_coll_q)
+{
+    acc_jerk_rows(s, n, active, begin, end, acc, jerk, epot, inv_coll_q);
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: selected_acc_jerk_kernel
+ *
+ *DESCRIPTION: instruction set of the row loop, the same one the direct
+ *             summation kernels picked for this CPU (and CELESTIAL_KERNEL)
+ *
+ *RETURNS: acc_jerk_kernel
+ *-----------------------------------------------------------------------------
+ */
+static acc_jerk_kernel selected_acc_jerk_kernel()
+{
+    static const acc_jerk_kernel selected = []()
+    {
+#ifdef CELESTIAL_X86
+        const char* name = gravity_kernels::best_direct_kernel().name;
+        if (strcmp(name, "avx512") == 0)
+            return acc_jerk_rows_avx512;
+        if (strcmp(name, "avx2") == 0)
+            return acc_jerk_rows_avx2;
+#endif
+        return acc_jerk_rows_scalar;
+    }();
+    return selected;
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: acc_jerk_pot_coll_sources
+ *
+ *DESCRIPTION: accelerations and jerks of the n_active particles listed in
+ *             active[] (all n in order when active is null) due to all n
+ *             particles, stored in rows 0 ... n_active-1 of acc[] and
+ *             jerk[], with the potential energy of those rows and the
+ *             collision time of nbody_sh1. Every row visits all n sources,
+ *             so rows are independent: blocks of them are spread over the
+ *             OpenMP threads, each with its own partial potential and
+ *             collision time, combined by the reduction clauses.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void acc_jerk_pot_coll_sources(const hermite_sources& s, int n,
+                               const int active[], int n_active,
+                               real acc[][NDIM], real jerk[][NDIM],
+                               real & epot, real & coll_time)
+{
+    acc_jerk_kernel rows = selected_acc_jerk_kernel();
+    real pot = 0, inv_q = 0;
+#ifdef _OPENMP
+    int threads = (int)std::min<long long>(omp_get_max_threads(),
+                  std::max<long long>(1, (long long)n_active * n / HERMITE_MIN_PAIRS_PER_THREAD));
+    #pragma omp parallel for num_threads(threads) if(threads > 1) schedule(static) reduction(+:pot) reduction(max:inv_q)
+    for (int block = 0; block < n_active; block += HERMITE_ROW_BLOCK)
+        rows(s, n, active, block, std::min(block + HERMITE_ROW_BLOCK, n_active),
+             acc, jerk, pot, inv_q);
+#else
+    rows(s, n, active, 0, n_active, acc, jerk, pot, inv_q);
+#endif
+    epot = pot;
+    const real VERY_LARGE_NUMBER = 1e300;
+    coll_time = sqrt(sqrt(inv_q > 0 ? 1 / inv_q : VERY_LARGE_NUMBER));
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: thread_sources
+ *
+ *DESCRIPTION: structure of arrays copy of the state in a buffer owned by the
+ *             calling thread, which only allocates when n grows
+ *
+ *RETURNS: hermite_sources
+ *-----------------------------------------------------------------------------
+ */
+static hermite_sources thread_sources(const real mass[], const real pos[][NDIM],
+                                      const real vel[][NDIM], int n)
+{
+    static thread_local std::vector<real> buffer;
+    if (buffer.size() < 7 * (std::size_t)n)
+        buffer.resize(7 * (std::size_t)n);
+    real* b = buffer.data();
+    hermite_sources s{ b, b + n, b + 2*n, b + 3*n, b + 4*n, b + 5*n, b + 6*n };
+    s.fill(mass, pos, vel, n);
+    return s;
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: get_acc_jerk_pot_coll
+ *
+ *DESCRIPTION: calculates accelerations and jerks, and as side effects also
+ *             calculates potential energy and the time scale coll_time for
+ *             significant changes in local configurations to occur, in one
+ *             fused vectorised and multithreaded pass (see
+ *             acc_jerk_pot_coll_sources). Agrees with
+ *             get_acc_jerk_pot_coll_scalar() to round-off: every pair is
+ *             evaluated from both sides instead of once, which doubles the
+ *             arithmetic but lets rows run independently.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void get_acc_jerk_pot_coll(const real mass[], const real pos[][NDIM],
+                           const real vel[][NDIM], real acc[][NDIM],
+                           real jerk[][NDIM], int n, real & epot,
+                           real & coll_time)
+{
+    hermite_sources s = thread_sources(mass, pos, vel, n);
+    acc_jerk_pot_coll_sources(s, n, nullptr, n, acc, jerk, epot, coll_time);
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: get_acc_jerk_active
+ *
+ *DESCRIPTION: accelerations and jerks of the n_active particles listed in
+ *             active[], due to all n particles. Results are stored in rows
+ *             0 ... n_active-1 of acc[] and jerk[]. The cost is
+ *             n_active * n pair interactions, no symmetry is used because the
+ *             sources are in general not active themselves.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void get_acc_jerk_active(const real mass[], const real pos[][NDIM],
+                         const real vel[][NDIM], const int active[],
+                         int n_active, int n, real acc[][NDIM],
+                         real jerk[][NDIM])
+{
+    hermite_sources s = thread_sources(mass, pos, vel, n);
+    real epot, coll_time;
+    acc_jerk_pot_coll_sources(s, n, active, n_active, acc, jerk, epot, coll_time);
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: potential_energy
+ *
+ *DESCRIPTION: potential energy of the system, for diagnostics of drivers
+ *             that do not get it from get_acc_jerk_pot_coll()
+ *
+ *RETURNS: real
+ *-----------------------------------------------------------------------------
+ */
+real potential_energy(const real mass[], const real pos[][NDIM], int n)
+{
+    real epot = 0;
+    for (int i = 0; i < n; i++)
+        for (int j = i+1; j < n; j++){
+            real r2 = 0;
+            for (int k = 0; k < NDIM; k++)
+                r2 += (pos[j][k] - pos[i][k]) * (pos[j][k] - pos[i][k]);
+            epot -= mass[i] * mass[j] / sqrt(r2);
+        }
+    return epot;
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: aarseth_timestep
+ *
+ *DESCRIPTION: Aarseth time step criterion from the acceleration and its
+ *             first three time derivatives:
+ *
+ *  dt = sqrt( eta (|a| |a2| + |j|^2) / (|j| |a3| + |a2|^2) )
+ *
+ *RETURNS: real, 0 if the derivatives vanish
+ *-----------------------------------------------------------------------------
+ */
+static real aarseth_timestep(const real acc[NDIM], const real jerk[NDIM],
+                             const real snap[NDIM], const real crackle[NDIM],
+                             real eta)
+{
+    real a2 = 0, j2 = 0, s2 = 0, c2 = 0;
+    for (int k = 0; k < NDIM; k++){
+        a2 += acc[k] * acc[k];
+        j2 += jerk[k] * jerk[k];
+        s2 += snap[k] * snap[k];
+        c2 += crackle[k] * crackle[k];
+    }
+    real denominator = sqrt(j2 * c2) + s2;
+    if (denominator <= 0)
+        return 0;
+    return sqrt(eta * (sqrt(a2 * s2) + j2) / denominator);
+}
+
+std::size_t HermiteEngine::workspace_bytes(int n)
+{
+    return Arena::bytes_for<real>(n) * 3                    // mass, time, step
+           + Arena::bytes_for<real>(NDIM * n) * 8           // current and old pos, vel, acc, jerk
+           + Arena::bytes_for<int>(n)                       // active block
+           + Arena::bytes_for<real>(n) * 7;                 // sources
+}
+
+HermiteEngine::HermiteEngine(int n, bool huge_pages) :
+        m_arena(workspace_bytes(n), huge_pages),
+        m_n(n),
+        m_t(0),
+        m_epot(0),
+        m_coll_time(0),
+        m_t0(0),
+        m_t_block(0),
+        m_dt_max(1),
+        m_dt_min(1),
+        m_steps(0),
+        m_particle_steps(0),
+        m_interactions(0)
+{
+    auto rows = [this, n]() { return reinterpret_cast<real (*)[NDIM]>(m_arena.allocate<real>(NDIM * n)); };
+    m_mass = m_arena.allocate<real>(n);
+    m_pos = rows();
+    m_vel = rows();
+    m_acc = rows();
+    m_jerk = rows();
+    m_old_pos = rows();
+    m_old_vel = rows();
+    m_old_acc = rows();
+    m_old_jerk = rows();
+    m_time = m_arena.allocate<real>(n);
+    m_step = m_arena.allocate<real>(n);
+    m_active = m_arena.allocate<int>(n);
+    m_sources.m = m_arena.allocate<real>(n);
+    m_sources.x = m_arena.allocate<real>(n);
+    m_sources.y = m_arena.allocate<real>(n);
+    m_sources.z = m_arena.allocate<real>(n);
+    m_sources.vx = m_arena.allocate<real>(n);
+    m_sources.vy = m_arena.allocate<real>(n);
+    m_sources.vz = m_arena.allocate<real>(n);
+}
+
+void HermiteEngine::load(const real mass[], const real pos[][NDIM], const real vel[][NDIM], real t)
+{
+    for (int i = 0; i < m_n; i++){
+        m_mass[i] = mass[i];
+        for (int k = 0; k < NDIM; k++){
+            m_pos[i][k] = pos[i][k];
+            m_vel[i][k] = vel[i][k];
+        }
+    }
+    m_t = m_t0 = t;
+}
+
+void HermiteEngine::store(real pos[][NDIM], real vel[][NDIM]) const
+{
+    for (int i = 0; i < m_n; i++)
+        for (int k = 0; k < NDIM; k++){
+            pos[i][k] = m_pos[i][k];
+            vel[i][k] = m_vel[i][k];
+        }
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: HermiteEngine::start_shared
+ *
+ *DESCRIPTION: accelerations, jerks, potential energy and collision time of
+ *             the loaded state, needed before the first shared step
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void HermiteEngine::start_shared()
+{
+    m_sources.fill(m_mass, m_pos, m_vel, m_n);
+    acc_jerk_pot_coll_sources(m_sources, m_n, nullptr, m_n, m_acc, m_jerk,
+                              m_epot, m_coll_time);
+    m_interactions += (long long)m_n * (m_n - 1) / 2;
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: HermiteEngine::step
+ *
+ *DESCRIPTION: one shared Hermite step of every particle. The current
+ *             buffers become the old ones by a pointer swap and the
+ *             predictor fills the new ones from them, so the previous
+ *             state is never copied.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void HermiteEngine::step(real dt)
+{
+    std::swap(m_pos, m_old_pos);
+    std::swap(m_vel, m_old_vel);
+    std::swap(m_acc, m_old_acc);
+    std::swap(m_jerk, m_old_jerk);
+
+    for (int i = 0; i < m_n; i++)
+        for (int k = 0; k < NDIM; k++){
+            m_pos[i][k] = m_old_pos[i][k] + m_old_vel[i][k]*dt
+                          + m_old_acc[i][k]*dt*dt/2 + m_old_jerk[i][k]*dt*dt*dt/6;
+            m_vel[i][k] = m_old_vel[i][k] + m_old_acc[i][k]*dt
+                          + m_old_jerk[i][k]*dt*dt/2;
+        }
+    m_sources.fill(m_mass, m_pos, m_vel, m_n);
+    acc_jerk_pot_coll_sources(m_sources, m_n, nullptr, m_n, m_acc, m_jerk,
+                              m_epot, m_coll_time);
+    correct_step(m_pos, m_vel, m_acc, m_jerk, m_old_pos, m_old_vel, m_old_acc,
+                 m_old_jerk, m_n, dt);
+    m_t += dt;
+
+    m_steps++;
+    m_particle_steps += m_n;
+    m_interactions += (long long)m_n * (m_n - 1) / 2;
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: HermiteEngine::start_block
+ *
+ *DESCRIPTION: accelerations and jerks of every particle and their first
+ *             block steps, dt_param |a| / |j| rounded down to a power of two
+ *             fraction of dt_max. The current time becomes the origin of the
+ *             block times.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void HermiteEngine::start_block(real dt_param, real dt_max)
+{
+    m_t0 = m_t;
+    m_t_block = 0;
+    m_dt_max = dt_max;
+    m_dt_min = ldexp(dt_max, -BLOCK_MAX_LEVELS);
+
+    for (int i = 0; i < m_n; i++)
+        m_active[i] = i;
+    real epot, coll_time;
+    m_sources.fill(m_mass, m_pos, m_vel, m_n);
+    acc_jerk_pot_coll_sources(m_sources, m_n, m_active, m_n, m_acc, m_jerk,
+                              epot, coll_time);
+    m_interactions += (long long)m_n * m_n;
+
+    // no higher derivatives yet: start conservatively from |a| / |j|
+    for (int i = 0; i < m_n; i++){
+        real a2 = 0, j2 = 0;
+        for (int k = 0; k < NDIM; k++){
+            a2 += m_acc[i][k] * m_acc[i][k];
+            j2 += m_jerk[i][k] * m_jerk[i][k];
+        }
+        real target = j2 > 0 ? dt_param * sqrt(a2 / j2) : dt_max;
+        real dt = dt_max;
+        while (dt > target && dt > m_dt_min)
+            dt /= 2;
+        m_time[i] = 0;
+        m_step[i] = dt;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: HermiteEngine::step_block
+ *
+ *DESCRIPTION: advances the block of particles with the earliest due time:
+ *             predicts every particle to that time, evaluates accelerations
+ *             and jerks for the active ones only, corrects them and picks
+ *             their next steps from the Aarseth criterion with eta =
+ *             dt_param.
+ *
+ *RETURNS: int, number of particles advanced
+ *-----------------------------------------------------------------------------
+ */
+int HermiteEngine::step_block(real dt_param)
+{
+    const int n = m_n;
+
+    // next block time and the particles due at it
+    real t_next = m_time[0] + m_step[0];
+    for (int i = 1; i < n; i++)
+        t_next = std::min(t_next, m_time[i] + m_step[i]);
+    int n_active = 0;
+    for (int i = 0; i < n; i++)
+        if (m_time[i] + m_step[i] == t_next)
+            m_active[n_active++] = i;
+
+    // predictor for every particle, at the time of the block
+    real (* pred_pos)[NDIM] = m_old_pos;
+    real (* pred_vel)[NDIM] = m_old_vel;
+    for (int i = 0; i < n; i++){
+        real dt = t_next - m_time[i];
+        for (int k = 0; k < NDIM; k++){
+            pred_pos[i][k] = m_pos[i][k] + m_vel[i][k]*dt + m_acc[i][k]*dt*dt/2
+                             + m_jerk[i][k]*dt*dt*dt/6;
+            pred_vel[i][k] = m_vel[i][k] + m_acc[i][k]*dt + m_jerk[i][k]*dt*dt/2;
+        }
+    }
+
+    // forces only on the active block
+    real (* new_acc)[NDIM] = m_old_acc;
+    real (* new_jerk)[NDIM] = m_old_jerk;
+    real epot, coll_time;
+    m_sources.fill(m_mass, pred_pos, pred_vel, n);
+    acc_jerk_pot_coll_sources(m_sources, n, m_active, n_active, new_acc,
+                              new_jerk, epot, coll_time);
+
+    // corrector and next step of the active particles
+    for (int a = 0; a < n_active; a++){
+        const int i = m_active[a];
+        const real dt = m_step[i];
+        real snap[NDIM], crackle[NDIM];
+        for (int k = 0; k < NDIM; k++){
+            // Hermite interpolation of the acceleration over the step gives
+            // its second and third derivatives at the start of the step
+            real a0 = m_acc[i][k], a1 = new_acc[a][k];
+            real j0 = m_jerk[i][k], j1 = new_jerk[a][k];
+            real snap0 = (-6*(a0 - a1) - dt*(4*j0 + 2*j1)) / (dt*dt);
+            crackle[k] = (12*(a0 - a1) + 6*dt*(j0 + j1)) / (dt*dt*dt);
+            snap[k] = snap0 + crackle[k]*dt;
+
+            real v1 = m_vel[i][k] + (a0 + a1)*dt/2 + (j0 - j1)*dt*dt/12;
+            m_pos[i][k] += (m_vel[i][k] + v1)*dt/2 + (a0 - a1)*dt*dt/12;
+            m_vel[i][k] = v1;
+            m_acc[i][k] = a1;
+            m_jerk[i][k] = j1;
+        }
+
+        // halve as often as needed, double at most once and only where the
+        // doubled step stays commensurate with the block times
+        real target = aarseth_timestep(m_acc[i], m_jerk[i], snap, crackle, dt_param);
+        real new_dt = dt;
+        if (target <= 0)
+            target = m_dt_max;
+        if (target < dt){
+            while (new_dt > target && new_dt > m_dt_min)
+                new_dt /= 2;
+        }
+        else if (target >= 2*dt && 2*dt <= m_dt_max && fmod(t_next, 2*dt) == 0)
+            new_dt = 2*dt;
+        m_time[i] = t_next;
+        m_step[i] = new_dt;
+    }
+
+    m_t_block = t_next;
+    m_t = m_t0 + t_next;
+    m_steps++;
+    m_particle_steps += n_active;
+    m_interactions += (long long)n_active * n;
+    return n_active;
+}
+
+/*-----------------------------------------------------------------------------
+ *PROCEDURE: evolve_block
+ *
+ *DESCRIPTION: integrates an N-body system for a total duration dt_tot with
+ *             individual block time steps, with the same output as evolve().
+ *             The steps are powers of two, at most the largest power of two
+ *             not exceeding dt_dia, dt_out and dt_tot, so every particle is
+ *             synchronised at multiples of it; output happens at the first
+ *             synchronisation at or after the requested time. dt_param is
+ *             the eta of the Aarseth criterion.
+ *
+ *RETURNS: -
+ *-----------------------------------------------------------------------------
+ */
+void evolve_block(const real mass[], real pos[][NDIM], real vel[][NDIM],
+                  int n, real & t, real dt_param, real dt_dia, real dt_out,
+                  real dt_tot, bool init_out, bool x_flag)
+{
+    real dt_max = 1;
+    real interval = std::min(dt_dia, std::min(dt_out, dt_tot));
+    while (dt_max > interval)
+        dt_max /= 2;
+    while (2 * dt_max <= interval)
+        dt_max *= 2;
+
+    cerr << "Starting a block time step Hermite integration for a " << n
+         << "-body system,\n  from time t = " << t
+         << " with time step control parameter dt_param = " << dt_param
+         << "  until time " << t + dt_tot
+         << " ,\n  with maximum time step " << dt_max
+         << ", diagnostics output interval dt_dia = "
+         << dt_dia << ",\n  and snapshot output interval dt_out = "
+         << dt_out << "." << endl;
+
+    HermiteEngine engine(n);
+    engine.load(mass, pos, vel, t);
+    engine.start_block(dt_param, dt_max);
+
+    int nsteps = 0;               // number of block steps completed
+    real einit;                   // initial total energy of the system
+
+    write_diagnostics(mass, engine.positions(), engine.velocities(),
+                      engine.accelerations(), engine.jerks(), n, t,
+                      potential_energy(mass, engine.positions(), n), nsteps,
+                      einit, true, x_flag);
+    if (init_out)
+        put_snapshot(mass, pos, vel, n, t);
+
+    real t_dia = t + dt_dia;
+    real t_out = t + dt_out;
+    real t_end = t + dt_tot;
+
+    while (true){
+        do {
+            engine.step_block(dt_param);
+            nsteps++;
+            t = engine.time();
+        } while (!(engine.synchronized() && (t >= t_dia || t >= t_out || t >= t_end)));
+
+        if (t >= t_dia){
+            write_diagnostics(mass, engine.positions(), engine.velocities(),
+                              engine.accelerations(), engine.jerks(), n, t,
+                              potential_energy(mass, engine.positions(), n),
+                              nsteps, einit, false, x_flag);
+            cerr << "                "
+                 << engine.particle_steps() << " particle steps, "
+                 << (double)engine.particle_steps() / n << " per particle" << endl;
+            t_dia += dt_dia;
+        }
+        if (t >= t_out){
+            put_snapshot(mass, engine.positions(), engine.velocities(), n, t);
+            t_out += dt_out;
+        }
+        if (t >= t_end)
+            break;
+    }
+    engine.store(pos, vel);
+}
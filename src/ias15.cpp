@@ -0,0 +1,388 @@
+/*
+ * ias15.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "include/integration.h"
+
+using namespace solar_system;
+
+#define IAS15_SAFETY_FACTOR 0.25    // steps the error control would shorten below this ratio are redone
+#define IAS15_MAX_ITERATIONS 12     // predictor-corrector iterations per step
+#define IAS15_CONVERGENCE 1e-16     // relative change of the last coefficient that ends the iterations
+
+//Gauss-Radau spacings of the seven substeps, h_0 = 0 is the start of the step
+static const double IAS15_H[8] = { 0.0,
+                                   0.0562625605369221464656521910318,
+                                   0.180240691736892364987579942780,
+                                   0.352624717113169637373907769648,
+                                   0.547153626330555383001448554766,
+                                   0.734210177215410531523210605558,
+                                   0.885320946839095768090359771030,
+                                   0.977520613561287501891174488626 };
+
+/*
+ * Struct: ias15_coefficients
+ *
+ * OBJECTS: Constants relating the two forms of the acceleration polynomial,
+ * a(s) = a_0 + sum_k b_k s^(k+1) = a_0 + sum_j g_j s (s - h_1) ... (s - h_j)
+ * with s the fraction of the step: c[j][k] expands the Newton basis product
+ * of g_j into powers of s, r[n][j] = 1 / (h_n - h_j) builds the divided
+ * differences g_j from the substep accelerations.
+*/
+struct ias15_coefficients{
+    double c[7][7];
+    double r[8][8];
+
+    ias15_coefficients()
+    {
+        for (int j = 0; j < 7; j++)
+        {
+            double poly[8] = { 1.0 };
+            for (int i = 1; i <= j; i++)
+                for (int k = i; k >= 0; k--)
+                    poly[k] = (k > 0 ? poly[k - 1] : 0.0) - IAS15_H[i] * poly[k];
+            for (int k = 0; k < 7; k++)
+                c[j][k] = k <= j ? poly[k] : 0.0;
+        }
+        for (int n = 0; n < 8; n++)
+            for (int j = 0; j < 8; j++)
+                r[n][j] = n != j ? 1.0 / (IAS15_H[n] - IAS15_H[j]) : 0.0;
+    }
+};
+
+static const ias15_coefficients& coefficients()
+{
+    static const ias15_coefficients table;
+    return table;
+}
+
+/*
+ *PROCEDURE: add_compensated
+ *
+ *DESCRIPTION: Kahan summation: adds increment to sum, carrying the rounding
+ *error lost so far in compensation
+ *
+ *RETURNS: -
+ */
+static inline void add_compensated(double& sum, double& compensation, double increment)
+{
+    const double y = increment - compensation;
+    const double t = sum + y;
+    compensation = (t - sum) - y;
+    sum = t;
+}
+
+/*
+ *PROCEDURE: start
+ *
+ *DESCRIPTION: Sizes the per coordinate arrays and loads the particle set,
+ *with no prediction for the first step
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::IAS15::start()
+{
+    const ParticleSet& p = m_particles;
+    const std::size_t n3 = 3 * p.size();
+    for (auto* v : { &m_x0, &m_v0, &m_a0, &m_at, &m_csx, &m_csv })
+        v->assign(n3, 0.0);
+    for (int k = 0; k < 7; k++)
+    {
+        m_b[k].assign(n3, 0.0);
+        m_g[k].assign(n3, 0.0);
+    }
+    for (std::size_t i = 0; i < p.size(); i++)
+    {
+        m_x0[3 * i] = p.x[i]; m_x0[3 * i + 1] = p.y[i]; m_x0[3 * i + 2] = p.z[i];
+        m_v0[3 * i] = p.vx[i]; m_v0[3 * i + 1] = p.vy[i]; m_v0[3 * i + 2] = p.vz[i];
+    }
+    m_a0_valid = false;
+}
+
+/*
+ *PROCEDURE: evaluate
+ *
+ *DESCRIPTION: Accelerations at the current particle positions, per coordinate
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::IAS15::evaluate(std::vector<double>& acc)
+{
+    m_forces->accelerations(m_particles, G_const, m_ax, m_ay, m_az);
+    for (std::size_t i = 0; i < m_particles.size(); i++)
+    {
+        acc[3 * i] = m_ax[i];
+        acc[3 * i + 1] = m_ay[i];
+        acc[3 * i + 2] = m_az[i];
+    }
+    m_evaluations++;
+}
+
+/*
+ *PROCEDURE: rescale_step
+ *
+ *DESCRIPTION: Rewrites the b coefficients for a step of the same start ratio
+ *times as long: the polynomial is unchanged, s scales by 1 / ratio
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::IAS15::rescale_step(double ratio)
+{
+    double q = ratio;
+    for (int k = 0; k < 7; k++, q *= ratio)
+        for (double& b : m_b[k])
+            b *= q;
+}
+
+/*
+ *PROCEDURE: predict_next_step
+ *
+ *DESCRIPTION: Extrapolates the acceleration polynomial of the step just taken
+ *to the next one, ratio times as long, as the starting guess of its
+ *iterations: b'_k = ratio^(k+1) sum_(j >= k) binomial(j + 1, k + 1) b_j
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::IAS15::predict_next_step(double ratio)
+{
+    static const double binomial[8][8] = {
+        { 1 }, { 1, 1 }, { 1, 2, 1 }, { 1, 3, 3, 1 }, { 1, 4, 6, 4, 1 },
+        { 1, 5, 10, 10, 5, 1 }, { 1, 6, 15, 20, 15, 6, 1 }, { 1, 7, 21, 35, 35, 21, 7, 1 } };
+
+    // the old polynomial says little about a step this much longer
+    if (ratio > 20)
+    {
+        for (int k = 0; k < 7; k++)
+            std::fill(m_b[k].begin(), m_b[k].end(), 0.0);
+        return;
+    }
+    double q[8] = { 1.0 };
+    for (int k = 1; k < 8; k++)
+        q[k] = q[k - 1] * ratio;
+    for (std::size_t c = 0; c < m_x0.size(); c++)
+    {
+        double b[7];
+        for (int k = 0; k < 7; k++)
+            b[k] = m_b[k][c];
+        for (int k = 0; k < 7; k++)
+        {
+            double sum = 0;
+            for (int j = k; j < 7; j++)
+                sum += binomial[j + 1][k + 1] * b[j];
+            m_b[k][c] = q[k + 1] * sum;
+        }
+    }
+}
+
+/*
+ *PROCEDURE: attempt_step
+ *
+ *DESCRIPTION: Iterates the acceleration polynomial of a step of m_time_step
+ *to convergence and sets the next step from its last coefficient. A step the
+ *error control rejects is undone and m_time_step shortened, an accepted one
+ *advances positions and velocities with compensated summation
+ *
+ *RETURNS: true if the step was accepted
+ */
+bool Orbit_integration::IAS15::attempt_step()
+{
+    const ias15_coefficients& co = coefficients();
+    ParticleSet& p = m_particles;
+    const std::size_t n = p.size(), n3 = 3 * n;
+    const double dt = m_time_step;
+
+    if (!m_a0_valid)
+    {
+        evaluate(m_a0);
+        m_a0_valid = true;
+    }
+
+    // g from the predicted b, back substituting c (unit diagonal)
+    for (std::size_t c = 0; c < n3; c++)
+    {
+        for (int k = 6; k >= 0; k--)
+        {
+            double g = m_b[k][c];
+            for (int j = k + 1; j < 7; j++)
+                g -= co.c[j][k] * m_g[j][c];
+            m_g[k][c] = g;
+        }
+    }
+
+    double previous = HUGE_VAL;
+    for (int iteration = 0; iteration < IAS15_MAX_ITERATIONS; iteration++)
+    {
+        double max_change = 0, max_acc = 0;
+        for (int s = 1; s < 8; s++)
+        {
+            const double h = IAS15_H[s];
+            const double hdt = h * dt;
+            for (std::size_t i = 0; i < n; i++)
+            {
+                double* position[3] = { &p.x[i], &p.y[i], &p.z[i] };
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    const std::size_t c = 3 * i + axis;
+                    const double poly = m_a0[c] / 2 + h * (m_b[0][c] / 6 + h * (m_b[1][c] / 12 + h * (m_b[2][c] / 20
+                                      + h * (m_b[3][c] / 30 + h * (m_b[4][c] / 42 + h * (m_b[5][c] / 56
+                                      + h * m_b[6][c] / 72))))));
+                    *position[axis] = m_x0[c] + hdt * m_v0[c] + hdt * hdt * poly;
+                }
+            }
+            evaluate(m_at);
+
+            for (std::size_t c = 0; c < n3; c++)
+            {
+                double g = (m_at[c] - m_a0[c]) * co.r[s][0];
+                for (int j = 1; j < s; j++)
+                    g = (g - m_g[j - 1][c]) * co.r[s][j];
+                const double change = g - m_g[s - 1][c];
+                m_g[s - 1][c] = g;
+                for (int k = 0; k < s; k++)
+                    m_b[k][c] += co.c[s - 1][k] * change;
+                if (s == 7)
+                {
+                    max_change = std::max(max_change, fabs(change));
+                    max_acc = std::max(max_acc, fabs(m_at[c]));
+                }
+            }
+        }
+        const double error = max_acc > 0 ? max_change / max_acc : 0;
+        if (error < IAS15_CONVERGENCE || (iteration > 1 && error >= previous))
+            break;
+        previous = error;
+    }
+
+    double dt_new = dt;
+    if (m_epsilon > 0)
+    {
+        // shortest timescale on which a particle's acceleration changes, in
+        // units of the step, from the derivatives at its end
+        double timescale2 = HUGE_VAL;
+        for (std::size_t i = 0; i < n; i++)
+        {
+            double a2 = 0, da2 = 0, dda2 = 0;
+            for (std::size_t c = 3 * i; c < 3 * i + 3; c++)
+            {
+                const double a = m_a0[c] + m_b[0][c] + m_b[1][c] + m_b[2][c] + m_b[3][c] + m_b[4][c] + m_b[5][c] + m_b[6][c];
+                const double da = m_b[0][c] + 2 * m_b[1][c] + 3 * m_b[2][c] + 4 * m_b[3][c] + 5 * m_b[4][c]
+                                + 6 * m_b[5][c] + 7 * m_b[6][c];
+                const double dda = 2 * m_b[1][c] + 6 * m_b[2][c] + 12 * m_b[3][c] + 20 * m_b[4][c]
+                                 + 30 * m_b[5][c] + 42 * m_b[6][c];
+                a2 += a * a;
+                da2 += da * da;
+                dda2 += dda * dda;
+            }
+            const double denominator = da2 + sqrt(dda2 * a2);
+            if (denominator > 0)
+                timescale2 = std::min(timescale2, 2 * a2 / denominator);
+        }
+        dt_new = std::isfinite(timescale2) ? sqrt(timescale2) * dt * pow(m_epsilon * 5040.0, 1.0 / 7.0)
+                                           : dt / IAS15_SAFETY_FACTOR;
+
+        if (fabs(dt_new / dt) < IAS15_SAFETY_FACTOR)
+        {
+            for (std::size_t i = 0; i < n; i++)
+            {
+                p.x[i] = m_x0[3 * i]; p.y[i] = m_x0[3 * i + 1]; p.z[i] = m_x0[3 * i + 2];
+            }
+            rescale_step(dt_new / dt);
+            m_time_step = dt_new;
+            m_rejected++;
+            return false;
+        }
+        if (dt_new / dt > 1.0 / IAS15_SAFETY_FACTOR)
+            dt_new = dt / IAS15_SAFETY_FACTOR;
+    }
+
+    for (std::size_t c = 0; c < n3; c++)
+    {
+        const double dx = dt * m_v0[c] + dt * dt * (m_a0[c] / 2 + m_b[0][c] / 6 + m_b[1][c] / 12 + m_b[2][c] / 20
+                        + m_b[3][c] / 30 + m_b[4][c] / 42 + m_b[5][c] / 56 + m_b[6][c] / 72);
+        const double dv = dt * (m_a0[c] + m_b[0][c] / 2 + m_b[1][c] / 3 + m_b[2][c] / 4
+                        + m_b[3][c] / 5 + m_b[4][c] / 6 + m_b[5][c] / 7 + m_b[6][c] / 8);
+        add_compensated(m_x0[c], m_csx[c], dx);
+        add_compensated(m_v0[c], m_csv[c], dv);
+    }
+    for (std::size_t i = 0; i < n; i++)
+    {
+        p.x[i] = m_x0[3 * i]; p.y[i] = m_x0[3 * i + 1]; p.z[i] = m_x0[3 * i + 2];
+        p.vx[i] = m_v0[3 * i]; p.vy[i] = m_v0[3 * i + 1]; p.vz[i] = m_v0[3 * i + 2];
+    }
+    m_time += dt;
+    m_steps++;
+    m_a0_valid = false;
+    predict_next_step(dt_new / dt);
+    m_time_step = dt_new;
+    return true;
+}
+
+/*
+ *PROCEDURE: compute_gravity_step
+ *
+ *DESCRIPTION: Takes one accepted IAS15 step, retrying with shorter steps
+ *while the error control rejects them
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::IAS15::compute_gravity_step()
+{
+    if (m_x0.size() != 3 * m_particles.size())
+        start();
+    while (!attempt_step())
+        ;
+}
+
+/*
+ *PROCEDURE: integrate
+ *
+ *DESCRIPTION: Advances the system by exactly duration, shortening the last
+ *step so that it ends on the requested time
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::IAS15::integrate(double duration)
+{
+    if (m_x0.size() != 3 * m_particles.size())
+        start();
+    const double t_end = m_time + duration;
+    while (m_time < t_end)
+    {
+        const double remaining = t_end - m_time;
+        if (m_time_step < remaining)
+        {
+            while (!attempt_step())
+                ;
+            continue;
+        }
+        rescale_step(remaining / m_time_step);
+        m_time_step = remaining;
+        if (attempt_step())
+        {
+            m_time = t_end;
+            break;
+        }
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * arena.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+//Every block handed out by an Arena starts on its own cache line
+const std::size_t ARENA_ALIGNMENT = 64;
+const std::size_t ARENA_HUGE_PAGE = 2 * 1024 * 1024;
+
+/*
+*CLASS: Arena
+*
+*DESCRIPTION: Fixed size bump allocator for integrator workspaces. The memory
+*is obtained once at construction and released at destruction; allocate()
+*only moves an offset, so nothing touches the heap afterwards. With
+*huge_pages the block is mapped from the reserved huge page pool when there is
+*one, else from ordinary pages with a transparent huge page hint (Linux only,
+*elsewhere the request is ignored).
+*
+*/
+class Arena{
+public:
+    explicit Arena(std::size_t bytes, bool huge_pages = false);
+
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /*
+     *count uninitialised T, ARENA_ALIGNMENT aligned. Throws std::bad_alloc
+     *when the arena is exhausted.
+     */
+    template <class T>
+    T* allocate(std::size_t count)
+    {
+        std::size_t offset = (m_used + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+        if (offset + count * sizeof(T) > m_capacity)
+            throw std::bad_alloc();
+        m_used = offset + count * sizeof(T);
+        return reinterpret_cast<T*>(static_cast<char*>(m_base) + offset);
+    };
+
+    //Bytes needed to carve count T, including the alignment padding
+    template <class T>
+    static std::size_t bytes_for(std::size_t count)
+    {
+        return (count * sizeof(T) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    };
+
+    void reset() { m_used = 0; };
+
+    std::size_t capacity() const { return m_capacity; };
+
+    std::size_t used() const { return m_used; };
+
+    bool huge_pages() const { return m_huge_pages; };
+
+private:
+    void* m_base;
+    std::size_t m_capacity;
+    std::size_t m_used;
+    std::size_t m_mapped;       // bytes obtained with mmap, 0 for operator new
+    bool m_huge_pages;
+};
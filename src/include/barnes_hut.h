@@ -0,0 +1,87 @@
+/*
+ * barnes_hut.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include "force_provider.h"
+
+/*
+*CLASS: BarnesHut
+*
+*DESCRIPTION: O(N log N) octree gravity. The tree is rebuilt on every call.
+*A cell of side l whose centre of mass is at distance r from the target is
+*accepted when r > l / theta + delta, delta being the offset between the
+*cell's geometric centre and its centre of mass; accepted cells contribute
+*their monopole and (optionally) traceless quadrupole, the rest are opened
+*down to leaves of at most leaf_size particles that are summed directly.
+*The tree is walked once per leaf, measuring r to the nearest point of the
+*leaf, and the resulting interaction list is evaluated for all its particles
+*with the direct summation kernel selected for this CPU.
+*
+*/
+class BarnesHut : public ForceProvider{
+public:
+    explicit BarnesHut(double theta = 0.5, bool quadrupole = true, int leaf_size = 32) :
+            m_theta(theta),
+            m_quadrupole(quadrupole),
+            m_leaf_size(leaf_size) {};
+
+    void accelerations(const ParticleSet& particles, double G,
+                       std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az);
+
+    void rk4_moments(const ParticleSet& particles, double G, std::vector<double>& moments);
+
+    const char* name() const { return "tree"; };
+
+    double theta() const { return m_theta; };
+
+private:
+    struct cell{
+        double cx, cy, cz, half;        // geometric centre and half side
+        double mass, mx, my, mz;        // total mass and centre of mass
+        double qxx, qxy, qxz, qyy, qyz, qzz;  // traceless quadrupole about the centre of mass
+        double w2, w3, w4;              // sum of m^2, m^3, m^4 (RK4 moments)
+        double delta;                   // |centre of mass - geometric centre|
+        int begin, end;                 // particle range in tree order
+        int first_child, children;
+    };
+
+    void build(const ParticleSet& particles);
+
+    void build_cell(int index, int depth);
+
+    void compute_moments(int index);
+
+    void interaction_lists(int group, std::vector<int>& cells, std::vector<int>& leaves) const;
+
+    double m_theta;
+    bool m_quadrupole;
+    int m_leaf_size;
+
+    std::vector<cell> m_cells;
+    std::vector<int> m_groups;          // leaf cells, walked once for all their particles
+    std::vector<int> m_order;           // tree position -> particle index
+    std::vector<int> m_scratch;
+    std::vector<double> m_x, m_y, m_z, m_m;   // particle data in tree order
+};
@@ -0,0 +1,177 @@
+/*
+ * batch.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include "structures.h"
+
+//Systems advanced side by side, one per SIMD lane: a full AVX-512 register of
+//doubles, two AVX2 ones
+#define BATCH_LANES 8
+
+//Steps between two energy checks of the running systems
+#define BATCH_ENERGY_INTERVAL 64
+
+/*
+ * Struct: batch_system
+ *
+ * OBJECTS: One small independent system of a batch, label and bodies.
+*/
+struct batch_system{
+    std::string label;
+    std::vector<body> bodies;
+};
+
+/*
+ * Struct: batch_options
+ *
+ * OBJECTS: Settings shared by every system of a batch. The systems run for
+ * duration with fixed steps of time_step made of the leapfrog stages of
+ * weights (one of the Composition schemes, plain leapfrog by default). A
+ * system stops early when two bodies touch, when a body moves further than
+ * escape_radius from the first one or when its relative energy error exceeds
+ * energy_tolerance; a zero disables the last two checks.
+*/
+struct batch_options{
+    double G;
+    double time_step;
+    double duration;
+    double escape_radius = 0;
+    double energy_tolerance = 0;
+    std::vector<double> weights{ 1.0 };
+};
+
+enum batch_status{
+    BATCH_COMPLETED,
+    BATCH_COLLIDED,
+    BATCH_ESCAPED,
+    BATCH_DIVERGED
+};
+
+/*
+ * Struct: batch_result
+ *
+ * OBJECTS: Outcome of one system: why and when it stopped, its relative
+ * energy error at that time and the final bodies.
+*/
+struct batch_result{
+    batch_status status;
+    double time;
+    double energy_error;
+    std::vector<body> bodies;
+};
+
+/*
+*CLASS: SystemBatch
+*
+*DESCRIPTION: Up to BATCH_LANES systems with the same number of bodies
+*integrated together, lane l of every array holding system l: the arrays
+*are indexed [body * BATCH_LANES + lane], so each pair interaction, kick and
+*drift is one vector operation over all the systems. All lanes share the
+*step sequence; a lane is masked off once its system stops, freezing its
+*state, and the batch returns as soon as every lane is stopped. The lane
+*loops are compiled for AVX-512, AVX2 and plain SSE2 and the variant of the
+*direct gravity kernels (gravity_kernels::best_direct_kernel) is used. The
+*vector variants contract products into FMAs, so they differ from the SSE2
+*one in the last bits; a lane gives the same bits alone or among others.
+*
+*/
+class SystemBatch{
+public:
+    SystemBatch(const std::vector<const batch_system*>& systems, const batch_options& options);
+
+    /*
+     *PROCEDURE: run
+     *
+     *DESCRIPTION: Integrates until the duration is reached or every system has stopped
+     *
+     *RETURNS: -
+     */
+    void run();
+
+    /*
+     *PROCEDURE: result
+     *
+     *DESCRIPTION: Outcome of the system in lane l
+     *
+     *RETURNS: batch_result
+     */
+    batch_result result(int lane) const;
+
+    int systems() const { return m_systems; };
+
+    long long steps() const { return m_steps; };
+
+private:
+    void energies(double* energy) const;
+
+    void check_lanes(long long step);
+
+    batch_options m_options;
+    std::vector<const batch_system*> m_sources;
+    int m_systems;
+    int m_n;
+    std::vector<double> m_x, m_y, m_z, m_vx, m_vy, m_vz, m_ax, m_ay, m_az, m_mass, m_radius;
+    double m_contact[BATCH_LANES];      // smallest r^2 - (r_i + r_j)^2 since the last check
+    double m_escape[BATCH_LANES];       // largest r^2 from the first body since the last check
+    double m_invalid[BATCH_LANES];      // NaN once a distance stopped being finite
+    double m_energy0[BATCH_LANES];
+    double m_stop_time[BATCH_LANES];
+    batch_status m_status[BATCH_LANES];
+    bool m_running[BATCH_LANES];
+    long long m_steps = 0;
+};
+
+/*
+ *PROCEDURE: integrate_batch
+ *
+ *DESCRIPTION: Integrates every system of the batch: systems with the same
+ *number of bodies are packed BATCH_LANES at a time into SystemBatch groups,
+ *which are spread over threads workers (all cores when threads <= 0)
+ *
+ *RETURNS: the results, in the order of the systems
+ */
+std::vector<batch_result> integrate_batch(const std::vector<batch_system>& systems,
+                                          const batch_options& options, int threads = 0);
+
+/*
+ *PROCEDURE: write_batch_results
+ *
+ *DESCRIPTION: Writes one block per system to filename: a line with label,
+ *status, stop time and relative energy error, then a name,x,y,z,vx,vy,vz line
+ *per body
+ *
+ *RETURNS: -
+ */
+void write_batch_results(const std::string& filename, const std::vector<batch_system>& systems,
+                         const std::vector<batch_result>& results);
+
+/*
+ *PROCEDURE: batch_status_name
+ *
+ *DESCRIPTION: completed, collided, escaped or diverged
+ *
+ *RETURNS: const char*
+ */
+const char* batch_status_name(batch_status status);
@@ -35,6 +35,8 @@
 #include <string.h>
 #include <errno.h>
 #include <chrono>
+#include <iostream>
+#include <string>
 
 class Timer
 {
@@ -55,12 +57,12 @@ private:
         std::chrono::time_point<std::chrono::high_resolution_clock> m_StartTimepoint;
 };
 
-Timer::~Timer(){
+inline Timer::~Timer(){
 
           Stop();
 }
 
-Timer::Timer(){
+inline Timer::Timer(){
 
          m_StartTimepoint = std::chrono::high_resolution_clock::now();
 }
@@ -74,7 +76,7 @@ Timer::Timer(){
 *RETURNS: -
 */
 extern "C"{
-void number_of_cores()
+inline void number_of_cores()
 {
   long nprocs = -1;
   long nprocs_max = -1;
@@ -110,4 +112,323 @@ strerror (errno));
   exit (EXIT_FAILURE);
 #endif
 }
-}
\ No newline at end of file
+}
+
+/*
+*NAMESPACE: benchmarking
+*
+*DESCRIPTION: Performance regression benchmarks. Each one prints its own
+*report and returns false when its acceptance criterion is not met. Heap
+*allocations are only counted, and their checks only bite, when run from
+*the Celestial_benchmark build (see heap_counter.h).
+*
+*/
+namespace benchmarking{
+    /*
+    *PROCEDURE: history_growth
+    *
+    *DESCRIPTION: Integrates the solar system while a TrajectoryWriter streams
+    *the trajectory and checks that neither the cost of one step nor the memory
+    *of the writer grow with the length of the run.
+    *
+    *RETURNS: true if the last window is at most 25% slower than the first one
+    *and the frame buffers did not grow
+    */
+    bool history_growth(int steps, int report_frequency);
+
+    /*
+    *PROCEDURE: direct_kernels
+    *
+    *DESCRIPTION: Measures interactions per second (fastest of half a second
+    *of evaluations alternating with the scalar reference) of every direct
+    *summation kernel supported by the CPU, its speedup over the scalar
+    *reference and the largest relative acceleration difference between them
+    *
+    *RETURNS: true if every kernel agrees with the scalar path to 1e-12 and,
+    *from n = 1024, reaches the speedup of its instruction set: 4x for
+    *AVX-512 (measures about 5.5x), 1.6x for AVX2 (about 2x)
+    */
+    bool direct_kernels(int n);
+
+    /*
+    *PROCEDURE: pair_forces
+    *
+    *DESCRIPTION: Compares the full N^2 direct kernel with the half pair engine
+    *(fastest of a second of alternating evaluations), single threaded and with
+    *every OpenMP thread but at least two, so the per thread buffers and their
+    *reduction are timed on any machine; the full kernel then shares out the
+    *targets between the same threads
+    *
+    *RETURNS: true if the half pair accelerations agree with the full ones to
+    *1e-12 and the half pair engine is 1.25 times faster both single threaded
+    *and threaded (1.3-1.5x measured at N = 1024, 1.5-1.65x at 16384). A pair
+    *costs about 25 vector operations against 21 for each of its two
+    *directions in the full kernel, which bounds the gain at 1.7x rather than
+    *the 2x of the halved pair count.
+    */
+    bool pair_forces(int n);
+
+    /*
+    *PROCEDURE: tree_gravity
+    *
+    *DESCRIPTION: Times direct summation against the Barnes-Hut tree for
+    *N = 256 ... max_n to locate the crossover, then reports the relative force
+    *error distribution for several opening angles, with and without the
+    *quadrupole term, on error_n particles
+    *
+    *RETURNS: true if the tree wins at max_n and theta = 0.5 with quadrupole
+    *keeps 99% of the forces within 1%
+    */
+    bool tree_gravity(int max_n, int error_n);
+
+    /*
+    *PROCEDURE: fmm_scaling
+    *
+    *DESCRIPTION: Times one fast multipole force evaluation for N = 1e4 ... max_n
+    *and for several expansion orders at order_n, with the relative force
+    *error against the direct kernel on a sample of particles
+    *
+    *RETURNS: true if the cost per particle stays flat with N and the error
+    *drops with every increase of the order
+    */
+    bool fmm_scaling(int max_n, int order_n);
+
+    /*
+    *PROCEDURE: particle_mesh
+    *
+    *DESCRIPTION: Times the particle-mesh solver with CIC and TSC assignment on
+    *a grid^3 mesh and reports its force error against the direct kernel on a
+    *sample of particles
+    *
+    *RETURNS: true if the median error is below 10% and a step is cheaper than
+    *direct summation
+    */
+    bool particle_mesh(int n, int grid);
+
+    /*
+    *PROCEDURE: hermite_block
+    *
+    *DESCRIPTION: Integrates a virialised Plummer sphere of n stars, two of
+    *them in a tight binary, for duration time units with the shared time
+    *step Hermite integrator and with block time steps, and compares wall
+    *time, pair interactions and energy error. Heap allocations are counted
+    *over both step loops.
+    *
+    *RETURNS: true if block steps are faster and conserve energy to 1e-4 and
+    *neither step loop allocates
+    */
+    bool hermite_block(int n, double duration);
+
+    /*
+    *PROCEDURE: hermite_forces
+    *
+    *DESCRIPTION: Times the fused SIMD + OpenMP get_acc_jerk_pot_coll against
+    *the nbody_sh1 half pair loop on a Plummer sphere of n stars and reports
+    *the largest relative differences of accelerations, jerks, potential
+    *energy and collision time
+    *
+    *RETURNS: true if the fused version is faster and agrees to 1e-10
+    */
+    bool hermite_forces(int n);
+
+    /*
+    *PROCEDURE: whfast_energy
+    *
+    *DESCRIPTION: Largest relative energy error and wall time of RK4 and of
+    *the Wisdom-Holman integrator (with and without correctors) on the
+    *solar system over years, then of Wisdom-Holman alone over long_years
+    *
+    *RETURNS: true if Wisdom-Holman with correctors at an 8 day step beats the
+    *most accurate RK4 run both in time and in energy error
+    */
+    bool whfast_energy(double years, double long_years);
+
+    /*
+    *PROCEDURE: ias15_accuracy
+    *
+    *DESCRIPTION: Wall time, energy error and position error (against a
+    *tight tolerance IAS15 run) of fixed step RK4 and of IAS15 at several
+    *tolerances, on the solar system over solar_years and on a close
+    *encounter with Jupiter over encounter_years
+    *
+    *RETURNS: true if in both cases IAS15 at epsilon 1e-9 is more accurate
+    *than every RK4 run
+    */
+    bool ias15_accuracy(double solar_years, double encounter_years);
+
+    /*
+    *PROCEDURE: dopri5_dense
+    *
+    *DESCRIPTION: Dormand-Prince on the solar system over years at several
+    *tolerances: wall time, steps and final position error with a single
+    *output, then the largest position error of daily dense outputs against
+    *an IAS15 reference, and the heap allocations of the step loop
+    *
+    *RETURNS: true if daily outputs never changed the number of steps and the
+    *step loop does not allocate
+    */
+    bool dopri5_dense(double years);
+
+    /*
+    *PROCEDURE: bs_efficiency
+    *
+    *DESCRIPTION: Force evaluations per digit of accuracy of Bulirsch-Stoer,
+    *Dormand-Prince and IAS15 on the Sun-Earth pair (against the exact Kepler
+    *orbit), the Sun with the outer planets and the whole solar system
+    *
+    *RETURNS: true if in every case Bulirsch-Stoer at tolerance 1e-12 reaches
+    *11 digits and needs fewer evaluations per digit than Dormand-Prince
+    */
+    bool bs_efficiency();
+
+    /*
+    *PROCEDURE: symplectic_compositions
+    *
+    *DESCRIPTION: Observed order on the Kepler problem and energy error over
+    *years of the solar system of the leapfrog and its Yoshida and Suzuki
+    *compositions, at steps costing one force evaluation per day, next to RK4
+    *at one day
+    *
+    *RETURNS: true if every scheme shows its nominal order and an energy error
+    *without secular growth
+    */
+    bool symplectic_compositions(double years);
+
+    /*
+    *PROCEDURE: test_particles
+    *
+    *DESCRIPTION: Planets plus n asteroids: cost of one force evaluation with the
+    *asteroids as test particles against treating them as massive bodies, check
+    *of their accelerations against the direct kernel, and a year of leapfrog
+    *and RK4 showing that they leave the planets untouched
+    *
+    *RETURNS: true if the accelerations agree, the planets follow exactly the
+    *planets only run and the test particle evaluation is the cheaper one
+    */
+    bool test_particles(int n);
+
+    /*
+    *PROCEDURE: collision_detection
+    *
+    *DESCRIPTION: Saturn with a ring of n self gravitating particles: time of the
+    *spatial hash collision search against a Barnes-Hut leapfrog step, its cost
+    *per particle at n / 10 and n at the same ring density, with equal radii
+    *and with radii spread over 3x, and the pairs it finds against an O(N^2)
+    *swept sphere search on the smaller rings
+    *
+    *RETURNS: true if both searches find the same pairs and the collision
+    *search is cheaper than the step
+    */
+    bool collision_detection(int n);
+
+    /*
+    *PROCEDURE: particle_mergers
+    *
+    *DESCRIPTION: Saturn with a ring of n particles that merge on contact, run
+    *for a number of Barnes-Hut leapfrog steps: particles lost, cost of the
+    *merge stage and its in place compaction against rebuilding the store
+    *from a vector of bodies, and conservation of mass, momentum and centre of
+    *mass across every merge
+    *
+    *RETURNS: true if mass, momentum and centre of mass are conserved, the
+    *particle columns are never reallocated, ids stay unique and in order and
+    *merging is cheaper than a rebuild
+    */
+    bool particle_mergers(int n, int steps);
+
+    /*
+    *PROCEDURE: ensemble_throughput
+    *
+    *DESCRIPTION: systems perturbed copies of the solar system of uneven length
+    *integrated with WHFast one after the other and through the work stealing
+    *EnsembleRunner, on every core and on an oversubscribed pool of 4 threads
+    *per core: systems per second, speedup and steals
+    *
+    *RETURNS: true if system 0 is the unperturbed original and the others are
+    *perturbed, every run gives bit identical final states and the pool is not
+    *slower than the serial loop
+    */
+    bool ensemble_throughput(int systems);
+
+    /*
+    *PROCEDURE: batch_systems
+    *
+    *DESCRIPTION: systems random binaries and hierarchical triples, a few of them
+    *set up to collide or to escape early, integrated with the SIMD across
+    *systems SystemBatch and one by one with the leapfrog integrator:
+    *throughput in systems per hour, agreement of the final states, stop
+    *reasons, and whether masking a lane off disturbs the others
+    *
+    *RETURNS: true if the final states agree, the early stops are found, a
+    *system gives the same bits alone and among others and the batch beats
+    *the one by one integration
+    */
+    bool batch_systems(int systems);
+
+    /*
+    *PROCEDURE: snapshot_io
+    *
+    *DESCRIPTION: Plummer sphere of n particles dumped and loaded through the
+    *former put_snapshot/get_snapshot text format and through binary
+    *snapshots (a single write, a memory map with and without checksum
+    *verification): seconds and bandwidth of each, exactness of the binary
+    *round trip, accuracy of the text converters and detection of a corrupted
+    *byte
+    *
+    *RETURNS: true if the binary round trip is exact, the converters agree to
+    *the text precision, the corruption is caught and binary I/O is ten times
+    *faster than text in both directions
+    */
+    bool snapshot_io(int n);
+
+    /*
+    *PROCEDURE: trajectory_output
+    *
+    *DESCRIPTION: Trajectory of n drifting bodies over frames frames streamed
+    *to the per body text files and to a columnar trajectory file, plain and
+    *losslessly coded, with the same six columns to 17 digits: best write
+    *seconds from a flushed disk, read seconds, bytes on disk, and exactness
+    *of random access by time in the columnar file
+    *
+    *RETURNS: true if random access returns the written bits, the plain
+    *columnar file is written and read ten times faster than the text files
+    *and the coded one is ten times smaller
+    */
+    bool trajectory_output(int n, int frames);
+
+    /*
+    *PROCEDURE: column_compression
+    *
+    *DESCRIPTION: Solar system over frames daily frames and the planets with
+    *an asteroid belt of belt test particles written to columnar
+    *trajectories as plain doubles, losslessly coded and quantized to 1 km
+    *and 1 mm/s: compression ratio, write and decode bandwidth, exactness of
+    *the lossless round trip and largest quantization error
+    *
+    *RETURNS: true if the lossless files decode to the plain bits and the
+    *quantized ones stay within their error bounds
+    */
+    bool column_compression(int belt, int frames);
+
+    /*
+    *PROCEDURE: trajectory_decimation
+    *
+    *DESCRIPTION: Solar system integrated for frames daily frames, written
+    *whole and through HermiteSampler at 1000 km and 100000 km: samples and
+    *bytes kept per tolerance, per body samples, sampling cost and the largest
+    *error of the TrajectoryInterpolator reconstruction at every frame
+    *
+    *RETURNS: true if the reconstruction stays within the tolerance and each
+    *decimated file is at least five times smaller than the whole one
+    */
+    bool trajectory_decimation(int frames);
+
+    /*
+    *PROCEDURE: run
+    *
+    *DESCRIPTION: Runs the benchmark selected with --benchmark
+    *
+    *RETURNS: true if the benchmark exists and passed
+    */
+    bool run(const std::string& name);
+}
@@ -0,0 +1,152 @@
+/*
+ * collisions.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include "particles.h"
+
+/*
+ * Struct: collision
+ *
+ * OBJECTS: Pair of particles (i < j) whose spheres touch during a step and the
+ * fraction of the step at which they first touch, 0 when they already
+ * overlapped at its start.
+*/
+struct collision{
+    int i;
+    int j;
+    double time;
+};
+
+/*
+*CLASS: CollisionDetector
+*
+*DESCRIPTION: Collision search run over one or more integration steps. Particles are
+*spheres of their radius moving on a straight line from their position at
+*start() to their position at detect(). The search runs in a frame rotating
+*with the median angular motion of the particles about their centre of mass,
+*where a ring or a disc barely moves, the paths being padded by how far the
+*rotation can bend them. The step is cut into sub-steps over which the median
+*particle moves about two diameters in that frame, and the box swept by every
+*sphere during a sub-step is hashed, by its centre, into a hierarchy of
+*uniform grids: the finest cell is a little larger than the median box, each
+*level doubles it and a box goes to the first level whose cell holds it. A
+*box is searched for in the neighbouring cells of its own level and of every
+*coarser occupied one, so each particle meets a bounded number of candidates
+*and the search stays expected O(N) whatever the spread of sizes (a planet
+*among ring particles, radii varying several times). Candidates are
+*confirmed with the exact swept sphere test on their relative motion. A few
+*dozen particles skip the grid and test every pair. Pairs of test particles
+*are never reported.
+*
+*/
+class CollisionDetector{
+public:
+    /*
+     *PROCEDURE: start
+     *
+     *DESCRIPTION: Records the positions at the beginning of a step
+     *
+     *RETURNS: -
+     */
+    void start(const ParticleSet& particles);
+
+    /*
+     *PROCEDURE: detect
+     *
+     *DESCRIPTION: Pairs that touched since start(), sorted by (i, j). Without a
+     *matching start() the particles are taken as not having moved.
+     *
+     *RETURNS: the colliding pairs, valid until the next call
+     */
+    const std::vector<collision>& detect(const ParticleSet& particles);
+
+    double cell_size() const { return m_cell; };
+
+    int grid_levels() const { return m_levels; };
+
+    int substeps() const { return m_substeps; };
+
+    double frame_rotation() const { return m_angle; };
+
+    std::size_t candidate_pairs() const { return m_candidates; };
+
+private:
+    // straight line motion of a particle over the step
+    struct sweep{
+        double start[3];
+        double move[3];
+        double radius;
+    };
+
+    // the same motion seen from the search frame, as a chord of the bent path
+    // and the largest distance between the two
+    struct path{
+        int particle;
+        double start[3];
+        double move[3];
+        double radius;
+        double bend;
+    };
+
+    // the path is copied next to its cell so a bucket is scanned without touching the particles
+    struct entry{
+        long long cell[3];
+        int level;
+        path motion;
+    };
+
+    struct cell_key{
+        long long cell[3];
+        int bucket;
+    };
+
+    void search_frame(const ParticleSet& particles);
+
+    static void path_box(const path& s, double t0, double t1, double lo[3], double hi[3]);
+
+    static double contact_time(const sweep& i, const sweep& j);
+
+    void test_pair(int i, int j, int substep, int substeps);
+
+    std::vector<double> m_x0, m_y0, m_z0;   // positions at start()
+    std::vector<sweep> m_sweeps;
+    std::vector<path> m_paths;
+    std::vector<double> m_extent;           // largest side of every sub-step box
+    std::vector<int> m_level;               // grid level of every box, -1 past the coarsest
+    std::vector<double> m_median;           // scratch copy for the medians
+    std::vector<cell_key> m_cells;          // centre cell of every box in the current sub-step
+    std::vector<int> m_bucket_start;        // hash table, counting sorted
+    std::vector<entry> m_entries;
+    std::vector<int> m_oversized;
+    std::vector<collision> m_hits;
+    double m_centre[3] = { 0, 0, 0 };       // search frame: rotation by m_angle about m_axis through m_centre
+    double m_axis[3] = { 0, 0, 1 };
+    double m_angle = 0;
+    double m_cell = 0;
+    int m_substeps = 1;
+    int m_levels = 0;                       // one past the coarsest occupied level
+    int m_massive = 0;
+    std::size_t m_candidates = 0;
+};
@@ -0,0 +1,122 @@
+/*
+ * ensemble.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "structures.h"
+
+/*
+ * Struct: ensemble_stats
+ *
+ * OBJECTS: Outcome of an ensemble run: systems integrated, wall clock seconds,
+ * throughput and how many times an idle worker stole systems from another.
+*/
+struct ensemble_stats{
+    std::size_t systems;
+    double seconds;
+    double systems_per_second;
+    std::size_t steals;
+};
+
+/*
+ *PROCEDURE: perturbed_bodies
+ *
+ *DESCRIPTION: Member system of an ensemble of perturbed initial conditions:
+ *a copy of bodies with every position and velocity scaled by its own factor
+ *1 + N(0, relative), drawn from a generator seeded with system. System 0 is
+ *the unperturbed original.
+ *
+ *RETURNS: std::vector<body>
+ */
+std::vector<body> perturbed_bodies(const std::vector<body>& bodies, std::size_t system, double relative);
+
+/*
+*CLASS: EnsembleRunner
+*
+*DESCRIPTION: Runs a batch of independent simulations (a parameter sweep, a
+*set of perturbed initial conditions) on a pool of worker threads. Each
+*worker starts with a contiguous share of the systems in its own queue and
+*takes them from the front; a worker whose queue runs dry steals the back
+*half of the queue of another one, so systems of very different cost (a
+*stable case against one that ends in a close encounter) still keep every
+*core busy. Every system writes to its own output stream, the file
+*<output_prefix><system>.dat, or to no file when the prefix is empty.
+*OpenMP inside a simulation is limited to one thread per worker, the
+*parallelism is across systems.
+*
+*/
+class EnsembleRunner{
+public:
+    typedef std::function<void(std::size_t system, std::ostream& out)> simulation;
+
+    /*
+     *threads <= 0 uses every hardware thread
+     */
+    explicit EnsembleRunner(int threads = 0, std::string output_prefix = "");
+
+    /*
+     *PROCEDURE: run
+     *
+     *DESCRIPTION: Runs simulate(system, out) for every system in 0 ... systems-1
+     *and, when progress is given, writes the systems completed and the
+     *throughput to it every report_seconds. An exception thrown by a
+     *simulation stops the remaining ones and is rethrown here.
+     *
+     *RETURNS: ensemble_stats
+     */
+    ensemble_stats run(std::size_t systems, const simulation& simulate,
+                       std::ostream* progress = nullptr, double report_seconds = 1.0);
+
+    int threads() const { return m_threads; };
+
+private:
+    struct work_queue{
+        std::mutex lock;
+        std::deque<std::size_t> systems;
+    };
+
+    bool next_system(int worker, std::size_t& system);
+
+    void work(int worker, const simulation& simulate);
+
+    int m_threads;
+    std::string m_output_prefix;
+    std::vector<std::unique_ptr<work_queue>> m_queues;
+    std::atomic<std::size_t> m_done{ 0 };
+    std::atomic<std::size_t> m_steals{ 0 };
+    std::atomic<bool> m_failed{ false };
+    std::mutex m_finished_lock;             // guards m_first_error and the wake up of run()
+    std::condition_variable m_finished;
+    std::exception_ptr m_first_error;
+};
@@ -0,0 +1,82 @@
+/*
+ * fft.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include <complex>
+#include <vector>
+
+typedef std::complex<double> complex_t;
+
+/*
+*CLASS: ComplexFFT
+*
+*DESCRIPTION: In place radix 2 complex FFT of a fixed power of two length.
+*forward computes X_k = sum x_j e^(-2 pi i jk/n), inverse the same with
+*e^(+2 pi i jk/n) and no 1/n normalisation.
+*
+*/
+class ComplexFFT{
+public:
+    explicit ComplexFFT(int n);
+
+    void forward(complex_t* data) const { transform(data, false); };
+
+    void inverse(complex_t* data) const { transform(data, true); };
+
+    int size() const { return m_n; };
+
+private:
+    void transform(complex_t* data, bool inverse) const;
+
+    int m_n;
+    std::vector<int> m_reverse;
+    std::vector<double> m_cos, m_sin;
+};
+
+/*
+*CLASS: RealFFT
+*
+*DESCRIPTION: In place FFT of n real values (n a power of two) through one
+*complex FFT of length n / 2. The line holds n / 2 + 1 complex values: on
+*input its first n doubles are the real samples, on output of forward it
+*holds X_0 ... X_(n/2) (the rest follows from Hermitian symmetry). inverse
+*undoes forward up to the usual factor n.
+*
+*/
+class RealFFT{
+public:
+    explicit RealFFT(int n);
+
+    void forward(complex_t* line) const;
+
+    void inverse(complex_t* line) const;
+
+    int size() const { return m_n; };
+
+private:
+    int m_n;
+    ComplexFFT m_half;
+    std::vector<complex_t> m_twiddles;   // e^(-2 pi i k/n), k <= n/4
+};
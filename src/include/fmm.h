@@ -0,0 +1,124 @@
+/*
+ * fmm.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include "force_provider.h"
+
+//Highest expansion order accepted by FastMultipole
+#define FMM_MAX_ORDER 10
+
+/*
+*CLASS: FastMultipole
+*
+*DESCRIPTION: O(N) fast multipole gravity with Cartesian Taylor expansions of
+*configurable order on an adaptive octree (leaves of at most leaf_size
+*particles). Multipoles and locals are taken about the centre of mass of
+*each cell. The interaction lists come from a dual tree traversal: a pair of
+*cells with radii r_a, r_b is well separated when r_a + r_b < theta * d, and
+*then interacts through one multipole to local translation; otherwise the
+*bigger cell is split, down to leaf pairs that are summed directly.
+*The upward pass and the combined traversal / downward pass run as OpenMP
+*tasks, one task per target subtree, so no two tasks write the same local.
+*
+*/
+class FastMultipole : public ForceProvider{
+public:
+    explicit FastMultipole(int order = 4, double theta = 0.7, int leaf_size = 64);
+
+    void accelerations(const ParticleSet& particles, double G,
+                       std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az);
+
+    /*
+     *Pairs summed directly contribute every channel exactly. Well separated
+     *cells only contribute their acceleration (D1): the remaining channels
+     *are RK4 corrections of relative size (G m / r^3) h^2 or v h / r, which
+     *the opening criterion keeps small for far cells.
+     */
+    void rk4_moments(const ParticleSet& particles, double G, std::vector<double>& moments);
+
+    const char* name() const { return "fmm"; };
+
+    int order() const { return m_order; };
+
+    double theta() const { return m_theta; };
+
+private:
+    struct cell{
+        double cx, cy, cz, half;        // geometric box
+        double mx, my, mz, mass;        // centre of mass, expansion centre
+        double radius;                  // distance from the expansion centre to the farthest particle
+        int begin, end;                 // particle range in tree order
+        int first_child, children;
+    };
+
+    // out[out] += coefficient * a[a] * b[b]
+    struct term_product{
+        int out, a, b;
+        double coefficient;
+    };
+
+    void build(const ParticleSet& particles);
+
+    void build_cell(int index, int depth);
+
+    void upward(int index);
+
+    void downward(int target, std::vector<int> sources);
+
+    void evaluate(const ParticleSet& particles);
+
+    void monomials(double x, double y, double z, double* out) const;
+
+    void derivatives(double x, double y, double z, double* out) const;
+
+    void multipole_to_local(int source, int target);
+
+    void particle_to_particle(int source, int target);
+
+    void local_to_particle(int index);
+
+    int m_order;
+    double m_theta;
+    int m_leaf_size;
+    int m_terms;
+    double m_G;
+    bool m_moments;                     // current evaluation fills RK4 moments
+
+    // multi index tables, terms ordered by total degree
+    std::vector<int> m_exponents;       // 3 per term
+    std::vector<int> m_lower;           // 3 per term: index of term - e_i
+    std::vector<int> m_lower2;          // 3 per term: index of term - 2 e_i
+    std::vector<int> m_axis;            // an axis along which the term has a positive exponent
+    std::vector<double> m_recurrence;   // 2 per term: -(2|k| - 1) / |k|, -(|k| - 1) / |k|
+    std::vector<term_product> m_m2m, m_m2l, m_l2l, m_gradient;
+
+    std::vector<cell> m_cells;
+    std::vector<int> m_order_of;        // tree position -> particle index
+    std::vector<int> m_scratch;
+    std::vector<double> m_x, m_y, m_z, m_m;   // particle data in tree order
+    std::vector<double> m_multipoles, m_locals; // m_terms per cell
+    std::vector<double> m_ax, m_ay, m_az;       // tree order results
+    std::vector<double> m_moment_sums;          // tree order, channel major
+};
@@ -0,0 +1,113 @@
+/*
+ * force_provider.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include "particles.h"
+#include "pair_forces.h"
+
+/*
+*CLASS: ForceProvider
+*
+*DESCRIPTION: Gravity backend used by the Orbit_integration integrators. An
+*integrator only asks for the accelerations of a particle set; how they are
+*obtained (direct summation, tree, ...) is up to the provider.
+*
+*/
+class ForceProvider{
+public:
+    virtual ~ForceProvider() = default;
+
+    /*
+     *PROCEDURE: accelerations
+     *
+     *DESCRIPTION: Gravitational acceleration of every particle due to all the others
+     *
+     *RETURNS: -
+     */
+    virtual void accelerations(const ParticleSet& particles, double G,
+                               std::vector<double>& ax, std::vector<double>& ay,
+                               std::vector<double>& az) = 0;
+
+    /*
+     *PROCEDURE: rk4_moments
+     *
+     *DESCRIPTION: Per particle sums needed by the RK4 integrator (see rk4_moment),
+     *channel major
+     *
+     *RETURNS: -
+     */
+    virtual void rk4_moments(const ParticleSet& particles, double G,
+                             std::vector<double>& moments) = 0;
+
+    /*
+     *PROCEDURE: has_rk4_moments
+     *
+     *DESCRIPTION: Whether rk4_moments fills every channel. A backend without
+     *pair terms returns false and the RK4 integrator refuses it.
+     *
+     *RETURNS: bool
+     */
+    virtual bool has_rk4_moments() const { return true; };
+
+    virtual const char* name() const = 0;
+};
+
+/*
+*CLASS: DirectSummation
+*
+*DESCRIPTION: Exact O(N^2) forces through the half pair engine
+*
+*/
+class DirectSummation : public ForceProvider{
+public:
+    explicit DirectSummation(int threads = 0) : m_engine(threads) {};
+
+    void accelerations(const ParticleSet& particles, double G,
+                       std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az)
+    {
+        m_engine.accelerations(particles, G, ax, ay, az);
+    };
+
+    void rk4_moments(const ParticleSet& particles, double G, std::vector<double>& moments)
+    {
+        m_engine.rk4_moments(particles, G, moments);
+    };
+
+    const char* name() const { return "direct"; };
+
+private:
+    PairForceEngine m_engine;
+};
+
+/*
+ *PROCEDURE: make_force_provider
+ *
+ *DESCRIPTION: Gravity backend selected by name: direct, tree (Barnes-Hut),
+ *fmm (fast multipole) or pm (particle-mesh on a grid^3 mesh)
+ *
+ *RETURNS: the provider, or nullptr if the name is unknown
+ */
+std::shared_ptr<ForceProvider> make_force_provider(const std::string& name, int grid = 128);
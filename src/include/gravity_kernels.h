@@ -0,0 +1,159 @@
+/*
+ * gravity_kernels.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include "particles.h"
+
+/*
+*NAMESPACE: gravity_kernels
+*
+*DESCRIPTION: Direct summation gravity kernels. Every kernel adds to
+*(ax, ay, az) of the nt targets the acceleration produced by the ns sources.
+*A source sitting exactly on a target (the target itself) is skipped.
+*The best kernel for the running CPU is chosen once, on first use.
+*
+*/
+namespace gravity_kernels{
+
+    typedef void (*direct_kernel)(const double* sx, const double* sy, const double* sz,
+                                  const double* sm, int ns,
+                                  const double* tx, const double* ty, const double* tz, int nt,
+                                  double G, double* ax, double* ay, double* az);
+
+    /*
+     *PROCEDURE: direct_scalar
+     *
+     *DESCRIPTION: Portable reference kernel, one pair at a time with sqrt and
+     *division, same arithmetic as the original calculate_single_body_acceleration
+     *
+     *RETURNS: -
+     */
+    void direct_scalar(const double* sx, const double* sy, const double* sz,
+                       const double* sm, int ns,
+                       const double* tx, const double* ty, const double* tz, int nt,
+                       double G, double* ax, double* ay, double* az);
+
+    /*
+     *PROCEDURE: direct_avx2
+     *
+     *DESCRIPTION: AVX2 + FMA kernel, 8 sources per iteration, rsqrt estimate
+     *refined with Newton-Raphson iterations to full double precision
+     *
+     *RETURNS: -
+     */
+    void direct_avx2(const double* sx, const double* sy, const double* sz,
+                     const double* sm, int ns,
+                     const double* tx, const double* ty, const double* tz, int nt,
+                     double G, double* ax, double* ay, double* az);
+
+    /*
+     *PROCEDURE: direct_avx512
+     *
+     *DESCRIPTION: AVX-512F kernel, 8 sources against 2 targets per iteration,
+     *rsqrt14 estimate refined with Newton-Raphson iterations to full double
+     *precision
+     *
+     *RETURNS: -
+     */
+    void direct_avx512(const double* sx, const double* sy, const double* sz,
+                       const double* sm, int ns,
+                       const double* tx, const double* ty, const double* tz, int nt,
+                       double G, double* ax, double* ay, double* az);
+
+    /*
+     *Symmetric (half pair) kernels: for every row i in [row_begin, row_end) and
+     *every j > i the pair is evaluated once and m_j * d / r^3 is added to i while
+     *m_i * d / r^3 is subtracted from j (Newton's third law). The gravitational
+     *constant is not applied, callers scale the accumulated result.
+     */
+    typedef void (*symmetric_kernel)(const double* x, const double* y, const double* z,
+                                     const double* m, int n, int row_begin, int row_end,
+                                     double* ax, double* ay, double* az);
+
+    void symmetric_scalar(const double* x, const double* y, const double* z,
+                          const double* m, int n, int row_begin, int row_end,
+                          double* ax, double* ay, double* az);
+
+    void symmetric_avx2(const double* x, const double* y, const double* z,
+                        const double* m, int n, int row_begin, int row_end,
+                        double* ax, double* ay, double* az);
+
+    void symmetric_avx512(const double* x, const double* y, const double* z,
+                          const double* m, int n, int row_begin, int row_end,
+                          double* ax, double* ay, double* az);
+
+    /*
+     *PROCEDURE: test_particles
+     *
+     *DESCRIPTION: Adds to (ax, ay, az) of the nt test particles the acceleration
+     *produced by the ns massive sources. Unlike the direct kernels it is
+     *vectorised across the targets: every source is broadcast to a whole block
+     *of test particles, which keeps the lanes full when there are only a
+     *handful of massive bodies (planets) and many thousands of targets.
+     *
+     *RETURNS: -
+     */
+    void test_particles(const double* sx, const double* sy, const double* sz,
+                        const double* sm, int ns,
+                        const double* tx, const double* ty, const double* tz, int nt,
+                        double G, double* ax, double* ay, double* az);
+
+    struct kernel_info{
+        const char* name;
+        direct_kernel function;
+        symmetric_kernel symmetric;
+        bool supported;
+    };
+
+    /*
+     *PROCEDURE: available_kernels
+     *
+     *DESCRIPTION: Lists every compiled kernel and whether the CPU can run it
+     *
+     *RETURNS: std::vector<kernel_info>
+     */
+    std::vector<kernel_info> available_kernels();
+
+    /*
+     *PROCEDURE: best_direct_kernel
+     *
+     *DESCRIPTION: Kernel selected from cpuid at first call. Setting the
+     *environment variable CELESTIAL_KERNEL to a kernel name overrides it.
+     *
+     *RETURNS: kernel_info
+     */
+    const kernel_info& best_direct_kernel();
+
+    /*
+     *PROCEDURE: accelerations
+     *
+     *DESCRIPTION: Fills (ax, ay, az) with the gravitational acceleration of
+     *every particle of the set due to all the others
+     *
+     *RETURNS: -
+     */
+    void accelerations(const ParticleSet& particles, double G,
+                       std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az);
+}
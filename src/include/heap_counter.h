@@ -0,0 +1,39 @@
+/*
+ * heap_counter.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+/*
+*PROCEDURE: heap_allocations
+*
+*DESCRIPTION: Number of calls of operator new made by the program so far,
+*for benchmarks to check that a step loop does not touch the heap. Only
+*the Celestial_benchmark build, compiled with CELESTIAL_COUNT_ALLOCATIONS,
+*counts: heap_counter.cpp then replaces every operator new, out of line so
+*the callers see the usual new/delete pair. Other builds keep the standard
+*allocator.
+*
+*RETURNS: allocation count, -1 when the build does not count
+*/
+long long heap_allocations();
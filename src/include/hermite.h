@@ -0,0 +1,159 @@
+/*
+ * hermite.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include "integration.h"
+#include "arena.h"
+
+//Block time steps: the smallest step is dt_max / 2^BLOCK_MAX_LEVELS
+const int BLOCK_MAX_LEVELS = 40;
+
+/*
+ * 	Struct: hermite_sources
+ *
+ *  Members: Structure of arrays copy of masses, positions and velocities,
+ *  streamed by the vectorised acceleration and jerk loop.
+ */
+struct hermite_sources{
+    real* m;
+    real* x;
+    real* y;
+    real* z;
+    real* vx;
+    real* vy;
+    real* vz;
+
+    void fill(const real mass[], const real pos[][NDIM], const real vel[][NDIM], int n);
+};
+
+void acc_jerk_pot_coll_sources(const hermite_sources& s, int n,
+                               const int active[], int n_active,
+                               real acc[][NDIM], real jerk[][NDIM],
+                               real & epot, real & coll_time);
+
+/*
+*CLASS: HermiteEngine
+*
+*DESCRIPTION: Stateful fourth order Hermite integrator for n particles in
+*units G = 1, with either a shared step (step) or individual block time steps
+*(step_block). Every buffer lives in one Arena sized at construction, so
+*stepping never allocates. The state at the start of a step is kept by
+*swapping the current and previous buffer pointers, the predictor then
+*writes the new state out of place.
+*
+*In block mode positions(), velocities(), accelerations() and jerks() hold
+*each particle's corrected state at its own last step; they describe one
+*instant only when synchronized() is true.
+*
+*/
+class HermiteEngine{
+public:
+    explicit HermiteEngine(int n, bool huge_pages = false);
+
+    HermiteEngine(const HermiteEngine&) = delete;
+    HermiteEngine& operator=(const HermiteEngine&) = delete;
+
+    //Copies the initial conditions in
+    void load(const real mass[], const real pos[][NDIM], const real vel[][NDIM], real t);
+
+    //Copies positions and velocities out
+    void store(real pos[][NDIM], real vel[][NDIM]) const;
+
+    /*
+     *Shared step: start_shared evaluates accelerations, jerks, potential
+     *and collision time, step advances every particle by dt
+     */
+    void start_shared();
+
+    void step(real dt);
+
+    /*
+     *Block steps: start_block picks the first steps, power of two fractions
+     *of dt_max, from dt_param |a| / |j|; step_block advances the particles
+     *due at the next block time and returns how many there were, with
+     *dt_param as the eta of the Aarseth criterion
+     */
+    void start_block(real dt_param, real dt_max);
+
+    int step_block(real dt_param);
+
+    bool synchronized() const { return fmod(m_t_block, m_dt_max) == 0; };
+
+    //Bytes of workspace needed for n particles
+    static std::size_t workspace_bytes(int n);
+
+    int size() const { return m_n; };
+    real time() const { return m_t; };
+    real potential() const { return m_epot; };              // shared step only
+    real collision_time() const { return m_coll_time; };    // shared step only
+    const real* masses() const { return m_mass; };
+    real (* positions())[NDIM] { return m_pos; };
+    real (* velocities())[NDIM] { return m_vel; };
+    real (* accelerations())[NDIM] { return m_acc; };
+    real (* jerks())[NDIM] { return m_jerk; };
+    long long steps() const { return m_steps; };
+    long long particle_steps() const { return m_particle_steps; };
+    long long interactions() const { return m_interactions; };
+    const Arena& workspace() const { return m_arena; };
+
+private:
+    Arena m_arena;
+    int m_n;
+    real m_t;
+    real m_epot, m_coll_time;
+    real* m_mass;
+    real (* m_pos)[NDIM];
+    real (* m_vel)[NDIM];
+    real (* m_acc)[NDIM];
+    real (* m_jerk)[NDIM];
+    real (* m_old_pos)[NDIM];       // start of the step, in block mode the predicted state
+    real (* m_old_vel)[NDIM];
+    real (* m_old_acc)[NDIM];       // start of the step, in block mode the new forces of the block
+    real (* m_old_jerk)[NDIM];
+
+    // block time steps, times relative to m_t0 so they stay exact binary fractions
+    real m_t0;
+    real m_t_block;
+    real m_dt_max, m_dt_min;
+    real* m_time;
+    real* m_step;
+    int* m_active;
+    hermite_sources m_sources;
+
+    long long m_steps;
+    long long m_particle_steps;
+    long long m_interactions;
+};
+
+/*
+ *PROCEDURE: evolve_step
+ *
+ *DESCRIPTION: One shared Hermite step of dt of the system loaded in engine
+ *(after start_shared), on the engine workspace
+ *
+ *RETURNS: potential energy and collision time of the new state in epot and
+ *coll_time
+ */
+void evolve_step(HermiteEngine& engine, real dt, real & epot, real & coll_time);
@@ -24,7 +24,11 @@
 
 #pragma once
 
+#include <functional>
+#include <utility>
 #include "structures.h"
+#include "particles.h"
+#include "force_provider.h"
 #include "planet_data.h"
 
 typedef double real;
@@ -39,14 +43,15 @@ void correct_step(real pos[][NDIM], real vel[][NDIM],
 void evolve(const real mass[], real pos[][NDIM], real vel[][NDIM],
             int n, real & t, real dt_param, real dt_dia, real dt_out,
             real dt_tot, bool init_out, bool x_flag);
-void evolve_step(const real mass[], real pos[][NDIM], real vel[][NDIM],
-                 real acc[][NDIM], real jerk[][NDIM], int n, real & t,
-                 real dt, real & epot, real & coll_time);
 void get_acc_jerk_pot_coll(const real mass[], const real pos[][NDIM],
                            const real vel[][NDIM], real acc[][NDIM],
                            real jerk[][NDIM], int n, real & epot,
                            real & coll_time);
-void get_snapshot(real mass[], real pos[][NDIM], real vel[][NDIM], int n);
+void get_acc_jerk_pot_coll_scalar(const real mass[], const real pos[][NDIM],
+                                  const real vel[][NDIM], real acc[][NDIM],
+                                  real jerk[][NDIM], int n, real & epot,
+                                  real & coll_time);
+bool get_snapshot(real mass[], real pos[][NDIM], real vel[][NDIM], int n, real & t);
 void predict_step(real pos[][NDIM], real vel[][NDIM],
                   const real acc[][NDIM], const real jerk[][NDIM],
                   int n, real dt);
@@ -59,43 +64,18 @@ void write_diagnostics(const real mass[], const real pos[][NDIM],
                        const real jerk[][NDIM], int n, real t, real epot,
                        int nsteps, real & einit, bool init_flag,
                        bool x_flag);
+void get_acc_jerk_active(const real mass[], const real pos[][NDIM],
+                         const real vel[][NDIM], const int active[],
+                         int n_active, int n, real acc[][NDIM],
+                         real jerk[][NDIM]);
+real potential_energy(const real mass[], const real pos[][NDIM], int n);
+void evolve_block(const real mass[], real pos[][NDIM], real vel[][NDIM],
+                  int n, real & t, real dt_param, real dt_dia, real dt_out,
+                  real dt_tot, bool init_out, bool x_flag);
 
 
 static const double dt = 0.00000001;
 
-static void record_state(std::vector<body>& bodies)
-{
-    for (auto body_iterator = bodies.begin(); body_iterator != bodies.end(); *body_iterator++)
-    {
-        body_iterator->locations.push_back(body_iterator->location);
-    }
-}
-
-static void output_states(const std::vector<body>& body_locations)
-{
-
-    for (auto body_iterator = body_locations.begin(); body_iterator != body_locations.end(); *body_iterator++)
-    {
-        std::ofstream f;
-        f.open(body_iterator->name + ".dat");
-        f << body_iterator->name << std::endl;
-        f.close();
-    }
-
-    for (auto body_iterator = body_locations.begin(); body_iterator != body_locations.end(); *body_iterator++)
-    {
-        std::ofstream f;
-        f.open(body_iterator->name + ".dat", std::ofstream::out | std::ofstream::app);
-        for (auto location = body_iterator->locations.begin(); location < body_iterator->locations.end(); *location++)
-        {
-            f << location->x << ","
-              << location->y << ","
-              << location->z << std::endl;
-        }
-        f.close();
-    }
-}
-
 /*
 *NAMESPACE: Orbit integration
 *
@@ -112,54 +92,536 @@ namespace Orbit_integration {
     class Integrator {
     public:
         virtual void compute_gravity_step() = 0;
-        virtual std::vector<body> &get_bodies() = 0;
+        virtual ParticleSet &get_particles() = 0;
     };
 
     class Euler : virtual Integrator {
     public:
-        Euler(std::vector<body> bodies, double time_step = 1) :
-                m_bodies(bodies),
-                m_time_step(time_step) {};
+        Euler(const std::vector<body>& bodies, double time_step = 1,
+              std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(bodies),
+                m_time_step(time_step),
+                m_forces(std::move(forces)) {};
+
+        Euler(ParticleSet particles, double time_step = 1,
+              std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(std::move(particles)),
+                m_time_step(time_step),
+                m_forces(std::move(forces)) {};
+
+        ParticleSet &get_particles() { return m_particles; };
 
-        std::vector<body> &get_bodies() { return m_bodies; };
+        std::vector<body> get_bodies() const { return m_particles.to_bodies(); };
+
+        void set_force_provider(std::shared_ptr<ForceProvider> forces) { m_forces = std::move(forces); };
 
         void compute_gravity_step();
 
-    private:
-        point calculate_single_body_acceleration(int);
+        double time() const { return m_time; };
 
+    private:
         void compute_velocity();
 
         void update_location();
 
     protected:
-        std::vector<body> m_bodies;
+        ParticleSet m_particles;
         double m_time_step;
+        std::shared_ptr<ForceProvider> m_forces;
+        std::vector<double> m_ax, m_ay, m_az;
+        double m_time = 0;
     };
 
     class RK4 : virtual public Integrator {
     public:
-        RK4(std::vector<body> bodies, double time_step = 1) :
-                m_bodies(std::move(bodies)),
-                m_time_step(time_step) {};
+        RK4(const std::vector<body>& bodies, double time_step = 1,
+              std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(bodies),
+                m_time_step(time_step),
+                m_forces(moment_provider(std::move(forces))) {};
+
+        RK4(ParticleSet particles, double time_step = 1,
+              std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(std::move(particles)),
+                m_time_step(time_step),
+                m_forces(moment_provider(std::move(forces))) {};
+
+        ParticleSet &get_particles() { return m_particles; };
 
-        std::vector<body> &get_bodies() { return m_bodies; };
+        std::vector<body> get_bodies() const { return m_particles.to_bodies(); };
+
+        void set_force_provider(std::shared_ptr<ForceProvider> forces) { m_forces = moment_provider(std::move(forces)); };
 
         void compute_gravity_step();
 
-    private:
-        point calculate_single_body_acceleration(int);
+        double time() const { return m_time; };
 
-        point partial_step(point &, point &, double);
+    private:
+        static std::shared_ptr<ForceProvider> moment_provider(std::shared_ptr<ForceProvider> forces);
 
         void compute_velocity();
 
         void update_location();
 
     protected:
-        std::vector<body> m_bodies;
+        ParticleSet m_particles;
         double m_time_step;
+        std::shared_ptr<ForceProvider> m_forces;
+        std::vector<double> m_moments;
+        double m_time = 0;
     };
+
+/*
+*CLASS: WHFast
+*
+*DESCRIPTION: Wisdom-Holman symplectic mapping in Jacobi coordinates for
+*systems dominated by one central mass (particle 0). Each step kicks the
+*Jacobi velocities with the interaction part of the forces and drifts every
+*Jacobi body along its exact Kepler orbit (universal variables), so the step
+*only has to resolve the perturbations: a few percent of the innermost orbital
+*period is enough. Consecutive half drifts are merged; the particle set is
+*brought back to a synchronised inertial state only when get_particles()
+*or get_bodies() asks for it. With correctors, the third order symplectic
+*corrector of Wisdom, Holman & Touma (1996) is applied when leaving and
+*entering the synchronised state, which removes the leading energy error
+*term. Interaction forces come from the force provider.
+*
+*/
+    class WHFast : virtual public Integrator {
+    public:
+        WHFast(const std::vector<body>& bodies, double time_step = 1, bool correctors = true,
+               std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(bodies),
+                m_time_step(time_step),
+                m_correctors(correctors),
+                m_forces(std::move(forces)) {};
+
+        WHFast(ParticleSet particles, double time_step = 1, bool correctors = true,
+               std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(std::move(particles)),
+                m_time_step(time_step),
+                m_correctors(correctors),
+                m_forces(std::move(forces)) {};
+
+        ParticleSet &get_particles() { synchronize(); return m_particles; };
+
+        std::vector<body> get_bodies() { synchronize(); return m_particles.to_bodies(); };
+
+        void set_force_provider(std::shared_ptr<ForceProvider> forces) { m_forces = std::move(forces); };
+
+        void compute_gravity_step();
+
+        double time() const { return m_time; };
+
+        /*
+         *Finishes the pending half drift and writes the inertial state back
+         *to the particle set
+         */
+        void synchronize();
+
+    private:
+        void to_jacobi();
+
+        void to_inertial_positions();
+
+        void to_inertial_velocities();
+
+        void kepler_drift(double dt);
+
+        void interaction_kick(double dt);
+
+        void corrector_step(double a, double b);
+
+        void apply_corrector(double direction);
+
+    protected:
+        ParticleSet m_particles;
+        double m_time_step;
+        bool m_correctors;
+        std::shared_ptr<ForceProvider> m_forces;
+        bool m_synchronized = true;
+        std::vector<double> m_x, m_y, m_z, m_vx, m_vy, m_vz;   // Jacobi coordinates, 0 = centre of mass
+        std::vector<double> m_interior;                       // m_0 + ... + m_i
+        std::vector<double> m_ax, m_ay, m_az;
+        double m_time = 0;
+    };
+
+/*
+*CLASS: IAS15
+*
+*DESCRIPTION: 15th order implicit integrator with adaptive time steps
+*(Rein & Spiegel 2015, after Everhart's RADAU). The acceleration over a step
+*is a degree seven polynomial in time, fitted by predictor-corrector iterations
+*on the seven Gauss-Radau substeps until it stops changing. The next step is
+*epsilon^(1/7) times the shortest timescale on which a particle's acceleration
+*changes, taken from the polynomial's derivatives at the end of the step
+*(Pham, Rein & Spiegel 2024), which unlike the last coefficient alone is not
+*swamped by round-off at tight tolerances. Steps that turn out much too long
+*are rejected and redone. Close encounters therefore get
+*short steps and quiet phases very long ones. epsilon = 0 keeps time_step
+*fixed. Positions and velocities are updated with compensated summation, and
+*forces come from the force provider.
+*
+*/
+    class IAS15 : virtual public Integrator {
+    public:
+        IAS15(const std::vector<body>& bodies, double time_step = 1, double epsilon = 1e-9,
+              std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(bodies),
+                m_time_step(time_step),
+                m_epsilon(epsilon),
+                m_forces(std::move(forces)) {};
+
+        IAS15(ParticleSet particles, double time_step = 1, double epsilon = 1e-9,
+              std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(std::move(particles)),
+                m_time_step(time_step),
+                m_epsilon(epsilon),
+                m_forces(std::move(forces)) {};
+
+        ParticleSet &get_particles() { return m_particles; };
+
+        std::vector<body> get_bodies() const { return m_particles.to_bodies(); };
+
+        void set_force_provider(std::shared_ptr<ForceProvider> forces) { m_forces = std::move(forces); };
+
+        /*
+         *Takes one accepted step, of whatever length the error control chose
+         */
+        void compute_gravity_step();
+
+        /*
+         *Takes steps until exactly duration has passed, shortening the last one
+         */
+        void integrate(double duration);
+
+        double time() const { return m_time; };
+
+        double time_step() const { return m_time_step; };
+
+        long long steps() const { return m_steps; };
+
+        long long rejected_steps() const { return m_rejected; };
+
+        long long evaluations() const { return m_evaluations; };
+
+    private:
+        void start();
+
+        void evaluate(std::vector<double>& acc);
+
+        bool attempt_step();
+
+        void rescale_step(double ratio);
+
+        void predict_next_step(double ratio);
+
+    protected:
+        ParticleSet m_particles;
+        double m_time_step;
+        double m_epsilon;
+        std::shared_ptr<ForceProvider> m_forces;
+        double m_time = 0;
+        long long m_steps = 0, m_rejected = 0, m_evaluations = 0;
+        bool m_a0_valid = false;
+        // per coordinate (3 i + axis) arrays
+        std::vector<double> m_x0, m_v0, m_a0, m_at, m_csx, m_csv;
+        std::vector<double> m_b[7], m_g[7];
+        std::vector<double> m_ax, m_ay, m_az;
+    };
+
+/*
+*CLASS: DOPRI5
+*
+*DESCRIPTION: Dormand-Prince 5(4) embedded Runge-Kutta integrator of the whole
+*system. Each of the seven stages evaluates the full N-body derivative (the
+*velocities and the force provider accelerations of the stage positions) into
+*its own preallocated buffer. The last stage of a step is the first of the
+*next one, so an accepted step costs six force evaluations. The difference
+*between the fifth and fourth order solutions sets the next step through a PI
+*controller, keeping it at tolerance relative to the size of each coordinate
+*and of the system. Hairer's fourth order dense output interpolates the state
+*anywhere inside the last step, so output times never shorten a step.
+*
+*/
+    class DOPRI5 : virtual public Integrator {
+    public:
+        DOPRI5(const std::vector<body>& bodies, double time_step = 1, double tolerance = 1e-10,
+               std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(bodies),
+                m_time_step(time_step),
+                m_tolerance(tolerance),
+                m_forces(std::move(forces)) {};
+
+        DOPRI5(ParticleSet particles, double time_step = 1, double tolerance = 1e-10,
+               std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(std::move(particles)),
+                m_time_step(time_step),
+                m_tolerance(tolerance),
+                m_forces(std::move(forces)) {};
+
+        ParticleSet &get_particles() { return m_particles; };
+
+        std::vector<body> get_bodies() const { return m_particles.to_bodies(); };
+
+        void set_force_provider(std::shared_ptr<ForceProvider> forces) { m_forces = std::move(forces); };
+
+        /*
+         *Takes one accepted step, of whatever length the error control chose
+         */
+        void compute_gravity_step();
+
+        /*
+         *Writes the state at time t, inside the last step taken, to the
+         *positions and velocities of out (sized like the particle set)
+         */
+        void interpolate(double t, ParticleSet& out) const;
+
+        /*
+         *Steps past time() + duration, calling output with the interpolated
+         *state every interval (the last call at time() + duration when it is
+         *a multiple of interval). The integrator ends inside the last step.
+         */
+        void integrate(double duration, double interval,
+                       const std::function<void(double, const ParticleSet&)>& output);
+
+        double time() const { return m_time; };
+
+        double time_step() const { return m_time_step; };
+
+        long long steps() const { return m_steps; };
+
+        long long rejected_steps() const { return m_rejected; };
+
+        long long evaluations() const { return m_evaluations; };
+
+    private:
+        void start();
+
+        void derivative(const std::vector<double>& state, std::vector<double>& rate);
+
+        bool attempt_step();
+
+    protected:
+        ParticleSet m_particles;
+        double m_time_step;
+        double m_tolerance;
+        std::shared_ptr<ForceProvider> m_forces;
+        double m_time = 0, m_last_step = 0;
+        double m_previous_error = 1e-4;
+        long long m_steps = 0, m_rejected = 0, m_evaluations = 0;
+        bool m_last_rejected = false;
+        ParticleSet m_stage, m_output;          // stage positions for the force provider, dense output
+        // states of 6 n values laid out x, y, z, vx, vy, vz
+        std::vector<double> m_y, m_y_new, m_y_stage;
+        std::vector<double> m_k[7];             // stage derivatives, m_k[0] holds f(m_y)
+        std::vector<double> m_dense[5];         // dense output coefficients of the last step
+        std::vector<double> m_ax, m_ay, m_az;
+    };
+
+/*
+*CLASS: BulirschStoer
+*
+*DESCRIPTION: Bulirsch-Stoer extrapolation integrator of the whole system for
+*short, very accurate arcs. A step of length H is crossed with Gragg's
+*modified midpoint rule using 2, 4, 6, ... substeps, whose error expands in
+*even powers of the substep, and the results are extrapolated to zero substep
+*length by Aitken-Neville polynomials in h^2. The difference between the last
+*two extrapolations measures the error against tolerance. The number of
+*columns (the order) and the step are chosen to minimise the force
+*evaluations per unit time (Deuflhard's work model), and steps that fail to
+*converge within one column beyond the target are redone shorter.
+*
+*/
+    class BulirschStoer : virtual public Integrator {
+    public:
+        BulirschStoer(const std::vector<body>& bodies, double time_step = 1, double tolerance = 1e-12,
+                      std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(bodies),
+                m_time_step(time_step),
+                m_tolerance(tolerance),
+                m_forces(std::move(forces)) {};
+
+        BulirschStoer(ParticleSet particles, double time_step = 1, double tolerance = 1e-12,
+                      std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(std::move(particles)),
+                m_time_step(time_step),
+                m_tolerance(tolerance),
+                m_forces(std::move(forces)) {};
+
+        ParticleSet &get_particles() { return m_particles; };
+
+        std::vector<body> get_bodies() const { return m_particles.to_bodies(); };
+
+        void set_force_provider(std::shared_ptr<ForceProvider> forces) { m_forces = std::move(forces); };
+
+        /*
+         *Takes one accepted step, of whatever length and order the error
+         *control chose
+         */
+        void compute_gravity_step();
+
+        /*
+         *Takes steps until exactly duration has passed, shortening the last one
+         */
+        void integrate(double duration);
+
+        double time() const { return m_time; };
+
+        double time_step() const { return m_time_step; };
+
+        int columns() const { return m_columns; };
+
+        long long steps() const { return m_steps; };
+
+        long long rejected_steps() const { return m_rejected; };
+
+        long long evaluations() const { return m_evaluations; };
+
+    private:
+        void start();
+
+        void derivative(const std::vector<double>& state, std::vector<double>& rate);
+
+        void modified_midpoint(double H, int substeps);
+
+        bool attempt_step();
+
+    protected:
+        ParticleSet m_particles;
+        double m_time_step;
+        double m_tolerance;
+        std::shared_ptr<ForceProvider> m_forces;
+        double m_time = 0;
+        int m_columns = 4;                      // target extrapolation column
+        long long m_steps = 0, m_rejected = 0, m_evaluations = 0;
+        bool m_f0_valid = false;                // m_f0 holds the derivative at m_y
+        ParticleSet m_stage;                    // positions handed to the force provider
+        // states of 6 n values laid out x, y, z, vx, vy, vz
+        std::vector<double> m_y, m_f0, m_z0, m_z1, m_f, m_result;
+        std::vector<std::vector<double>> m_table; // extrapolation tableau, one row
+        std::vector<double> m_ax, m_ay, m_az;
+    };
+
+/*
+ * Struct: leapfrog2, yoshida4, suzuki4, yoshida6, yoshida8
+ *
+ * OBJECTS: Symmetric compositions of the second order leapfrog. A step of
+ * length dt is the sequence of leapfrog steps weights[0] dt, ...,
+ * weights[stages - 1] dt. yoshida4 is the triple jump, suzuki4 Suzuki's five
+ * stage fractal, yoshida6 and yoshida8 Yoshida's (1990) solutions A and D.
+*/
+    struct leapfrog2{
+        static constexpr int order = 2;
+        static constexpr int stages = 1;
+        static constexpr double weights[stages] = { 1.0 };
+    };
+
+    struct yoshida4{
+        static constexpr int order = 4;
+        static constexpr int stages = 3;
+        static constexpr double weights[stages] = { 1.351207191959657634047687808971460827,
+                                                    -1.702414383919315268095375617942921654,
+                                                    1.351207191959657634047687808971460827 };
+    };
+
+    struct suzuki4{
+        static constexpr int order = 4;
+        static constexpr int stages = 5;
+        static constexpr double weights[stages] = { 0.414490771794375737142354062860761496,
+                                                    0.414490771794375737142354062860761496,
+                                                    -0.657963087177502948569416251443045983,
+                                                    0.414490771794375737142354062860761496,
+                                                    0.414490771794375737142354062860761496 };
+    };
+
+    struct yoshida6{
+        static constexpr int order = 6;
+        static constexpr int stages = 7;
+        static constexpr double weights[stages] = { 0.784513610477560, 0.235573213359357, -1.17767998417887,
+                                                    1.315186320683906,
+                                                    -1.17767998417887, 0.235573213359357, 0.784513610477560 };
+    };
+
+    struct yoshida8{
+        static constexpr int order = 8;
+        static constexpr int stages = 15;
+        static constexpr double weights[stages] = { 0.914844246229740, 0.253693336566229, -1.44485223686048,
+                                                    -0.158240635368243, 1.93813913762276, -1.96061023297549,
+                                                    0.102799849391985,
+                                                    1.708453070786998,
+                                                    0.102799849391985, -1.96061023297549, 1.93813913762276,
+                                                    -0.158240635368243, -1.44485223686048, 0.253693336566229,
+                                                    0.914844246229740 };
+    };
+
+/*
+*CLASS: Composition
+*
+*DESCRIPTION: N-body kick-drift-kick leapfrog composed into a higher order
+*symplectic map by the weights of Scheme (one of the structs above), fixed at
+*compile time so the stage loop unrolls completely. Each stage costs one force
+*evaluation: the acceleration after a drift serves both the closing kick of
+*that stage and the opening kick of the next, across steps too. Being
+*symplectic and time symmetric, the map keeps the energy error bounded with
+*no secular drift, so long runs can take much longer steps than RK4.
+*Instantiated for the five schemes in symplectic.cpp.
+*
+*/
+    template <class Scheme>
+    class Composition : virtual public Integrator {
+    public:
+        Composition(const std::vector<body>& bodies, double time_step = 1,
+                    std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(bodies),
+                m_time_step(time_step),
+                m_forces(std::move(forces)) {};
+
+        Composition(ParticleSet particles, double time_step = 1,
+                    std::shared_ptr<ForceProvider> forces = std::make_shared<DirectSummation>()) :
+                m_particles(std::move(particles)),
+                m_time_step(time_step),
+                m_forces(std::move(forces)) {};
+
+        ParticleSet &get_particles() { return m_particles; };
+
+        std::vector<body> get_bodies() const { return m_particles.to_bodies(); };
+
+        void set_force_provider(std::shared_ptr<ForceProvider> forces) { m_forces = std::move(forces); m_accelerations_valid = false; };
+
+        void compute_gravity_step();
+
+        double time() const { return m_time; };
+
+        long long evaluations() const { return m_evaluations; };
+
+    private:
+        void evaluate();
+
+        void kick(double dt);
+
+        void drift(double dt);
+
+        void stage(double dt);
+
+        template <std::size_t... I>
+        void stages(std::index_sequence<I...>);
+
+    protected:
+        ParticleSet m_particles;
+        double m_time_step;
+        std::shared_ptr<ForceProvider> m_forces;
+        bool m_accelerations_valid = false;
+        long long m_evaluations = 0;
+        double m_time = 0;
+        std::vector<double> m_ax, m_ay, m_az;
+    };
+
+    typedef Composition<leapfrog2> Leapfrog;
+    typedef Composition<yoshida4> Yoshida4;
+    typedef Composition<suzuki4> Suzuki4;
+    typedef Composition<yoshida6> Yoshida6;
+    typedef Composition<yoshida8> Yoshida8;
 }
 
 /*
@@ -0,0 +1,59 @@
+/*
+ * kepler.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+/*
+*NAMESPACE: kepler
+*
+*DESCRIPTION: Two body (Kepler) propagation in universal variables, valid for
+*elliptic, parabolic and hyperbolic orbits alike.
+*
+*/
+namespace kepler{
+
+    /*
+     *PROCEDURE: stumpff
+     *
+     *DESCRIPTION: Stumpff functions c0(z) ... c3(z), with series near z = 0
+     *where the closed forms lose precision
+     *
+     *RETURNS: - (c[0] ... c[3])
+     */
+    void stumpff(double z, double c[4]);
+
+    /*
+     *PROCEDURE: drift
+     *
+     *DESCRIPTION: Advances the relative position (x, y, z) and velocity
+     *(vx, vy, vz) along the Kepler orbit about gm = G (m1 + m2) by dt.
+     *Solves Kepler's equation for the universal anomaly with Newton steps and
+     *falls back to Laguerre-Conway iterations, then applies the f and g
+     *functions.
+     *
+     *RETURNS: -
+     */
+    void drift(double gm, double dt, double& x, double& y, double& z,
+               double& vx, double& vy, double& vz);
+}
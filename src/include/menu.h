@@ -47,11 +47,11 @@ void Process_Selection_Two();
 void Process_Selection_Three();
 void Process_Selection_Four();
 
-static Menu_Option main_menu[] =
+[[maybe_unused]] static Menu_Option main_menu[] =
 {
   {'1', "Euler first order for 2 body systems", Process_Selection_One},
   {'2', "F and G series for 2 body systems", Process_Selection_Two},
-  {'3', "Runge Kutta-Fehlberg 5th order", Process_Selection_Two},
+  {'3', "IAS15 15th order with adaptive time steps", Process_Selection_Three},
   {'4',"Runge-Kutta 4th order", Process_Selection_Two}
 };
 
@@ -0,0 +1,69 @@
+/*
+ * mergers.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include "collisions.h"
+
+/*
+*CLASS: MergeStage
+*
+*DESCRIPTION: Perfectly inelastic mergers of the pairs found by a
+*CollisionDetector, run once per step on the particles of an integrator.
+*Pairs are merged in the order of their contact time; a particle that
+*already merged is replaced by the body it merged into, so chains collapse
+*onto a single survivor. The survivor is the more massive particle of a
+*pair and keeps its id and name; it takes the total mass, the centre of
+*mass position and velocity (conserving mass and momentum) and the radius of
+*the combined volume. A test particle is simply absorbed. The losers are
+*only marked during the pass and removed together by one in place
+*compaction of the particle store at its end, so a step costs one O(N) pass
+*however many particles it loses, and no column is reallocated.
+*
+*The integrators notice the smaller store on their next step: the adaptive
+*ones restart, WHFast rebuilds its Jacobi coordinates from the synchronised
+*particles.
+*
+*/
+class MergeStage{
+public:
+    /*
+     *PROCEDURE: merge
+     *
+     *DESCRIPTION: Merges the colliding pairs and compacts the store
+     *
+     *RETURNS: number of particles removed
+     */
+    std::size_t merge(ParticleSet& particles, const std::vector<collision>& hits);
+
+    std::size_t removed() const { return m_removed; };
+
+private:
+    int survivor(int i);
+
+    std::vector<collision> m_order;     // hits sorted by contact time
+    std::vector<int> m_merged_into;     // -1, or the particle a loser merged into
+    std::vector<char> m_dead;
+    std::size_t m_removed = 0;
+};
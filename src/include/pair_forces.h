@@ -0,0 +1,97 @@
+/*
+ * pair_forces.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include "particles.h"
+
+/*
+ * Enum: rk4_moment
+ *
+ * OBJECTS: Channels of the per particle sums needed by the RK4 integrator.
+ * With t = G m_j / r^3 and d = x_j - x_i for every partner j of particle i,
+ * P_k = sum t^k and D_k = sum t^k d.
+*/
+enum rk4_moment{
+    RK4_P1, RK4_P2, RK4_P3,
+    RK4_D1X, RK4_D1Y, RK4_D1Z,
+    RK4_D2X, RK4_D2Y, RK4_D2Z,
+    RK4_D3X, RK4_D3Y, RK4_D3Z,
+    RK4_D4X, RK4_D4Y, RK4_D4Z,
+    RK4_MOMENT_CHANNELS
+};
+
+/*
+*CLASS: PairForceEngine
+*
+*DESCRIPTION: Shared pair force evaluation for the Orbit_integration integrators.
+*Every unordered pair {i, j} is evaluated once and its contribution is scattered
+*with opposite signs to i and j. Rows are shared out between OpenMP threads,
+*each thread accumulating into its own buffer so no two threads ever write the
+*same element; the buffers are summed at the end. Test particles (the tail of
+*the set, see ParticleSet) only interact with the massive particles, which
+*makes their cost O(N_massive N_test) instead of quadratic.
+*
+*/
+class PairForceEngine{
+public:
+    /*
+     *threads = 0 uses every thread OpenMP makes available
+     */
+    explicit PairForceEngine(int threads = 0);
+
+    /*
+     *PROCEDURE: accelerations
+     *
+     *DESCRIPTION: Gravitational acceleration of every particle due to all the
+     *others, using the symmetric kernel selected for this CPU
+     *
+     *RETURNS: -
+     */
+    void accelerations(const ParticleSet& particles, double G,
+                       std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az);
+
+    /*
+     *PROCEDURE: rk4_moments
+     *
+     *DESCRIPTION: Per particle sums listed in rk4_moment, stored channel major
+     *(moments[channel * n + i])
+     *
+     *RETURNS: -
+     */
+    void rk4_moments(const ParticleSet& particles, double G, std::vector<double>& moments);
+
+    int threads() const { return m_threads; }
+
+private:
+    void test_accelerations(const ParticleSet& particles, double G,
+                            std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az);
+
+    template <class RowFunction>
+    void accumulate(int n, int channels, std::vector<double>& out, RowFunction rows);
+
+    int m_threads;
+    std::vector<std::vector<double>> m_thread_buffers;
+    std::vector<double> m_buffer;
+};
@@ -26,6 +26,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include "structures.h"
+#include "batch.h"
 
 /*
  *PROCEDURE: check_comment
@@ -81,10 +83,28 @@ void initiateSystem(char * filename);
 /*
  *PROCEDURE: parse_data
  *
- *DESCRIPTION: Parses file and initializes system with received bodies (in C++)
+ *DESCRIPTION: Parses file and initializes system with received bodies (in C++).
+ *The first line holds the number of bodies and the gravitational constant,
+ *then every row is "name mass radius x y z vx vy vz [test]" in SI units. A
+ *trailing 1 flags the row as a test particle: a massless body that feels the
+ *gravity of the massive ones but exerts none.
  *
- *RETURNS: -
+ *RETURNS: std::vector<body>
  *
  */
-void parse_data(const std::string& filename);
+std::vector<body> parse_data(const std::string& filename);
+
 
+/*
+ *PROCEDURE: parse_batch
+ *
+ *DESCRIPTION: Parses a batch of small independent systems. The first line
+ *holds "num_systems gravity_constant time_step duration [escape_radius
+ *[energy_tolerance]]", which fill options; every system then starts with a
+ *"label num_bodies" line followed by num_bodies rows in the format of
+ *parse_data (without the test particle flag).
+ *
+ *RETURNS: std::vector<batch_system>
+ *
+ */
+std::vector<batch_system> parse_batch(const std::string& filename, batch_options& options);
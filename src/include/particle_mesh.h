@@ -0,0 +1,108 @@
+/*
+ * particle_mesh.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include "force_provider.h"
+#include "fft.h"
+
+/*
+ * Enum: mass_assignment
+ *
+ * OBJECTS: Particle <-> mesh weighting of ParticleMesh. Cloud in cell spreads
+ * a particle over the 2x2x2 nearest nodes, triangular shaped cloud over 3x3x3.
+*/
+enum mass_assignment{
+    CIC,
+    TSC
+};
+
+/*
+*CLASS: ParticleMesh
+*
+*DESCRIPTION: Particle-mesh gravity for large, smooth (collisionless) mass
+*distributions. Every evaluation fits a cubic mesh of grid^3 nodes around the
+*particles, assigns their mass to it, convolves it with the 1/r Green's
+*function through FFTs on a mesh zero padded to (2 grid)^3 (Hockney-Eastwood
+*isolated boundary conditions, no periodic images) and interpolates the four
+*point finite difference acceleration back with the same weighting, which
+*keeps the scheme free of self forces. grid must be a power of two. Forces
+*are smoothed on the scale of a mesh cell.
+*
+*/
+class ParticleMesh : public ForceProvider{
+public:
+    explicit ParticleMesh(int grid = 128, mass_assignment scheme = TSC);
+
+    void accelerations(const ParticleSet& particles, double G,
+                       std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az);
+
+    /*
+     *The mesh has no pair terms for the P and D2-D4 sums, which RK4 needs
+     *to stay fourth order: rk4_moments throws std::logic_error and the RK4
+     *integrator refuses this backend.
+     */
+    void rk4_moments(const ParticleSet& particles, double G, std::vector<double>& moments);
+
+    bool has_rk4_moments() const { return false; };
+
+    const char* name() const { return "pm"; };
+
+    int grid() const { return m_n; };
+
+    double cell_size() const { return m_h; };
+
+private:
+    void green_function();
+
+    void place_mesh(const ParticleSet& particles);
+
+    void assign(const ParticleSet& particles);
+
+    void forward(int active);
+
+    void inverse(int active);
+
+    void convolve();
+
+    void interpolate(const ParticleSet& particles, double G,
+                     std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az);
+
+    std::size_t real_index(int x, int y, int z) const
+    {
+        return ((std::size_t)z * m_padded + y) * 2 * m_line + x;
+    };
+
+    int m_n;                    // mesh nodes per side
+    int m_padded;               // 2 m_n
+    int m_line;                 // m_padded / 2 + 1 complex values per x line
+    mass_assignment m_scheme;
+    double m_h;                 // cell size
+    double m_origin[3];         // position of node (0, 0, 0)
+
+    RealFFT m_real_fft;
+    ComplexFFT m_fft;
+    std::vector<double> m_green;        // transformed Green's function, (m_padded/2 + 1)^3, grid units
+    std::vector<complex_t> m_work;      // m_padded^2 x lines of m_line values
+};
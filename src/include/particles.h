@@ -0,0 +1,119 @@
+/*
+ * particles.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include "structures.h"
+
+/*
+ * Struct: ParticleSet
+ *
+ * OBJECTS: Structure-of-arrays particle store. Every hot quantity used by the
+ * force loops (position, velocity, mass) lives in its own contiguous array;
+ * radius and name are cold data kept in separate arrays. The body struct is
+ * only used to import and export particles.
+ *
+ * Massless bodies are test particles: they feel the gravity of the massive
+ * particles but exert none. They are kept together at the end of the store,
+ * the last n_test entries, so the force loops can treat them as a separate
+ * population and skip every test-test pair.
+ *
+ * Every particle carries an external id that does not change when particles
+ * are inserted or removed: the position of the body in the input for the
+ * constructor, the next unused id for add().
+*/
+struct ParticleSet{
+
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+    std::vector<double> vx;
+    std::vector<double> vy;
+    std::vector<double> vz;
+    std::vector<double> mass;
+    std::vector<double> radius;
+    std::vector<std::string> name;
+    std::vector<std::size_t> id;
+    std::size_t n_test = 0;
+    std::size_t next_id = 0;
+
+    ParticleSet() = default;
+    explicit ParticleSet(const std::vector<body>& bodies);
+
+    std::size_t size() const { return mass.size(); }
+
+    std::size_t massive() const { return size() - std::min(n_test, size()); }
+
+    point location(std::size_t i) const { return point{ x[i], y[i], z[i] }; }
+    point velocity(std::size_t i) const { return point{ vx[i], vy[i], vz[i] }; }
+
+    /*
+     *PROCEDURE: reserve
+     *
+     *DESCRIPTION: Reserves storage for n particles in every column
+     *
+     *RETURNS: -
+     */
+    void reserve(std::size_t n);
+
+    /*
+     *PROCEDURE: add
+     *
+     *DESCRIPTION: Appends a body to the store. Its location history is
+     *not copied. A massive body added once test particles are present is
+     *inserted in front of them.
+     *
+     *RETURNS: -
+     */
+    void add(const body& b);
+
+    /*
+     *PROCEDURE: remove_marked
+     *
+     *DESCRIPTION: Removes every particle i with dead[i] set, compacting all
+     *columns in place in a single pass. The survivors keep their order, ids
+     *and the massive / test partition, and no storage is released.
+     *
+     *RETURNS: number of particles removed
+     */
+    std::size_t remove_marked(const std::vector<char>& dead);
+
+    /*
+     *PROCEDURE: get_body
+     *
+     *DESCRIPTION: Builds a body view of particle i (without location history)
+     *
+     *RETURNS: body
+     */
+    body get_body(std::size_t i) const;
+
+    /*
+     *PROCEDURE: to_bodies
+     *
+     *DESCRIPTION: Exports the whole store as a vector of bodies
+     *
+     *RETURNS: std::vector<body>
+     */
+    std::vector<body> to_bodies() const;
+};
@@ -0,0 +1,222 @@
+/*
+ * snapshot.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include "particles.h"
+
+#define SNAPSHOT_VERSION 1
+
+//Columns start on multiples of this many bytes (a cache line, an AVX-512 vector)
+#define SNAPSHOT_ALIGNMENT 64
+
+#define SNAPSHOT_COLUMNS 7
+
+/*
+ * Struct: snapshot_units
+ *
+ * OBJECTS: Unit system of a snapshot: the gravitational constant in it and
+ * the SI value of its units of length, mass and time, which are 0 for
+ * dimensionless N-body units.
+*/
+struct snapshot_units{
+    double G;
+    double length;
+    double mass;
+    double time;
+};
+
+/*
+ * Struct: snapshot_header
+ *
+ * OBJECTS: First 256 bytes of every snapshot record. It is followed by
+ * SNAPSHOT_COLUMNS columns of n doubles (mass, x, y, z, vx, vy, vz, named in
+ * fields), each starting column_stride bytes after the previous one, so
+ * every column is SNAPSHOT_ALIGNMENT aligned in a mapped file. checksum covers
+ * the columns, padding included. Records follow each other: the next one, if
+ * any, starts record_bytes after this header. Numbers are stored in the byte
+ * order of the writer, recorded in byte_order.
+*/
+struct snapshot_header{
+    char magic[8];                      // "CELSNAP"
+    std::uint32_t version;
+    std::uint32_t byte_order;           // 0x01020304 as written
+    std::uint64_t header_bytes;         // offset of the first column
+    std::uint64_t record_bytes;
+    std::uint64_t n;
+    std::uint64_t columns;
+    std::uint64_t column_stride;
+    std::uint64_t checksum;
+    double time;
+    snapshot_units units;
+    char fields[SNAPSHOT_COLUMNS][16];
+    char reserved[256 - 104 - 16 * SNAPSHOT_COLUMNS];
+};
+
+/*
+ *PROCEDURE: snapshot_checksum
+ *
+ *DESCRIPTION: 64 bit checksum of bytes (a multiple of 32) of data, four
+ *independent multiply-rotate lanes as in xxHash64 so it runs at memory speed
+ *
+ *RETURNS: std::uint64_t
+ */
+std::uint64_t snapshot_checksum(const void* data, std::size_t bytes);
+
+/*
+ *PROCEDURE: write_snapshot
+ *
+ *DESCRIPTION: Appends a snapshot record of the particles to the open file
+ *descriptor fd with a single gathering write straight from the particle
+ *columns, nothing is formatted or copied
+ *
+ *RETURNS: false if the write failed
+ */
+bool write_snapshot(int fd, const ParticleSet& particles, double time, const snapshot_units& units);
+
+/*
+ *PROCEDURE: write_snapshot
+ *
+ *DESCRIPTION: Same for the columns mass, x, y, z, vx, vy, vz of n particles
+ *
+ *RETURNS: false if the write failed
+ */
+bool write_snapshot(int fd, const double* const columns[SNAPSHOT_COLUMNS], std::size_t n, double time,
+                    const snapshot_units& units);
+
+/*
+ *PROCEDURE: write_snapshot
+ *
+ *DESCRIPTION: Writes the particles to a new snapshot file path
+ *
+ *RETURNS: false if the file could not be written
+ */
+bool write_snapshot(const std::string& path, const ParticleSet& particles, double time, const snapshot_units& units);
+
+/*
+*CLASS: SnapshotReader
+*
+*DESCRIPTION: Memory maps a snapshot file and serves its columns in place:
+*opening a file reads and checks the record headers, the data is never
+*parsed or copied and is paged in by the kernel as the columns are used.
+*A file may hold several records (a run dumping a snapshot per output
+*time); select() moves to another one. The checksum of a record is verified
+*when it is selected unless verification is turned off.
+*
+*/
+class SnapshotReader{
+public:
+    SnapshotReader() = default;
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+    ~SnapshotReader();
+
+    /*
+     *PROCEDURE: open
+     *
+     *DESCRIPTION: Maps path and selects its first record
+     *
+     *RETURNS: false with the reason in error() if the file is not a valid snapshot
+     */
+    bool open(const std::string& path, bool verify = true);
+
+    void close();
+
+    /*
+     *PROCEDURE: select
+     *
+     *DESCRIPTION: Makes record k of the file the current one
+     *
+     *RETURNS: false if there is no such record or its checksum does not match
+     */
+    bool select(std::size_t k);
+
+    std::size_t snapshots() const { return m_records.size(); };
+
+    const snapshot_header& header() const { return *m_header; };
+
+    std::size_t size() const { return m_header->n; };
+
+    double time() const { return m_header->time; };
+
+    const double* column(int c) const
+    {
+        return reinterpret_cast<const double*>(reinterpret_cast<const char*>(m_header) + m_header->header_bytes
+                                               + c * m_header->column_stride);
+    };
+
+    const double* mass() const { return column(0); };
+    const double* x() const { return column(1); };
+    const double* y() const { return column(2); };
+    const double* z() const { return column(3); };
+    const double* vx() const { return column(4); };
+    const double* vy() const { return column(5); };
+    const double* vz() const { return column(6); };
+
+    /*
+     *PROCEDURE: particles
+     *
+     *DESCRIPTION: Copies the current record into a particle store, particle i
+     *named p<i>, with no radius
+     *
+     *RETURNS: ParticleSet
+     */
+    ParticleSet particles() const;
+
+    const std::string& error() const { return m_error; };
+
+private:
+    bool fail(const std::string& reason);
+
+    const char* m_map = nullptr;
+    std::size_t m_bytes = 0;
+    bool m_verify = true;
+    std::vector<std::size_t> m_records;     // offset of every record
+    const snapshot_header* m_header = nullptr;
+    std::string m_error;
+};
+
+/*
+ *PROCEDURE: text_to_snapshot
+ *
+ *DESCRIPTION: Converts the text snapshots of put_snapshot's former output
+ *(N, time, then a "mass x y z vx vy vz" line per particle, repeated) read
+ *from in into a snapshot file
+ *
+ *RETURNS: number of snapshots converted, -1 if the text is malformed or the
+ *file cannot be written
+ */
+int text_to_snapshot(std::istream& in, const std::string& path, const snapshot_units& units);
+
+/*
+ *PROCEDURE: snapshot_to_text
+ *
+ *DESCRIPTION: Writes every record of the snapshot file in that text format
+ *
+ *RETURNS: number of snapshots converted, -1 if the file is not a valid snapshot
+ */
+int snapshot_to_text(const std::string& path, std::ostream& out);
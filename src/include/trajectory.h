@@ -0,0 +1,604 @@
+/*
+ * trajectory.h
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "particles.h"
+
+//Frames a TrajectoryWriter holds in memory, its whole footprint is this many
+//copies of the particle state whatever the length of the run
+#define TRAJECTORY_RING_FRAMES 128
+
+//Frames the writer thread waits for before it hands a chunk to the format,
+//long chunks leave the column coder fewer starts of columns to pay for
+#define TRAJECTORY_CHUNK_FRAMES 64
+
+#define TRAJECTORY_VERSION 2
+
+//Highest order of the finite differences tried by the column coder
+#define TRAJECTORY_MAX_ORDER 4
+
+//Per body columns of a columnar trajectory: x, y, z, vx, vy, vz
+#define TRAJECTORY_COLUMNS 6
+
+/*
+ * Struct: trajectory_frame
+ *
+ * OBJECTS: State of the particles at one output time, columns in store order
+ * keyed by the external particle id, and the names of the ids that appear in
+ * the trajectory for the first time with this frame.
+*/
+struct trajectory_frame{
+    double time;
+    std::vector<std::size_t> id;
+    std::vector<double> x, y, z, vx, vy, vz;
+    std::vector<std::pair<std::size_t, std::string>> new_names;
+};
+
+/*
+*CLASS: TrajectoryFormat
+*
+*DESCRIPTION: Storage backend of a TrajectoryWriter. It only ever runs on the
+*writer thread and gets the frames in time order, a chunk at a time.
+*
+*/
+class TrajectoryFormat{
+public:
+    virtual ~TrajectoryFormat() {};
+
+    /*
+     *PROCEDURE: write
+     *
+     *DESCRIPTION: Stores a chunk of consecutive frames
+     *
+     *RETURNS: false on an output error
+     */
+    virtual bool write(const std::vector<const trajectory_frame*>& chunk) = 0;
+
+    /*
+     *PROCEDURE: finish
+     *
+     *DESCRIPTION: Completes the output after the last chunk
+     *
+     *RETURNS: false on an output error
+     */
+    virtual bool finish() { return true; };
+};
+
+/*
+*CLASS: TextTrajectory
+*
+*DESCRIPTION: The per body text output: <name>.dat starts with the name of the
+*body and has one "x,y,z" line per frame, or with full_state one
+*"x,y,z,vx,vy,vz" line to 17 digits, which reads back exactly. A file is
+*created when its body first appears and appended to once per chunk, so
+*everything but the last chunk is on disk if the run dies, and a body
+*removed in a merger keeps its trajectory up to its last frame.
+*
+*/
+class TextTrajectory : public TrajectoryFormat{
+public:
+    explicit TextTrajectory(std::string prefix = "", bool full_state = false) :
+        m_prefix(std::move(prefix)), m_full_state(full_state) {};
+
+    bool write(const std::vector<const trajectory_frame*>& chunk);
+
+private:
+    std::string m_prefix;                   // prepended to every file name
+    bool m_full_state;
+    std::vector<std::string> m_file;        // [id], empty until the body appears
+    std::vector<std::string> m_pending;     // [id], lines of the current chunk
+};
+
+/*
+ * Struct: trajectory_file_header
+ *
+ * OBJECTS: First 64 bytes of a columnar trajectory file, followed by its
+ * chunks. Numbers are stored in the byte order of the writer, recorded in
+ * byte_order.
+*/
+struct trajectory_file_header{
+    char magic[8];                      // "CELTRAJ"
+    std::uint32_t version;
+    std::uint32_t byte_order;           // 0x01020304 as written
+    std::uint64_t header_bytes;         // offset of the first chunk
+    std::uint64_t columns;              // TRAJECTORY_COLUMNS
+    char reserved[32];
+};
+
+/*
+ * Struct: trajectory_chunk_header
+ *
+ * OBJECTS: Header of a chunk of consecutive frames. It is followed by the ids
+ * of the bodies of the chunk (bodies uint64), the name table of the bodies
+ * first seen in it (names_bytes, entries of uint64 id, uint64 length and the
+ * name padded to 8 bytes), the time column (frames doubles) and then, body
+ * after body in id order of the chunk, its TRAJECTORY_COLUMNS columns of
+ * frames doubles. A body missing from a frame (merged away, not yet added)
+ * has NaN there. The next chunk starts chunk_bytes after this header.
+ *
+ * In an encoded chunk (encoding 1) the name table is followed by a table of
+ * the byte sizes of 1 + bodies * TRAJECTORY_COLUMNS coded columns (uint64),
+ * then the coded columns in the order above, each padded to 8 bytes.
+*/
+struct trajectory_chunk_header{
+    char magic[8];                      // "CELCHNK"
+    std::uint64_t chunk_bytes;
+    std::uint64_t frames;
+    std::uint64_t bodies;
+    std::uint64_t names_bytes;
+    std::uint64_t encoding;             // 0 plain doubles, 1 coded columns
+    double first_time;
+    double last_time;
+};
+
+/*
+ * Struct: trajectory_index_entry
+ *
+ * OBJECTS: Entry of the time index closing a columnar trajectory file, one
+ * per chunk. The index is followed by a trajectory_index_trailer, the last
+ * 32 bytes of the file.
+*/
+struct trajectory_index_entry{
+    std::uint64_t offset;
+    std::uint64_t frames;
+    double first_time;
+    double last_time;
+};
+
+struct trajectory_index_trailer{
+    char magic[8];                      // "CELTIDX"
+    std::uint64_t chunks;
+    std::uint64_t index_offset;
+    std::uint64_t reserved;
+};
+
+/*
+ * Struct: trajectory_compression
+ *
+ * OBJECTS: Column coding of a ColumnarTrajectory. Disabled, the columns are
+ * stored as plain doubles. Enabled, every column is coded losslessly, or, for
+ * positions or velocities with a positive error, quantized to multiples of
+ * twice that error so no stored value is further than error from the true
+ * one. Times are always lossless.
+*/
+struct trajectory_compression{
+    bool enabled = false;
+    double position_error = 0;
+    double velocity_error = 0;
+};
+
+/*
+*CLASS: ColumnarTrajectory
+*
+*DESCRIPTION: Writes the whole trajectory to a single binary file: one chunk
+*of columns per chunk of frames, each written with a single system call, and
+*a time index of the chunks once the run finishes. A file whose run died has
+*no index but every complete chunk is still readable. The columns are
+*doubles, full precision, velocities included, either plain or coded.
+*
+*The coder treats a column as 64 bit integers: the bit patterns of the
+*doubles, or the quantization levels. It stores the k-th finite differences
+*of them along the frames, k from 0 to TRAJECTORY_MAX_ORDER chosen per
+*column to give the fewest bytes: a difference is the error of the
+*polynomial extrapolation of degree k - 1 from the previous frames, and for
+*smooth motion most of its high bytes are zero. Differences are zigzag
+*mapped, their count of significant bytes goes in a 4 bit code (FPC style)
+*and only those bytes are stored. Decoding is k running sums. Missing values
+*are left out of a coded column and marked in a presence bitmap, so sparse
+*frames (HermiteSampler) cost only the samples they hold.
+*
+*/
+class ColumnarTrajectory : public TrajectoryFormat{
+public:
+    explicit ColumnarTrajectory(const std::string& path,
+                                const trajectory_compression& compression = trajectory_compression());
+
+    ~ColumnarTrajectory();
+
+    bool write(const std::vector<const trajectory_frame*>& chunk);
+
+    bool finish();
+
+    std::uint64_t plain_bytes() const { return m_plain_bytes; };    // chunks as plain doubles
+
+    std::uint64_t written_bytes() const { return m_offset; };
+
+private:
+    bool append(const void* data, std::size_t bytes);
+
+    trajectory_compression m_compression;
+    std::uint64_t m_plain_bytes = 0;
+    std::vector<unsigned char> m_coded;     // the chunk after coding
+    std::vector<double> m_values;
+    std::vector<std::uint64_t> m_scratch;
+    int m_fd;
+    std::uint64_t m_offset = 0;
+    std::vector<trajectory_index_entry> m_index;
+    std::vector<std::int64_t> m_slot;       // [id], body of the id in the current chunk or -1
+    std::vector<std::size_t> m_bodies;      // ids of the current chunk
+    std::vector<double> m_buffer;           // the chunk being assembled
+};
+
+/*
+ *PROCEDURE: make_trajectory_format
+ *
+ *DESCRIPTION: Trajectory output selected by name: "text" for the per body
+ *<name>.dat files, any other name is the path of a columnar trajectory file
+ *written with compression
+ *
+ *RETURNS: std::unique_ptr<TrajectoryFormat>
+ */
+std::unique_ptr<TrajectoryFormat> make_trajectory_format(const std::string& name,
+                                                         const trajectory_compression& compression);
+
+/*
+*CLASS: TrajectoryReader
+*
+*DESCRIPTION: Memory maps a columnar trajectory and serves its chunks in
+*place, like SnapshotReader; coded chunks are decoded into a buffer when
+*selected. Opening reads the time index, or walks the chunk
+*headers if the file has none, and collects the body names; locate() finds
+*the frame of a time with two binary searches, on the index and on the time
+*column of one chunk, so random access only pages in the chunk it reads.
+*
+*/
+class TrajectoryReader{
+public:
+    TrajectoryReader() = default;
+    TrajectoryReader(const TrajectoryReader&) = delete;
+    TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+    ~TrajectoryReader();
+
+    /*
+     *PROCEDURE: open
+     *
+     *DESCRIPTION: Maps path and selects its first chunk
+     *
+     *RETURNS: false with the reason in error() if the file is not a valid trajectory
+     */
+    bool open(const std::string& path);
+
+    void close();
+
+    /*
+     *PROCEDURE: select
+     *
+     *DESCRIPTION: Makes chunk k of the file the current one
+     *
+     *RETURNS: false if there is no such chunk or it does not decode
+     */
+    bool select(std::size_t k);
+
+    /*
+     *PROCEDURE: locate
+     *
+     *DESCRIPTION: Selects the chunk holding the last frame at or before time
+     *(the first frame for earlier times) and sets frame to its index there
+     *
+     *RETURNS: false if the file has no frames
+     */
+    bool locate(double time, std::size_t& frame);
+
+    std::size_t chunks() const { return m_index.size(); };
+
+    std::size_t frames() const { return m_chunk->frames; };
+
+    std::size_t bodies() const { return m_chunk->bodies; };
+
+    const double* time() const { return m_time; };
+
+    std::size_t id(std::size_t body) const { return m_ids[body]; };
+
+    /*
+     *PROCEDURE: name
+     *
+     *DESCRIPTION: Name of a body by id
+     *
+     *RETURNS: empty string if the id never appears in the file
+     */
+    const std::string& name(std::size_t id) const;
+
+    const double* column(std::size_t body, int c) const
+    {
+        return m_time + m_chunk->frames * (1 + body * TRAJECTORY_COLUMNS + c);
+    };
+
+    const double* x(std::size_t body) const { return column(body, 0); };
+    const double* y(std::size_t body) const { return column(body, 1); };
+    const double* z(std::size_t body) const { return column(body, 2); };
+    const double* vx(std::size_t body) const { return column(body, 3); };
+    const double* vy(std::size_t body) const { return column(body, 4); };
+    const double* vz(std::size_t body) const { return column(body, 5); };
+
+    const std::string& error() const { return m_error; };
+
+private:
+    bool fail(const std::string& reason);
+
+    bool check_chunk(std::uint64_t offset);
+
+    const char* m_map = nullptr;
+    std::size_t m_bytes = 0;
+    std::vector<trajectory_index_entry> m_index;
+    std::vector<std::string> m_names;       // [id]
+    const trajectory_chunk_header* m_chunk = nullptr;
+    const std::uint64_t* m_ids = nullptr;
+    const double* m_time = nullptr;
+    std::vector<double> m_decoded;          // time and columns of a coded chunk
+    std::vector<std::uint64_t> m_scratch;
+    std::string m_error;
+};
+
+/*
+*CLASS: TrajectoryWriter
+*
+*DESCRIPTION: Streams the trajectory of a simulation to a TrajectoryFormat
+*with bounded memory. push copies the particle state into a ring of
+*ring_frames preallocated frames and returns; a background thread hands the
+*frames to the format in chunks of at least chunk_frames, so the integration
+*loop never waits for the disk unless the disk falls a whole ring behind.
+*Frame buffers are reused, after the first ring_frames pushes the writer does
+*not allocate as long as the number of particles does not grow.
+*
+*/
+class TrajectoryWriter{
+public:
+    explicit TrajectoryWriter(std::unique_ptr<TrajectoryFormat> format,
+                              std::size_t ring_frames = TRAJECTORY_RING_FRAMES,
+                              std::size_t chunk_frames = TRAJECTORY_CHUNK_FRAMES);
+
+    ~TrajectoryWriter();
+
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+    /*
+     *PROCEDURE: push
+     *
+     *DESCRIPTION: Queues the state of the particles at time. Blocks only while
+     *the ring is full
+     *
+     *RETURNS: false once the format failed or the writer was closed
+     */
+    bool push(const ParticleSet& particles, double time);
+
+    /*
+     *PROCEDURE: push
+     *
+     *DESCRIPTION: Queues a frame built by the caller, which may hold any
+     *subset of the bodies; its new_names must name the ids it is the first
+     *frame of
+     *
+     *RETURNS: false once the format failed or the writer was closed
+     */
+    bool push(const trajectory_frame& frame);
+
+    /*
+     *PROCEDURE: close
+     *
+     *DESCRIPTION: Writes the queued frames, finishes the format and stops the
+     *writer thread. Called by the destructor if needed
+     *
+     *RETURNS: false if any output failed
+     */
+    bool close();
+
+    std::size_t frames() const { return m_pushed; };
+
+    std::size_t stalls() const { return m_stalls; };    // pushes that waited for a free frame
+
+    /*
+     *PROCEDURE: buffer_bytes
+     *
+     *DESCRIPTION: Memory held by the frame buffers of the ring
+     *
+     *RETURNS: std::size_t
+     */
+    std::size_t buffer_bytes() const;
+
+private:
+    trajectory_frame* acquire();
+
+    void publish();
+
+    void drain();
+
+    std::unique_ptr<TrajectoryFormat> m_format;
+    std::vector<trajectory_frame> m_ring;
+    std::size_t m_chunk;
+    std::size_t m_pushed = 0;       // frames queued so far, frame k lives in m_ring[k % size]
+    std::size_t m_written = 0;      // frames handed to the format so far
+    std::size_t m_stalls = 0;
+    bool m_closing = false;
+    bool m_failed = false;
+    std::vector<char> m_named;      // [id], name already sent with a frame
+    std::mutex m_lock;
+    std::condition_variable m_ready;    // writer: a chunk is ready or closing
+    std::condition_variable m_free;     // producer: frames were written
+    std::thread m_thread;
+};
+
+//Longest run of frames HermiteSampler skips between two stored samples of a
+//body. Every skipped frame is kept to check the interpolant against, so this
+//bounds the memory per body and the cost of a frame
+#define TRAJECTORY_HERMITE_MAX_GAP 256
+
+/*
+ * Struct: trajectory_sample
+ *
+ * OBJECTS: State of one body at time t.
+*/
+struct trajectory_sample{
+    double t;
+    double x, y, z;
+    double vx, vy, vz;
+};
+
+/*
+ *PROCEDURE: hermite_state
+ *
+ *DESCRIPTION: Cubic Hermite interpolation of position and velocity at time t
+ *between the samples a and b
+ *
+ *RETURNS: Nothing
+ */
+void hermite_state(const trajectory_sample& a, const trajectory_sample& b, double t,
+                   point& position, point& velocity);
+
+/*
+*CLASS: HermiteSampler
+*
+*DESCRIPTION: Error bounded decimation of a trajectory at write time, in
+*front of a TrajectoryWriter. Every body keeps its last stored sample; a new
+*frame extends the body's interval up to it as long as the cubic Hermite
+*interpolant between the stored sample and the new one (positions and
+*velocities at both ends) reproduces the frames in between to within
+*tolerance. When it does not, the previous frame is stored and starts the
+*next interval. Each body is decided on its own: an outer planet is stored a
+*few times per orbit, a body in a close encounter every frame. Frames of a
+*body are also stored when it appears, when it disappears and at close.
+*
+*Every frame in between is kept and checked, so the bound holds at every
+*frame offered; no more than TRAJECTORY_HERMITE_MAX_GAP of them are skipped
+*in a row, which bounds that memory. The stored
+*frames are sparse, a body missing from one reads as NaN in a columnar
+*trajectory; TrajectoryInterpolator puts them back together.
+*
+*/
+class HermiteSampler{
+public:
+    HermiteSampler(TrajectoryWriter& writer, double tolerance);
+
+    /*
+     *PROCEDURE: push
+     *
+     *DESCRIPTION: Offers the state of the particles at time, writing the
+     *samples of the previous frame it decides to keep
+     *
+     *RETURNS: false once the writer failed
+     */
+    bool push(const ParticleSet& particles, double time);
+
+    /*
+     *PROCEDURE: close
+     *
+     *DESCRIPTION: Stores the last frame of every body not yet stored. The
+     *writer is left open
+     *
+     *RETURNS: false if the writer failed
+     */
+    bool close();
+
+    std::size_t offered() const { return m_offered; };      // body states pushed
+
+    std::size_t stored() const { return m_stored; };        // body states written
+
+private:
+    struct track{
+        trajectory_sample stored;
+        trajectory_sample last;
+        bool last_stored = true;    // last is the stored sample
+        bool named = false;         // written at least once, name sent
+        bool active = false;
+        std::size_t seen = 0;       // last frame the body was in
+        std::vector<trajectory_sample> checks;     // frames after stored, before last
+        std::string name;
+    };
+
+    bool fits(const track& body, const trajectory_sample& next) const;
+
+    void keep(track& body);
+
+    void emit(std::size_t id, track& body);
+
+    TrajectoryWriter& m_writer;
+    double m_tolerance;
+    std::vector<track> m_tracks;            // [id]
+    std::vector<std::size_t> m_active;      // ids in the last frame
+    trajectory_frame m_frame;               // stored samples of the last frame
+    double m_time = 0;                      // time of the last frame
+    std::size_t m_frames = 0;
+    std::size_t m_offered = 0;
+    std::size_t m_stored = 0;
+    bool m_ok = true;
+};
+
+/*
+*CLASS: TrajectoryInterpolator
+*
+*DESCRIPTION: Reconstructs the position and velocity of any body at any time
+*of a columnar trajectory, decimated or not: the samples of every body are
+*loaded once and a time is served by a binary search and the cubic Hermite
+*interpolant of the two samples around it, the one HermiteSampler checked.
+*
+*/
+class TrajectoryInterpolator{
+public:
+    /*
+     *PROCEDURE: open
+     *
+     *DESCRIPTION: Loads the samples of every body of path
+     *
+     *RETURNS: false with the reason in error() if the file cannot be read
+     */
+    bool open(const std::string& path);
+
+    const std::vector<std::size_t>& ids() const { return m_ids; };
+
+    const std::string& name(std::size_t id) const { return m_names[id]; };
+
+    const std::vector<trajectory_sample>& samples(std::size_t id) const { return m_samples[id]; };
+
+    /*
+     *PROCEDURE: state
+     *
+     *DESCRIPTION: Position and velocity of body id at time
+     *
+     *RETURNS: false if the body has no samples around time
+     */
+    bool state(std::size_t id, double time, point& position, point& velocity) const;
+
+    bool position(std::size_t id, double time, point& position) const
+    {
+        point velocity;
+        return state(id, time, position, velocity);
+    };
+
+    const std::string& error() const { return m_error; };
+
+private:
+    std::vector<std::size_t> m_ids;
+    std::vector<std::string> m_names;                       // [id]
+    std::vector<std::vector<trajectory_sample>> m_samples;  // [id], in time order
+    std::string m_error;
+};
@@ -24,38 +24,63 @@
 
 #include "include/integration.h"
 #include "structures.h"
+#include "particles.h"
+#include "pair_forces.h"
+#include "snapshot.h"
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
 
 #define NUMBER_OF_STEPS 100
 
 using namespace solar_system;
 
 /*-----------------------------------------------------------------------------
- *PROCEDURE:  get_snapshot  
+ *PROCEDURE:  get_snapshot
  *
- *DESCRIPTION: reads a single snapshot from the input stream cin.
- * note: in this implementation, only the particle data are read in, and it
- *        is left to the main program to first read particle number and time
+ *DESCRIPTION: reads a single binary snapshot record (snapshot.h) of n
+ * particles from the input stream cin, as written by put_snapshot(), and
+ * returns its time in t. Text snapshots are converted first with
+ * text_to_snapshot().
  *
- *RETURNS: -
+ *RETURNS: false at the end of the input or on a malformed or corrupted
+ * record, or one with another particle number
  *-----------------------------------------------------------------------------
  */
-
-void get_snapshot(real mass[], real pos[][NDIM], real vel[][NDIM], int n)
+bool get_snapshot(real mass[], real pos[][NDIM], real vel[][NDIM], int n, real & t)
 {
+    snapshot_header header;
+    if (!std::cin.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+    if (strncmp(header.magic, "CELSNAP", sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.n != (std::uint64_t)n || header.columns != SNAPSHOT_COLUMNS ||
+        header.header_bytes != sizeof(header) || header.column_stride < n * sizeof(double))
+        return false;
+
+    std::vector<char> data(header.columns * header.column_stride);
+    if (!std::cin.read(data.data(), data.size()) || snapshot_checksum(data.data(), data.size()) != header.checksum)
+        return false;
+    const double* column[SNAPSHOT_COLUMNS];
+    for (int c = 0; c < SNAPSHOT_COLUMNS; c++)
+        column[c] = reinterpret_cast<const double*>(data.data() + c * header.column_stride);
     for (int i = 0; i < n ; i++){
-        std::cin >> mass[i];                       // mass of particle i
-        for (int k = 0; k < NDIM; k++)
-            std::cin >> pos[i][k];                 // position of particle i
-        for (int k = 0; k < NDIM; k++)
-            std::cin >> vel[i][k];                 // velocity of particle i
+        mass[i] = column[0][i];
+        for (int k = 0; k < NDIM; k++){
+            pos[i][k] = column[1 + k][i];
+            vel[i][k] = column[4 + k][i];
+        }
     }
+    t = header.time;
+    return true;
 }
 
 /*-----------------------------------------------------------------------------
- *PROCEDURE:  put_snapshot  
+ *PROCEDURE:  put_snapshot
  *
- *DESCRIPTION: writes a single snapshot on the output stream cout.
- * note: unlike get_snapshot(), put_snapshot handles particle number and time
+ *DESCRIPTION: writes a single binary snapshot record (snapshot.h) on the
+ * standard output, in N-body units: the particles are transposed to columns
+ * and the record goes out in one write, a formatting free dump that
+ * snapshot_to_text() turns back into the former text output.
  *
  *RETURNS: -
  *-----------------------------------------------------------------------------
@@ -63,63 +88,42 @@ void get_snapshot(real mass[], real pos[][NDIM], real vel[][NDIM], int n)
 void put_snapshot(const real mass[], const real pos[][NDIM],
                   const real vel[][NDIM], int n, real t)
 {
-    std::cout.precision(16);                       // full double precision
-
-    std::cout << n << std::endl;                        // N, total particle number
-    std::cout << t << std::endl;                        // current time
+    std::vector<double> columns((std::size_t)SNAPSHOT_COLUMNS * n);
+    const double* column[SNAPSHOT_COLUMNS];
+    for (int c = 0; c < SNAPSHOT_COLUMNS; c++)
+        column[c] = columns.data() + (std::size_t)c * n;
     for (int i = 0; i < n ; i++){
-        std::cout << mass[i];                      // mass of particle i
-        for (int k = 0; k < NDIM; k++)
-            std::cout << ' ' << pos[i][k];         // position of particle i
-        for (int k = 0; k < NDIM; k++)
-            std::cout << ' ' << vel[i][k];         // velocity of particle i
-        std::cout << std::endl;
-    }
-}
-
-
-/*----------------------------------------------------------------------------
- *PROCEDURE: calculate_single_body_acceleration
- *
- *DESCRIPTION: Calculates acceleration vector for a single object for Euler algorithm
- *
- *RETURNS: Acceleration vector
- *----------------------------------------------------------------------------
- */
-point Orbit_integration::Euler::calculate_single_body_acceleration(int body_index)
-{
-    point acceleration{ 0, 0, 0 };
-    body target_body = m_bodies[body_index];
-
-    int index = 0;
-
-    for (auto external_body = m_bodies.begin(); external_body != m_bodies.end(); *external_body++, index++)
-    {
-        if (index != body_index)
-        {
-            double r = (pow((target_body.location.x - external_body->location.x), 2) + pow((target_body.location.y - external_body->location.y), 2) + pow((target_body.location.z - external_body->location.z), 2));
-            r = sqrt(r);
-            auto tmp = G_const * external_body->mass / (r*r*r);
-            acceleration = acceleration + (external_body->location - target_body.location) * tmp;
+        columns[i] = mass[i];
+        for (int k = 0; k < NDIM; k++){
+            columns[(std::size_t)(1 + k) * n + i] = pos[i][k];
+            columns[(std::size_t)(4 + k) * n + i] = vel[i][k];
         }
     }
-    return acceleration;
+    std::cout.flush();
+    if (!write_snapshot(STDOUT_FILENO, column, n, t, snapshot_units{ 1.0, 0.0, 0.0, 0.0 }))
+        std::cerr << "put_snapshot: writing the snapshot failed" << std::endl;
 }
 
+
 /*
  *PROCEDURE: compute_velocity
  *
- *DESCRIPTION: Calculates velocity vector for a single object for Euler algorithm
+ *DESCRIPTION: Kicks the velocity of every object with its acceleration, computed
+ *for all objects at once by the shared half pair force engine. Euler algorithm.
  *
  *RETURNS: -
  *
  */
 void Orbit_integration::Euler::compute_velocity()
 {
-    for (int i = 0; i < m_bodies.size(); i++)
+    m_forces->accelerations(m_particles, G_const, m_ax, m_ay, m_az);
+
+    const std::size_t n = m_particles.size();
+    for (std::size_t i = 0; i < n; i++)
     {
-        point acceleration = Orbit_integration::Euler::calculate_single_body_acceleration(i);
-        m_bodies[i].velocity += acceleration * m_time_step;
+        m_particles.vx[i] += m_ax[i] * m_time_step;
+        m_particles.vy[i] += m_ay[i] * m_time_step;
+        m_particles.vz[i] += m_az[i] * m_time_step;
     }
 }
 
@@ -133,9 +137,12 @@ void Orbit_integration::Euler::compute_velocity()
  */
 void Orbit_integration::Euler::update_location()
 {
-    for (auto target_body = m_bodies.begin(); target_body != m_bodies.end(); *target_body++)
+    const std::size_t n = m_particles.size();
+    for (std::size_t i = 0; i < n; i++)
     {
-        target_body->location += target_body->velocity * m_time_step;
+        m_particles.x[i] += m_particles.vx[i] * m_time_step;
+        m_particles.y[i] += m_particles.vy[i] * m_time_step;
+        m_particles.z[i] += m_particles.vz[i] * m_time_step;
     }
 }
 
@@ -151,96 +158,74 @@ void Orbit_integration::Euler::compute_gravity_step()
 {
     compute_velocity();
     update_location();
+    m_time += m_time_step;
 }
 
 /*
- *PROCEDURE: calculate_single_body_acceleration
+ *PROCEDURE: moment_provider
  *
- *DESCRIPTION: Calculates acceleration vector for a single object for RK4 algorithm
+ *DESCRIPTION: Checks that the force backend of an RK4 integrator fills every
+ *channel of rk4_moments: the stages are built from per pair sums, and a
+ *backend with only the accelerations would silently reduce the scheme to
+ *first order.
  *
- *RETURNS: Acceleration vector
+ *RETURNS: forces, or throws std::invalid_argument
  *
  */
-point Orbit_integration::RK4::calculate_single_body_acceleration(int body_index)
+std::shared_ptr<ForceProvider> Orbit_integration::RK4::moment_provider(std::shared_ptr<ForceProvider> forces)
 {
-    point acceleration{ 0, 0, 0 };
-    point velocity_update{ 0, 0, 0 };
-    point location_update{ 0, 0, 0 };
-    body target_body = m_bodies[body_index];
-
-    int index = 0;
-    for (auto external_body = m_bodies.begin(); external_body != m_bodies.end(); *external_body++, index++)
-    {
-        if (index != body_index)
-        {
-            point k1{ 0, 0, 0 };
-            point k2{ 0, 0, 0 };
-            point k3{ 0, 0, 0 };
-            point k4{ 0, 0, 0 };
-
-            double r = (pow((target_body.location.x - external_body->location.x), 2) +
-                        pow((target_body.location.y - external_body->location.y), 2) +
-                        pow((target_body.location.z - external_body->location.z), 2));
-
-            r = sqrt(r);
-
-            auto tmp = G_const * external_body->mass / (r*r*r);
-
-            //k1 - acceleration at current location
-            k1 = (external_body->location - target_body.location) * tmp;
-
-            //k2 - acceleration 0.5 timesteps in the future based on k1 acceleration value
-            velocity_update = partial_step(target_body.velocity, k1, 0.5);
-            location_update = partial_step(target_body.location, velocity_update, 0.5);
-            k2 = (external_body->location - location_update) * tmp;
-
-            //k3 acceleration 0.5 timesteps in the future using k2 acceleration
-            velocity_update = partial_step(target_body.velocity, k2, 0.5);
-            location_update = partial_step(target_body.location, velocity_update, 0.5);
-            k3 = (external_body->location - location_update) * tmp;
-
-            //k4 - location 1 timestep in the future using k3 acceleration
-            velocity_update = partial_step(target_body.velocity, k3, 1);
-            location_update = partial_step(target_body.location, velocity_update, 1);
-            k4 = (external_body->location - location_update) * tmp;
-
-            acceleration += (k1 + k2 * 2 + k3 * 2 + k4) / 6;
-        }
-    }
-    return acceleration;
-}
-
-/*
- *PROCEDURE: partial_step
- *
- *DESCRIPTION: Calculates partial step constants for RK4 algorithm
- *
- *RETURNS: f.x, f.y and f.z values
- *
- */
-point Orbit_integration::RK4::partial_step(point &f, point &df, double scale)
-{
-    return point{
-            f.x + df.x * m_time_step * scale,
-            f.y + df.y * m_time_step * scale,
-            f.z + df.z * m_time_step * scale
-    };
+    if (forces && !forces->has_rk4_moments())
+        throw std::invalid_argument(std::string("RK4 needs pair forces and cannot run with the ")
+                                    + forces->name() + " gravity backend");
+    return forces;
 }
 
 /*
  *PROCEDURE: compute_velocity
  *
- *DESCRIPTION: Calculates velocity vector for a single object for RK4 algorithm
+ *DESCRIPTION: Calculates velocity vector for all objects for RK4 algorithm.
+ * For every pair the scheme evaluates k1..k4 with the pair factor
+ * t = G m_j / r^3 frozen over the step:
+ *   k1 = t d
+ *   k2 = t (d - v h/2 - k1 h^2/4)
+ *   k3 = t (d - v h/2 - k2 h^2/4)
+ *   k4 = t (d - v h   - k3 h^2)
+ * Expanding (k1 + 2 k2 + 2 k3 + k4) / 6 in powers of t, with c = h^2/4, gives
+ *   D1 - 4/3 c D2 + c^2 D3 - 2/3 c^3 D4 - v h/2 (P1 - c P2 + 2/3 c^2 P3)
+ * where P_k = sum t^k and D_k = sum t^k d are accumulated by the shared half
+ * pair force engine, so every pair is visited only once.
  *
  *RETURNS: -
  *
  */
 void Orbit_integration::RK4::compute_velocity()
 {
-    for (int i = 0; i < m_bodies.size(); i++)
+    m_forces->rk4_moments(m_particles, G_const, m_moments);
+
+    const std::size_t n = m_particles.size();
+    const double h = m_time_step;
+    const double c = h * h / 4;
+    const double c2 = c * c;
+    const double c3 = c2 * c;
+    auto moment = [&](int channel, std::size_t i) { return m_moments[channel * n + i]; };
+
+    for (std::size_t i = 0; i < n; i++)
     {
-        point acceleration = Orbit_integration::RK4::calculate_single_body_acceleration(i);
-        m_bodies[i].velocity += acceleration * m_time_step;
+        double p = moment(RK4_P1, i) - c * moment(RK4_P2, i) + 2.0 / 3.0 * c2 * moment(RK4_P3, i);
+        double half_step = 0.5 * h * p;
+        double ax = moment(RK4_D1X, i) - 4.0 / 3.0 * c * moment(RK4_D2X, i)
+                  + c2 * moment(RK4_D3X, i) - 2.0 / 3.0 * c3 * moment(RK4_D4X, i);
+        double ay = moment(RK4_D1Y, i) - 4.0 / 3.0 * c * moment(RK4_D2Y, i)
+                  + c2 * moment(RK4_D3Y, i) - 2.0 / 3.0 * c3 * moment(RK4_D4Y, i);
+        double az = moment(RK4_D1Z, i) - 4.0 / 3.0 * c * moment(RK4_D2Z, i)
+                  + c2 * moment(RK4_D3Z, i) - 2.0 / 3.0 * c3 * moment(RK4_D4Z, i);
+        ax -= m_particles.vx[i] * half_step;
+        ay -= m_particles.vy[i] * half_step;
+        az -= m_particles.vz[i] * half_step;
+
+        m_particles.vx[i] += ax * h;
+        m_particles.vy[i] += ay * h;
+        m_particles.vz[i] += az * h;
     }
 }
 
@@ -254,9 +239,12 @@ void Orbit_integration::RK4::compute_velocity()
  */
 void Orbit_integration::RK4::update_location()
 {
-    for (auto target_body = m_bodies.begin(); target_body != m_bodies.end(); *target_body++)
+    const std::size_t n = m_particles.size();
+    for (std::size_t i = 0; i < n; i++)
     {
-        target_body->location += target_body->velocity * m_time_step;
+        m_particles.x[i] += m_particles.vx[i] * m_time_step;
+        m_particles.y[i] += m_particles.vy[i] * m_time_step;
+        m_particles.z[i] += m_particles.vz[i] * m_time_step;
     }
 }
 
@@ -272,6 +260,7 @@ void Orbit_integration::RK4::compute_gravity_step()
 {
     compute_velocity();
     update_location();
+    m_time += m_time_step;
 }
 
 /*
@@ -426,11 +415,8 @@ void two_body_algorithms::leapfrog(double dt, double integration_time){
             t_out += dt_out;
         }
     }
-    ekin = 0.5 * (v.x * v.x + v.y * v.y + v.z * v.z);
-    epot = -1.0 / norm(r);
-    eout
-    std::cout<< "Final total energy:" << 
-
-
-
+    double e_kin = 0.5 * (v.x * v.x + v.y * v.y + v.z * v.z);
+    double e_pot = -1.0 / norm(r);
+    std::cout<< "Final total energy:" << e_kin + e_pot << std::endl;
 }
+
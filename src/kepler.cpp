@@ -0,0 +1,129 @@
+/*
+ * kepler.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <cmath>
+#include "include/kepler.h"
+
+//Iteration cap of the universal Kepler equation solvers
+#define KEPLER_MAX_ITERATIONS 50
+
+void kepler::stumpff(double z, double c[4])
+{
+    if (fabs(z) < 0.1)
+    {
+        c[2] = 1.0 / 2 - z * (1.0 / 24 - z * (1.0 / 720 - z * (1.0 / 40320 - z * (1.0 / 3628800
+               - z * (1.0 / 479001600 - z / 87178291200.0)))));
+        c[3] = 1.0 / 6 - z * (1.0 / 120 - z * (1.0 / 5040 - z * (1.0 / 362880 - z * (1.0 / 39916800
+               - z * (1.0 / 6227020800.0 - z / 1307674368000.0)))));
+        c[1] = 1 - z * c[3];
+        c[0] = 1 - z * c[2];
+    }
+    else if (z > 0)
+    {
+        double s = sqrt(z);
+        c[0] = cos(s);
+        c[1] = sin(s) / s;
+        c[2] = (1 - c[0]) / z;
+        c[3] = (1 - c[1]) / z;
+    }
+    else
+    {
+        double s = sqrt(-z);
+        c[0] = cosh(s);
+        c[1] = sinh(s) / s;
+        c[2] = (1 - c[0]) / z;
+        c[3] = (1 - c[1]) / z;
+    }
+}
+
+void kepler::drift(double gm, double dt, double& x, double& y, double& z,
+                   double& vx, double& vy, double& vz)
+{
+    const double r0 = sqrt(x * x + y * y + z * z);
+    const double eta0 = x * vx + y * vy + z * vz;         // r0 . v0
+    const double beta = 2 * gm / r0 - (vx * vx + vy * vy + vz * vz);
+    const double zeta0 = gm - beta * r0;
+
+    // bound orbits are periodic: never solve for more than one period
+    double tau = dt;
+    if (beta > 0)
+    {
+        double period = 2 * M_PI * gm / (beta * sqrt(beta));
+        if (fabs(tau) > period)
+            tau = fmod(tau, period);
+    }
+
+    // universal anomaly s solves r0 G1 + eta0 G2 + gm G3 = tau, G_k = s^k c_k(beta s^2)
+    double c[4];
+    auto residual = [&](double s, double& g1, double& g2, double& g3, double& r)
+    {
+        stumpff(beta * s * s, c);
+        g1 = s * c[1];
+        g2 = s * s * c[2];
+        g3 = s * s * s * c[3];
+        r = r0 * c[0] + eta0 * g1 + gm * g2;
+        return r0 * g1 + eta0 * g2 + gm * g3 - tau;
+    };
+
+    double s = tau / r0;
+    double g1 = 0, g2 = 0, g3 = 0, r = r0;
+    bool converged = false;
+    for (int i = 0; i < KEPLER_MAX_ITERATIONS && !converged; i++)
+    {
+        double f = residual(s, g1, g2, g3, r);
+        double ds = f / r;
+        s -= ds;
+        converged = fabs(ds) <= 1e-15 * fabs(s) || f == 0;
+    }
+    if (!converged)
+    {
+        // Laguerre-Conway, degree 5: converges from poor guesses where Newton cycles
+        s = tau / r0;
+        for (int i = 0; i < KEPLER_MAX_ITERATIONS; i++)
+        {
+            double f = residual(s, g1, g2, g3, r);
+            double f1 = r;
+            double f2 = eta0 * c[0] + zeta0 * g1;
+            double root = sqrt(fabs(16 * f1 * f1 - 20 * f * f2));
+            double ds = 5 * f / (f1 + (f1 >= 0 ? root : -root));
+            s -= ds;
+            if (fabs(ds) <= 1e-15 * fabs(s) || f == 0)
+                break;
+        }
+    }
+    residual(s, g1, g2, g3, r);
+
+    const double f = 1 - gm * g2 / r0;
+    const double g = tau - gm * g3;
+    const double fdot = -gm * g1 / (r0 * r);
+    const double gdot = 1 - gm * g2 / r;
+
+    const double nx = f * x + g * vx, ny = f * y + g * vy, nz = f * z + g * vz;
+    vx = fdot * x + gdot * vx;
+    vy = fdot * y + gdot * vy;
+    vz = fdot * z + gdot * vz;
+    x = nx;
+    y = ny;
+    z = nz;
+}
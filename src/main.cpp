@@ -38,8 +38,16 @@ Compile with folowing flags:
 #include <sstream>     
 #include <string_view>  
 #include <variant>
+#include <iomanip>
+#include <cstring>
+#include <stdexcept>
 #include "include/structures.h"
 #include "include/integration.h"
+#include "include/mergers.h"
+#include "include/ensemble.h"
+#include "include/batch.h"
+#include "include/snapshot.h"
+#include "include/trajectory.h"
 #include "include/planet_data.h"
 #include "include/menu.h"
 #include "include/benchmark.h"
@@ -49,16 +57,235 @@ Compile with folowing flags:
 //#include "matplotlibcpp.h" //experimental
 
 //STANDARD INTEGRATOR TEMPLATE
+//The particles are only read (which brings WHFast back to a synchronised
+//state) every report_frequency steps and, when collision_frequency > 0, at
+//the ends of each window of collision_frequency steps searched for contacts
 template <typename Integrator>
-void run_simulation(Integrator integrator, int iterations, int report_frequency)
+void run_simulation(Integrator integrator, int iterations, int report_frequency,
+                    std::unique_ptr<TrajectoryFormat> output, double tolerance, int collision_frequency)
 {
+    TrajectoryWriter trajectory(std::move(output));
+    HermiteSampler sampler(trajectory, tolerance);
+    CollisionDetector collisions;
+    MergeStage mergers;
     for (auto i = 0; i < iterations; i++)
     {
         if (i % report_frequency == 0)
-            record_state(integrator.get_bodies());
+        {
+            const bool recorded = tolerance > 0 ? sampler.push(integrator.get_particles(), integrator.time())
+                                                : trajectory.push(integrator.get_particles(), integrator.time());
+            if (!recorded)
+            {
+                std::cerr << "Error in writing the trajectory, stopping at step " << i << std::endl;
+                break;
+            }
+        }
+        if (collision_frequency > 0 && i % collision_frequency == 0)
+            collisions.start(integrator.get_particles());
         integrator.compute_gravity_step();
+        if (collision_frequency > 0 && ((i + 1) % collision_frequency == 0 || i + 1 == iterations))
+        {
+            ParticleSet& particles = integrator.get_particles();
+            const std::vector<collision>& hits = collisions.detect(particles);
+            for (const auto& c : hits)
+                std::cout << "Collision between " << particles.name[c.i] << " and " << particles.name[c.j]
+                          << " by step " << i << std::endl;
+            mergers.merge(particles, hits);
+        }
+    }
+    if (tolerance > 0)
+    {
+        sampler.close();
+        std::cout << "Trajectory: " << sampler.stored() << " of " << sampler.offered() << " samples stored" << std::endl;
+    }
+    if (!trajectory.close())
+        std::cerr << "Error in writing the trajectory" << std::endl;
+}
+
+/*
+ *PROCEDURE: with_integrator
+ *
+ *DESCRIPTION: Builds the integrator selected by name on the bodies and passes
+ *it to action
+ *
+ *RETURNS: false if the name is not a known integrator
+ */
+template <class Action>
+static bool with_integrator(const std::string& algorithm, const std::vector<body>& bodies,
+                            std::shared_ptr<ForceProvider> forces, double error, Action action)
+{
+    if(algorithm == "RK4"){
+        Orbit_integration::RK4 orbit(bodies, 0.01, forces);
+        action(orbit);
+    }
+    else if(algorithm == "Euler"){
+        Orbit_integration::Euler orbit(bodies, 0.01, forces);
+        action(orbit);
+    }
+    else if(algorithm == "WHFast"){
+        //Kepler orbits are solved exactly: steps only need to resolve the perturbations
+        Orbit_integration::WHFast orbit(bodies, 86400, true, forces);
+        action(orbit);
     }
-    output_states(integrator.get_bodies());
+    else if(algorithm == "IAS15"){
+        //The first step is a day, later ones follow from the error tolerance
+        Orbit_integration::IAS15 orbit(bodies, 86400, error > 0 ? error : 1e-9, forces);
+        action(orbit);
+    }
+    else if(algorithm == "DOPRI5"){
+        Orbit_integration::DOPRI5 orbit(bodies, 86400, error > 0 ? error : 1e-10, forces);
+        action(orbit);
+    }
+    else if(algorithm == "BS"){
+        Orbit_integration::BulirschStoer orbit(bodies, 86400, error > 0 ? error : 1e-12, forces);
+        action(orbit);
+    }
+    else if(algorithm == "Leapfrog"){
+        Orbit_integration::Leapfrog orbit(bodies, 86400, forces);
+        action(orbit);
+    }
+    else if(algorithm == "Yoshida4"){
+        Orbit_integration::Yoshida4 orbit(bodies, 86400, forces);
+        action(orbit);
+    }
+    else if(algorithm == "Suzuki4"){
+        Orbit_integration::Suzuki4 orbit(bodies, 86400, forces);
+        action(orbit);
+    }
+    else if(algorithm == "Yoshida6"){
+        Orbit_integration::Yoshida6 orbit(bodies, 86400, forces);
+        action(orbit);
+    }
+    else if(algorithm == "Yoshida8"){
+        Orbit_integration::Yoshida8 orbit(bodies, 86400, forces);
+        action(orbit);
+    }
+    else{
+        return false;
+    }
+    return true;
+}
+
+/*
+ *PROCEDURE: run_ensemble
+ *
+ *DESCRIPTION: Integrates systems copies of the bodies, every one but the
+ *first with positions and velocities perturbed by a relative 1e-8, on all
+ *cores of the machine (or threads of them). Each system gets its own force
+ *solver and writes its final state to ensemble_<system>.dat.
+ *
+ *RETURNS: false if the integrator is unknown
+ */
+static bool run_ensemble(const std::string& algorithm, const std::vector<body>& bodies,
+                         const std::string& gravity, int grid, double error,
+                         int steps, int systems, int threads)
+{
+    if (!with_integrator(algorithm, bodies, make_force_provider(gravity, grid), error, [](auto&) {}))
+        return false;
+
+    EnsembleRunner runner(threads, "ensemble_");
+    std::cout << "Ensemble of " << systems << " systems on " << runner.threads() << " threads" << std::endl;
+    runner.run(systems, [&](std::size_t system, std::ostream& out)
+    {
+        with_integrator(algorithm, perturbed_bodies(bodies, system, 1e-8), make_force_provider(gravity, grid), error, [&](auto& orbit)
+        {
+            for (int i = 0; i < steps; i++)
+                orbit.compute_gravity_step();
+            const ParticleSet& p = orbit.get_particles();
+            out << "system " << system << std::endl;
+            out << std::setprecision(17);
+            for (std::size_t i = 0; i < p.size(); i++)
+                out << p.name[i] << "," << p.x[i] << "," << p.y[i] << "," << p.z[i] << ","
+                    << p.vx[i] << "," << p.vy[i] << "," << p.vz[i] << std::endl;
+        });
+    }, &std::cout);
+    return true;
+}
+
+/*
+ *PROCEDURE: run_batch
+ *
+ *DESCRIPTION: Integrates the batch of small systems of filename, one system
+ *per SIMD lane, with the leapfrog composition named by algorithm (Leapfrog
+ *when empty) on threads workers, and writes the outcome of every system to
+ *batch_results.dat
+ *
+ *RETURNS: false if the algorithm is not a leapfrog composition
+ */
+static bool run_batch(const std::string& filename, const std::string& algorithm, int threads)
+{
+    using namespace Orbit_integration;
+    const std::map<std::string, std::vector<double>> schemes{
+        { "Leapfrog", { std::begin(leapfrog2::weights), std::end(leapfrog2::weights) } },
+        { "Yoshida4", { std::begin(yoshida4::weights), std::end(yoshida4::weights) } },
+        { "Suzuki4", { std::begin(suzuki4::weights), std::end(suzuki4::weights) } },
+        { "Yoshida6", { std::begin(yoshida6::weights), std::end(yoshida6::weights) } },
+        { "Yoshida8", { std::begin(yoshida8::weights), std::end(yoshida8::weights) } } };
+    auto scheme = schemes.find(algorithm.empty() ? "Leapfrog" : algorithm);
+    if (scheme == schemes.end())
+    {
+        std::cout << "Batches run with Leapfrog, Yoshida4, Suzuki4, Yoshida6 or Yoshida8" << std::endl;
+        return false;
+    }
+
+    batch_options options;
+    std::vector<batch_system> systems = parse_batch(filename, options);
+    options.weights = scheme->second;
+    Timer timer;
+    std::vector<batch_result> results = integrate_batch(systems, options, threads);
+    write_batch_results("batch_results.dat", systems, results);
+
+    std::size_t outcomes[4] = { 0, 0, 0, 0 };
+    for (const auto& r : results)
+        outcomes[r.status]++;
+    std::cout << systems.size() << " systems: " << outcomes[BATCH_COMPLETED] << " completed, "
+              << outcomes[BATCH_COLLIDED] << " collided, " << outcomes[BATCH_ESCAPED] << " escaped, "
+              << outcomes[BATCH_DIVERGED] << " diverged" << std::endl;
+    return true;
+}
+
+/*
+ *PROCEDURE: convert_snapshot
+ *
+ *DESCRIPTION: Converts a binary snapshot file to the text snapshot format in
+ *<filename>.txt, or a text snapshot file (taken to be in N-body units) to a
+ *binary one in <filename>.snap
+ *
+ *RETURNS: false if the conversion failed
+ */
+static bool convert_snapshot(const std::string& filename)
+{
+    char magic[8] = {};
+    std::ifstream probe(filename, std::ios::binary);
+    if (!probe)
+    {
+        std::cerr << "Error in opening the required file: " << filename << std::endl;
+        return false;
+    }
+    probe.read(magic, sizeof(magic));
+    probe.close();
+
+    int snapshots;
+    std::string output;
+    if (strncmp(magic, "CELSNAP", sizeof(magic)) == 0)
+    {
+        output = filename + ".txt";
+        std::ofstream out(output);
+        snapshots = snapshot_to_text(filename, out);
+    }
+    else
+    {
+        output = filename + ".snap";
+        std::ifstream in(filename);
+        snapshots = text_to_snapshot(in, output, snapshot_units{ 1.0, 0.0, 0.0, 0.0 });
+    }
+    if (snapshots < 0)
+    {
+        std::cerr << "Converting " << filename << " failed" << std::endl;
+        return false;
+    }
+    std::cout << "Converted " << snapshots << " snapshots of " << filename << " to " << output << std::endl;
+    return true;
 }
 
 //STANDARD PARSER TEMPLATE
@@ -106,7 +333,7 @@ private:
                 visit(
                     [this, idx, &argv](auto&& arg)
                     {
-                        if (idx < argv.size() - 1)
+                        if (idx + 1 < (int)argv.size())
                         {
                             std::stringstream value;
                             value << argv[idx+1];
@@ -124,7 +351,6 @@ private:
 int main(int argc, char *argv[]){
     
     std::vector<body> bodies;
-    const char *algorithms[3] = {"Euler", "RK4", "Leapfrog"}; 
 
 
     //Using solar system data in planet_data.h for benchmarking
@@ -147,6 +373,18 @@ int main(int argc, char *argv[]){
         bool boolOpt{}; //True/False for Debug flag
         bool boolOpt_test{}; //True/False Solar system test flag
         std::string filenameOpt{}; //File name with system data
+        std::string benchmarkOpt{}; //Runs the named performance benchmark and exits
+        std::string gravityOpt{}; //Gravity solver: direct, tree, fmm or pm
+        int gridOpt{}; //Particle-mesh grid size per side
+        int ensembleOpt{}; //Number of perturbed copies of the system integrated in parallel
+        int threadsOpt{}; //Worker threads of the ensemble, all cores by default
+        std::string batchOpt{}; //File with a batch of small systems integrated side by side
+        std::string convertOpt{}; //Snapshot file converted between the binary and text formats
+        std::string trajectoryOpt{}; //Columnar trajectory file, or text for one file per body
+        double quantizeOpt{}; //Absolute error of the positions of the trajectory, 0 for lossless
+        double decimateOpt{}; //Position tolerance of the adaptive trajectory sampling, 0 stores every step
+        int everyOpt{}; //Steps between trajectory frames, 1 by default
+        int collisionsOpt{}; //Steps between collision searches, 0 (default) for none
     };
     //{"-tol", &MyOpts::errorOpt}
     auto parser = CmdOpts<MyOpts>::Create({
@@ -155,15 +393,39 @@ int main(int argc, char *argv[]){
         {"--DEBUG", &MyOpts::boolOpt},
         {"--test", &MyOpts::boolOpt},
         {"--error", &MyOpts::errorOpt},
-        {"--file", &MyOpts::filenameOpt}});
+        {"--file", &MyOpts::filenameOpt},
+        {"--benchmark", &MyOpts::benchmarkOpt},
+        {"--gravity", &MyOpts::gravityOpt},
+        {"--grid", &MyOpts::gridOpt},
+        {"--ensemble", &MyOpts::ensembleOpt},
+        {"--threads", &MyOpts::threadsOpt},
+        {"--batch", &MyOpts::batchOpt},
+        {"--convert", &MyOpts::convertOpt},
+        {"--trajectory", &MyOpts::trajectoryOpt},
+        {"--quantize", &MyOpts::quantizeOpt},
+        {"--decimate", &MyOpts::decimateOpt},
+        {"--every", &MyOpts::everyOpt},
+        {"--collisions", &MyOpts::collisionsOpt}});
 
-    auto myopts = parser->parse(argc, argv);
+    auto myopts = parser->parse(argc, const_cast<const char**>(argv));
     /*
     std::cout << "stringOpt = " << myopts.AlgorithmOpt << std::endl;
     std::cout << "intOpt = " << myopts.intOpt << std::endl;
     std::cout << "boolOpt = " << myopts.boolOpt << std::endl;
     */
 
+   if(!myopts.benchmarkOpt.empty()){
+       return benchmarking::run(myopts.benchmarkOpt) ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
+   if(!myopts.convertOpt.empty()){
+       return convert_snapshot(myopts.convertOpt) ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
+   if(!myopts.batchOpt.empty()){
+       return run_batch(myopts.batchOpt, myopts.AlgorithmOpt, myopts.threadsOpt) ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
    //Main program execution
    spawn_title();
    number_of_cores();
@@ -173,6 +435,52 @@ int main(int argc, char *argv[]){
    //spawn_menu();
    //parse_file();
    //parse_data(argv[1]);
+   else if(!myopts.AlgorithmOpt.empty()){
+       //Bodies of the data file replace the solar system of planet_data.h
+       if(!myopts.filenameOpt.empty()){
+           bodies = parse_data(myopts.filenameOpt);
+       }
+       std::string gravity = myopts.gravityOpt.empty() ? "direct" : myopts.gravityOpt;
+       auto forces = make_force_provider(gravity, myopts.gridOpt > 0 ? myopts.gridOpt : 128);
+       if(!forces){
+           error_message("Unknown gravity solver: " + gravity);
+       }
+       {
+           Timer timer;
+           const int steps = (int)myopts.intOpt;
+           bool known = false;
+           //An integrator refuses a gravity backend it cannot work with
+           try{
+               if(myopts.ensembleOpt > 0){
+                   known = run_ensemble(myopts.AlgorithmOpt, bodies, gravity, myopts.gridOpt > 0 ? myopts.gridOpt : 128,
+                                        myopts.errorOpt, steps, myopts.ensembleOpt, myopts.threadsOpt);
+               }
+               else{
+                   std::string output = myopts.trajectoryOpt.empty() ? "trajectory.traj" : myopts.trajectoryOpt;
+                   trajectory_compression compression;
+                   compression.enabled = true;
+                   compression.position_error = myopts.quantizeOpt;
+                   double tolerance = myopts.decimateOpt;
+                   if(tolerance > 0 && output == "text"){
+                       std::cout << "--decimate needs a columnar trajectory, storing every step" << std::endl;
+                       tolerance = 0;
+                   }
+                   known = with_integrator(myopts.AlgorithmOpt, bodies, forces, myopts.errorOpt, [&](auto& orbit)
+                   {
+                       run_simulation(orbit, steps, myopts.everyOpt > 0 ? myopts.everyOpt : 1,
+                                      make_trajectory_format(output, compression), tolerance, myopts.collisionsOpt);
+                   });
+               }
+           }
+           catch(const std::invalid_argument& e){
+               error_message(e.what());
+           }
+           if(!known){
+               std::cout << "Non defined integrator" << std::endl;
+           }
+       }
+       std::cout << "Execution terminated!!" << std::endl;
+   }
    else{
        two_body_algorithms::euler_forward(0.001);
    }
@@ -22,6 +22,7 @@
  *
  */
 
+#include <unistd.h>
 #include "menu.h"
 #include "integration.h"
 
@@ -56,7 +57,7 @@ bool read_options(int argc, char *argv[], real & dt_param, real & dt_dia,
     int c;
     while ((c = getopt(argc, argv, "hd:e:o:t:ix")) != -1)
         switch(c){
-            case 'h': cerr << "usage: " << argv[0]
+            case 'h': std::cerr << "usage: " << argv[0]
                            << " [-h (for help)]"
                            << " [-d step_size_control_parameter]\n"
                            << "         [-e diagnostics_interval]"
@@ -64,7 +65,7 @@ bool read_options(int argc, char *argv[], real & dt_param, real & dt_dia,
                            << "         [-t total_duration]"
                            << " [-i (start output at t = 0)]\n"
                            << "         [-x (extra debugging diagnostics)]"
-                           << endl;
+                           << std::endl;
                       return false;         // execution should stop after help
             case 'd': dt_param = atof(optarg);
                       break;
@@ -78,7 +79,7 @@ bool read_options(int argc, char *argv[], real & dt_param, real & dt_dia,
                       break;
             case 'x': x_flag = true;
                       break;
-            case '?': cerr << "usage: " << argv[0]
+            case '?': std::cerr << "usage: " << argv[0]
                            << " [-h (for help)]"
                            << " [-d step_size_control_parameter]\n"
                            << "         [-e diagnostics_interval]"
@@ -86,7 +87,7 @@ bool read_options(int argc, char *argv[], real & dt_param, real & dt_dia,
                            << "         [-t total_duration]"
                            << " [-i (start output at t = 0)]\n"
                            << "         [-x (extra debugging diagnostics)]"
-                           << endl;
+                           << std::endl;
                       return false;        // execution should stop after error
             }
 
@@ -128,11 +129,31 @@ void print_cmd_options(){
     std::cout << "Implemented algorithms:\n" << std::endl;
     std::cout << "-RK4 - Runge-Kutta 4th order\n" << std::endl;
     std::cout << "-Euler - Standard Euler integration\n" << std::endl;
+    std::cout << "-WHFast - Wisdom-Holman symplectic map with correctors, 1 day steps\n" << std::endl;
+    std::cout << "-IAS15 - 15th order Gauss-Radau with adaptive time steps, tolerance set by --error\n" << std::endl;
+    std::cout << "-DOPRI5 - Dormand-Prince 5(4) with adaptive time steps and dense output, tolerance set by --error\n" << std::endl;
+    std::cout << "-BS - Bulirsch-Stoer extrapolation with adaptive order and step, tolerance set by --error\n" << std::endl;
+    std::cout << "-Leapfrog, Yoshida4, Suzuki4, Yoshida6, Yoshida8 - Kick-drift-kick leapfrog and its symplectic compositions, 1 day steps\n" << std::endl;
     std::cout << "-f_and_g - F and G series expansion(for 2 body systems only!)" << std::endl;
     std::cout << "-taylor - Taylor series expansion(for 2 body systems only!)" << std::endl;
     std::cout << "---------------------------------------------------------------\n" << std::endl;
     std::cout << "Extra flags:" << std::endl;
     std::cout << "-test - Uses default solar system testing system" << std::endl;
+    std::cout << "--integrator name --steps n - Integrates the solar system with any integrator above except f_and_g and taylor" << std::endl;
+    std::cout << "--file name - Integrates the bodies of a data file instead (rows: name mass radius x y z vx vy vz [test], test = 1 for a massless test particle)" << std::endl;
+    std::cout << "--gravity name - Gravity solver for --integrator: direct (default), tree, fmm, pm" << std::endl;
+    std::cout << "--grid n - Particle-mesh grid size per side (default 128)" << std::endl;
+    std::cout << "--ensemble n - Integrates n copies of the system with perturbed initial conditions in parallel, final states in ensemble_<i>.dat" << std::endl;
+    std::cout << "--threads n - Worker threads of --ensemble (default: all cores)" << std::endl;
+    std::cout << "--batch name - Integrates a batch of small systems side by side, one per SIMD lane, with --integrator Leapfrog (default) or a Yoshida/Suzuki composition; results in batch_results.dat" << std::endl;
+    std::cout << "--trajectory name - Trajectory output of --integrator: a columnar file (default trajectory.traj, read by Cpp_Orbits/plot.py) or text for one name.dat file per body" << std::endl;
+    std::cout << "--quantize eps - Stores the trajectory positions to within eps metres instead of losslessly" << std::endl;
+    std::cout << "--decimate tol - Stores a body only when cubic Hermite interpolation of its stored states would miss it by more than tol metres" << std::endl;
+    std::cout << "--every n - Writes a trajectory frame every n steps (default 1)" << std::endl;
+    std::cout << "--collisions n - Searches for collisions and merges the bodies every n steps (default off)" << std::endl;
+    std::cout << "--convert name - Converts a binary snapshot to text (name.txt) or a text snapshot to binary (name.snap)" << std::endl;
+    std::cout << "--error eps - Error tolerance of IAS15 (default 1e-9), DOPRI5 (default 1e-10) and BS (default 1e-12)" << std::endl;
+    std::cout << "--benchmark name - Runs a performance benchmark (history, kernels, pairs, tree, fmm, pm, hermite, jerk, whfast, ias15, dopri5, bs, symplectic, testparticles, collisions, mergers, ensemble, batch, snapshot, trajectory, compression, decimation)" << std::endl;
     
     exit(EXIT_FAILURE);
 }
@@ -145,8 +166,13 @@ void Process_Selection_Two(){
 
 }
 void Process_Selection_Three(){
-    std::cout << "Caca" << std::endl;
-
+    using namespace solar_system;
+    const double year = 365.25 * 86400;
+    Orbit_integration::IAS15 orbit({ sun, mercury, venus, earth, mars, jupiter, saturn, uranus, neptune, pluto }, 86400);
+    orbit.integrate(year);
+    std::cout << "IAS15: solar system after one year (m)" << std::endl;
+    for (const auto& b : orbit.get_bodies())
+        std::cout << b.name << ": " << b.location.x << ", " << b.location.y << ", " << b.location.z << std::endl;
 }
 void Process_Selection_Four(){
     std::cout << "Caca" << std::endl;
@@ -0,0 +1,92 @@
+/*
+ * mergers.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "include/mergers.h"
+
+/*
+ *PROCEDURE: survivor
+ *
+ *DESCRIPTION: Particle that i has been merged into, following the chain of
+ *mergers and shortening it on the way
+ *
+ *RETURNS: index of a live particle
+ */
+int MergeStage::survivor(int i)
+{
+    int root = i;
+    while (m_merged_into[root] >= 0)
+        root = m_merged_into[root];
+    while (m_merged_into[i] >= 0)
+    {
+        const int next = m_merged_into[i];
+        m_merged_into[i] = root;
+        i = next;
+    }
+    return root;
+}
+
+std::size_t MergeStage::merge(ParticleSet& p, const std::vector<collision>& hits)
+{
+    if (hits.empty())
+        return 0;
+
+    const std::size_t n = p.size();
+    m_order.assign(hits.begin(), hits.end());
+    std::stable_sort(m_order.begin(), m_order.end(),
+                     [](const collision& a, const collision& b) { return a.time < b.time; });
+    m_merged_into.assign(n, -1);
+    m_dead.assign(n, 0);
+
+    for (const auto& c : m_order)
+    {
+        int a = survivor(c.i), b = survivor(c.j);
+        if (a == b)
+            continue;
+        // the heavier body survives, the earlier one on a tie
+        if (p.mass[b] > p.mass[a] || (p.mass[b] == p.mass[a] && b < a))
+            std::swap(a, b);
+
+        const double ma = p.mass[a], mb = p.mass[b], m = ma + mb;
+        if (mb > 0)
+        {
+            const double fa = ma / m, fb = mb / m;
+            p.x[a] = fa * p.x[a] + fb * p.x[b];
+            p.y[a] = fa * p.y[a] + fb * p.y[b];
+            p.z[a] = fa * p.z[a] + fb * p.z[b];
+            p.vx[a] = fa * p.vx[a] + fb * p.vx[b];
+            p.vy[a] = fa * p.vy[a] + fb * p.vy[b];
+            p.vz[a] = fa * p.vz[a] + fb * p.vz[b];
+            p.mass[a] = m;
+            p.radius[a] = cbrt(p.radius[a] * p.radius[a] * p.radius[a] + p.radius[b] * p.radius[b] * p.radius[b]);
+        }
+        m_merged_into[b] = a;
+        m_dead[b] = 1;
+    }
+
+    const std::size_t removed = p.remove_marked(m_dead);
+    m_removed += removed;
+    return removed;
+}
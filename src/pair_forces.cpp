@@ -0,0 +1,206 @@
+/*
+ * pair_forces.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "include/pair_forces.h"
+#include "include/gravity_kernels.h"
+
+//Rows handed out to a thread at a time. Row i costs n - i pairs, so the rows
+//are scheduled dynamically in small blocks to keep the triangle balanced.
+#define PAIR_ROW_BLOCK 16
+
+//Below this many particles per thread the extra buffers cost more than they save
+#define PAIR_MIN_ROWS_PER_THREAD 256
+
+//Test particles handed to a thread at a time: the block's positions and
+//accelerations (6 x 4 KB) stay in L1 while every massive source sweeps over it
+#define PAIR_TEST_BLOCK 512
+
+PairForceEngine::PairForceEngine(int threads)
+{
+#ifdef _OPENMP
+    m_threads = threads > 0 ? threads : omp_get_max_threads();
+#else
+    m_threads = 1;
+#endif
+}
+
+template <class RowFunction>
+void PairForceEngine::accumulate(int n, int channels, std::vector<double>& out, RowFunction rows)
+{
+    const std::size_t length = (std::size_t)channels * n;
+    out.assign(length, 0.0);
+
+    int threads = std::min(m_threads, std::max(1, n / PAIR_MIN_ROWS_PER_THREAD));
+    if (threads <= 1)
+    {
+        rows(0, n, out.data());
+        return;
+    }
+
+#ifdef _OPENMP
+    m_thread_buffers.resize(threads);
+    int team = threads;                 // OpenMP may grant fewer threads than asked for
+    #pragma omp parallel num_threads(threads)
+    {
+        #pragma omp single
+        team = omp_get_num_threads();
+
+        std::vector<double>& buffer = m_thread_buffers[omp_get_thread_num()];
+        buffer.assign(length, 0.0);
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int block = 0; block < n; block += PAIR_ROW_BLOCK)
+            rows(block, std::min(block + PAIR_ROW_BLOCK, n), buffer.data());
+
+        #pragma omp for schedule(static)
+        for (std::size_t k = 0; k < length; k++)
+        {
+            double sum = 0;
+            for (int t = 0; t < team; t++)
+                sum += m_thread_buffers[t][k];
+            out[k] = sum;
+        }
+    }
+#endif
+}
+
+void PairForceEngine::accelerations(const ParticleSet& particles, double G,
+                                    std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az)
+{
+    const int n = (int)particles.size();
+    const int nm = (int)particles.massive();
+    const double *x = particles.x.data(), *y = particles.y.data(), *z = particles.z.data();
+    const double *m = particles.mass.data();
+    gravity_kernels::symmetric_kernel kernel = gravity_kernels::best_direct_kernel().symmetric;
+
+    // massive pairs only, the test particles are neither sources nor symmetric partners
+    accumulate(nm, 3, m_buffer, [&](int row_begin, int row_end, double* buffer)
+    {
+        kernel(x, y, z, m, nm, row_begin, row_end, buffer, buffer + nm, buffer + 2 * nm);
+    });
+
+    ax.resize(n);
+    ay.resize(n);
+    az.resize(n);
+    for (int i = 0; i < nm; i++)
+    {
+        ax[i] = G * m_buffer[i];
+        ay[i] = G * m_buffer[nm + i];
+        az[i] = G * m_buffer[2 * nm + i];
+    }
+
+    if (nm < n)
+        test_accelerations(particles, G, ax, ay, az);
+}
+
+void PairForceEngine::test_accelerations(const ParticleSet& particles, double G,
+                                         std::vector<double>& ax, std::vector<double>& ay,
+                                         std::vector<double>& az)
+{
+    const int nm = (int)particles.massive();
+    const int nt = (int)particles.size() - nm;
+    const double *x = particles.x.data(), *y = particles.y.data(), *z = particles.z.data();
+    const double *m = particles.mass.data();
+    const int threads = std::min(m_threads, std::max(1, nt / PAIR_TEST_BLOCK));
+
+    // every target is written by exactly one block, no per thread buffers needed
+    #pragma omp parallel for num_threads(threads) if(threads > 1) schedule(static)
+    for (int block = 0; block < nt; block += PAIR_TEST_BLOCK)
+    {
+        const int begin = nm + block;
+        const int count = std::min(PAIR_TEST_BLOCK, nt - block);
+        std::fill(ax.begin() + begin, ax.begin() + begin + count, 0.0);
+        std::fill(ay.begin() + begin, ay.begin() + begin + count, 0.0);
+        std::fill(az.begin() + begin, az.begin() + begin + count, 0.0);
+        gravity_kernels::test_particles(x, y, z, m, nm, x + begin, y + begin, z + begin, count,
+                                        G, ax.data() + begin, ay.data() + begin, az.data() + begin);
+    }
+}
+
+void PairForceEngine::rk4_moments(const ParticleSet& particles, double G, std::vector<double>& moments)
+{
+    const int n = (int)particles.size();
+    const int nm = (int)particles.massive();
+    const double *x = particles.x.data(), *y = particles.y.data(), *z = particles.z.data();
+    const double *m = particles.mass.data();
+
+    accumulate(n, RK4_MOMENT_CHANNELS, moments, [&](int row_begin, int row_end, double* buffer)
+    {
+        double* c[RK4_MOMENT_CHANNELS];
+        for (int k = 0; k < RK4_MOMENT_CHANNELS; k++)
+            c[k] = buffer + (std::size_t)k * n;
+
+        for (int i = row_begin; i < row_end; i++)
+        {
+            // test particles only see the massive sources, and act on nothing
+            if (i >= nm)
+            {
+                for (int j = 0; j < nm; j++)
+                {
+                    double dx = x[j] - x[i];
+                    double dy = y[j] - y[i];
+                    double dz = z[j] - z[i];
+                    double r = sqrt(dx*dx + dy*dy + dz*dz);
+                    double t1 = G * m[j] / (r*r*r), t2 = t1 * t1, t3 = t2 * t1, t4 = t3 * t1;
+
+                    c[RK4_P1][i] += t1; c[RK4_P2][i] += t2; c[RK4_P3][i] += t3;
+                    c[RK4_D1X][i] += t1 * dx; c[RK4_D1Y][i] += t1 * dy; c[RK4_D1Z][i] += t1 * dz;
+                    c[RK4_D2X][i] += t2 * dx; c[RK4_D2Y][i] += t2 * dy; c[RK4_D2Z][i] += t2 * dz;
+                    c[RK4_D3X][i] += t3 * dx; c[RK4_D3Y][i] += t3 * dy; c[RK4_D3Z][i] += t3 * dz;
+                    c[RK4_D4X][i] += t4 * dx; c[RK4_D4Y][i] += t4 * dy; c[RK4_D4Z][i] += t4 * dz;
+                }
+                continue;
+            }
+
+            for (int j = i + 1; j < nm; j++)
+            {
+                double dx = x[j] - x[i];
+                double dy = y[j] - y[i];
+                double dz = z[j] - z[i];
+                double r = sqrt(dx*dx + dy*dy + dz*dz);
+                double s = G / (r*r*r);
+
+                // t of j acting on i, and of i acting on j (seen with -d)
+                double t1 = m[j] * s, t2 = t1 * t1, t3 = t2 * t1, t4 = t3 * t1;
+                double u1 = m[i] * s, u2 = u1 * u1, u3 = u2 * u1, u4 = u3 * u1;
+
+                c[RK4_P1][i] += t1; c[RK4_P2][i] += t2; c[RK4_P3][i] += t3;
+                c[RK4_P1][j] += u1; c[RK4_P2][j] += u2; c[RK4_P3][j] += u3;
+
+                c[RK4_D1X][i] += t1 * dx; c[RK4_D1Y][i] += t1 * dy; c[RK4_D1Z][i] += t1 * dz;
+                c[RK4_D2X][i] += t2 * dx; c[RK4_D2Y][i] += t2 * dy; c[RK4_D2Z][i] += t2 * dz;
+                c[RK4_D3X][i] += t3 * dx; c[RK4_D3Y][i] += t3 * dy; c[RK4_D3Z][i] += t3 * dz;
+                c[RK4_D4X][i] += t4 * dx; c[RK4_D4Y][i] += t4 * dy; c[RK4_D4Z][i] += t4 * dz;
+
+                c[RK4_D1X][j] -= u1 * dx; c[RK4_D1Y][j] -= u1 * dy; c[RK4_D1Z][j] -= u1 * dz;
+                c[RK4_D2X][j] -= u2 * dx; c[RK4_D2Y][j] -= u2 * dy; c[RK4_D2Z][j] -= u2 * dz;
+                c[RK4_D3X][j] -= u3 * dx; c[RK4_D3Y][j] -= u3 * dy; c[RK4_D3Z][j] -= u3 * dz;
+                c[RK4_D4X][j] -= u4 * dx; c[RK4_D4Y][j] -= u4 * dy; c[RK4_D4Z][j] -= u4 * dz;
+            }
+        }
+    });
+}
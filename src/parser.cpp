@@ -21,6 +21,7 @@
  *
  */
 
+#include <sstream>
 #include "include/parser.h"
 #include "include/structures.h"
 #include "include/menu.h"
@@ -107,31 +108,105 @@ void parse_file(){
     fclose(fp2);
 }
 
-void parse_data(const std::string& filename){
-    
+/*
+ *PROCEDURE: read_body
+ *
+ *DESCRIPTION: Reads "name mass radius x y z vx vy vz" from row, exits with an
+ *error message on a malformed row
+ *
+ *RETURNS: false for a blank row
+ */
+static bool read_body(std::istringstream& row, body& b, const std::string& filename, const std::string& line){
+    if(!(row >> b.name))
+        return false;
+    if(!(row >> b.mass >> b.radius >> b.location.x >> b.location.y >> b.location.z >>
+    b.velocity.x >> b.velocity.y >> b.velocity.z)){
+        error_message("Malformed body row in " + filename + ": " + line);
+    }
+    return true;
+}
+
+std::vector<body> parse_data(const std::string& filename){
+
     int num_bodies;
     std::ifstream fin;
-    fin.open("input.txt");
+    fin.open(filename);
     if (!fin) {
-        error_message("Error in opening the required file");
+        error_message("Error in opening the required file: " + filename);
     }
 
     std::vector<body> bodies;
-    body temp;
+    std::size_t test_particles = 0;
+    std::string line;
     fin >> num_bodies >> gravity_constant;
-    while(fin >> temp.name >> temp.mass >> temp.radius >> temp.location.x >> temp.location.y >> temp.location.z >>
-    temp.velocity.x >> temp.velocity.y >> temp.velocity.z){
+    std::getline(fin, line);
+    while(std::getline(fin, line)){
+        std::istringstream row(line);
+        body temp;
+        if(!read_body(row, temp, filename, line))
+            continue;
+        //Optional last column: 1 flags a test particle, its mass is ignored
+        int test = 0;
+        if(row >> test && test != 0){
+            temp.mass = 0;
+            test_particles++;
+        }
         bodies.push_back(temp);
     }
 
-// now print the information you read in
-    for (const auto& simulation_objects : bodies) {
-        std::cout << simulation_objects.name << ' ' << simulation_objects.mass << ' ' << simulation_objects.radius << std::endl;
-        std::cout << "Position vector:" << std::endl;
-        std::cout << simulation_objects.location.x << ' ' << simulation_objects.location.y << ' ' << simulation_objects.location.z << std::endl;
-        std::cout << "velocity vector:" << std::endl;
-        std::cout << simulation_objects.velocity.x << ' ' << simulation_objects.velocity.y << ' ' << simulation_objects.velocity.z << std::endl;
+    if((int)bodies.size() != num_bodies){
+        std::cerr << filename << " announces " << num_bodies << " bodies but holds " << bodies.size() << std::endl;
+    }
+    std::cout << "Read " << bodies.size() - test_particles << " massive bodies and "
+              << test_particles << " test particles from " << filename << std::endl;
+    return bodies;
+}
+
+std::vector<batch_system> parse_batch(const std::string& filename, batch_options& options){
+
+    std::ifstream fin;
+    fin.open(filename);
+    if (!fin) {
+        error_message("Error in opening the required file: " + filename);
+    }
+
+    int num_systems = 0;
+    std::string line;
+    std::getline(fin, line);
+    std::istringstream header(line);
+    if(!(header >> num_systems >> options.G >> options.time_step >> options.duration)){
+        error_message("Malformed batch header in " + filename + ": " + line);
+    }
+    header >> options.escape_radius >> options.energy_tolerance;
+
+    std::vector<batch_system> systems;
+    systems.reserve(num_systems);
+    while(std::getline(fin, line)){
+        std::istringstream system_line(line);
+        batch_system system;
+        std::size_t num_bodies;
+        if(!(system_line >> system.label))
+            continue;
+        if(!(system_line >> num_bodies)){
+            error_message("Malformed system line in " + filename + ": " + line);
+        }
+        while(system.bodies.size() < num_bodies && std::getline(fin, line)){
+            std::istringstream row(line);
+            body temp;
+            if(read_body(row, temp, filename, line))
+                system.bodies.push_back(temp);
+        }
+        if(system.bodies.size() != num_bodies){
+            error_message("System " + system.label + " of " + filename + " ends before its " + std::to_string(num_bodies) + " bodies");
+        }
+        systems.push_back(std::move(system));
+    }
+
+    if((int)systems.size() != num_systems){
+        std::cerr << filename << " announces " << num_systems << " systems but holds " << systems.size() << std::endl;
     }
+    std::cout << "Read " << systems.size() << " systems from " << filename << std::endl;
+    return systems;
 }
 
 //C implementation of the parse file function: benchmark and refactor needed
@@ -0,0 +1,385 @@
+/*
+ * particle_mesh.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "include/particle_mesh.h"
+
+//Empty nodes kept between the particles and each face of the mesh: one for
+//the TSC stencil, two for the four point gradient and one of slack
+#define PM_MARGIN 4
+
+//Columns transformed together along y and z, one cache line of complex values
+#define PM_COLUMN_TILE 4
+
+static int next_power_of_two(int n)
+{
+    int p = 1;
+    while (p < n)
+        p *= 2;
+    return p;
+}
+
+ParticleMesh::ParticleMesh(int grid, mass_assignment scheme) :
+        m_n(next_power_of_two(std::max(grid, 4 * PM_MARGIN))),
+        m_padded(2 * m_n),
+        m_line(m_n + 1),
+        m_scheme(scheme),
+        m_h(1),
+        m_origin{ 0, 0, 0 },
+        m_real_fft(2 * m_n),
+        m_fft(2 * m_n) {}
+
+/*
+ *PROCEDURE: stencil
+ *
+ *DESCRIPTION: First node and weights of the CIC (2 nodes) or TSC (3 nodes)
+ *cloud of a particle at mesh coordinate u along one axis
+ *
+ *RETURNS: number of nodes(int)
+ */
+static int stencil(mass_assignment scheme, double u, int& first, double w[3])
+{
+    if (scheme == CIC)
+    {
+        first = (int)floor(u);
+        double f = u - first;
+        w[0] = 1 - f;
+        w[1] = f;
+        return 2;
+    }
+    int nearest = (int)floor(u + 0.5);
+    double d = u - nearest;
+    first = nearest - 1;
+    w[0] = 0.5 * (0.5 - d) * (0.5 - d);
+    w[1] = 0.75 - d * d;
+    w[2] = 0.5 * (0.5 + d) * (0.5 + d);
+    return 3;
+}
+
+/*
+ *PROCEDURE: green_function
+ *
+ *DESCRIPTION: Transform of -1/r (grid units, -1 at r = 0) on the padded mesh,
+ *with r measured to the nearest periodic copy so the kernel is even. Its
+ *transform is real and even, so only the octant k <= padded / 2 is kept,
+ *already divided by padded^3 for the inverse transform.
+ *
+ *RETURNS: -
+ */
+void ParticleMesh::green_function()
+{
+    const int M = m_padded, n = m_n;
+    m_work.assign((std::size_t)M * M * m_line, complex_t(0, 0));
+    double* real = reinterpret_cast<double*>(m_work.data());
+
+    #pragma omp parallel for
+    for (int z = 0; z < M; z++)
+    {
+        for (int y = 0; y < M; y++)
+        {
+            for (int x = 0; x < M; x++)
+            {
+                double dx = std::min(x, M - x), dy = std::min(y, M - y), dz = std::min(z, M - z);
+                double r = sqrt(dx*dx + dy*dy + dz*dz);
+                real[real_index(x, y, z)] = r > 0 ? -1.0 / r : -1.0;
+            }
+        }
+    }
+    forward(M);
+
+    const double normalisation = 1.0 / ((double)M * M * M);
+    m_green.resize((std::size_t)(n + 1) * (n + 1) * (n + 1));
+    for (int kz = 0; kz <= n; kz++)
+        for (int ky = 0; ky <= n; ky++)
+            for (int kx = 0; kx <= n; kx++)
+                m_green[((std::size_t)kz * (n + 1) + ky) * (n + 1) + kx] =
+                        m_work[((std::size_t)kz * M + ky) * m_line + kx].real() * normalisation;
+}
+
+/*
+ *PROCEDURE: forward
+ *
+ *DESCRIPTION: 3D real to complex transform of the work mesh, whose real
+ *samples are zero outside [0, active)^3, so lines that are known to be
+ *zero are skipped
+ *
+ *RETURNS: -
+ */
+void ParticleMesh::forward(int active)
+{
+    const int M = m_padded, L = m_line;
+
+    #pragma omp parallel for collapse(2)
+    for (int z = 0; z < active; z++)
+        for (int y = 0; y < active; y++)
+            m_real_fft.forward(&m_work[((std::size_t)z * M + y) * L]);
+
+    #pragma omp parallel
+    {
+        std::vector<complex_t> columns((std::size_t)PM_COLUMN_TILE * M);
+
+        // along y, planes z < active
+        #pragma omp for collapse(2)
+        for (int z = 0; z < active; z++)
+        {
+            for (int tile = 0; tile < L; tile += PM_COLUMN_TILE)
+            {
+                const int width = std::min(PM_COLUMN_TILE, L - tile);
+                complex_t* base = &m_work[(std::size_t)z * M * L + tile];
+                for (int y = 0; y < M; y++)
+                    for (int c = 0; c < width; c++)
+                        columns[c * M + y] = y < active ? base[(std::size_t)y * L + c] : complex_t(0, 0);
+                for (int c = 0; c < width; c++)
+                    m_fft.forward(&columns[c * M]);
+                for (int y = 0; y < M; y++)
+                    for (int c = 0; c < width; c++)
+                        base[(std::size_t)y * L + c] = columns[c * M + y];
+            }
+        }
+
+        // along z, every y
+        const std::size_t plane = (std::size_t)M * L;
+        #pragma omp for collapse(2)
+        for (int y = 0; y < M; y++)
+        {
+            for (int tile = 0; tile < L; tile += PM_COLUMN_TILE)
+            {
+                const int width = std::min(PM_COLUMN_TILE, L - tile);
+                complex_t* base = &m_work[(std::size_t)y * L + tile];
+                for (int z = 0; z < M; z++)
+                    for (int c = 0; c < width; c++)
+                        columns[c * M + z] = z < active ? base[z * plane + c] : complex_t(0, 0);
+                for (int c = 0; c < width; c++)
+                    m_fft.forward(&columns[c * M]);
+                for (int z = 0; z < M; z++)
+                    for (int c = 0; c < width; c++)
+                        base[z * plane + c] = columns[c * M + z];
+            }
+        }
+    }
+}
+
+/*
+ *PROCEDURE: inverse
+ *
+ *DESCRIPTION: 3D complex to real transform of the work mesh (unnormalised),
+ *only producing the real samples in [0, active)^3
+ *
+ *RETURNS: -
+ */
+void ParticleMesh::inverse(int active)
+{
+    const int M = m_padded, L = m_line;
+
+    #pragma omp parallel
+    {
+        std::vector<complex_t> columns((std::size_t)PM_COLUMN_TILE * M);
+
+        const std::size_t plane = (std::size_t)M * L;
+        #pragma omp for collapse(2)
+        for (int y = 0; y < M; y++)
+        {
+            for (int tile = 0; tile < L; tile += PM_COLUMN_TILE)
+            {
+                const int width = std::min(PM_COLUMN_TILE, L - tile);
+                complex_t* base = &m_work[(std::size_t)y * L + tile];
+                for (int z = 0; z < M; z++)
+                    for (int c = 0; c < width; c++)
+                        columns[c * M + z] = base[z * plane + c];
+                for (int c = 0; c < width; c++)
+                    m_fft.inverse(&columns[c * M]);
+                for (int z = 0; z < active; z++)
+                    for (int c = 0; c < width; c++)
+                        base[z * plane + c] = columns[c * M + z];
+            }
+        }
+
+        #pragma omp for collapse(2)
+        for (int z = 0; z < active; z++)
+        {
+            for (int tile = 0; tile < L; tile += PM_COLUMN_TILE)
+            {
+                const int width = std::min(PM_COLUMN_TILE, L - tile);
+                complex_t* base = &m_work[(std::size_t)z * M * L + tile];
+                for (int y = 0; y < M; y++)
+                    for (int c = 0; c < width; c++)
+                        columns[c * M + y] = base[(std::size_t)y * L + c];
+                for (int c = 0; c < width; c++)
+                    m_fft.inverse(&columns[c * M]);
+                for (int y = 0; y < active; y++)
+                    for (int c = 0; c < width; c++)
+                        base[(std::size_t)y * L + c] = columns[c * M + y];
+            }
+        }
+    }
+
+    #pragma omp parallel for collapse(2)
+    for (int z = 0; z < active; z++)
+        for (int y = 0; y < active; y++)
+            m_real_fft.inverse(&m_work[((std::size_t)z * M + y) * L]);
+}
+
+void ParticleMesh::convolve()
+{
+    const int M = m_padded, L = m_line, n = m_n;
+
+    #pragma omp parallel for collapse(2)
+    for (int kz = 0; kz < M; kz++)
+    {
+        for (int ky = 0; ky < M; ky++)
+        {
+            const double* green = &m_green[((std::size_t)std::min(kz, M - kz) * (n + 1) + std::min(ky, M - ky)) * (n + 1)];
+            complex_t* line = &m_work[((std::size_t)kz * M + ky) * L];
+            for (int kx = 0; kx < L; kx++)
+                line[kx] *= green[kx];
+        }
+    }
+}
+
+/*
+ *PROCEDURE: place_mesh
+ *
+ *DESCRIPTION: Centres the mesh on the particles' bounding box, with a cell
+ *size leaving PM_MARGIN empty nodes on every side of the largest extent
+ *
+ *RETURNS: -
+ */
+void ParticleMesh::place_mesh(const ParticleSet& particles)
+{
+    const std::vector<double>* columns[3] = { &particles.x, &particles.y, &particles.z };
+    double low[3], high[3];
+    for (int a = 0; a < 3; a++)
+    {
+        auto range = std::minmax_element(columns[a]->begin(), columns[a]->end());
+        low[a] = *range.first;
+        high[a] = *range.second;
+    }
+    double extent = std::max({ high[0] - low[0], high[1] - low[1], high[2] - low[2] });
+    m_h = extent > 0 ? extent * (1 + 1e-12) / (m_n - 2 * PM_MARGIN) : 1.0;
+    for (int a = 0; a < 3; a++)
+        m_origin[a] = 0.5 * (low[a] + high[a]) - 0.5 * m_n * m_h;
+}
+
+void ParticleMesh::assign(const ParticleSet& particles)
+{
+    const int n = m_n;
+    double* real = reinterpret_cast<double*>(m_work.data());
+
+    #pragma omp parallel for collapse(2)
+    for (int z = 0; z < n; z++)
+        for (int y = 0; y < n; y++)
+            std::fill(real + real_index(0, y, z), real + real_index(0, y, z) + 2 * m_line, 0.0);
+
+    const int count = (int)particles.size();
+    #pragma omp parallel for
+    for (int i = 0; i < count; i++)
+    {
+        int fx, fy, fz;
+        double wx[3], wy[3], wz[3];
+        const int nodes = stencil(m_scheme, (particles.x[i] - m_origin[0]) / m_h, fx, wx);
+        stencil(m_scheme, (particles.y[i] - m_origin[1]) / m_h, fy, wy);
+        stencil(m_scheme, (particles.z[i] - m_origin[2]) / m_h, fz, wz);
+        for (int c = 0; c < nodes; c++)
+            for (int b = 0; b < nodes; b++)
+            {
+                const double w = particles.mass[i] * wz[c] * wy[b];
+                double* row = real + real_index(fx, fy + b, fz + c);
+                for (int a = 0; a < nodes; a++)
+                {
+                    #pragma omp atomic
+                    row[a] += w * wx[a];
+                }
+            }
+    }
+}
+
+void ParticleMesh::interpolate(const ParticleSet& particles, double G,
+                               std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az)
+{
+    const double* phi = reinterpret_cast<const double*>(m_work.data());
+    const std::size_t sx = 1, sy = 2 * (std::size_t)m_line, sz = sy * m_padded;
+    // a = -G / h^2 grad(phi) in grid units, four point differences
+    const double scale = -G / (m_h * m_h) / 12.0;
+    auto difference = [phi](std::size_t node, std::size_t stride)
+    {
+        return 8 * (phi[node + stride] - phi[node - stride]) - (phi[node + 2 * stride] - phi[node - 2 * stride]);
+    };
+
+    const int count = (int)particles.size();
+    ax.resize(count);
+    ay.resize(count);
+    az.resize(count);
+
+    #pragma omp parallel for
+    for (int i = 0; i < count; i++)
+    {
+        int fx, fy, fz;
+        double wx[3], wy[3], wz[3];
+        const int nodes = stencil(m_scheme, (particles.x[i] - m_origin[0]) / m_h, fx, wx);
+        stencil(m_scheme, (particles.y[i] - m_origin[1]) / m_h, fy, wy);
+        stencil(m_scheme, (particles.z[i] - m_origin[2]) / m_h, fz, wz);
+        double gx = 0, gy = 0, gz = 0;
+        for (int c = 0; c < nodes; c++)
+            for (int b = 0; b < nodes; b++)
+                for (int a = 0; a < nodes; a++)
+                {
+                    const double w = wz[c] * wy[b] * wx[a];
+                    const std::size_t node = real_index(fx + a, fy + b, fz + c);
+                    gx += w * difference(node, sx);
+                    gy += w * difference(node, sy);
+                    gz += w * difference(node, sz);
+                }
+        ax[i] = scale * gx;
+        ay[i] = scale * gy;
+        az[i] = scale * gz;
+    }
+}
+
+void ParticleMesh::accelerations(const ParticleSet& particles, double G,
+                                 std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az)
+{
+    if (particles.size() == 0)
+    {
+        ax.clear();
+        ay.clear();
+        az.clear();
+        return;
+    }
+    if (m_green.empty())
+        green_function();
+
+    place_mesh(particles);
+    assign(particles);
+    forward(m_n);
+    convolve();
+    inverse(m_n);
+    interpolate(particles, G, ax, ay, az);
+}
+
+void ParticleMesh::rk4_moments(const ParticleSet&, double, std::vector<double>&)
+{
+    throw std::logic_error("the particle-mesh backend has no RK4 moments");
+}
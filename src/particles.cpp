@@ -0,0 +1,146 @@
+/*
+ * particles.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "include/particles.h"
+
+ParticleSet::ParticleSet(const std::vector<body>& bodies)
+{
+    // massive bodies first, so building the store never inserts in the middle
+    // and the new particle is always the last one
+    reserve(bodies.size());
+    for (std::size_t i = 0; i < bodies.size(); i++)
+        if (bodies[i].mass != 0)
+        {
+            add(bodies[i]);
+            id.back() = i;
+        }
+    for (std::size_t i = 0; i < bodies.size(); i++)
+        if (bodies[i].mass == 0)
+        {
+            add(bodies[i]);
+            id.back() = i;
+        }
+    next_id = bodies.size();
+}
+
+void ParticleSet::reserve(std::size_t n)
+{
+    x.reserve(n);
+    y.reserve(n);
+    z.reserve(n);
+    vx.reserve(n);
+    vy.reserve(n);
+    vz.reserve(n);
+    mass.reserve(n);
+    radius.reserve(n);
+    name.reserve(n);
+    id.reserve(n);
+}
+
+void ParticleSet::add(const body& b)
+{
+    if (b.mass != 0 && n_test > 0)
+    {
+        const std::size_t at = massive();
+        x.insert(x.begin() + at, b.location.x);
+        y.insert(y.begin() + at, b.location.y);
+        z.insert(z.begin() + at, b.location.z);
+        vx.insert(vx.begin() + at, b.velocity.x);
+        vy.insert(vy.begin() + at, b.velocity.y);
+        vz.insert(vz.begin() + at, b.velocity.z);
+        mass.insert(mass.begin() + at, b.mass);
+        radius.insert(radius.begin() + at, b.radius);
+        name.insert(name.begin() + at, b.name);
+        id.insert(id.begin() + at, next_id++);
+        return;
+    }
+
+    x.push_back(b.location.x);
+    y.push_back(b.location.y);
+    z.push_back(b.location.z);
+    vx.push_back(b.velocity.x);
+    vy.push_back(b.velocity.y);
+    vz.push_back(b.velocity.z);
+    mass.push_back(b.mass);
+    radius.push_back(b.radius);
+    name.push_back(b.name);
+    id.push_back(next_id++);
+    if (b.mass == 0)
+        n_test++;
+}
+
+std::size_t ParticleSet::remove_marked(const std::vector<char>& dead)
+{
+    const std::size_t n = size();
+    std::size_t kept = 0, tests = 0;
+    for (std::size_t i = 0; i < n; i++)
+    {
+        if (dead[i])
+            continue;
+        if (kept != i)
+        {
+            x[kept] = x[i];
+            y[kept] = y[i];
+            z[kept] = z[i];
+            vx[kept] = vx[i];
+            vy[kept] = vy[i];
+            vz[kept] = vz[i];
+            mass[kept] = mass[i];
+            radius[kept] = radius[i];
+            name[kept] = std::move(name[i]);
+            id[kept] = id[i];
+        }
+        if (mass[kept] == 0)
+            tests++;
+        kept++;
+    }
+
+    // resize() to a smaller size keeps the capacity
+    x.resize(kept);
+    y.resize(kept);
+    z.resize(kept);
+    vx.resize(kept);
+    vy.resize(kept);
+    vz.resize(kept);
+    mass.resize(kept);
+    radius.resize(kept);
+    name.resize(kept);
+    id.resize(kept);
+    n_test = tests;
+    return n - kept;
+}
+
+body ParticleSet::get_body(std::size_t i) const
+{
+    return body{ location(i), mass[i], radius[i], velocity(i), name[i] };
+}
+
+std::vector<body> ParticleSet::to_bodies() const
+{
+    std::vector<body> bodies;
+    bodies.reserve(size());
+    for (std::size_t i = 0; i < size(); i++)
+        bodies.push_back(get_body(i));
+    return bodies;
+}
@@ -0,0 +1,350 @@
+/*
+ * snapshot.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "include/snapshot.h"
+
+static_assert(sizeof(snapshot_header) == 256, "snapshot header must stay 256 bytes");
+static_assert(sizeof(snapshot_header) % SNAPSHOT_ALIGNMENT == 0, "columns must start aligned");
+
+static const char SNAPSHOT_MAGIC[8] = "CELSNAP";
+static const char* const SNAPSHOT_FIELDS[SNAPSHOT_COLUMNS] = { "mass", "x", "y", "z", "vx", "vy", "vz" };
+static const std::uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+static inline std::uint64_t rotate_left(std::uint64_t v, int bits)
+{
+    return (v << bits) | (v >> (64 - bits));
+}
+
+/*
+ * Struct: checksum_state
+ *
+ * OBJECTS: Running state of snapshot_checksum, fed whole 32 byte stripes in
+ * file order so a record can be summed from its separate columns.
+*/
+struct checksum_state{
+    static constexpr std::uint64_t P1 = 0x9E3779B185EBCA87ULL;
+    static constexpr std::uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+    std::uint64_t lane[4] = { P1 + P2, P2, 0, 0 - P1 };
+    std::uint64_t bytes = 0;
+
+    void update(const void* data, std::size_t size)
+    {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        std::uint64_t l0 = lane[0], l1 = lane[1], l2 = lane[2], l3 = lane[3];
+        for (std::size_t offset = 0; offset + 32 <= size; offset += 32)
+        {
+            std::uint64_t w[4];
+            std::memcpy(w, p + offset, 32);
+            l0 = rotate_left(l0 + w[0] * P2, 31) * P1;
+            l1 = rotate_left(l1 + w[1] * P2, 31) * P1;
+            l2 = rotate_left(l2 + w[2] * P2, 31) * P1;
+            l3 = rotate_left(l3 + w[3] * P2, 31) * P1;
+        }
+        lane[0] = l0; lane[1] = l1; lane[2] = l2; lane[3] = l3;
+        bytes += size;
+    }
+
+    std::uint64_t finish() const
+    {
+        std::uint64_t h = rotate_left(lane[0], 1) + rotate_left(lane[1], 7) + rotate_left(lane[2], 12) + rotate_left(lane[3], 18);
+        h ^= bytes;
+        h ^= h >> 33; h *= P2; h ^= h >> 29; h *= P1; h ^= h >> 32;
+        return h;
+    }
+};
+
+std::uint64_t snapshot_checksum(const void* data, std::size_t bytes)
+{
+    checksum_state state;
+    state.update(data, bytes);
+    return state.finish();
+}
+
+/*
+ *PROCEDURE: column_stride
+ *
+ *DESCRIPTION: Bytes between the starts of two columns of n doubles
+ *
+ *RETURNS: std::uint64_t
+ */
+static std::uint64_t column_stride(std::size_t n)
+{
+    return (n * sizeof(double) + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+/*
+ *PROCEDURE: write_all
+ *
+ *DESCRIPTION: writev until every buffer is written, resuming after partial
+ *writes and signals
+ *
+ *RETURNS: false on an error
+ */
+static bool write_all(int fd, iovec* parts, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, parts, std::min(count, IOV_MAX));
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        while (count > 0 && (std::size_t)written >= parts->iov_len)
+        {
+            written -= parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0)
+        {
+            parts->iov_base = static_cast<char*>(parts->iov_base) + written;
+            parts->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+bool write_snapshot(int fd, const double* const columns[SNAPSHOT_COLUMNS], std::size_t n, double time,
+                    const snapshot_units& units)
+{
+    static const char padding[SNAPSHOT_ALIGNMENT] = {};
+    const std::uint64_t stride = column_stride(n);
+    const std::size_t data_bytes = n * sizeof(double), pad = stride - data_bytes;
+
+    snapshot_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.header_bytes = sizeof(snapshot_header);
+    header.record_bytes = sizeof(snapshot_header) + SNAPSHOT_COLUMNS * stride;
+    header.n = n;
+    header.columns = SNAPSHOT_COLUMNS;
+    header.column_stride = stride;
+    header.time = time;
+    header.units = units;
+    for (int c = 0; c < SNAPSHOT_COLUMNS; c++)
+        std::strncpy(header.fields[c], SNAPSHOT_FIELDS[c], sizeof(header.fields[c]) - 1);
+
+    iovec parts[1 + 2 * SNAPSHOT_COLUMNS];
+    int count = 0;
+    parts[count++] = iovec{ &header, sizeof(header) };
+    checksum_state checksum;
+    for (int c = 0; c < SNAPSHOT_COLUMNS; c++)
+    {
+        parts[count++] = iovec{ const_cast<double*>(columns[c]), data_bytes };
+        if (pad > 0)
+            parts[count++] = iovec{ const_cast<char*>(padding), pad };
+
+        // whole stripes straight from the column, the last partial one with
+        // the padding from a zeroed copy (stride is a multiple of 64)
+        const std::size_t body = data_bytes / 32 * 32;
+        char tail[96] = {};
+        checksum.update(columns[c], body);
+        std::memcpy(tail, reinterpret_cast<const char*>(columns[c]) + body, data_bytes - body);
+        checksum.update(tail, stride - body);
+    }
+    header.checksum = checksum.finish();
+    return write_all(fd, parts, count);
+}
+
+bool write_snapshot(int fd, const ParticleSet& p, double time, const snapshot_units& units)
+{
+    const double* const columns[SNAPSHOT_COLUMNS] = { p.mass.data(), p.x.data(), p.y.data(), p.z.data(),
+                                                      p.vx.data(), p.vy.data(), p.vz.data() };
+    return write_snapshot(fd, columns, p.size(), time, units);
+}
+
+bool write_snapshot(const std::string& path, const ParticleSet& particles, double time, const snapshot_units& units)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool written = write_snapshot(fd, particles, time, units);
+    return ::close(fd) == 0 && written;
+}
+
+SnapshotReader::~SnapshotReader()
+{
+    close();
+}
+
+void SnapshotReader::close()
+{
+    if (m_map)
+        munmap(const_cast<char*>(m_map), m_bytes);
+    m_map = nullptr;
+    m_bytes = 0;
+    m_records.clear();
+    m_header = nullptr;
+}
+
+bool SnapshotReader::fail(const std::string& reason)
+{
+    m_error = reason;
+    close();
+    return false;
+}
+
+bool SnapshotReader::open(const std::string& path, bool verify)
+{
+    close();
+    m_verify = verify;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return fail("cannot open " + path + ": " + strerror(errno));
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(snapshot_header))
+    {
+        ::close(fd);
+        return fail(path + " is too short to be a snapshot");
+    }
+    m_bytes = info.st_size;
+    void* map = mmap(nullptr, m_bytes, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        m_bytes = 0;
+        return fail("cannot map " + path + ": " + strerror(errno));
+    }
+    m_map = static_cast<const char*>(map);
+
+    // walk the record headers, the columns are not touched
+    for (std::size_t offset = 0; offset < m_bytes;)
+    {
+        if (m_bytes - offset < sizeof(snapshot_header))
+            return fail(path + ": truncated record header");
+        const snapshot_header* h = reinterpret_cast<const snapshot_header*>(m_map + offset);
+        if (std::memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0)
+            return fail(path + ": not a snapshot file");
+        if (h->byte_order != SNAPSHOT_BYTE_ORDER)
+            return fail(path + ": written with another byte order");
+        if (h->version != SNAPSHOT_VERSION)
+            return fail(path + ": unsupported snapshot version " + std::to_string(h->version));
+        if (h->columns != SNAPSHOT_COLUMNS || h->header_bytes % SNAPSHOT_ALIGNMENT != 0 ||
+            h->column_stride < h->n * sizeof(double) || h->column_stride % SNAPSHOT_ALIGNMENT != 0 ||
+            h->record_bytes != h->header_bytes + h->columns * h->column_stride)
+            return fail(path + ": inconsistent field layout");
+        if (m_bytes - offset < h->record_bytes)
+            return fail(path + ": truncated record");
+        m_records.push_back(offset);
+        offset += h->record_bytes;
+    }
+    return select(0);
+}
+
+bool SnapshotReader::select(std::size_t k)
+{
+    if (k >= m_records.size())
+    {
+        m_error = "no snapshot " + std::to_string(k);
+        return false;
+    }
+    const snapshot_header* h = reinterpret_cast<const snapshot_header*>(m_map + m_records[k]);
+    if (m_verify && snapshot_checksum(reinterpret_cast<const char*>(h) + h->header_bytes, h->columns * h->column_stride) != h->checksum)
+    {
+        m_error = "checksum mismatch in snapshot " + std::to_string(k);
+        return false;
+    }
+    m_header = h;
+    return true;
+}
+
+ParticleSet SnapshotReader::particles() const
+{
+    ParticleSet p;
+    const std::size_t n = size();
+    p.reserve(n);
+    for (std::size_t i = 0; i < n; i++)
+        p.add(body{ { x()[i], y()[i], z()[i] }, mass()[i], 0.0, { vx()[i], vy()[i], vz()[i] }, "p" + std::to_string(i) });
+    return p;
+}
+
+int text_to_snapshot(std::istream& in, const std::string& path, const snapshot_units& units)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    int snapshots = 0;
+    std::size_t n;
+    double time;
+    std::vector<double> columns[SNAPSHOT_COLUMNS];
+    while (in >> n >> time)
+    {
+        for (auto& column : columns)
+            column.resize(n);
+        for (std::size_t i = 0; i < n; i++)
+            for (auto& column : columns)
+                if (!(in >> column[i]))
+                {
+                    ::close(fd);
+                    return -1;
+                }
+        const double* const data[SNAPSHOT_COLUMNS] = { columns[0].data(), columns[1].data(), columns[2].data(),
+                                                       columns[3].data(), columns[4].data(), columns[5].data(),
+                                                       columns[6].data() };
+        if (!write_snapshot(fd, data, n, time, units))
+        {
+            ::close(fd);
+            return -1;
+        }
+        snapshots++;
+    }
+    const bool complete = in.eof();
+    return ::close(fd) == 0 && complete ? snapshots : -1;
+}
+
+int snapshot_to_text(const std::string& path, std::ostream& out)
+{
+    SnapshotReader reader;
+    if (!reader.open(path))
+        return -1;
+    out.precision(16);
+    for (std::size_t k = 0; k < reader.snapshots(); k++)
+    {
+        if (!reader.select(k))
+            return -1;
+        out << reader.size() << std::endl;
+        out << reader.time() << std::endl;
+        for (std::size_t i = 0; i < reader.size(); i++)
+        {
+            out << reader.mass()[i];
+            for (int c = 1; c < SNAPSHOT_COLUMNS; c++)
+                out << ' ' << reader.column(c)[i];
+            out << '\n';
+        }
+    }
+    return (int)reader.snapshots();
+}
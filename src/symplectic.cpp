@@ -0,0 +1,138 @@
+/*
+ * symplectic.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "include/integration.h"
+
+using namespace solar_system;
+
+/*
+ *PROCEDURE: evaluate
+ *
+ *DESCRIPTION: Force provider accelerations at the current positions
+ *
+ *RETURNS: -
+ */
+template <class Scheme>
+void Orbit_integration::Composition<Scheme>::evaluate()
+{
+    m_forces->accelerations(m_particles, G_const, m_ax, m_ay, m_az);
+    m_accelerations_valid = true;
+    m_evaluations++;
+}
+
+/*
+ *PROCEDURE: kick
+ *
+ *DESCRIPTION: Advances the velocities by dt with the current accelerations
+ *
+ *RETURNS: -
+ */
+template <class Scheme>
+void Orbit_integration::Composition<Scheme>::kick(double dt)
+{
+    const std::size_t n = m_particles.size();
+    double* vx = m_particles.vx.data();
+    double* vy = m_particles.vy.data();
+    double* vz = m_particles.vz.data();
+    for (std::size_t i = 0; i < n; i++)
+    {
+        vx[i] += dt * m_ax[i];
+        vy[i] += dt * m_ay[i];
+        vz[i] += dt * m_az[i];
+    }
+}
+
+/*
+ *PROCEDURE: drift
+ *
+ *DESCRIPTION: Advances the positions by dt with the current velocities
+ *
+ *RETURNS: -
+ */
+template <class Scheme>
+void Orbit_integration::Composition<Scheme>::drift(double dt)
+{
+    const std::size_t n = m_particles.size();
+    double* x = m_particles.x.data();
+    double* y = m_particles.y.data();
+    double* z = m_particles.z.data();
+    for (std::size_t i = 0; i < n; i++)
+    {
+        x[i] += dt * m_particles.vx[i];
+        y[i] += dt * m_particles.vy[i];
+        z[i] += dt * m_particles.vz[i];
+    }
+}
+
+/*
+ *PROCEDURE: stage
+ *
+ *DESCRIPTION: One kick-drift-kick leapfrog step of length dt
+ *
+ *RETURNS: -
+ */
+template <class Scheme>
+void Orbit_integration::Composition<Scheme>::stage(double dt)
+{
+    kick(0.5 * dt);
+    drift(dt);
+    evaluate();
+    kick(0.5 * dt);
+}
+
+/*
+ *PROCEDURE: stages
+ *
+ *DESCRIPTION: The leapfrog steps of the composition, expanded at compile time
+ *
+ *RETURNS: -
+ */
+template <class Scheme>
+template <std::size_t... I>
+void Orbit_integration::Composition<Scheme>::stages(std::index_sequence<I...>)
+{
+    (stage(Scheme::weights[I] * m_time_step), ...);
+}
+
+/*
+ *PROCEDURE: compute_gravity_step
+ *
+ *DESCRIPTION: One composition step of m_time_step
+ *
+ *RETURNS: -
+ */
+template <class Scheme>
+void Orbit_integration::Composition<Scheme>::compute_gravity_step()
+{
+    if (!m_accelerations_valid || m_ax.size() != m_particles.size())
+        evaluate();
+    stages(std::make_index_sequence<Scheme::stages>{});
+    m_time += m_time_step;
+}
+
+template class Orbit_integration::Composition<Orbit_integration::leapfrog2>;
+template class Orbit_integration::Composition<Orbit_integration::yoshida4>;
+template class Orbit_integration::Composition<Orbit_integration::suzuki4>;
+template class Orbit_integration::Composition<Orbit_integration::yoshida6>;
+template class Orbit_integration::Composition<Orbit_integration::yoshida8>;
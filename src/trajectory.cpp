@@ -0,0 +1,1034 @@
+/*
+ * trajectory.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/trajectory.h"
+
+static_assert(sizeof(trajectory_file_header) == 64, "trajectory file header must stay 64 bytes");
+static_assert(sizeof(trajectory_chunk_header) == 64, "trajectory chunk header must stay 64 bytes");
+static_assert(sizeof(trajectory_index_trailer) == 32, "trajectory trailer must stay 32 bytes");
+
+static const char TRAJECTORY_MAGIC[8] = "CELTRAJ";
+static const char TRAJECTORY_CHUNK_MAGIC[8] = "CELCHNK";
+static const char TRAJECTORY_INDEX_MAGIC[8] = "CELTIDX";
+static const std::uint32_t TRAJECTORY_BYTE_ORDER = 0x01020304;
+
+//Coded column header: mode, order and padding, then the quantization step
+//for quantized columns
+enum column_mode{
+    COLUMN_BITS = 0,
+    COLUMN_QUANTIZED = 1
+};
+
+static inline std::uint64_t zigzag(std::uint64_t difference)
+{
+    return (difference << 1) ^ (std::uint64_t)((std::int64_t)difference >> 63);
+}
+
+static inline std::uint64_t unzigzag(std::uint64_t u)
+{
+    return (u >> 1) ^ (0 - (u & 1));
+}
+
+static inline int significant_bytes(std::uint64_t u)
+{
+    return u ? 8 - __builtin_clzll(u) / 8 : 0;
+}
+
+/*
+ *PROCEDURE: encode_column
+ *
+ *DESCRIPTION: Appends the coded column v of n values to out. Missing values
+ *(NaN) are left out and marked in a presence bitmap. With a positive error
+ *the values are quantized to multiples of 2 error, unless one of them is not
+ *finite, too large for the levels or would round to further than error, in
+ *which case the column is stored losslessly
+ *
+ *RETURNS: bytes appended, a multiple of 8
+ */
+static std::size_t encode_column(const double* v, std::size_t n, double error, std::vector<double>& values,
+                                 std::vector<std::uint64_t>& words, std::vector<unsigned char>& out)
+{
+    values.clear();
+    for (std::size_t f = 0; f < n; f++)
+        if (!std::isnan(v[f]))
+            values.push_back(v[f]);
+    const std::size_t m = values.size();
+    const bool sparse = m < n;
+    words.resize(2 * m);
+    std::uint64_t* w = words.data();
+    std::uint64_t* difference = w + m;
+
+    double step = 2 * error;
+    unsigned char mode = COLUMN_QUANTIZED;
+    for (std::size_t f = 0; f < m && step > 0; f++)
+    {
+        const double level = std::nearbyint(values[f] / step);
+        if (!(fabs(level) < 4503599627370496.0) || fabs(level * step - values[f]) > error)
+            step = 0;
+        else
+            w[f] = (std::uint64_t)(std::int64_t)level;
+    }
+    if (step <= 0)
+    {
+        mode = COLUMN_BITS;
+        std::memcpy(w, values.data(), m * sizeof(double));
+    }
+
+    // order with the fewest significant bytes, the differences of each order
+    // computed in place from the previous one
+    int order = 0;
+    std::size_t best = 0;
+    std::copy(w, w + m, difference);
+    for (std::size_t f = 0; f < m; f++)
+        best += significant_bytes(zigzag(difference[f]));
+    for (int k = 1; k <= TRAJECTORY_MAX_ORDER && k < (int)m; k++)
+    {
+        std::size_t bytes = 0;
+        for (std::size_t f = m - 1; f >= (std::size_t)k; f--)
+        {
+            difference[f] -= difference[f - 1];
+            bytes += significant_bytes(zigzag(difference[f]));
+        }
+        for (int f = 0; f < k; f++)
+            bytes += significant_bytes(zigzag(difference[f]));
+        if (bytes < best)
+        {
+            best = bytes;
+            order = k;
+        }
+    }
+    std::copy(w, w + m, difference);
+    for (int k = 1; k <= order; k++)
+        for (std::size_t f = m - 1; f >= (std::size_t)k; f--)
+            difference[f] -= difference[f - 1];
+
+    const std::size_t start = out.size();
+    const std::size_t header = mode == COLUMN_QUANTIZED ? 16 : 8;
+    const std::size_t bitmap = sparse ? (n + 7) / 8 : 0;
+    const std::size_t bytes = (header + bitmap + (m + 1) / 2 + best + 7) / 8 * 8;
+    out.resize(start + bytes, 0);
+    unsigned char* p = out.data() + start;
+    p[0] = mode;
+    p[1] = order;
+    p[2] = sparse;
+    if (mode == COLUMN_QUANTIZED)
+        std::memcpy(p + 8, &step, sizeof(step));
+    unsigned char* present = p + header;
+    if (sparse)
+        for (std::size_t f = 0; f < n; f++)
+            if (!std::isnan(v[f]))
+                present[f / 8] |= 1 << (f % 8);
+    unsigned char* codes = present + bitmap;
+    unsigned char* data = codes + (m + 1) / 2;
+    for (std::size_t f = 0; f < m; f++)
+    {
+        std::uint64_t u = zigzag(difference[f]);
+        const int length = significant_bytes(u);
+        codes[f / 2] |= length << (4 * (f & 1));
+        for (int b = 0; b < length; b++, u >>= 8)
+            *data++ = (unsigned char)u;
+    }
+    return bytes;
+}
+
+/*
+ *PROCEDURE: decode_column
+ *
+ *DESCRIPTION: Decodes a column of n values coded in bytes bytes at p
+ *
+ *RETURNS: false if the column is malformed
+ */
+static bool decode_column(const unsigned char* p, std::size_t bytes, std::size_t n,
+                          std::vector<std::uint64_t>& words, double* v)
+{
+    const std::size_t header = p[0] == COLUMN_QUANTIZED ? 16 : 8;
+    const int order = p[1];
+    const bool sparse = p[2] != 0;
+    const std::size_t bitmap = sparse ? (n + 7) / 8 : 0;
+    if (bytes < 8 || p[0] > COLUMN_QUANTIZED || order > TRAJECTORY_MAX_ORDER || bytes < header + bitmap)
+        return false;
+    const unsigned char* present = p + header;
+    std::size_t m = n;
+    if (sparse)
+    {
+        m = 0;
+        for (std::size_t f = 0; f < n; f++)
+            m += (present[f / 8] >> (f % 8)) & 1;
+    }
+    const unsigned char* codes = present + bitmap;
+    const unsigned char* data = codes + (m + 1) / 2;
+    const unsigned char* end = p + bytes;
+    if (data > end)
+        return false;
+    words.resize(m);
+    std::uint64_t* w = words.data();
+    for (std::size_t f = 0; f < m; f++)
+    {
+        const int length = (codes[f / 2] >> (4 * (f & 1))) & 15;
+        if (length > 8 || end - data < length)
+            return false;
+        std::uint64_t u = 0;
+        for (int b = 0; b < length; b++)
+            u |= (std::uint64_t)data[b] << (8 * b);
+        data += length;
+        w[f] = unzigzag(u);
+    }
+    for (int k = order; k >= 1; k--)
+        for (std::size_t f = k; f < m; f++)
+            w[f] += w[f - 1];
+
+    double step = 0;
+    if (p[0] == COLUMN_QUANTIZED)
+        std::memcpy(&step, p + 8, sizeof(step));
+    for (std::size_t f = 0, k = 0; f < n; f++)
+    {
+        if (sparse && !((present[f / 8] >> (f % 8)) & 1))
+        {
+            v[f] = std::numeric_limits<double>::quiet_NaN();
+            continue;
+        }
+        if (p[0] == COLUMN_QUANTIZED)
+            v[f] = (double)(std::int64_t)w[k++] * step;
+        else
+            std::memcpy(v + f, &w[k++], sizeof(double));
+    }
+    return true;
+}
+
+bool TextTrajectory::write(const std::vector<const trajectory_frame*>& chunk)
+{
+    char line[160];
+    for (const trajectory_frame* frame : chunk)
+    {
+        for (const auto& named : frame->new_names)
+        {
+            if (named.first >= m_file.size())
+            {
+                m_file.resize(named.first + 1);
+                m_pending.resize(named.first + 1);
+            }
+            m_file[named.first] = m_prefix + named.second + ".dat";
+            std::ofstream f(m_file[named.first], std::ios::trunc);
+            f << named.second << std::endl;
+            if (!f)
+                return false;
+        }
+        // %g is the default ostream formatting of the former output
+        for (std::size_t i = 0; i < frame->id.size(); i++)
+        {
+            int length = m_full_state
+                ? snprintf(line, sizeof(line), "%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n", frame->x[i], frame->y[i],
+                           frame->z[i], frame->vx[i], frame->vy[i], frame->vz[i])
+                : snprintf(line, sizeof(line), "%g,%g,%g\n", frame->x[i], frame->y[i], frame->z[i]);
+            m_pending[frame->id[i]].append(line, length);
+        }
+    }
+
+    for (std::size_t id = 0; id < m_pending.size(); id++)
+    {
+        if (m_pending[id].empty())
+            continue;
+        std::ofstream f(m_file[id], std::ios::app);
+        f << m_pending[id];
+        m_pending[id].clear();
+        if (!f)
+            return false;
+    }
+    return true;
+}
+
+TrajectoryWriter::TrajectoryWriter(std::unique_ptr<TrajectoryFormat> format,
+                                   std::size_t ring_frames, std::size_t chunk_frames) :
+    m_format(std::move(format)), m_ring(std::max<std::size_t>(ring_frames, 1)),
+    m_chunk(std::min(std::max<std::size_t>(chunk_frames, 1), m_ring.size()))
+{
+    m_thread = std::thread(&TrajectoryWriter::drain, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    close();
+}
+
+/*
+ *PROCEDURE: acquire
+ *
+ *DESCRIPTION: Waits for a free frame of the ring, the producer fills it
+ *without the lock since the writer thread only reads published frames
+ *
+ *RETURNS: the frame, nullptr once the format failed or the writer was closed
+ */
+trajectory_frame* TrajectoryWriter::acquire()
+{
+    std::unique_lock<std::mutex> guard(m_lock);
+    if (m_pushed - m_written == m_ring.size() && !m_failed)
+    {
+        m_stalls++;
+        m_free.wait(guard, [&] { return m_pushed - m_written < m_ring.size() || m_failed; });
+    }
+    if (m_failed || m_closing)
+        return nullptr;
+    return &m_ring[m_pushed % m_ring.size()];
+}
+
+void TrajectoryWriter::publish()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_pushed++;
+    if (m_pushed - m_written >= m_chunk)
+        m_ready.notify_one();
+}
+
+bool TrajectoryWriter::push(const ParticleSet& particles, double time)
+{
+    trajectory_frame* frame = acquire();
+    if (!frame)
+        return false;
+
+    const std::size_t n = particles.size();
+    frame->time = time;
+    frame->id.assign(particles.id.begin(), particles.id.begin() + n);
+    frame->x.assign(particles.x.begin(), particles.x.begin() + n);
+    frame->y.assign(particles.y.begin(), particles.y.begin() + n);
+    frame->z.assign(particles.z.begin(), particles.z.begin() + n);
+    frame->vx.assign(particles.vx.begin(), particles.vx.begin() + n);
+    frame->vy.assign(particles.vy.begin(), particles.vy.begin() + n);
+    frame->vz.assign(particles.vz.begin(), particles.vz.begin() + n);
+    frame->new_names.clear();
+    for (std::size_t i = 0; i < n; i++)
+    {
+        const std::size_t id = particles.id[i];
+        if (id >= m_named.size())
+            m_named.resize(id + 1, 0);
+        if (!m_named[id])
+        {
+            m_named[id] = 1;
+            frame->new_names.emplace_back(id, particles.name[i]);
+        }
+    }
+    publish();
+    return true;
+}
+
+bool TrajectoryWriter::push(const trajectory_frame& source)
+{
+    trajectory_frame* frame = acquire();
+    if (!frame)
+        return false;
+
+    frame->time = source.time;
+    frame->id.assign(source.id.begin(), source.id.end());
+    frame->x.assign(source.x.begin(), source.x.end());
+    frame->y.assign(source.y.begin(), source.y.end());
+    frame->z.assign(source.z.begin(), source.z.end());
+    frame->vx.assign(source.vx.begin(), source.vx.end());
+    frame->vy.assign(source.vy.begin(), source.vy.end());
+    frame->vz.assign(source.vz.begin(), source.vz.end());
+    frame->new_names.assign(source.new_names.begin(), source.new_names.end());
+    for (const auto& named : source.new_names)
+    {
+        if (named.first >= m_named.size())
+            m_named.resize(named.first + 1, 0);
+        m_named[named.first] = 1;
+    }
+    publish();
+    return true;
+}
+
+/*
+ *PROCEDURE: drain
+ *
+ *DESCRIPTION: Writer thread. Waits for a full chunk (or closing), takes every
+ *frame queued at that moment and writes them without holding the lock, then
+ *releases them to the producer.
+ *
+ *RETURNS: Nothing
+ */
+void TrajectoryWriter::drain()
+{
+    std::vector<const trajectory_frame*> chunk;
+    std::unique_lock<std::mutex> guard(m_lock);
+    for (;;)
+    {
+        m_ready.wait(guard, [&] { return m_pushed - m_written >= m_chunk || m_closing; });
+        const std::size_t begin = m_written, end = m_pushed;
+        if (begin == end)
+            break;
+
+        guard.unlock();
+        chunk.clear();
+        for (std::size_t k = begin; k < end; k++)
+            chunk.push_back(&m_ring[k % m_ring.size()]);
+        const bool ok = m_failed || m_format->write(chunk);
+        guard.lock();
+
+        m_written = end;
+        m_failed = m_failed || !ok;
+        m_free.notify_one();
+    }
+}
+
+bool TrajectoryWriter::close()
+{
+    if (!m_thread.joinable())
+        return !m_failed;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_closing = true;
+    }
+    m_ready.notify_one();
+    m_thread.join();
+    if (!m_failed && !m_format->finish())
+        m_failed = true;
+    return !m_failed;
+}
+
+std::size_t TrajectoryWriter::buffer_bytes() const
+{
+    std::size_t bytes = m_ring.size() * sizeof(trajectory_frame);
+    for (const auto& frame : m_ring)
+        bytes += frame.id.capacity() * sizeof(std::size_t)
+               + (frame.x.capacity() + frame.y.capacity() + frame.z.capacity()
+                  + frame.vx.capacity() + frame.vy.capacity() + frame.vz.capacity()) * sizeof(double)
+               + frame.new_names.capacity() * sizeof(std::pair<std::size_t, std::string>);
+    return bytes;
+}
+
+ColumnarTrajectory::ColumnarTrajectory(const std::string& path, const trajectory_compression& compression) :
+    m_compression(compression)
+{
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    trajectory_file_header header{};
+    std::memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+    header.version = TRAJECTORY_VERSION;
+    header.byte_order = TRAJECTORY_BYTE_ORDER;
+    header.header_bytes = sizeof(header);
+    header.columns = TRAJECTORY_COLUMNS;
+    if (m_fd >= 0 && !append(&header, sizeof(header)))
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+ColumnarTrajectory::~ColumnarTrajectory()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+/*
+ *PROCEDURE: append
+ *
+ *DESCRIPTION: write until every byte is written, resuming after partial
+ *writes and signals
+ *
+ *RETURNS: false on an error
+ */
+bool ColumnarTrajectory::append(const void* data, std::size_t bytes)
+{
+    const char* p = static_cast<const char*>(data);
+    while (bytes > 0)
+    {
+        ssize_t written = ::write(m_fd, p, bytes);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += written;
+        bytes -= written;
+        m_offset += written;
+    }
+    return true;
+}
+
+bool ColumnarTrajectory::write(const std::vector<const trajectory_frame*>& chunk)
+{
+    if (m_fd < 0)
+        return false;
+    const std::size_t frames = chunk.size();
+
+    // bodies of the chunk in order of first appearance, and the names table
+    m_bodies.clear();
+    std::size_t names_bytes = 0;
+    for (const trajectory_frame* frame : chunk)
+    {
+        for (std::size_t id : frame->id)
+        {
+            if (id >= m_slot.size())
+                m_slot.resize(id + 1, -1);
+            if (m_slot[id] < 0)
+            {
+                m_slot[id] = m_bodies.size();
+                m_bodies.push_back(id);
+            }
+        }
+        for (const auto& named : frame->new_names)
+            names_bytes += 2 * sizeof(std::uint64_t) + (named.second.size() + 7) / 8 * 8;
+    }
+    const std::size_t bodies = m_bodies.size();
+
+    // every section is a multiple of 8 bytes, the chunk is assembled as doubles
+    const std::size_t words = (sizeof(trajectory_chunk_header) + names_bytes) / sizeof(double) + bodies
+                            + frames * (1 + bodies * TRAJECTORY_COLUMNS);
+    m_buffer.assign(words, 0.0);
+    char* p = reinterpret_cast<char*>(m_buffer.data());
+
+    trajectory_chunk_header header{};
+    std::memcpy(header.magic, TRAJECTORY_CHUNK_MAGIC, sizeof(header.magic));
+    header.chunk_bytes = words * sizeof(double);
+    header.frames = frames;
+    header.bodies = bodies;
+    header.names_bytes = names_bytes;
+    header.first_time = chunk.front()->time;
+    header.last_time = chunk.back()->time;
+    std::memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+
+    for (std::size_t id : m_bodies)
+    {
+        const std::uint64_t stored = id;
+        std::memcpy(p, &stored, sizeof(stored));
+        p += sizeof(stored);
+    }
+    for (const trajectory_frame* frame : chunk)
+        for (const auto& named : frame->new_names)
+        {
+            const std::uint64_t entry[2] = { named.first, named.second.size() };
+            std::memcpy(p, entry, sizeof(entry));
+            std::memcpy(p + sizeof(entry), named.second.data(), named.second.size());
+            p += sizeof(entry) + (named.second.size() + 7) / 8 * 8;
+        }
+
+    double* time = reinterpret_cast<double*>(p);
+    double* columns = time + frames;
+    std::fill(columns, columns + frames * bodies * TRAJECTORY_COLUMNS, std::numeric_limits<double>::quiet_NaN());
+    for (std::size_t f = 0; f < frames; f++)
+    {
+        const trajectory_frame& frame = *chunk[f];
+        time[f] = frame.time;
+        for (std::size_t i = 0; i < frame.id.size(); i++)
+        {
+            double* body = columns + m_slot[frame.id[i]] * TRAJECTORY_COLUMNS * frames + f;
+            body[0] = frame.x[i];
+            body[frames] = frame.y[i];
+            body[2 * frames] = frame.z[i];
+            body[3 * frames] = frame.vx[i];
+            body[4 * frames] = frame.vy[i];
+            body[5 * frames] = frame.vz[i];
+        }
+    }
+    for (std::size_t id : m_bodies)
+        m_slot[id] = -1;
+
+    m_index.push_back(trajectory_index_entry{ m_offset, frames, header.first_time, header.last_time });
+    m_plain_bytes += header.chunk_bytes;
+    if (!m_compression.enabled)
+        return append(m_buffer.data(), header.chunk_bytes);
+
+    // header, ids and names as they are, then the size table and the columns
+    const std::size_t prefix = sizeof(header) + bodies * sizeof(std::uint64_t) + names_bytes;
+    const std::size_t coded = 1 + bodies * TRAJECTORY_COLUMNS;
+    m_coded.resize(prefix + coded * sizeof(std::uint64_t));
+    std::memcpy(m_coded.data(), m_buffer.data(), prefix);
+    std::vector<std::uint64_t> sizes(coded);
+    sizes[0] = encode_column(time, frames, 0.0, m_values, m_scratch, m_coded);
+    for (std::size_t b = 0; b < bodies; b++)
+        for (int c = 0; c < TRAJECTORY_COLUMNS; c++)
+        {
+            const double error = c < 3 ? m_compression.position_error : m_compression.velocity_error;
+            sizes[1 + b * TRAJECTORY_COLUMNS + c] = encode_column(columns + (b * TRAJECTORY_COLUMNS + c) * frames, frames,
+                                                                  error, m_values, m_scratch, m_coded);
+        }
+    std::memcpy(m_coded.data() + prefix, sizes.data(), coded * sizeof(std::uint64_t));
+    header.encoding = 1;
+    header.chunk_bytes = m_coded.size();
+    std::memcpy(m_coded.data(), &header, sizeof(header));
+    return append(m_coded.data(), m_coded.size());
+}
+
+bool ColumnarTrajectory::finish()
+{
+    if (m_fd < 0)
+        return false;
+    trajectory_index_trailer trailer{};
+    std::memcpy(trailer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(trailer.magic));
+    trailer.chunks = m_index.size();
+    trailer.index_offset = m_offset;
+    bool ok = append(m_index.data(), m_index.size() * sizeof(trajectory_index_entry))
+           && append(&trailer, sizeof(trailer));
+    ok = ::close(m_fd) == 0 && ok;
+    m_fd = -1;
+    return ok;
+}
+
+std::unique_ptr<TrajectoryFormat> make_trajectory_format(const std::string& name,
+                                                         const trajectory_compression& compression)
+{
+    if (name == "text")
+        return std::make_unique<TextTrajectory>();
+    return std::make_unique<ColumnarTrajectory>(name, compression);
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+    close();
+}
+
+void TrajectoryReader::close()
+{
+    if (m_map)
+        munmap(const_cast<char*>(m_map), m_bytes);
+    m_map = nullptr;
+    m_bytes = 0;
+    m_index.clear();
+    m_names.clear();
+    m_chunk = nullptr;
+    m_ids = nullptr;
+    m_time = nullptr;
+}
+
+bool TrajectoryReader::fail(const std::string& reason)
+{
+    m_error = reason;
+    close();
+    return false;
+}
+
+/*
+ *PROCEDURE: check_chunk
+ *
+ *DESCRIPTION: Checks that a whole chunk lies at offset and takes the names
+ *of its table
+ *
+ *RETURNS: false if the chunk is truncated or malformed
+ */
+bool TrajectoryReader::check_chunk(std::uint64_t offset)
+{
+    if (offset > m_bytes || m_bytes - offset < sizeof(trajectory_chunk_header))
+        return false;
+    const trajectory_chunk_header* h = reinterpret_cast<const trajectory_chunk_header*>(m_map + offset);
+    if (std::memcmp(h->magic, TRAJECTORY_CHUNK_MAGIC, sizeof(h->magic)) != 0 || h->frames == 0
+        || h->chunk_bytes > m_bytes - offset || h->encoding > 1 || h->bodies > h->chunk_bytes / sizeof(std::uint64_t)
+        || h->names_bytes > h->chunk_bytes)
+        return false;
+    const std::uint64_t prefix = sizeof(trajectory_chunk_header) + h->bodies * sizeof(std::uint64_t) + h->names_bytes;
+    const std::uint64_t columns = 1 + h->bodies * TRAJECTORY_COLUMNS;
+    std::uint64_t payload = prefix;
+    if (h->encoding == 0)
+        payload += h->frames * sizeof(double) * columns;
+    else
+    {
+        if (prefix + columns * sizeof(std::uint64_t) > h->chunk_bytes)
+            return false;
+        payload += columns * sizeof(std::uint64_t);
+        const char* sizes = m_map + offset + prefix;
+        for (std::uint64_t c = 0; c < columns && payload <= h->chunk_bytes; c++)
+        {
+            std::uint64_t size;
+            std::memcpy(&size, sizes + c * sizeof(size), sizeof(size));
+            payload += std::min(size, h->chunk_bytes);
+        }
+    }
+    if (payload != h->chunk_bytes)
+        return false;
+
+    const char* table = m_map + offset + sizeof(trajectory_chunk_header) + h->bodies * sizeof(std::uint64_t);
+    for (std::uint64_t read = 0; read + 2 * sizeof(std::uint64_t) <= h->names_bytes;)
+    {
+        std::uint64_t entry[2];
+        std::memcpy(entry, table + read, sizeof(entry));
+        read += sizeof(entry);
+        if (entry[1] > h->names_bytes - read)
+            return false;
+        if (entry[0] >= m_names.size())
+            m_names.resize(entry[0] + 1);
+        m_names[entry[0]].assign(table + read, entry[1]);
+        read += (entry[1] + 7) / 8 * 8;
+    }
+    return true;
+}
+
+bool TrajectoryReader::open(const std::string& path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return fail("cannot open " + path + ": " + strerror(errno));
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(trajectory_file_header))
+    {
+        ::close(fd);
+        return fail(path + " is too short to be a trajectory");
+    }
+    m_bytes = info.st_size;
+    void* map = mmap(nullptr, m_bytes, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        m_bytes = 0;
+        return fail("cannot map " + path + ": " + strerror(errno));
+    }
+    m_map = static_cast<const char*>(map);
+
+    const trajectory_file_header* header = reinterpret_cast<const trajectory_file_header*>(m_map);
+    if (std::memcmp(header->magic, TRAJECTORY_MAGIC, sizeof(header->magic)) != 0)
+        return fail(path + ": not a trajectory file");
+    if (header->byte_order != TRAJECTORY_BYTE_ORDER)
+        return fail(path + ": written with another byte order");
+    if (header->version > TRAJECTORY_VERSION || header->columns != TRAJECTORY_COLUMNS)
+        return fail(path + ": unsupported trajectory version");
+
+    // the index of a finished file, or else every complete chunk of a run that died
+    trajectory_index_trailer trailer;
+    std::memcpy(&trailer, m_map + m_bytes - sizeof(trailer), sizeof(trailer));
+    const bool indexed = m_bytes >= header->header_bytes + sizeof(trailer)
+                      && std::memcmp(trailer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(trailer.magic)) == 0
+                      && trailer.index_offset + trailer.chunks * sizeof(trajectory_index_entry) + sizeof(trailer) == m_bytes;
+    if (indexed)
+    {
+        m_index.resize(trailer.chunks);
+        std::memcpy(m_index.data(), m_map + trailer.index_offset, trailer.chunks * sizeof(trajectory_index_entry));
+        for (const auto& entry : m_index)
+            if (!check_chunk(entry.offset))
+                return fail(path + ": index points to a damaged chunk");
+    }
+    else
+    {
+        for (std::uint64_t offset = header->header_bytes; check_chunk(offset);)
+        {
+            const trajectory_chunk_header* h = reinterpret_cast<const trajectory_chunk_header*>(m_map + offset);
+            m_index.push_back(trajectory_index_entry{ offset, h->frames, h->first_time, h->last_time });
+            offset += h->chunk_bytes;
+        }
+    }
+    if (m_index.empty())
+        return fail(path + ": no frames");
+    return select(0);
+}
+
+bool TrajectoryReader::select(std::size_t k)
+{
+    if (k >= m_index.size())
+    {
+        m_error = "no chunk " + std::to_string(k);
+        return false;
+    }
+    const char* base = m_map + m_index[k].offset;
+    const trajectory_chunk_header* h = reinterpret_cast<const trajectory_chunk_header*>(base);
+    if (h == m_chunk)
+        return true;
+    const std::size_t prefix = sizeof(trajectory_chunk_header) + h->bodies * sizeof(std::uint64_t) + h->names_bytes;
+    const double* time = reinterpret_cast<const double*>(base + prefix);
+    if (h->encoding == 1)
+    {
+        const std::size_t columns = 1 + h->bodies * TRAJECTORY_COLUMNS;
+        const std::uint64_t* sizes = reinterpret_cast<const std::uint64_t*>(base + prefix);
+        const unsigned char* coded = reinterpret_cast<const unsigned char*>(sizes + columns);
+        m_decoded.resize(columns * h->frames);
+        for (std::size_t c = 0; c < columns; c++)
+        {
+            if (!decode_column(coded, sizes[c], h->frames, m_scratch, m_decoded.data() + c * h->frames))
+            {
+                m_error = "chunk " + std::to_string(k) + " does not decode";
+                return false;
+            }
+            coded += sizes[c];
+        }
+        time = m_decoded.data();
+    }
+    m_chunk = h;
+    m_ids = reinterpret_cast<const std::uint64_t*>(base + sizeof(trajectory_chunk_header));
+    m_time = time;
+    return true;
+}
+
+bool TrajectoryReader::locate(double time, std::size_t& frame)
+{
+    if (m_index.empty())
+        return false;
+    auto after = std::upper_bound(m_index.begin(), m_index.end(), time,
+                                  [](double t, const trajectory_index_entry& e) { return t < e.first_time; });
+    if (!select(after == m_index.begin() ? 0 : after - m_index.begin() - 1))
+        return false;
+    const double* t = m_time;
+    const std::size_t later = std::upper_bound(t, t + m_chunk->frames, time) - t;
+    frame = later > 0 ? later - 1 : 0;
+    return true;
+}
+
+const std::string& TrajectoryReader::name(std::size_t id) const
+{
+    static const std::string unknown;
+    return id < m_names.size() ? m_names[id] : unknown;
+}
+
+void hermite_state(const trajectory_sample& a, const trajectory_sample& b, double t,
+                   point& position, point& velocity)
+{
+    const double h = b.t - a.t;
+    const double u = (t - a.t) / h;
+    const double u2 = u * u, u3 = u2 * u;
+    // basis of the end positions and of the end velocities (scaled by h)
+    const double pa = 2 * u3 - 3 * u2 + 1, va = (u3 - 2 * u2 + u) * h;
+    const double pb = -2 * u3 + 3 * u2, vb = (u3 - u2) * h;
+    position = point{ pa * a.x + va * a.vx + pb * b.x + vb * b.vx,
+                      pa * a.y + va * a.vy + pb * b.y + vb * b.vy,
+                      pa * a.z + va * a.vz + pb * b.z + vb * b.vz };
+    // their derivatives in t
+    const double dpa = (6 * u2 - 6 * u) / h, dva = 3 * u2 - 4 * u + 1;
+    const double dpb = -dpa, dvb = 3 * u2 - 2 * u;
+    velocity = point{ dpa * a.x + dva * a.vx + dpb * b.x + dvb * b.vx,
+                      dpa * a.y + dva * a.vy + dpb * b.y + dvb * b.vy,
+                      dpa * a.z + dva * a.vz + dpb * b.z + dvb * b.vz };
+}
+
+HermiteSampler::HermiteSampler(TrajectoryWriter& writer, double tolerance) :
+    m_writer(writer), m_tolerance(tolerance)
+{
+}
+
+/*
+ *PROCEDURE: fits
+ *
+ *DESCRIPTION: Whether the interpolant from the stored sample of the body to
+ *next passes within tolerance of every frame in between, at most
+ *TRAJECTORY_HERMITE_MAX_GAP of them
+ *
+ *RETURNS: bool
+ */
+bool HermiteSampler::fits(const track& body, const trajectory_sample& next) const
+{
+    if (body.checks.size() >= TRAJECTORY_HERMITE_MAX_GAP)
+        return false;
+    const double tolerance2 = m_tolerance * m_tolerance;
+    auto close_enough = [&](const trajectory_sample& s)
+    {
+        point p, v;
+        hermite_state(body.stored, next, s.t, p, v);
+        const double dx = p.x - s.x, dy = p.y - s.y, dz = p.z - s.z;
+        return dx * dx + dy * dy + dz * dz <= tolerance2;
+    };
+    if (!body.last_stored && !close_enough(body.last))
+        return false;
+    for (const auto& s : body.checks)
+        if (!close_enough(s))
+            return false;
+    return true;
+}
+
+/*
+ *PROCEDURE: keep
+ *
+ *DESCRIPTION: Adds the last frame of the body to the frames in between
+ *
+ *RETURNS: Nothing
+ */
+void HermiteSampler::keep(track& body)
+{
+    body.checks.push_back(body.last);
+}
+
+/*
+ *PROCEDURE: emit
+ *
+ *DESCRIPTION: Adds the last frame of the body to the stored frame being built
+ *
+ *RETURNS: Nothing
+ */
+void HermiteSampler::emit(std::size_t id, track& body)
+{
+    m_frame.id.push_back(id);
+    m_frame.x.push_back(body.last.x);
+    m_frame.y.push_back(body.last.y);
+    m_frame.z.push_back(body.last.z);
+    m_frame.vx.push_back(body.last.vx);
+    m_frame.vy.push_back(body.last.vy);
+    m_frame.vz.push_back(body.last.vz);
+    if (!body.named)
+    {
+        m_frame.new_names.emplace_back(id, body.name);
+        body.named = true;
+    }
+    body.stored = body.last;
+    body.last_stored = true;
+    body.checks.clear();
+    m_stored++;
+}
+
+bool HermiteSampler::push(const ParticleSet& particles, double time)
+{
+    // the frame under construction holds samples of the previous frame
+    m_frame.time = m_time;
+    m_frame.id.clear();
+    m_frame.x.clear(); m_frame.y.clear(); m_frame.z.clear();
+    m_frame.vx.clear(); m_frame.vy.clear(); m_frame.vz.clear();
+    m_frame.new_names.clear();
+    m_frames++;
+
+    for (std::size_t i = 0; i < particles.size(); i++)
+    {
+        const std::size_t id = particles.id[i];
+        const trajectory_sample next{ time, particles.x[i], particles.y[i], particles.z[i],
+                                      particles.vx[i], particles.vy[i], particles.vz[i] };
+        m_offered++;
+        if (id >= m_tracks.size())
+            m_tracks.resize(id + 1);
+        track& body = m_tracks[id];
+        if (!body.active)
+        {
+            body.stored = body.last = next;
+            body.last_stored = true;
+            body.named = false;
+            body.active = true;
+            body.checks.clear();
+            body.name = particles.name[i];
+            body.seen = m_frames;
+            m_active.push_back(id);
+            continue;
+        }
+        body.seen = m_frames;
+        if (!body.named)
+            emit(id, body);
+        if (!fits(body, next))
+            emit(id, body);
+        else if (!body.last_stored)
+            keep(body);
+        body.last = next;
+        body.last_stored = false;
+    }
+
+    // bodies gone since the previous frame end with their last sample
+    std::size_t kept = 0;
+    for (std::size_t id : m_active)
+    {
+        track& body = m_tracks[id];
+        if (body.seen == m_frames)
+        {
+            m_active[kept++] = id;
+            continue;
+        }
+        if (!body.named || !body.last_stored)
+            emit(id, body);
+        body.active = false;
+        body.checks = std::vector<trajectory_sample>();
+    }
+    m_active.resize(kept);
+
+    if (!m_frame.id.empty())
+        m_ok = m_writer.push(m_frame) && m_ok;
+    m_time = time;
+    return m_ok;
+}
+
+bool HermiteSampler::close()
+{
+    m_frame.time = m_time;
+    m_frame.id.clear();
+    m_frame.x.clear(); m_frame.y.clear(); m_frame.z.clear();
+    m_frame.vx.clear(); m_frame.vy.clear(); m_frame.vz.clear();
+    m_frame.new_names.clear();
+    for (std::size_t id : m_active)
+    {
+        track& body = m_tracks[id];
+        if (!body.named || !body.last_stored)
+            emit(id, body);
+    }
+    if (!m_frame.id.empty())
+        m_ok = m_writer.push(m_frame) && m_ok;
+    return m_ok;
+}
+
+bool TrajectoryInterpolator::open(const std::string& path)
+{
+    m_ids.clear();
+    m_names.clear();
+    m_samples.clear();
+    TrajectoryReader reader;
+    if (!reader.open(path))
+    {
+        m_error = reader.error();
+        return false;
+    }
+    for (std::size_t k = 0; k < reader.chunks(); k++)
+    {
+        if (!reader.select(k))
+        {
+            m_error = reader.error();
+            return false;
+        }
+        for (std::size_t b = 0; b < reader.bodies(); b++)
+        {
+            const std::size_t id = reader.id(b);
+            if (id >= m_samples.size())
+            {
+                m_samples.resize(id + 1);
+                m_names.resize(id + 1);
+            }
+            if (m_samples[id].empty())
+            {
+                m_ids.push_back(id);
+                m_names[id] = reader.name(id);
+            }
+            for (std::size_t f = 0; f < reader.frames(); f++)
+                if (!std::isnan(reader.x(b)[f]))
+                    m_samples[id].push_back(trajectory_sample{ reader.time()[f], reader.x(b)[f], reader.y(b)[f],
+                                                               reader.z(b)[f], reader.vx(b)[f], reader.vy(b)[f],
+                                                               reader.vz(b)[f] });
+        }
+    }
+    return true;
+}
+
+bool TrajectoryInterpolator::state(std::size_t id, double time, point& position, point& velocity) const
+{
+    if (id >= m_samples.size() || m_samples[id].empty())
+        return false;
+    const std::vector<trajectory_sample>& s = m_samples[id];
+    if (time < s.front().t || time > s.back().t)
+        return false;
+    auto after = std::upper_bound(s.begin(), s.end(), time,
+                                  [](double t, const trajectory_sample& sample) { return t < sample.t; });
+    if (after == s.end())
+    {
+        position = point{ s.back().x, s.back().y, s.back().z };
+        velocity = point{ s.back().vx, s.back().vy, s.back().vz };
+        return true;
+    }
+    hermite_state(*(after - 1), *after, time, position, velocity);
+    return true;
+}
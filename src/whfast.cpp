@@ -0,0 +1,230 @@
+/*
+ * whfast.cpp
+ *
+ * Copyright 2019 Miquel Bernat Laporta i Granados
+ * <mlaportaigranados@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "include/integration.h"
+#include "include/kepler.h"
+
+using namespace solar_system;
+
+//Third order corrector of Wisdom, Holman & Touma (1996): a = sqrt(7/40), b = sqrt(10/7) / 48
+static const double WHFAST_CORRECTOR_A = 0.41833001326703777398908601289259374469640768464934;
+static const double WHFAST_CORRECTOR_B = 0.024900596027799867499350357910273437184309981229459;
+
+/*
+ *PROCEDURE: to_jacobi
+ *
+ *DESCRIPTION: Jacobi coordinates of the particle set: body i relative to the
+ *centre of mass of bodies 0 ... i-1, slot 0 holds the centre of mass of the
+ *whole system
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::WHFast::to_jacobi()
+{
+    const ParticleSet& p = m_particles;
+    const std::size_t n = p.size();
+    m_x.resize(n); m_y.resize(n); m_z.resize(n);
+    m_vx.resize(n); m_vy.resize(n); m_vz.resize(n);
+    m_interior.resize(n);
+
+    // running mass weighted sums of the interior bodies
+    double mass = p.mass[0];
+    double sx = mass * p.x[0], sy = mass * p.y[0], sz = mass * p.z[0];
+    double svx = mass * p.vx[0], svy = mass * p.vy[0], svz = mass * p.vz[0];
+    m_interior[0] = mass;
+    for (std::size_t i = 1; i < n; i++)
+    {
+        m_x[i] = p.x[i] - sx / mass;
+        m_y[i] = p.y[i] - sy / mass;
+        m_z[i] = p.z[i] - sz / mass;
+        m_vx[i] = p.vx[i] - svx / mass;
+        m_vy[i] = p.vy[i] - svy / mass;
+        m_vz[i] = p.vz[i] - svz / mass;
+        const double m = p.mass[i];
+        mass += m;
+        sx += m * p.x[i]; sy += m * p.y[i]; sz += m * p.z[i];
+        svx += m * p.vx[i]; svy += m * p.vy[i]; svz += m * p.vz[i];
+        m_interior[i] = mass;
+    }
+    m_x[0] = sx / mass; m_y[0] = sy / mass; m_z[0] = sz / mass;
+    m_vx[0] = svx / mass; m_vy[0] = svy / mass; m_vz[0] = svz / mass;
+}
+
+/*
+ *PROCEDURE: to_inertial_positions
+ *
+ *DESCRIPTION: Inertial positions from the Jacobi ones, walking the interior
+ *centres of mass down from the total one: R_(i-1) = R_i - m_i x'_i / M_i
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::WHFast::to_inertial_positions()
+{
+    ParticleSet& p = m_particles;
+    double rx = m_x[0], ry = m_y[0], rz = m_z[0];
+    for (std::size_t i = p.size() - 1; i > 0; i--)
+    {
+        const double f = p.mass[i] / m_interior[i];
+        rx -= f * m_x[i]; ry -= f * m_y[i]; rz -= f * m_z[i];
+        p.x[i] = m_x[i] + rx;
+        p.y[i] = m_y[i] + ry;
+        p.z[i] = m_z[i] + rz;
+    }
+    p.x[0] = rx; p.y[0] = ry; p.z[0] = rz;
+}
+
+void Orbit_integration::WHFast::to_inertial_velocities()
+{
+    ParticleSet& p = m_particles;
+    double rx = m_vx[0], ry = m_vy[0], rz = m_vz[0];
+    for (std::size_t i = p.size() - 1; i > 0; i--)
+    {
+        const double f = p.mass[i] / m_interior[i];
+        rx -= f * m_vx[i]; ry -= f * m_vy[i]; rz -= f * m_vz[i];
+        p.vx[i] = m_vx[i] + rx;
+        p.vy[i] = m_vy[i] + ry;
+        p.vz[i] = m_vz[i] + rz;
+    }
+    p.vx[0] = rx; p.vy[0] = ry; p.vz[0] = rz;
+}
+
+/*
+ *PROCEDURE: kepler_drift
+ *
+ *DESCRIPTION: Moves every Jacobi body along its Kepler orbit about the
+ *interior mass M_i = m_0 + ... + m_i for dt. The centre of mass is not moved.
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::WHFast::kepler_drift(double dt)
+{
+    for (std::size_t i = 1; i < m_particles.size(); i++)
+        kepler::drift(G_const * m_interior[i], dt, m_x[i], m_y[i], m_z[i], m_vx[i], m_vy[i], m_vz[i]);
+}
+
+/*
+ *PROCEDURE: interaction_kick
+ *
+ *DESCRIPTION: Kicks the Jacobi velocities by dt with the interaction
+ *Hamiltonian: the inertial accelerations from the force provider, taken to
+ *Jacobi coordinates like the positions, minus the Kepler term
+ *-G M_i x'_i / |x'_i|^3 the drift already accounts for
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::WHFast::interaction_kick(double dt)
+{
+    to_inertial_positions();
+    m_forces->accelerations(m_particles, G_const, m_ax, m_ay, m_az);
+
+    const ParticleSet& p = m_particles;
+    double mass = p.mass[0];
+    double sx = mass * m_ax[0], sy = mass * m_ay[0], sz = mass * m_az[0];
+    for (std::size_t i = 1; i < p.size(); i++)
+    {
+        const double r2 = m_x[i] * m_x[i] + m_y[i] * m_y[i] + m_z[i] * m_z[i];
+        const double kepler = G_const * m_interior[i] / (r2 * sqrt(r2));
+        m_vx[i] += dt * (m_ax[i] - sx / mass + kepler * m_x[i]);
+        m_vy[i] += dt * (m_ay[i] - sy / mass + kepler * m_y[i]);
+        m_vz[i] += dt * (m_az[i] - sz / mass + kepler * m_z[i]);
+        const double m = p.mass[i];
+        mass += m;
+        sx += m * m_ax[i]; sy += m * m_ay[i]; sz += m * m_az[i];
+    }
+}
+
+/*
+ *PROCEDURE: corrector_step
+ *
+ *DESCRIPTION: Z(a, b) = K(a) I(-b) K(-2a) I(b) K(a), with K a Kepler drift and
+ *I an interaction kick, the building block of the symplectic correctors
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::WHFast::corrector_step(double a, double b)
+{
+    kepler_drift(a);
+    interaction_kick(-b);
+    kepler_drift(-2 * a);
+    interaction_kick(b);
+    kepler_drift(a);
+}
+
+/*
+ *PROCEDURE: apply_corrector
+ *
+ *DESCRIPTION: Third order symplectic corrector (direction 1) or its inverse
+ *(direction -1)
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::WHFast::apply_corrector(double direction)
+{
+    const double a = WHFAST_CORRECTOR_A * m_time_step;
+    const double b = WHFAST_CORRECTOR_B * m_time_step * direction;
+    corrector_step(a, b);
+    corrector_step(-a, -b);
+}
+
+/*
+ *PROCEDURE: compute_gravity_step
+ *
+ *DESCRIPTION: One drift-kick-drift Wisdom-Holman step. The closing half
+ *drift is left pending and merged with the opening half drift of the next
+ *step.
+ *
+ *RETURNS: -
+ */
+void Orbit_integration::WHFast::compute_gravity_step()
+{
+    double drift = m_time_step;
+    if (m_synchronized)
+    {
+        to_jacobi();
+        if (m_correctors)
+            apply_corrector(1);
+        drift = m_time_step / 2;
+    }
+    kepler_drift(drift);
+    interaction_kick(m_time_step);
+    m_synchronized = false;
+
+    // the centre of mass moves uniformly
+    m_x[0] += m_vx[0] * m_time_step;
+    m_y[0] += m_vy[0] * m_time_step;
+    m_z[0] += m_vz[0] * m_time_step;
+    m_time += m_time_step;
+}
+
+void Orbit_integration::WHFast::synchronize()
+{
+    if (m_synchronized)
+        return;
+    kepler_drift(m_time_step / 2);
+    if (m_correctors)
+        apply_corrector(-1);
+    to_inertial_positions();
+    to_inertial_velocities();
+    m_synchronized = true;
+}